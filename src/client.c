@@ -0,0 +1,296 @@
+#include <poll.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lib/invaders.h"
+#include "lib/net.h"
+
+#define CLIENT_MAX_LINE 4096
+
+/**
+ * @brief Reads one reply line, without the newline. A file descriptor passed along with it
+ *  (the reply to "map") is returned through fd.
+ *
+ * @return int 0, or -1 if the server hung up
+ */
+static int read_line(int socket_fd, char* line, size_t size, int* fd) {
+    size_t length = 0;
+    while (length < size - 1) {
+        char c;
+        struct iovec iov = { &c, 1 };
+        char control[CMSG_SPACE(sizeof(int))];
+        struct msghdr message = { 0 };
+        message.msg_iov = &iov;
+        message.msg_iovlen = 1;
+        message.msg_control = control;
+        message.msg_controllen = sizeof(control);
+        if (recvmsg(socket_fd, &message, 0) <= 0) {
+            return -1;
+        }
+
+        struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+        if (header != NULL && header->cmsg_type == SCM_RIGHTS && fd != NULL) {
+            memcpy(fd, CMSG_DATA(header), sizeof(int));
+        }
+        if (c == '\n') {
+            break;
+        }
+        line[length++] = c;
+    }
+    line[length] = '\0';
+    return 0;
+}
+
+static int read_exactly(int socket_fd, uint8_t* data, size_t length) {
+    while (length > 0) {
+        ssize_t received = recv(socket_fd, data, length, 0);
+        if (received <= 0) {
+            return -1;
+        }
+        data += received;
+        length -= received;
+    }
+    return 0;
+}
+
+static int send_line(int socket_fd, const char* line) {
+    size_t length = strlen(line);
+    char* buffer = malloc(length + 1);
+    memcpy(buffer, line, length);
+    buffer[length] = '\n';
+    int result = send(socket_fd, buffer, length + 1, MSG_NOSIGNAL) == (ssize_t)(length + 1);
+    free(buffer);
+    return result ? 0 : -1;
+}
+
+static void write_screen(const char* path, const uint8_t* vram) {
+    FILE* out = fopen(path, "wb");
+    if (out == NULL) {
+        printf("Error: Could not open %s\n", path);
+        return;
+    }
+    invaders_write_vram(vram, out);
+    fclose(out);
+    printf("Wrote the screen to %s\n", path);
+}
+
+/**
+ * @brief Sends a command and prints the reply. The framebuffer from "screen" and the memory
+ *  file from "map" are written to screen_path as a PBM, if given.
+ *
+ * @return int 0, or -1 if the server hung up
+ */
+static int run_command(int socket_fd, const char* command, const char* screen_path) {
+    char line[CLIENT_MAX_LINE];
+    int fd = -1;
+    if (send_line(socket_fd, command) < 0 || read_line(socket_fd, line, sizeof(line), &fd) < 0) {
+        return -1;
+    }
+    printf("%s\n", line);
+
+    size_t offset, length;
+    if (strncmp(command, "screen", 6) == 0 && sscanf(line, "ok %zu", &length) == 1) {
+        uint8_t* vram = malloc(length);
+        if (read_exactly(socket_fd, vram, length) < 0) {
+            free(vram);
+            return -1;
+        }
+        if (screen_path != NULL && length == INVADERS_VRAM_SIZE) {
+            write_screen(screen_path, vram);
+        }
+        free(vram);
+    }
+    else if (fd >= 0) {
+        // The whole memory is mapped read-only; the framebuffer is read in place.
+        if (sscanf(line, "ok %zu %zu", &offset, &length) == 2 && offset <= 0x10000 &&
+            length <= 0x10000 - offset) {
+            uint8_t* memory = mmap(NULL, 0x10000, PROT_READ, MAP_SHARED, fd, 0);
+            if (memory != MAP_FAILED) {
+                if (screen_path != NULL && length == INVADERS_VRAM_SIZE) {
+                    write_screen(screen_path, &memory[offset]);
+                }
+                munmap(memory, 0x10000);
+            }
+        }
+        close(fd);
+    }
+    return 0;
+}
+
+#pragma region Benchmark
+
+double elapsed_seconds(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Creates a session per connection, runs them all at once and checks that they end up
+ *  with the same hashes, since they run the same ROM with the same (no) inputs.
+ */
+static void benchmark(const char* address, int sessions, uint64_t frames, char** roms,
+    int rom_count) {
+    char line[CLIENT_MAX_LINE] = "new";
+    int i;
+    for (i = 0; i < rom_count; i++) {
+        snprintf(&line[strlen(line)], sizeof(line) - strlen(line), " %s", roms[i]);
+    }
+
+    struct pollfd* fds = calloc(sessions, sizeof(struct pollfd));
+    int* ids = calloc(sessions, sizeof(int));
+    int* steps = calloc(sessions, sizeof(int));
+    for (i = 0; i < sessions; i++) {
+        fds[i].fd = net_connect(address);
+        fds[i].events = POLLIN;
+        if (fds[i].fd < 0 || send_line(fds[i].fd, line) < 0) {
+            printf("Error: Could not connect to %s\n", address);
+            exit(1);
+        }
+    }
+
+    // Each connection goes new -> run -> hash, replying in whatever order the workers finish.
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    char hash[CLIENT_MAX_LINE] = "";
+    int mismatches = 0;
+    int remaining = sessions;
+    while (remaining > 0) {
+        poll(fds, sessions, -1);
+        for (i = 0; i < sessions; i++) {
+            if (!(fds[i].revents & (POLLIN | POLLHUP))) {
+                continue;
+            }
+            char reply[CLIENT_MAX_LINE] = "";
+            if (read_line(fds[i].fd, reply, sizeof(reply), NULL) < 0 ||
+                strncmp(reply, "ok", 2) != 0) {
+                printf("Error: Session %d failed: %s\n", i, reply);
+                exit(1);
+            }
+
+            char command[64];
+            switch (steps[i]++) {
+                case 0:
+                    ids[i] = atoi(&reply[3]);
+                    snprintf(command, sizeof(command), "run %d %llu", ids[i],
+                        (unsigned long long)frames);
+                    send_line(fds[i].fd, command);
+                    break;
+                case 1:
+                    snprintf(command, sizeof(command), "hash %d", ids[i]);
+                    send_line(fds[i].fd, command);
+                    break;
+                default:
+                    if (hash[0] == '\0') {
+                        strcpy(hash, reply);
+                    }
+                    mismatches += strcmp(hash, reply) != 0;
+                    snprintf(command, sizeof(command), "free %d", ids[i]);
+                    send_line(fds[i].fd, command);
+                    fds[i].events = 0;
+                    remaining--;
+                    break;
+            }
+        }
+    }
+    double seconds = elapsed_seconds(&start);
+
+    printf("%d sessions of %llu frames in %.3f s (%.0f frames/s), %s\n", sessions,
+        (unsigned long long)frames, seconds, seconds > 0 ? sessions * frames / seconds : 0.0,
+        mismatches ? "hashes differ" : "hashes match");
+    for (i = 0; i < sessions; i++) {
+        read_line(fds[i].fd, line, sizeof(line), NULL);
+        close(fds[i].fd);
+    }
+    free(fds);
+    free(ids);
+    free(steps);
+    if (mismatches) {
+        exit(1);
+    }
+}
+
+#pragma endregion
+
+void print_usage() {
+    printf("Usage: client [-o screen.pbm] <address> [command]...\n");
+    printf("       client -b sessions [-f frames] <address> <rom>...\n");
+    printf("  -o file     Write the screen from \"screen\" or \"map\" to a PBM file\n");
+    printf("  -b sessions Run this many sessions of the ROM at once and report frames/s\n");
+    printf("  -f frames   Frames each session runs for with -b (default 3600)\n");
+    printf("Sends each command to the server and prints the reply, or reads commands from\n");
+    printf("stdin if none are given. See server -h for the commands.\n");
+}
+
+/**
+ * @brief Main method where program starts.
+ *
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return int Return code
+ */
+int main(int argc, char** argv) {
+    char* screen_path = NULL;
+    int sessions = 0;
+    uint64_t frames = 3600;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "o:b:f:h")) != -1) {
+        switch (opt) {
+            case 'o': screen_path = optarg; break;
+            case 'b': sessions = atoi(optarg); break;
+            case 'f': frames = strtoull(optarg, NULL, 10); break;
+            default: print_usage(); exit(1);
+        }
+    }
+    if (optind >= argc) {
+        print_usage();
+        exit(1);
+    }
+    char* address = argv[optind++];
+
+    if (sessions > 0) {
+        if (optind >= argc) {
+            printf("Error: The benchmark needs ROM files\n");
+            exit(1);
+        }
+        benchmark(address, sessions, frames, &argv[optind], argc - optind);
+        return 0;
+    }
+
+    int socket_fd = net_connect(address);
+    if (socket_fd < 0) {
+        printf("Error: Could not connect to %s\n", address);
+        exit(1);
+    }
+
+    int failed = 0;
+    if (optind < argc) {
+        int i;
+        for (i = optind; i < argc && !failed; i++) {
+            failed = run_command(socket_fd, argv[i], screen_path) < 0;
+        }
+    }
+    else {
+        char line[CLIENT_MAX_LINE];
+        while (!failed && fgets(line, sizeof(line), stdin) != NULL) {
+            line[strcspn(line, "\r\n")] = '\0';
+            if (line[0] != '\0') {
+                failed = run_command(socket_fd, line, screen_path) < 0;
+            }
+        }
+    }
+    close(socket_fd);
+
+    if (failed) {
+        printf("Error: The server hung up\n");
+        exit(1);
+    }
+    return 0;
+}
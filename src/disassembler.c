@@ -1,328 +1,603 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lib/disasm.h"
+
+#pragma region Control Flow
+
+/**
+ * @brief How an operation hands control to the next one.
+ */
+typedef enum FlowType {
+    FLOW_NEXT,      // Falls through to the next operation
+    FLOW_JUMP,      // Always continues at the target (JMP)
+    FLOW_FORK,      // Continues at the target and falls through (Jcc, CALL, Ccc, RST)
+    FLOW_END        // No statically known successor (RET, PCHL)
+} FlowType;
 
 /**
- * @brief For a valid hex 8080 operation, outputs a valid 8080 assembly operation.
+ * @brief Classifies an operation for control-flow tracing. The undocumented aliases are
+ *  classified the way the core runs them: 0xcb as JMP, 0xd9 as RET, and 0xdd, 0xed and 0xfd as
+ *  CALL, even though disassemble_op prints them as NOPs.
  * 
- * @param codebuffer Pointer to hex code
- * @param pc Program counter (offset)
- * @return int Number of bytes used for the operation (1-3)
+ * @param code Pointer to the operation
+ * @param target Set to the branch target for FLOW_JUMP and FLOW_FORK
+ * @return FlowType 
  */
-int disassemble_op(unsigned char *codebuffer, int pc) {
-    // Get the opcode at the program counter and print it's position
-    unsigned char *code = &codebuffer[pc];
-    int opbytes = 0;
-    printf("%04x ", pc);
-
-    // Main switch statement for 8080 opcodes.
-    switch(*code) {
-        case 0x00: printf("NOP"); opbytes = 1; break;
-        case 0x01: printf("LXI     B,#$%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0x02: printf("STAX    B"); opbytes = 1; break;
-        case 0x03: printf("INX     B"); opbytes = 1; break;
-        case 0x04: printf("INR     B"); opbytes = 1; break;
-        case 0x05: printf("DCR     B"); opbytes = 1; break;
-        case 0x06: printf("MVI     B,#$%02x", code[1]); opbytes = 2; break;
-        case 0x07: printf("RLC     B"); opbytes = 1; break;
-        case 0x08: printf("NOP"); opbytes = 1; break;
-        case 0x09: printf("DAD     B"); opbytes = 1; break;
-        case 0x0a: printf("LDAX    B"); opbytes = 1; break;
-        case 0x0b: printf("DCX     B"); opbytes = 1; break;
-        case 0x0c: printf("INR     C"); opbytes = 1; break;
-        case 0x0d: printf("DCR     C"); opbytes = 1; break;
-        case 0x0e: printf("MVI     C,#$%02x", code[1]); opbytes = 2; break;
-        case 0x0f: printf("RRC"); opbytes = 1; break;
-
-        case 0x10: printf("NOP"); opbytes = 1; break;
-        case 0x11: printf("LXI     D,#$%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0x12: printf("STAX    D"); opbytes = 1; break;
-        case 0x13: printf("INX     D"); opbytes = 1; break;
-        case 0x14: printf("INR     D"); opbytes = 1; break;
-        case 0x15: printf("DCR     D"); opbytes = 1; break;
-        case 0x16: printf("MVI     D,#$%02x", code[1]); opbytes = 2; break;
-        case 0x17: printf("RAL"); opbytes = 1; break;
-        case 0x18: printf("NOP"); opbytes = 1; break;
-        case 0x19: printf("DAD     D"); opbytes = 1; break;
-        case 0x1a: printf("LDAX    D"); opbytes = 1; break;
-        case 0x1b: printf("DCX     D"); opbytes = 1; break;
-        case 0x1c: printf("INR     E"); opbytes = 1; break;
-        case 0x1d: printf("DCR     E"); opbytes = 1; break;
-        case 0x1e: printf("MVI     E,#$%02x", code[1]); opbytes = 2; break;
-        case 0x1f: printf("RAR"); opbytes = 1; break;
-
-        case 0x20: printf("NOP"); opbytes = 1; break;
-        case 0x21: printf("LXI     H,#$%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0x22: printf("SHLD    $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0x23: printf("INX     H"); opbytes = 1; break;
-        case 0x24: printf("INR     H"); opbytes = 1; break;
-        case 0x25: printf("DCR     H"); opbytes = 1; break;
-        case 0x26: printf("MVI     H,#$%02x", code[1]); opbytes = 2; break;
-        case 0x27: printf("DAA"); opbytes = 1; break;
-        case 0x28: printf("NOP"); opbytes = 1; break;
-        case 0x29: printf("DAD     H"); opbytes = 1; break;
-        case 0x2a: printf("LHLD    $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0x2b: printf("DCX     H"); opbytes = 1; break;
-        case 0x2c: printf("INR     L"); opbytes = 1; break;
-        case 0x2d: printf("DCR     L"); opbytes = 1; break;
-        case 0x2e: printf("MVI     L,#$%02x", code[1]); opbytes = 2; break;
-        case 0x2f: printf("CMA"); opbytes = 1; break;
-
-        case 0x30: printf("NOP"); opbytes = 1; break;
-        case 0x31: printf("LXI     SP,#$%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0x32: printf("STA     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0x33: printf("INX     SP"); opbytes = 1; break;
-        case 0x34: printf("INR     M"); opbytes = 1; break;
-        case 0x35: printf("DCR     M"); opbytes = 1; break;
-        case 0x36: printf("MVI     M,#$%02x", code[1]); opbytes = 2; break;
-        case 0x37: printf("STC"); opbytes = 1; break;
-        case 0x38: printf("NOP"); opbytes = 1; break;
-        case 0x39: printf("DAD     SP"); opbytes = 1; break;
-        case 0x3a: printf("LDA     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0x3b: printf("DCX     SP"); opbytes = 1; break;
-        case 0x3c: printf("INR     A"); opbytes = 1; break;
-        case 0x3d: printf("DCR     A"); opbytes = 1; break;
-        case 0x3e: printf("MVI     A,#$%02x", code[1]); opbytes = 2; break;
-        case 0x3f: printf("CMC"); opbytes = 1; break;
-
-        case 0x40: printf("MOV     B,B"); opbytes = 1; break;
-        case 0x41: printf("MOV     B,C"); opbytes = 1; break;
-        case 0x42: printf("MOV     B,D"); opbytes = 1; break;
-        case 0x43: printf("MOV     B,E"); opbytes = 1; break;
-        case 0x44: printf("MOV     B,H"); opbytes = 1; break;
-        case 0x45: printf("MOV     B,L"); opbytes = 1; break;
-        case 0x46: printf("MOV     B,M"); opbytes = 1; break;
-        case 0x47: printf("MOV     B,A"); opbytes = 1; break;
-        case 0x48: printf("MOV     C,B"); opbytes = 1; break;
-        case 0x49: printf("MOV     C,C"); opbytes = 1; break;
-        case 0x4a: printf("MOV     C,D"); opbytes = 1; break;
-        case 0x4b: printf("MOV     C,E"); opbytes = 1; break;
-        case 0x4c: printf("MOV     C,H"); opbytes = 1; break;
-        case 0x4d: printf("MOV     C,L"); opbytes = 1; break;
-        case 0x4e: printf("MOV     C,M"); opbytes = 1; break;
-        case 0x4f: printf("MOV     C,A"); opbytes = 1; break;
-
-        case 0x50: printf("MOV     D,B"); opbytes = 1; break;
-        case 0x51: printf("MOV     D,C"); opbytes = 1; break;
-        case 0x52: printf("MOV     D,D"); opbytes = 1; break;
-        case 0x53: printf("MOV     D,E"); opbytes = 1; break;
-        case 0x54: printf("MOV     D,H"); opbytes = 1; break;
-        case 0x55: printf("MOV     D,L"); opbytes = 1; break;
-        case 0x56: printf("MOV     D,M"); opbytes = 1; break;
-        case 0x57: printf("MOV     D,A"); opbytes = 1; break;
-        case 0x58: printf("MOV     E,B"); opbytes = 1; break;
-        case 0x59: printf("MOV     E,C"); opbytes = 1; break;
-        case 0x5a: printf("MOV     E,D"); opbytes = 1; break;
-        case 0x5b: printf("MOV     E,E"); opbytes = 1; break;
-        case 0x5c: printf("MOV     E,H"); opbytes = 1; break;
-        case 0x5d: printf("MOV     E,L"); opbytes = 1; break;
-        case 0x5e: printf("MOV     E,M"); opbytes = 1; break;
-        case 0x5f: printf("MOV     E,A"); opbytes = 1; break;
-
-        case 0x60: printf("MOV     H,B"); opbytes = 1; break;
-        case 0x61: printf("MOV     H,C"); opbytes = 1; break;
-        case 0x62: printf("MOV     H,D"); opbytes = 1; break;
-        case 0x63: printf("MOV     H,E"); opbytes = 1; break;
-        case 0x64: printf("MOV     H,H"); opbytes = 1; break;
-        case 0x65: printf("MOV     H,L"); opbytes = 1; break;
-        case 0x66: printf("MOV     H,M"); opbytes = 1; break;
-        case 0x67: printf("MOV     H,A"); opbytes = 1; break;
-        case 0x68: printf("MOV     L,B"); opbytes = 1; break;
-        case 0x69: printf("MOV     L,C"); opbytes = 1; break;
-        case 0x6a: printf("MOV     L,D"); opbytes = 1; break;
-        case 0x6b: printf("MOV     L,E"); opbytes = 1; break;
-        case 0x6c: printf("MOV     L,H"); opbytes = 1; break;
-        case 0x6d: printf("MOV     L,L"); opbytes = 1; break;
-        case 0x6e: printf("MOV     L,M"); opbytes = 1; break;
-        case 0x6f: printf("MOV     L,A"); opbytes = 1; break;
-
-        case 0x70: printf("MOV     M,B"); opbytes = 1; break;
-        case 0x71: printf("MOV     M,C"); opbytes = 1; break;
-        case 0x72: printf("MOV     M,D"); opbytes = 1; break;
-        case 0x73: printf("MOV     M,E"); opbytes = 1; break;
-        case 0x74: printf("MOV     M,H"); opbytes = 1; break;
-        case 0x75: printf("MOV     M,L"); opbytes = 1; break;
-        case 0x76: printf("HLT"); opbytes = 1; break;
-        case 0x77: printf("MOV     M,A"); opbytes = 1; break;
-        case 0x78: printf("MOV     A,B"); opbytes = 1; break;
-        case 0x79: printf("MOV     A,C"); opbytes = 1; break;
-        case 0x7a: printf("MOV     A,D"); opbytes = 1; break;
-        case 0x7b: printf("MOV     A,E"); opbytes = 1; break;
-        case 0x7c: printf("MOV     A,H"); opbytes = 1; break;
-        case 0x7d: printf("MOV     A,L"); opbytes = 1; break;
-        case 0x7e: printf("MOV     A,M"); opbytes = 1; break;
-        case 0x7f: printf("MOV     A,A"); opbytes = 1; break;
-
-        case 0x80: printf("ADD     B"); opbytes = 1; break;
-        case 0x81: printf("ADD     C"); opbytes = 1; break;
-        case 0x82: printf("ADD     D"); opbytes = 1; break;
-        case 0x83: printf("ADD     E"); opbytes = 1; break;
-        case 0x84: printf("ADD     H"); opbytes = 1; break;
-        case 0x85: printf("ADD     L"); opbytes = 1; break;
-        case 0x86: printf("ADD     M"); opbytes = 1; break;
-        case 0x87: printf("ADD     A"); opbytes = 1; break;
-        case 0x88: printf("ADC     B"); opbytes = 1; break;
-        case 0x89: printf("ADC     C"); opbytes = 1; break;
-        case 0x8a: printf("ADC     D"); opbytes = 1; break;
-        case 0x8b: printf("ADC     E"); opbytes = 1; break;
-        case 0x8c: printf("ADC     H"); opbytes = 1; break;
-        case 0x8d: printf("ADC     L"); opbytes = 1; break;
-        case 0x8e: printf("ADC     M"); opbytes = 1; break;
-        case 0x8f: printf("ADC     A"); opbytes = 1; break;
-
-        case 0x90: printf("SUB     B"); opbytes = 1; break;
-        case 0x91: printf("SUB     C"); opbytes = 1; break;
-        case 0x92: printf("SUB     D"); opbytes = 1; break;
-        case 0x93: printf("SUB     E"); opbytes = 1; break;
-        case 0x94: printf("SUB     H"); opbytes = 1; break;
-        case 0x95: printf("SUB     L"); opbytes = 1; break;
-        case 0x96: printf("SUB     M"); opbytes = 1; break;
-        case 0x97: printf("SUB     A"); opbytes = 1; break;
-        case 0x98: printf("SBB     B"); opbytes = 1; break;
-        case 0x99: printf("SBB     C"); opbytes = 1; break;
-        case 0x9a: printf("SBB     D"); opbytes = 1; break;
-        case 0x9b: printf("SBB     E"); opbytes = 1; break;
-        case 0x9c: printf("SBB     H"); opbytes = 1; break;
-        case 0x9d: printf("SBB     L"); opbytes = 1; break;
-        case 0x9e: printf("SBB     M"); opbytes = 1; break;
-        case 0x9f: printf("SBB     A"); opbytes = 1; break;
-
-        case 0xa0: printf("ANA     B"); opbytes = 1; break;
-        case 0xa1: printf("ANA     C"); opbytes = 1; break;
-        case 0xa2: printf("ANA     D"); opbytes = 1; break;
-        case 0xa3: printf("ANA     E"); opbytes = 1; break;
-        case 0xa4: printf("ANA     H"); opbytes = 1; break;
-        case 0xa5: printf("ANA     L"); opbytes = 1; break;
-        case 0xa6: printf("ANA     M"); opbytes = 1; break;
-        case 0xa7: printf("ANA     A"); opbytes = 1; break;
-        case 0xa8: printf("XRA     B"); opbytes = 1; break;
-        case 0xa9: printf("XRA     C"); opbytes = 1; break;
-        case 0xaa: printf("XRA     D"); opbytes = 1; break;
-        case 0xab: printf("XRA     E"); opbytes = 1; break;
-        case 0xac: printf("XRA     H"); opbytes = 1; break;
-        case 0xad: printf("XRA     L"); opbytes = 1; break;
-        case 0xae: printf("XRA     M"); opbytes = 1; break;
-        case 0xaf: printf("XRA     A"); opbytes = 1; break;
-
-        case 0xb0: printf("ORA     B"); opbytes = 1; break;
-        case 0xb1: printf("ORA     C"); opbytes = 1; break;
-        case 0xb2: printf("ORA     D"); opbytes = 1; break;
-        case 0xb3: printf("ORA     E"); opbytes = 1; break;
-        case 0xb4: printf("ORA     H"); opbytes = 1; break;
-        case 0xb5: printf("ORA     L"); opbytes = 1; break;
-        case 0xb6: printf("ORA     M"); opbytes = 1; break;
-        case 0xb7: printf("ORA     A"); opbytes = 1; break;
-        case 0xb8: printf("CMP     B"); opbytes = 1; break;
-        case 0xb9: printf("CMP     C"); opbytes = 1; break;
-        case 0xba: printf("CMP     D"); opbytes = 1; break;
-        case 0xbb: printf("CMP     E"); opbytes = 1; break;
-        case 0xbc: printf("CMP     H"); opbytes = 1; break;
-        case 0xbd: printf("CMP     L"); opbytes = 1; break;
-        case 0xbe: printf("CMP     M"); opbytes = 1; break;
-        case 0xbf: printf("CMP     A"); opbytes = 1; break;
-
-        case 0xc0: printf("RNZ"); opbytes = 1; break;
-        case 0xc1: printf("POP     B"); opbytes = 1; break;
-        case 0xc2: printf("JNZ     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xc3: printf("JMP     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xc4: printf("CNZ     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xc5: printf("PUSH    B"); opbytes = 1; break;
-        case 0xc6: printf("ADI     #$%02x", code[1]); opbytes = 2; break;
-        case 0xc7: printf("RST     0"); opbytes = 1; break;
-        case 0xc8: printf("RZ"); opbytes = 1; break;
-        case 0xc9: printf("RET"); opbytes = 1; break;
-        case 0xca: printf("JZ      $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xcb: printf("NOP"); opbytes = 1; break;
-        case 0xcc: printf("CZ      $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xcd: printf("CALL    $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xce: printf("ACI     #$%02x", code[1]); opbytes = 2; break;
-        case 0xcf: printf("RST     1"); opbytes = 1; break;
-
-        case 0xd0: printf("RNC"); opbytes = 1; break;
-        case 0xd1: printf("POP     D"); opbytes = 1; break;
-        case 0xd2: printf("JNC     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xd3: printf("OUT     #$%02x", code[1]); opbytes = 2; break;
-        case 0xd4: printf("CNC     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xd5: printf("PUSH    D"); opbytes = 1; break;
-        case 0xd6: printf("SUI     #$%02x", code[1]); opbytes = 2; break;
-        case 0xd7: printf("RST     2"); opbytes = 1; break;
-        case 0xd8: printf("RC"); opbytes = 1; break;
-        case 0xd9: printf("NOP"); opbytes = 1; break;
-        case 0xda: printf("JC      $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xdb: printf("IN      #$%02x", code[1]); opbytes = 2; break;
-        case 0xdc: printf("CC      $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xdd: printf("NOP"); opbytes = 1; break;
-        case 0xde: printf("SBI     #$%02x", code[1]); opbytes = 2; break;
-        case 0xdf: printf("RST     3"); opbytes = 1; break;
-
-        case 0xe0: printf("RPO"); opbytes = 1; break;
-        case 0xe1: printf("POP     H"); opbytes = 1; break;
-        case 0xe2: printf("JPO     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xe3: printf("XTHL"); opbytes = 1; break;
-        case 0xe4: printf("CPO     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xe5: printf("PUSH    H"); opbytes = 1; break;
-        case 0xe6: printf("ANI     #$%02x", code[1]); opbytes = 2; break;
-        case 0xe7: printf("RST     4"); opbytes = 1; break;
-        case 0xe8: printf("RPE"); opbytes = 1; break;
-        case 0xe9: printf("PCHL"); opbytes = 1; break;
-        case 0xea: printf("JPE     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xeb: printf("XCHG"); opbytes = 1; break;
-        case 0xec: printf("CPE     $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xed: printf("NOP"); opbytes = 1; break;
-        case 0xee: printf("XRI     #$%02x", code[1]); opbytes = 2; break;
-        case 0xef: printf("RST     5"); opbytes = 1; break;
-
-        case 0xf0: printf("RP"); opbytes = 1; break;
-        case 0xf1: printf("POP     PSW"); opbytes = 1; break;
-        case 0xf2: printf("JP      $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xf3: printf("DI"); opbytes = 1; break;
-        case 0xf4: printf("CP      $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xf5: printf("PUSH    PSW"); opbytes = 1; break;
-        case 0xf6: printf("ORI     #$%02x", code[1]); opbytes = 2; break;
-        case 0xf7: printf("RST     6"); opbytes = 1; break;
-        case 0xf8: printf("RM"); opbytes = 1; break;
-        case 0xf9: printf("SPHL"); opbytes = 1; break;
-        case 0xfa: printf("JM      $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xfb: printf("EI"); opbytes = 1; break;
-        case 0xfc: printf("CM      $%02x%02x", code[2], code[1]); opbytes = 3; break;
-        case 0xfd: printf("NOP"); opbytes = 1; break;
-        case 0xfe: printf("CPI     #$%02x", code[1]); opbytes = 2; break;
-        case 0xff: printf("RST     7"); opbytes = 1; break;
-
-        default: printf("undefined opcode: 0x%02x", code[0]); opbytes = 1; break;
-    }
-
-    printf("\n");
-
-    return opbytes;
+FlowType op_flow(unsigned char* code, int* target) {
+    switch(code[0]) {
+        case 0xc3: case 0xcb:                                   // JMP
+            *target = (code[2] << 8) | code[1];
+            return FLOW_JUMP;
+
+        case 0xc2: case 0xca: case 0xd2: case 0xda:
+        case 0xe2: case 0xea: case 0xf2: case 0xfa:             // Jcc
+        case 0xc4: case 0xcc: case 0xcd: case 0xd4: case 0xdc:
+        case 0xe4: case 0xec: case 0xf4: case 0xfc:
+        case 0xdd: case 0xed: case 0xfd:                        // CALL, Ccc
+            *target = (code[2] << 8) | code[1];
+            return FLOW_FORK;
+
+        case 0xc7: case 0xcf: case 0xd7: case 0xdf:
+        case 0xe7: case 0xef: case 0xf7: case 0xff:             // RST n
+            *target = code[0] & 0x38;
+            return FLOW_FORK;
+
+        case 0xc9: case 0xd9:                                   // RET
+        case 0xe9:                                              // PCHL
+            return FLOW_END;
+
+        default:
+            return FLOW_NEXT;
+    }
+}
+
+void bitmap_set(uint8_t* bitmap, int index) {
+    bitmap[index >> 3] |= 1 << (index & 7);
+}
+
+int bitmap_test(uint8_t* bitmap, int index) {
+    return (bitmap[index >> 3] >> (index & 7)) & 1;
 }
 
 /**
- * @brief Main function. Looks through a file passed in as an argument and disassembles it into
- *  8080 assembly code.
+ * @brief Result of following control flow through a ROM.
  */
-int main(int argc, char** argv) {
-    // Open the file and verify it's valid
-    FILE* file = fopen(argv[1], "rb");
+typedef struct Disassembly {
+    unsigned char* buffer;
+    int size;
+    uint8_t* starts;    // Bitmap of addresses where a reachable operation begins
+    uint8_t* code;      // Bitmap of every byte covered by a reachable operation
+    uint8_t* labels;    // Bitmap of entry points and branch targets
+} Disassembly;
+
+/**
+ * @brief Follows every path from the entry points with a worklist, marking which bytes are
+ *  reachable code. Calls are assumed to return, so the operation after them is traced too.
+ * 
+ * @param dis Disassembly with buffer and size filled in. The bitmaps are allocated here.
+ * @param entries Addresses to start tracing from
+ * @param entry_count Number of entry points
+ */
+void trace_code(Disassembly* dis, int* entries, int entry_count) {
+    int bitmap_size = (dis->size + 7) / 8;
+    dis->starts = calloc(bitmap_size, 1);
+    dis->code = calloc(bitmap_size, 1);
+    dis->labels = calloc(bitmap_size, 1);
+
+    // Every traced operation pushes at most one target, so this can never overflow.
+    int* worklist = malloc((dis->size + entry_count) * sizeof(int));
+    int pending = 0;
+
+    int i;
+    for (i = 0; i < entry_count; i++) {
+        if (entries[i] >= 0 && entries[i] < dis->size) {
+            bitmap_set(dis->labels, entries[i]);
+            worklist[pending++] = entries[i];
+        }
+    }
+
+    while (pending > 0) {
+        int pc = worklist[--pending];
+
+        // Walk straight-line code until it ends or runs into something already traced.
+        while (pc < dis->size && !bitmap_test(dis->starts, pc)) {
+            unsigned char* code = &dis->buffer[pc];
+            int length = trace_length(*code);
+            int target = 0;
+            FlowType flow = op_flow(code, &target);
+
+            bitmap_set(dis->starts, pc);
+            for (i = 0; i < length && pc + i < dis->size; i++) {
+                bitmap_set(dis->code, pc + i);
+            }
+
+            if (flow == FLOW_JUMP || flow == FLOW_FORK) {
+                // Targets outside the image (e.g. RAM routines) can't be traced.
+                if (target < dis->size) {
+                    bitmap_set(dis->labels, target);
+                    if (!bitmap_test(dis->starts, target)) {
+                        worklist[pending++] = target;
+                    }
+                }
+            }
+
+            if (flow == FLOW_JUMP || flow == FLOW_END) {
+                break;
+            }
+            pc += length;
+        }
+    }
+
+    free(worklist);
+}
+
+/**
+ * @brief Prints a traced disassembly. Reachable code is disassembled, branch targets get an
+ *  L_xxxx label and everything else is emitted as DB lines of up to 8 bytes.
+ * 
+ * @param out Stream the assembly is written to
+ * @param dis A disassembly that has been through trace_code
+ */
+void print_disassembly(FILE* out, Disassembly* dis) {
+    const int DB_PER_LINE = 8;
+
+    int pc = 0;
+    while (pc < dis->size) {
+        if (bitmap_test(dis->labels, pc)) {
+            fprintf(out, "L_%04x:\n", pc);
+        }
+
+        if (bitmap_test(dis->starts, pc)) {
+            // If another traced path starts inside this operation (overlapping code), print
+            // that one too rather than hiding its label.
+            int end = pc + disassemble_op(out, dis->buffer, pc);
+            pc++;
+            while (pc < end && pc < dis->size && !bitmap_test(dis->starts, pc)) {
+                pc++;
+            }
+            continue;
+        }
+
+        // Data runs until the next line limit, label, or piece of code. The address of an
+        // undocumented JMP or CALL, which disassemble_op doesn't print, gets a line of its own.
+        fprintf(out, "%04x DB      $%02x", pc, dis->buffer[pc]);
+        int operand = bitmap_test(dis->code, pc);
+        int count = 1;
+        while (count < DB_PER_LINE && pc + count < dis->size &&
+               bitmap_test(dis->code, pc + count) == operand &&
+               !bitmap_test(dis->starts, pc + count) && !bitmap_test(dis->labels, pc + count)) {
+            fprintf(out, ",$%02x", dis->buffer[pc + count]);
+            count++;
+        }
+        fprintf(out, "\n");
+        pc += count;
+    }
+}
+
+#pragma endregion
+
+#pragma region Linear Sweep
+
+/**
+ * @brief Disassembles a buffer from start to finish, treating every byte as code.
+ * 
+ * @param out Stream the assembly is written to
+ * @param buffer The ROM
+ * @param size Size of the ROM
+ */
+void linear_sweep(FILE* out, unsigned char* buffer, int size) {
+    int pc = 0;
+    while(pc < size) {
+        pc += disassemble_op(out, buffer, pc);
+    }
+}
+
+/**
+ * @brief One slice of a parallel sweep. The main stream is decoded speculatively from the first
+ *  byte of the chunk. Since an operation is at most 3 bytes, the previous chunk's last operation
+ *  can spill over by 0-2 bytes, so streams starting 1 and 2 bytes in are decoded too, but only
+ *  until they land on a main stream boundary, which usually happens within a few operations.
+ */
+typedef struct SweepChunk {
+    unsigned char* buffer;
+    int size;
+    int start;
+    int end;
+
+    char* text;             // Main stream output
+    size_t text_size;
+    int* text_offsets;      // Offset into text of the operation at each address, or -1
+    int exit;               // Where the main stream's last operation ends (>= end)
+
+    char* alt_text[2];      // Output of the streams starting at start + 1 and start + 2
+    size_t alt_size[2];
+    int alt_merge[2];       // Address where the stream joined the main stream, or -1
+    int alt_exit[2];        // Where the stream's last operation ends if it never joined
+} SweepChunk;
+
+void* sweep_chunk(void* arg) {
+    SweepChunk* chunk = arg;
+    int length = chunk->end - chunk->start;
+    int i;
+
+    chunk->text_offsets = malloc(length * sizeof(int));
+    for (i = 0; i < length; i++) {
+        chunk->text_offsets[i] = -1;
+    }
+
+    FILE* out = open_memstream(&chunk->text, &chunk->text_size);
+    int pc = chunk->start;
+    while (pc < chunk->end) {
+        chunk->text_offsets[pc - chunk->start] = ftell(out);
+        pc += disassemble_op(out, chunk->buffer, pc);
+    }
+    chunk->exit = pc;
+    fclose(out);
+
+    for (i = 0; i < 2; i++) {
+        out = open_memstream(&chunk->alt_text[i], &chunk->alt_size[i]);
+        pc = chunk->start + 1 + i;
+        while (pc < chunk->end && chunk->text_offsets[pc - chunk->start] < 0) {
+            pc += disassemble_op(out, chunk->buffer, pc);
+        }
+        chunk->alt_merge[i] = pc < chunk->end ? pc : -1;
+        chunk->alt_exit[i] = pc;
+        fclose(out);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Linear sweep split over several threads. Each chunk is decoded speculatively, then the
+ *  chunks are stitched together in order by following the true operation boundary from one
+ *  chunk into the next. The output is byte-identical to linear_sweep.
+ * 
+ * @param out Stream the assembly is written to
+ * @param buffer The ROM, padded as by read_rom_file
+ * @param size Size of the ROM
+ * @param thread_count Number of chunks to decode in parallel
+ */
+void parallel_sweep(FILE* out, unsigned char* buffer, int size, int thread_count) {
+    // Below this, thread startup costs more than the decoding it saves.
+    const int MIN_CHUNK_SIZE = 4096;
+
+    int chunk_count = thread_count;
+    if (chunk_count > size / MIN_CHUNK_SIZE) {
+        chunk_count = size / MIN_CHUNK_SIZE;
+    }
+    if (chunk_count <= 1) {
+        linear_sweep(out, buffer, size);
+        return;
+    }
+
+    SweepChunk* chunks = calloc(chunk_count, sizeof(SweepChunk));
+    pthread_t* threads = malloc(chunk_count * sizeof(pthread_t));
+    int i;
+    for (i = 0; i < chunk_count; i++) {
+        chunks[i].buffer = buffer;
+        chunks[i].size = size;
+        chunks[i].start = (int)((long)size * i / chunk_count);
+        chunks[i].end = (int)((long)size * (i + 1) / chunk_count);
+        pthread_create(&threads[i], NULL, sweep_chunk, &chunks[i]);
+    }
+
+    int entry = 0;
+    for (i = 0; i < chunk_count; i++) {
+        SweepChunk* chunk = &chunks[i];
+        pthread_join(threads[i], NULL);
+
+        int phase = entry - chunk->start;
+        if (phase == 0) {
+            fwrite(chunk->text, 1, chunk->text_size, out);
+            entry = chunk->exit;
+        }
+        else {
+            fwrite(chunk->alt_text[phase - 1], 1, chunk->alt_size[phase - 1], out);
+            int merge = chunk->alt_merge[phase - 1];
+            if (merge >= 0) {
+                int offset = chunk->text_offsets[merge - chunk->start];
+                fwrite(chunk->text + offset, 1, chunk->text_size - offset, out);
+                entry = chunk->exit;
+            }
+            else {
+                entry = chunk->alt_exit[phase - 1];
+            }
+        }
+
+        free(chunk->text);
+        free(chunk->text_offsets);
+        free(chunk->alt_text[0]);
+        free(chunk->alt_text[1]);
+    }
+
+    free(threads);
+    free(chunks);
+}
+
+double elapsed_seconds(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Times the sequential sweep against parallel_sweep at 1, 2, 4... threads and checks
+ *  that every run produces the same output. Small ROMs are tiled so there is enough work for
+ *  the timings to mean something.
+ * 
+ * @param buffer The ROM
+ * @param size Size of the ROM
+ * @param max_threads Highest thread count to try
+ */
+void benchmark_sweep(unsigned char* buffer, int size, int max_threads) {
+    const int MIN_BENCH_SIZE = 8 * 1024 * 1024;
+
+    int bench_size = size;
+    while (bench_size < MIN_BENCH_SIZE) {
+        bench_size += size;
+    }
+    unsigned char* image = calloc(bench_size + 2, 1);
+    int i;
+    for (i = 0; i < bench_size; i += size) {
+        memcpy(&image[i], buffer, i + size <= bench_size ? size : bench_size - i);
+    }
+
+    char* expected;
+    size_t expected_size;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    FILE* out = open_memstream(&expected, &expected_size);
+    linear_sweep(out, image, bench_size);
+    fclose(out);
+    double sequential = elapsed_seconds(&start);
+
+    printf("Image: %d bytes, %zu bytes of output\n", bench_size, expected_size);
+    printf("threads  seconds  speedup  identical\n");
+    printf("%-7s  %7.3f  %6.2fx  %s\n", "seq", sequential, 1.0, "-");
 
+    int threads;
+    for (threads = 1; threads <= max_threads; threads *= 2) {
+        char* result;
+        size_t result_size;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        out = open_memstream(&result, &result_size);
+        parallel_sweep(out, image, bench_size, threads);
+        fclose(out);
+        double seconds = elapsed_seconds(&start);
+
+        int identical = result_size == expected_size && memcmp(result, expected, result_size) == 0;
+        printf("%-7d  %7.3f  %6.2fx  %s\n", threads, seconds, sequential / seconds,
+            identical ? "yes" : "NO");
+        free(result);
+    }
+
+    free(expected);
+    free(image);
+}
+
+#pragma endregion
+
+#pragma region Batch Processing
+
+/**
+ * @brief Reads a whole file into a new buffer. The buffer is padded with zeroed bytes so that
+ *  decoding a truncated operation at the end never reads past the allocation.
+ * 
+ * @param filename Path to the file
+ * @param size Set to the size of the file
+ * @return unsigned char* The buffer, or NULL if the file could not be opened
+ */
+unsigned char* read_rom_file(const char* filename, int* size) {
+    FILE* file = fopen(filename, "rb");
     if (file == NULL) {
-        printf("Error: Could not open %s\n", argv[1]);
-        exit(1);
+        return NULL;
     }
 
-    // Get the file size and read it into a memory buffer
     fseek(file, 0L, SEEK_END);
     int file_size = ftell(file);
     fseek(file, 0L, SEEK_SET);
 
-    unsigned char* buffer = malloc(file_size);
-    fread(buffer, file_size, 1, file);
+    unsigned char* buffer = calloc(file_size + 2, 1);
+    if (fread(buffer, 1, file_size, file) != (size_t)file_size) {
+        free(buffer);
+        fclose(file);
+        return NULL;
+    }
     fclose(file);
 
-    // Read through the buffer and disassemble every operation.
-    int pc = 0;
-    while(pc < file_size) {
-        pc += disassemble_op(buffer, pc);
+    *size = file_size;
+    return buffer;
+}
+
+/**
+ * @brief Options shared by every file on the command line.
+ */
+typedef struct Options {
+    int recursive;
+    int* entries;
+    int entry_count;
+    int threads;
+    int sweep_threads;
+} Options;
+
+/**
+ * @brief One ROM file's worth of work. Output is collected in memory so files disassembled in
+ *  parallel can still be printed in command line order.
+ */
+typedef struct BatchJob {
+    const char* filename;
+    char* output;
+    size_t output_size;
+    int error;
+} BatchJob;
+
+typedef struct Batch {
+    BatchJob* jobs;
+    int count;
+    Options* options;
+    atomic_int next;
+} Batch;
+
+void run_job(BatchJob* job, Options* options) {
+    int size;
+    unsigned char* buffer = read_rom_file(job->filename, &size);
+    if (buffer == NULL) {
+        job->error = 1;
+        return;
+    }
+
+    FILE* out = open_memstream(&job->output, &job->output_size);
+    if (options->recursive) {
+        Disassembly dis = { 0 };
+        dis.buffer = buffer;
+        dis.size = size;
+        trace_code(&dis, options->entries, options->entry_count);
+        print_disassembly(out, &dis);
+        free(dis.starts);
+        free(dis.code);
+        free(dis.labels);
+    }
+    else if (options->sweep_threads > 1) {
+        parallel_sweep(out, buffer, size, options->sweep_threads);
     }
+    else {
+        linear_sweep(out, buffer, size);
+    }
+    fclose(out);
+
+    free(buffer);
+}
 
-    return 0;
-}
\ No newline at end of file
+void* batch_worker(void* arg) {
+    Batch* batch = arg;
+
+    int index;
+    while ((index = atomic_fetch_add(&batch->next, 1)) < batch->count) {
+        run_job(&batch->jobs[index], batch->options);
+    }
+
+    return NULL;
+}
+
+/**
+ * @brief Disassembles independent ROM files on a pool of worker threads.
+ * 
+ * @param batch Jobs to run. Each job's output or error is filled in.
+ */
+void run_batch(Batch* batch) {
+    int thread_count = batch->options->threads;
+    if (thread_count > batch->count) {
+        thread_count = batch->count;
+    }
+
+    if (thread_count <= 1) {
+        batch_worker(batch);
+        return;
+    }
+
+    pthread_t* threads = malloc(thread_count * sizeof(pthread_t));
+    int i;
+    for (i = 0; i < thread_count; i++) {
+        pthread_create(&threads[i], NULL, batch_worker, batch);
+    }
+    for (i = 0; i < thread_count; i++) {
+        pthread_join(threads[i], NULL);
+    }
+    free(threads);
+}
+
+#pragma endregion
+
+void print_usage() {
+    printf("Usage: disassembler [-r] [-e address]... [-j threads] [-b] <rom>...\n");
+    printf("  -r          Only disassemble code reachable from the entry points\n");
+    printf("  -e address  Extra entry point (hex) for -r, on top of 0x0000 and the RST vectors\n");
+    printf("  -j threads  Worker threads. Multiple ROM files are split between them, a single\n");
+    printf("              ROM is split into chunks that are disassembled in parallel\n");
+    printf("  -b          Benchmark the parallel sweep against the sequential one\n");
+}
+
+/**
+ * @brief Main function. Looks through the files passed in as arguments and disassembles them
+ *  into 8080 assembly code, either by sweeping every byte or by following control flow.
+ */
+int main(int argc, char** argv) {
+    const int RST_VECTOR_COUNT = 8;
+
+    Options options = { 0 };
+    options.threads = sysconf(_SC_NPROCESSORS_ONLN);
+    options.entries = malloc((RST_VECTOR_COUNT + argc) * sizeof(int));
+
+    // 0x0000 is RST 0, so the RST vectors cover the reset entry point too.
+    int i;
+    for (i = 0; i < RST_VECTOR_COUNT; i++) {
+        options.entries[options.entry_count++] = i * 8;
+    }
+
+    int benchmark = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "re:j:bh")) != -1) {
+        switch (opt) {
+            case 'r': options.recursive = 1; break;
+            case 'b': benchmark = 1; break;
+            case 'e': options.entries[options.entry_count++] = strtol(optarg, NULL, 16); break;
+            case 'j': options.threads = atoi(optarg); break;
+            default: print_usage(); exit(1);
+        }
+    }
+
+    if (optind >= argc) {
+        print_usage();
+        exit(1);
+    }
+
+    if (benchmark) {
+        int size;
+        unsigned char* buffer = read_rom_file(argv[optind], &size);
+        if (buffer == NULL || size == 0) {
+            printf("Error: Could not open %s\n", argv[optind]);
+            exit(1);
+        }
+        benchmark_sweep(buffer, size, options.threads);
+        return 0;
+    }
+
+    Batch batch = { 0 };
+    batch.count = argc - optind;
+    batch.jobs = calloc(batch.count, sizeof(BatchJob));
+    batch.options = &options;
+    for (i = 0; i < batch.count; i++) {
+        batch.jobs[i].filename = argv[optind + i];
+    }
+
+    // The threads go to splitting up the files if there are several, or the one file if not.
+    options.sweep_threads = batch.count == 1 ? options.threads : 1;
+
+    run_batch(&batch);
+
+    int status = 0;
+    for (i = 0; i < batch.count; i++) {
+        BatchJob* job = &batch.jobs[i];
+        if (job->error) {
+            printf("Error: Could not open %s\n", job->filename);
+            status = 1;
+            continue;
+        }
+
+        if (batch.count > 1) {
+            printf("; %s\n", job->filename);
+        }
+        fwrite(job->output, 1, job->output_size, stdout);
+        free(job->output);
+    }
+
+    return status;
+}
@@ -1,828 +1,970 @@
+#include <pthread.h>
+#include <stdatomic.h>
 #include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lib/audio.h"
+#include "lib/capture.h"
+#include "lib/cpm.h"
+#include "lib/cpu8080.h"
+#include "lib/debugger.h"
+#include "lib/explore.h"
+#include "lib/hash.h"
+#include "lib/invaders.h"
+#include "lib/lockstep.h"
+#include "lib/metrics.h"
+#include "lib/pacer.h"
+#include "lib/profiler.h"
+#include "lib/snapshot.h"
+
+// Operations run between checks for a debugger interrupt request, and between metrics updates.
+#define DEBUGGER_POLL_INTERVAL 65536
+
+// Clock and frame rate used to pace a bare ROM, the same as Space Invaders.
+#define CPU_HZ 2000000
+#define FPS 60
 
-typedef struct ConditionCodes {
-    uint8_t z : 1;
-    uint8_t s : 1;
-    uint8_t p : 1;
-    uint8_t cy : 1;
-    uint8_t ac : 1;
-} ConditionCodes;
-
-typedef struct State8080 {
-    uint8_t a;
-    uint8_t b;
-    uint8_t c;
-    uint8_t d;
-    uint8_t e;
-    uint8_t h;
-    uint8_t l;
-    uint16_t sp;
-    uint16_t pc;
-    uint8_t* memory;
-    struct ConditionCodes codes;
-    uint8_t int_enable;
-} State8080;
-
-#pragma region Helpers
+/**
+ * @brief Command line options.
+ */
+typedef struct Options {
+    int trace;
+    char* profile_path;
+    char* debugger_address;
+    char* machine;
+    uint64_t frames;
+    char* script_path;
+    char* screen_path;
+    char* wav_path;
+    char* sound_directory;
+    char* video_path;
+    int drop_frames;            // Drop video frames when the encoder falls behind, don't wait
+    double speed;
+    char* lateness_path;
+    uint64_t op_limit;
+    char* record_path;
+    char* replay_path;
+    int lockstep;
+    int no_superinstructions;
+    int no_idle_skipping;
+    char* metrics_address;
+    int json_summary;
+    int instances;
+    char* snapshot_point;
+    char* children_path;
+    int threads;
+    char* explore_buttons;
+    uint64_t explore_limit;
+    char* disk_paths[CPM_MAX_DISKS];
+    int disk_count;
+    char** program_args;        // Command line for a CP/M program
+    int program_arg_count;
+    uint16_t rom_start;
+    uint32_t rom_size;
+    uint32_t end_address;       // The program is finished once pc reaches this
+} Options;
 
 /**
- * @brief Combine two 1-byte immediates into a 2-byte immediate. Useful for register pairs.
- * 
- * @param a 1-byte immediate
- * @param b 1-byte immediate
- * @return uint16_t Resulting 2-byte immediate
+ * @brief Everything the run loops need to know about.
  */
-uint16_t combine_immediates(uint8_t a, uint8_t b) {
-    return ((uint16_t)a << 8) | (uint16_t)b;
-}
+typedef struct Emulator {
+    State8080* state;
+    Profiler* profiler;         // NULL if profiling is off
+    Debugger* debugger;         // NULL if no debugger is attached
+    Pacer* pacer;
+    Lockstep* lockstep;         // NULL unless checking against the reference core
+    Metrics* metrics;           // NULL unless serving metrics or printing the JSON summary
+    Options* options;
+    uint64_t opcounter;
+} Emulator;
 
 /**
- * @brief Prints the codes/flags for an 8080 state
+ * @brief Writes the profile report and coverage bitmap, if profiling was turned on.
  * 
- * @param state 
+ * @param emulator 
  */
-void print_codes(State8080* state) {
-    printf("Codes {z: %u, s: %u, p: %u, cy: %u, ac: %u}\n", 
-        state->codes.z,
-        state->codes.s,
-        state->codes.p,
-        state->codes.cy,
-        state->codes.ac);
+void write_profile(Emulator* emulator) {
+    Options* options = emulator->options;
+    FILE* report = fopen(options->profile_path, "w");
+    if (report == NULL) {
+        printf("\nError: Could not open %s\n", options->profile_path);
+        return;
+    }
+    profiler_write_report(emulator->profiler, emulator->state, report,
+        options->rom_start, options->rom_size);
+    fclose(report);
+
+    // The coverage bitmap goes next to the report.
+    char* coverage_path = malloc(strlen(options->profile_path) + 5);
+    sprintf(coverage_path, "%s.cov", options->profile_path);
+    FILE* coverage = fopen(coverage_path, "wb");
+    if (coverage == NULL) {
+        printf("\nError: Could not open %s\n", coverage_path);
+    }
+    else {
+        profiler_write_coverage(emulator->profiler, coverage);
+        fclose(coverage);
+    }
+    free(coverage_path);
 }
 
 /**
- * @brief Prints a state
+ * @brief Prints the pacing summary and writes the lateness log, if pacing was turned on.
  * 
- * @param state 
+ * @param emulator 
  */
-void print_state(State8080* state) {
-    printf("State {a: 0x%02x, bc: 0x%04x, de: 0x%04x, hl: 0x%04x, pc: 0x%04x, sp: 0x%04x}\n\t\t", 
-        state->a,
-        combine_immediates(state->b, state->c),
-        combine_immediates(state->d, state->e),
-        combine_immediates(state->h, state->l),
-        state->pc, 
-        state->sp);
-
-    print_codes(state);
+void write_lateness(Emulator* emulator) {
+    Pacer* pacer = emulator->pacer;
+    if (pacer == NULL || pacer->speed <= 0) {
+        return;
+    }
+    pacer_write_report(pacer, stdout);
+
+    char* path = emulator->options->lateness_path;
+    if (path != NULL) {
+        FILE* log = fopen(path, "w");
+        if (log == NULL) {
+            printf("\nError: Could not open %s\n", path);
+            return;
+        }
+        pacer_write_log(pacer, log);
+        fclose(log);
+    }
 }
 
 /**
  * @brief Shuts down the emualator
  * 
- * @param state 
+ * @param emulator 
  */
-void shutdown(State8080* state) {
-    printf("\nProgram Finished.\nFinal State -> ");
-    print_state(state);
+void shutdown(Emulator* emulator) {
+    if (emulator->debugger != NULL) {
+        debugger_exited(emulator->debugger, 0);
+        debugger_free(emulator->debugger);
+    }
+    if (emulator->profiler != NULL) {
+        write_profile(emulator);
+    }
+    write_lateness(emulator);
+
+    if (emulator->options->json_summary) {
+        metrics_update(emulator->metrics, emulator->state);
+        metrics_write_json(emulator->metrics, emulator->state, stdout);
+    }
+    else {
+        printf("\nProgram Finished.\nFinal State -> ");
+        print_state(emulator->state);
+    }
+    if (emulator->metrics != NULL) {
+        metrics_free(emulator->metrics);
+    }
     exit(0);
 }
 
-#pragma endregion
+#pragma region Run Loops
 
-#pragma region Arithmetic Codes/Flags Calculations
+/**
+ * @brief Emulates operations until either limit is reached or the program is finished. This is
+ *  the normal loop, used whenever no debugger is attached or nothing is armed.
+ * 
+ * @param emulator 
+ * @param op_limit Value of the operation counter to stop at
+ * @param cycle_limit Value of the cycle counter to stop at
+ */
+void run_ops(Emulator* emulator, uint64_t op_limit, uint64_t cycle_limit) {
+    State8080* state = emulator->state;
+    Options* options = emulator->options;
+
+    while (state->pc < options->end_address && emulator->opcounter < op_limit &&
+           state->cycles < cycle_limit) {
+        uint16_t pc = state->pc;
+        uint16_t sp = state->sp;
+        uint8_t opcode = state->memory[pc];
+
+        if (options->trace) {
+            printf("%04llu -- 0x%02x -> ", (unsigned long long)emulator->opcounter, opcode);
+        }
 
-void calculate_codes_z(State8080* state, uint8_t result) {
-    state->codes.z = (result & 0xff) == 0;
-}
+        if (emulator->lockstep != NULL) {
+            lockstep_before_op(emulator->lockstep);
+        }
 
-void calculate_codes_s(State8080* state, uint8_t result) {
-    state->codes.s = (result & 0x80) != 0;
-}
+        int cycles = emulate_op(state);
 
-void calculate_codes_p(State8080* state, uint8_t result) {
-    const uint8_t RESULT_BITS = 8;
+        if (emulator->profiler != NULL) {
+            profiler_record(emulator->profiler, state, pc, sp, opcode, cycles);
+        }
+        if (options->trace) {
+            print_state(state);
+        }
 
-    int parity = 0;
-    int i;
-    for (i = 0; i < RESULT_BITS; i++) {
-        parity += result & 1;
-        result = result >> 1;
+        emulator->opcounter++;
+        if (emulator->lockstep != NULL && !lockstep_after_op(emulator->lockstep)) {
+            break;
+        }
     }
-
-    state->codes.p = parity % 2 == 0;
-}
-
-void calculate_codes_cy(State8080* state, uint8_t result) {
-    state->codes.cy = result > 0xff;
-}
-
-void calculate_codes_ac(State8080* state, uint8_t result) {
-    state->codes.ac = result > 0x09;
 }
 
-void calculate_codes_all(State8080* state, uint8_t result) {
-    calculate_codes_z(state, result);
-    calculate_codes_s(state, result);
-    calculate_codes_p(state, result);
-    calculate_codes_cy(state, result);
-    calculate_codes_ac(state, result);
-}
+/**
+ * @brief Same as run_ops, but gives the debugger a look before and after every operation so it
+ *  can stop on breakpoints, watchpoints and single steps. When only breakpoints are set, a
+ *  machine runs whole blocks instead, and only steps through the straight-line code that leads
+ *  to a breakpoint. A bare ROM always steps, since it has to stop as soon as it runs off the end.
+ */
+void run_ops_debug(Emulator* emulator, uint64_t op_limit, uint64_t cycle_limit) {
+    State8080* state = emulator->state;
+    Options* options = emulator->options;
+    Debugger* debugger = emulator->debugger;
+    int blocks = options->machine != NULL && emulator->profiler == NULL &&
+        emulator->lockstep == NULL && !options->trace;
+    int stepping_block = 0;         // Stepping through code debugger_run_block stopped at
+
+    while (state->pc < options->end_address && emulator->opcounter < op_limit &&
+           state->cycles < cycle_limit && debugger_armed(debugger)) {
+        if (blocks && !stepping_block && debugger_can_run_blocks(debugger)) {
+            // Every operation takes at least 4 cycles, so this runs no more than op_limit.
+            uint64_t limit = cycle_limit;
+            if (op_limit - emulator->opcounter < (cycle_limit - state->cycles) / 4) {
+                limit = state->cycles + (op_limit - emulator->opcounter) * 4;
+            }
+            uint64_t instructions = state->instructions;
+            stepping_block = debugger_run_block(debugger, state, limit,
+                !options->no_superinstructions);
+            emulator->opcounter += state->instructions - instructions;
+            continue;
+        }
 
-void calculate_codes_all_except_cy(State8080* state, uint8_t result) {
-    calculate_codes_z(state, result);
-    calculate_codes_s(state, result);
-    calculate_codes_p(state, result);
-    calculate_codes_ac(state, result);
-}
+        debugger_before_op(debugger, state);
+        if (debugger->killed) {
+            return;
+        }
 
-#pragma endregion
+        uint16_t pc = state->pc;
+        uint16_t sp = state->sp;
+        uint8_t opcode = state->memory[pc];
 
-#pragma region Errors
+        if (options->trace) {
+            printf("%04llu -- 0x%02x -> ", (unsigned long long)emulator->opcounter, opcode);
+        }
 
-void unimplemented_op_error(State8080* state) {
-    printf("\nError: Unimplemented operation at 0x%04x (opcode: 0x%02x)\n", 
-        state->pc, state->memory[state->pc]);
-    exit(1);
-}
+        if (emulator->lockstep != NULL) {
+            lockstep_before_op(emulator->lockstep);
+        }
 
-#pragma endregion
+        int cycles = emulate_op(state);
 
-#pragma region Arithmetic Operations
+        if (emulator->profiler != NULL) {
+            profiler_record(emulator->profiler, state, pc, sp, opcode, cycles);
+        }
+        if (options->trace) {
+            print_state(state);
+        }
 
-void add(State8080* state, uint8_t value) {
-    uint16_t result = (uint16_t)state->a + (uint16_t)value;
-    calculate_codes_all(state, result);
-    state->a = result & 0xff;
+        emulator->opcounter++;
+        if (emulator->lockstep != NULL && !lockstep_after_op(emulator->lockstep)) {
+            break;
+        }
+        if (debugger_ends_block(opcode)) {
+            stepping_block = 0;
+        }
+        debugger_after_op(debugger, state);
+    }
 }
 
-void adc(State8080* state, uint8_t value) {
-    uint16_t result = (uint16_t)state->a + (uint16_t)value + (uint16_t)state->codes.cy;
-    calculate_codes_all(state, result);
-    state->a = result & 0xff;
+/**
+ * @brief Whether the program has run off the end of the ROM, the debugger killed it, or it no
+ *  longer matches the reference core.
+ */
+int finished(Emulator* emulator) {
+    return emulator->state->pc >= emulator->options->end_address ||
+        (emulator->debugger != NULL && emulator->debugger->killed) ||
+        (emulator->lockstep != NULL && emulator->lockstep->diverged);
 }
 
-void dad(State8080* state, uint16_t value) {
-    uint32_t hl = combine_immediates(state->h, state->l);
-    uint32_t result = hl + value;
+/**
+ * @brief Runs until either limit is reached or the program is finished.
+ * 
+ * @param emulator 
+ * @param op_limit Value of the operation counter to stop at
+ * @param cycle_limit Value of the cycle counter to stop at
+ */
+void run(Emulator* emulator, uint64_t op_limit, uint64_t cycle_limit) {
+    Debugger* debugger = emulator->debugger;
+    if (debugger == NULL && emulator->metrics == NULL) {
+        run_ops(emulator, op_limit, cycle_limit);
+        return;
+    }
 
-    state->codes.cy = result > 0xffff;
-    state->h = (result & 0xff00) >> 8;
-    state->l = result & 0xff;
-}
+    // With a debugger attached, run in batches so it can interrupt between them. The
+    // debugger only slows the loop down while it actually has something to check. The
+    // metrics are published between batches too.
+    while (!finished(emulator) && emulator->opcounter < op_limit &&
+           emulator->state->cycles < cycle_limit) {
+        if (debugger != NULL) {
+            debugger_poll(debugger, emulator->state);
+            if (debugger->killed) {
+                break;
+            }
+        }
 
-void sub(State8080* state, uint8_t value) {
-    uint16_t result = (uint16_t)state->a - (uint16_t)value;
-    calculate_codes_all(state, result);
-    state->a = result & 0xff;
+        uint64_t limit = emulator->opcounter + DEBUGGER_POLL_INTERVAL;
+        if (limit > op_limit) {
+            limit = op_limit;
+        }
+        if (debugger != NULL && debugger_armed(debugger)) {
+            run_ops_debug(emulator, limit, cycle_limit);
+        }
+        else {
+            run_ops(emulator, limit, cycle_limit);
+        }
+        if (emulator->metrics != NULL) {
+            metrics_update(emulator->metrics, emulator->state);
+        }
+    }
 }
 
-void sbb(State8080* state, uint8_t value) {
-    uint16_t result = (uint16_t)state->a - (uint16_t)value - (uint16_t)state->codes.cy;
-    calculate_codes_all(state, result);
-    state->a = result & 0xff;
-}
+#pragma endregion
 
-void inr(State8080* state, uint8_t* reg) {
-    (*reg)++;
-    calculate_codes_all_except_cy(state, *reg);
-}
+#pragma region Machines
 
-void dcr(State8080* state, uint8_t* reg) {
-    (*reg)--;
-    calculate_codes_all_except_cy(state, *reg);
+double elapsed_seconds(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
 }
 
-void inx(State8080* state, uint8_t* reg_1, uint8_t* reg_2) {
-    (*reg_2)++;
-    if (*reg_2 == 0) {
-        (*reg_1)++;
+static void publish_frame(Emulator* emulator, Invaders* invaders) {
+    Metrics* metrics = emulator->metrics;
+    if (metrics != NULL) {
+        metrics_update(metrics, emulator->state);
+        metrics_set(&metrics->frames, invaders->frame);
+        metrics_set(&metrics->idle_skipped_cycles, invaders->idle.skipped_cycles);
     }
 }
 
-void dcx(State8080* state, uint8_t* reg_1, uint8_t* reg_2) {
-    (*reg_2)--;
-    if (*reg_2 == 0xff) {
-        (*reg_1)--;
+/**
+ * @brief Runs the Space Invaders machine headless for the requested number of frames, as fast
+ *  as the host allows.
+ * 
+ * @param emulator 
+ */
+void run_invaders(Emulator* emulator) {
+    State8080* state = emulator->state;
+    Options* options = emulator->options;
+    Invaders* invaders = invaders_create(state);
+    invaders->superinstructions = !options->no_superinstructions;
+    invaders->idle_skipping = !options->no_idle_skipping;
+    invaders->metrics = emulator->metrics;
+
+    InputScript* script = NULL;
+    if (options->script_path != NULL && options->replay_path == NULL) {
+        script = input_script_load(options->script_path);
+        if (script == NULL) {
+            printf("\nError: Could not load input script %s\n", options->script_path);
+            exit(1);
+        }
+        invaders_set_script(invaders, script);
     }
-}
-
-void cpi(State8080* state, uint8_t value) {
-    uint8_t result = state->a - value;
-    calculate_codes_all(state, result);
-
-    state->pc++;
-}
 
-#pragma endregion
+    Audio* audio = NULL;
+    FILE* wav = NULL;
+    if (options->wav_path != NULL) {
+        wav = fopen(options->wav_path, "wb");
+        if (wav == NULL) {
+            printf("\nError: Could not open %s\n", options->wav_path);
+            exit(1);
+        }
+        audio = audio_create(wav);
+        int loaded = invaders_set_audio(invaders, audio, options->sound_directory);
+        printf("Loaded %d sounds from %s\n", loaded, options->sound_directory);
+    }
 
-#pragma region Logical and Bitwise Operations
+    Capture* capture = NULL;
+    FILE* video = NULL;
+    if (options->video_path != NULL) {
+        video = fopen(options->video_path, "wb");
+        if (video == NULL) {
+            printf("\nError: Could not open %s\n", options->video_path);
+            exit(1);
+        }
+        size_t length = strlen(options->video_path);
+        int y4m = length >= 4 && strcmp(&options->video_path[length - 4], ".y4m") == 0;
+        capture = capture_create(video, y4m ? CAPTURE_Y4M : CAPTURE_DELTA, options->drop_frames);
+        invaders->capture = capture;
+    }
 
-void rrc(State8080* state) {
-    state->codes.cy = state->a & 1;
-    state->a = ((state->a & 1) << 7) | (state->a >> 1);    
-}
+    // Set up last, so the replay sits between the CPU and everything else.
+    Replay* replay = NULL;
+    if (options->record_path != NULL) {
+        replay = replay_record(state, options->record_path);
+        if (replay == NULL) {
+            printf("\nError: Could not open %s\n", options->record_path);
+            exit(1);
+        }
+    }
+    else if (options->replay_path != NULL) {
+        replay = replay_play(state, options->replay_path);
+        if (replay == NULL) {
+            printf("\nError: Could not read replay log %s\n", options->replay_path);
+            exit(1);
+        }
+    }
+    invaders->replay = replay;
+    if (options->lockstep) {
+        emulator->lockstep = lockstep_create(state);
+    }
 
-void ana(State8080* state, uint8_t value) {
-    state->a = state->a & value;
-    calculate_codes_all(state, state->a);
-}
+    // Nothing to hook into each operation, so let the machine run whole frames by itself.
+    int plain = emulator->profiler == NULL && emulator->debugger == NULL &&
+        emulator->lockstep == NULL && !options->trace;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (invaders->frame < options->frames && !finished(emulator) &&
+           (replay == NULL || !replay_stopped(replay))) {
+        if (plain) {
+            invaders_run_frame(invaders);
+            publish_frame(emulator, invaders);
+            pacer_wait(emulator->pacer);
+            continue;
+        }
 
-void xra(State8080* state, uint8_t value) {
-    state->a = state->a ^ value;
-    calculate_codes_all(state, state->a);
-}
+        uint64_t target = invaders_next_event(invaders);
+        run(emulator, UINT64_MAX, target);
+        if (state->cycles < target) {
+            break;
+        }
+        int interrupt_num = invaders->half == 0 ? 1 : 2;
+        if (invaders_handle_event(invaders) && emulator->profiler != NULL) {
+            profiler_interrupt(emulator->profiler, state);
+        }
+        if (emulator->lockstep != NULL) {
+            lockstep_interrupt(emulator->lockstep, interrupt_num);
+        }
+        if (invaders->half == 0) {
+            publish_frame(emulator, invaders);
+            pacer_wait(emulator->pacer);
+        }
+    }
+    double seconds = elapsed_seconds(&start);
+
+    printf("Ran %llu frames in %.3f s (%.0f frames/s)\n", (unsigned long long)invaders->frame,
+        seconds, seconds > 0 ? invaders->frame / seconds : 0.0);
+    if (invaders->idle.skips > 0) {
+        printf("Skipped %llu idle loops, %.1f%% of all cycles\n",
+            (unsigned long long)invaders->idle.skips,
+            100.0 * invaders->idle.skipped_cycles / (state->cycles - invaders->start_cycles));
+    }
 
-void ora(State8080* state, uint8_t value) {
-    state->a = state->a | value;
-    calculate_codes_all(state, state->a);
-}
+    if (emulator->lockstep != NULL) {
+        lockstep_write_report(emulator->lockstep, stdout);
+        lockstep_free(emulator->lockstep);
+        emulator->lockstep = NULL;
+    }
 
-#pragma endregion
+    if (replay != NULL) {
+        if (replay->diverged) {
+            printf("%s\n", replay->message);
+        }
+        else if (!replay->recording) {
+            printf("Replay matched for %llu frames%s\n", (unsigned long long)replay->frame,
+                replay->finished ? ", the whole log" : "");
+        }
+        invaders->replay = NULL;
+        replay_free(replay);
+    }
 
-#pragma region Data Transfer Operations
+    if (audio != NULL) {
+        audio_finish(audio, invaders_audio_time(invaders));
+        printf("Mixed %.1f s of sound in %.3f ms (%.2f us per frame), %llu events dropped\n",
+            (double)audio->mixed / AUDIO_RATE, audio->mix_nanoseconds / 1e6,
+            invaders->frame ? audio->mix_nanoseconds / 1e3 / invaders->frame : 0.0,
+            (unsigned long long)audio->dropped);
+        invaders->audio = NULL;
+        audio_free(audio);
+        fclose(wav);
+    }
 
-void mvi(State8080* state, uint8_t* reg, uint8_t value) {
-    *reg = value;
-    state->pc++;
-}
+    if (capture != NULL) {
+        capture_finish(capture, invaders->frame);
+        uint64_t handed = capture->captured + capture->dropped;
+        printf("Captured %llu frames (%llu dropped) to %.1f KB: %.2f us per frame on the "
+            "emulation thread plus %.3f ms waiting for the encoder, %.2f us per frame to encode\n",
+            (unsigned long long)capture->captured, (unsigned long long)capture->dropped,
+            capture->bytes / 1e3,
+            handed ? (capture->capture_nanoseconds - capture->wait_nanoseconds) / 1e3 / handed
+                : 0.0,
+            capture->wait_nanoseconds / 1e6,
+            capture->written ? capture->encode_nanoseconds / 1e3 / capture->written : 0.0);
+        invaders->capture = NULL;
+        capture_free(capture);
+        fclose(video);
+    }
 
-void mov(State8080* state, uint8_t* move_to_reg, uint8_t* move_from_reg) {
-    *move_to_reg = *move_from_reg;
-}
+    if (options->screen_path != NULL) {
+        FILE* screen = fopen(options->screen_path, "wb");
+        if (screen == NULL) {
+            printf("\nError: Could not open %s\n", options->screen_path);
+        }
+        else {
+            invaders_write_screen(invaders, screen);
+            fclose(screen);
+        }
+    }
 
-void lxi(State8080* state, uint8_t* reg_1, uint8_t* reg_2, uint8_t* opcode) {
-    *reg_1 = opcode[2];
-    *reg_2 = opcode[1];
-    state->pc += 2;
+    publish_frame(emulator, invaders);
+    invaders_free(invaders);
+    if (script != NULL) {
+        input_script_free(script);
+    }
 }
 
-void ldax(State8080* state, uint8_t reg_1_val, uint8_t reg_2_val) {
-    uint16_t reg_pair_addr = combine_immediates(reg_1_val, reg_2_val);
-    state->a = state->memory[reg_pair_addr];
+/**
+ * @brief Proportional set size of the process in KB, which splits each page shared between
+ *  mappings evenly between them, so pages shared by many states add up to one copy.
+ */
+static long proportional_kb() {
+    FILE* file = fopen("/proc/self/smaps_rollup", "r");
+    if (file == NULL) {
+        return -1;
+    }
+    char line[256];
+    long kb = -1;
+    while (fgets(line, sizeof(line), file) != NULL && sscanf(line, "Pss: %ld", &kb) != 1);
+    fclose(file);
+    return kb;
 }
 
-void stax(State8080* state, uint8_t reg_1_val, uint8_t reg_2_val) {
-    uint16_t addr = combine_immediates(reg_1_val, reg_2_val);
-    state->memory[addr] = state->a;
-}
+/**
+ * @brief Runs instances of the machine from the loaded ROM side by side, all kept alive until
+ *  the end, and measures how much memory they took.
+ * 
+ * @param emulator 
+ * @param image Image to share, or NULL for a private 64KB of memory each
+ * @param memory_hash Set to the hash of the first instance's memory at the end
+ * @return double KB per instance, or -1 if the memory can't be measured
+ */
+static double measure_instances(Emulator* emulator, MemoryImage* image, uint64_t* memory_hash) {
+    Options* options = emulator->options;
+    int count = options->instances;
+    State8080** states = malloc(count * sizeof(State8080*));
+    Invaders** machines = malloc(count * sizeof(Invaders*));
 
-#pragma endregion
+    long before = proportional_kb();
+    int i;
+    for (i = 0; i < count; i++) {
+        if (image != NULL) {
+            states[i] = init_8080_shared(image);
+            if (states[i] == NULL) {
+                printf("\nError: Could not map the memory image\n");
+                exit(1);
+            }
+        }
+        else {
+            states[i] = init_8080();
+            memcpy(states[i]->memory, emulator->state->memory, options->rom_size);
+        }
+        machines[i] = invaders_create(states[i]);
+        machines[i]->superinstructions = !options->no_superinstructions;
+        machines[i]->idle_skipping = !options->no_idle_skipping;
 
-#pragma region Branch Operations
+        uint64_t frame;
+        for (frame = 0; frame < options->frames; frame++) {
+            invaders_run_frame(machines[i]);
+        }
+        if (i == 0) {
+            *memory_hash = hash64(states[0]->memory, 0x10000, 0);
+        }
+    }
+    long after = proportional_kb();
 
-void jmp(State8080* state, unsigned char* opcode) {
-    // Combine the next 2 bytes into an address and assign the program counter to it.
-    state->pc = combine_immediates(opcode[2], opcode[1]);
-    state->pc -= 1;
+    for (i = 0; i < count; i++) {
+        invaders_free(machines[i]);
+        free_8080(states[i]);
+    }
+    free(machines);
+    free(states);
+    return before < 0 || after < 0 ? -1 : (double)(after - before) / count;
 }
 
-void call(State8080* state, unsigned char* opcode) {
-    // The return address is the next instruction. Since CALL is a 3 byte instruction, the next
-    // instruction is 2 bytes away (remember state->pc is incremented after each operation, which
-    // is why we're adding 2 instead of 3 to get to the next instruction.)
-    uint16_t ret_address = state->pc + 2;
-
-    // Push the address of the next instruction onto the stack
-    state->memory[state->sp - 1] = (ret_address >> 8) & 0xff;
-    state->memory[state->sp - 2] = ret_address & 0xff;
-    state->sp -= 2;
-
-    // Jump to the address
-    jmp(state, opcode);
-}
+/**
+ * @brief Compares the memory taken by instances with private memory against instances sharing
+ *  an image of the ROM, and reports both per 1,000 instances.
+ * 
+ * @param emulator 
+ */
+void run_instances(Emulator* emulator) {
+    Options* options = emulator->options;
+    MemoryImage* image = create_memory_image(emulator->state);
+    if (image == NULL) {
+        printf("\nError: Could not create the memory image\n");
+        exit(1);
+    }
 
-void ret(State8080* state) {
-    // Assign the program counter to the address at the top of the stack, then move the stack
-    // pointer back down to "pop" it.
-    state->pc = combine_immediates(state->memory[state->sp + 1], state->memory[state->sp]);
-    state->sp += 2;
+    uint64_t private_hash, shared_hash;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    double private_kb = measure_instances(emulator, NULL, &private_hash);
+    double private_seconds = elapsed_seconds(&start);
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    double shared_kb = measure_instances(emulator, image, &shared_hash);
+    double shared_seconds = elapsed_seconds(&start);
+    release_memory_image(image);
+
+    if (private_kb < 0 || shared_kb < 0) {
+        printf("\nError: Could not read /proc/self/smaps_rollup\n");
+        exit(1);
+    }
+    printf("%d instances of %llu frames, memory per 1,000 instances:\n", options->instances,
+        (unsigned long long)options->frames);
+    printf("  private: %.1f MB (%.1f KB each) in %.3f s\n", private_kb, private_kb,
+        private_seconds);
+    printf("  shared:  %.1f MB (%.1f KB each) in %.3f s\n", shared_kb, shared_kb,
+        shared_seconds);
+    printf("Final memory %s\n", private_hash == shared_hash ? "matches" : "differs");
 }
 
-#pragma endregion
-
-#pragma region Stack Operations
-
-void push(State8080* state, uint8_t* reg_1, uint8_t* reg_2) {
-    state->memory[state->sp - 1] = *reg_1;
-    state->memory[state->sp - 2] = *reg_2;
-    state->sp -= 2;
-}
+/**
+ * @brief A machine forked from the snapshot, with its own input script.
+ */
+typedef struct Child {
+    char* script_path;
+    InputScript* script;
+    uint64_t frame;
+    uint64_t registers_hash;
+    uint64_t memory_hash;
+    uint64_t fork_nanoseconds;
+} Child;
+
+typedef struct Children {
+    Snapshot* snapshot;
+    Child* children;
+    int count;
+    atomic_int next;
+    uint64_t frames;
+} Children;
+
+static void* child_thread(void* arg) {
+    Children* children = arg;
+    int i;
+    while ((i = atomic_fetch_add(&children->next, 1)) < children->count) {
+        Child* child = &children->children[i];
+        struct timespec start;
+        clock_gettime(CLOCK_MONOTONIC, &start);
+        Invaders* invaders = snapshot_fork(children->snapshot);
+        child->fork_nanoseconds = elapsed_seconds(&start) * 1e9;
+        if (invaders == NULL) {
+            printf("\nError: Could not map the snapshot\n");
+            exit(1);
+        }
 
-void pop(State8080* state, uint8_t* reg_1, uint8_t* reg_2) {
-    *reg_1 = state->memory[state->sp + 1];
-    *reg_2 = state->memory[state->sp];
-    state->sp += 2;
+        invaders_set_script(invaders, child->script);
+        while (invaders->frame < children->frames) {
+            invaders_run_frame(invaders);
+        }
+        child->frame = invaders->frame;
+        child->registers_hash = hash_registers(invaders->state);
+        child->memory_hash = hash64(invaders->state->memory, 0x10000, 0);
+        snapshot_free_fork(invaders);
+    }
+    return NULL;
 }
 
-#pragma endregion
-
-#pragma region Main Operation Emulation Switch Case
-
-void emulate_op(State8080* state) {
-    uint8_t* opcode = &state->memory[state->pc];
-    printf("0x%02x -> ", *opcode);
-
-    uint16_t addr_offset;
-    uint16_t value;
-
-    switch(*opcode) {
-        case 0x00: break;                                   // NOP
-        case 0x01:                                          // LXI B,2-byte-immediate
-            lxi(state, &state->b, &state->c, opcode); 
-            break;
-        case 0x02: unimplemented_op_error(state); break;
-        case 0x03: inx(state, &state->b, &state->c); break; // INX B
-        case 0x04: inr(state, &state->b); break;            // INR B
-        case 0x05: dcr(state, &state->b); break;            // DCR B
-        case 0x06: mvi(state, &state->b, opcode[1]); break; // MVI B,1-byte-imeddiate
-        case 0x07: unimplemented_op_error(state); break;
-        case 0x08: unimplemented_op_error(state); break;
-        case 0x09:                                          // DAD B
-            value = combine_immediates(state->b, state->c);
-            dad(state, value);
-            break;
-        case 0x0a: ldax(state, state->b, state->c); break;  // LDAX B
-        case 0x0b: dcx(state, &state->b, &state->c); break; // DCX B
-        case 0x0c: inr(state, &state->c); break;            // INR C
-        case 0x0d: dcr(state, &state->c); break;            // DCR C
-        case 0x0e: mvi(state, &state->c, opcode[1]); break; // MVI C,1-byte-imeddiate
-        case 0x0f: rrc(state); break;                       // RRC
-
-        case 0x10: unimplemented_op_error(state); break;
-        case 0x11:                                          // LXI D,2-byte-immediate
-            lxi(state, &state->d, &state->e, opcode); 
-            break;
-        case 0x12: unimplemented_op_error(state); break;
-        case 0x13: inx(state, &state->d, &state->e); break; // INX D
-        case 0x14: inr(state, &state->d); break;            // INR D
-        case 0x15: dcr(state, &state->d); break;            // DCR D
-        case 0x16: mvi(state, &state->d, opcode[1]); break; // MVI D,1-byte-imeddiate
-        case 0x17: unimplemented_op_error(state); break;
-        case 0x18: unimplemented_op_error(state); break;
-        case 0x19:                                          // DAD D
-            value = combine_immediates(state->d, state->e);
-            dad(state, value);
-            break;
-        case 0x1a: ldax(state, state->d, state->e); break;  // LDAX D
-        case 0x1b: dcx(state, &state->d, &state->e); break; // DCX D
-        case 0x1c: inr(state, &state->e); break;            // INR E
-        case 0x1d: dcr(state, &state->e); break;            // DCR E
-        case 0x1e: mvi(state, &state->e, opcode[1]); break; // MVI E,1-byte-imeddiate
-        case 0x1f: unimplemented_op_error(state); break;
-
-        case 0x20: unimplemented_op_error(state); break;
-        case 0x21:                                          // LXI H,2-byte-immediate
-            lxi(state, &state->h, &state->l, opcode); 
-            break;
-        case 0x22: unimplemented_op_error(state); break;
-        case 0x23: inx(state, &state->h, &state->l); break;   // INX H
-        case 0x24: inr(state, &state->h); break;            // INR H
-        case 0x25: dcr(state, &state->h); break;            // DCR H
-        case 0x26: mvi(state, &state->h, opcode[1]); break; // MVI H,1-byte-imeddiate
-        case 0x27: unimplemented_op_error(state); break;
-        case 0x28: unimplemented_op_error(state); break;
-        case 0x29:                                          // DAD H
-            value = combine_immediates(state->h, state->l);
-            dad(state, value);
-            break;
-        case 0x2a: unimplemented_op_error(state); break;
-        case 0x2b: dcx(state, &state->h, &state->l); break; // DCX H
-        case 0x2c: inr(state, &state->l); break;            // INR L
-        case 0x2d: dcr(state, &state->l); break;            // DCR L
-        case 0x2e: mvi(state, &state->l, opcode[1]); break; // MVI L,1-byte-imeddiate
-        case 0x2f: unimplemented_op_error(state); break;
-
-        case 0x30: unimplemented_op_error(state); break;
-        case 0x31:                                          // LXI SP,2-byte-immediate
-            state->sp = combine_immediates(opcode[2], opcode[1]);
-            state->pc += 2;
-            break;
-        case 0x32:                                          // STA 2-byte-immediate
-            stax(state, opcode[2], opcode[1]);
-            state->pc += 2;
-            break;
-        case 0x33: state->sp++; break;       // INX SP
-        case 0x34:                                          // INR M
-            addr_offset = combine_immediates(state->h, state->l);
-            inr(state, &state->memory[addr_offset]);
-            break;
-        case 0x35:                                          // DCR M
-            addr_offset = combine_immediates(state->h, state->l);
-            dcr(state, &state->memory[addr_offset]);
-            break;
-        case 0x36:                                          // MVI M,1-byte-imeddiate
-            addr_offset = combine_immediates(state->h, state->l);
-            mvi(state, &state->memory[addr_offset], opcode[1]);
-            break;
-        case 0x37: unimplemented_op_error(state); break;
-        case 0x38: unimplemented_op_error(state); break;
-        case 0x39:                                          // DAD SP
-            dad(state, state->sp);
-            break;
-        case 0x3a:                                          // LDAX 2-byte-immediate
-             ldax(state, opcode[2], opcode[1]);
-             state->pc += 2;
-             break;
-        case 0x3b: state->sp--; break;                      // DCX B
-        case 0x3c: inr(state, &state->a); break;            // INR A
-        case 0x3d: dcr(state, &state->a); break;            // DCR A
-        case 0x3e: mvi(state, &state->a, opcode[1]); break; // MVI A,1-byte-imeddiate
-        case 0x3f: unimplemented_op_error(state); break;
-
-        case 0x40: mov(state, &state->b, &state->b); break; // MOV B,B
-        case 0x41: mov(state, &state->b, &state->c); break; // MOV B,C
-        case 0x42: mov(state, &state->b, &state->d); break; // MOV B,D
-        case 0x43: mov(state, &state->b, &state->e); break; // MOV B,E
-        case 0x44: mov(state, &state->b, &state->h); break; // MOV B,H
-        case 0x45: mov(state, &state->b, &state->l); break; // MOV B,L
-        case 0x46:                                          // MOV B,M
-            addr_offset = combine_immediates(state->h, state->l);
-            mov(state, &state->b, &state->memory[addr_offset]);
-            break;
-        case 0x47: mov(state, &state->b, &state->a); break; // MOV B,A
-        case 0x48: mov(state, &state->c, &state->b); break; // MOV C,B
-        case 0x49: mov(state, &state->c, &state->c); break; // MOV C,C
-        case 0x4a: mov(state, &state->c, &state->d); break; // MOV C,D
-        case 0x4b: mov(state, &state->c, &state->e); break; // MOV C,E
-        case 0x4c: mov(state, &state->c, &state->h); break; // MOV C,H
-        case 0x4d: mov(state, &state->c, &state->l); break; // MOV C,L
-        case 0x4e:                                          // MOV C,M
-            addr_offset = combine_immediates(state->h, state->l);
-            mov(state, &state->c, &state->memory[addr_offset]);
-            break;
-        case 0x4f: mov(state, &state->c, &state->a); break; // MOV C,A
-
-        case 0x50: mov(state, &state->d, &state->b); break; // MOV D,B
-        case 0x51: mov(state, &state->d, &state->c); break; // MOV D,C
-        case 0x52: mov(state, &state->d, &state->d); break; // MOV D,D
-        case 0x53: mov(state, &state->d, &state->e); break; // MOV D,E
-        case 0x54: mov(state, &state->d, &state->h); break; // MOV D,H
-        case 0x55: mov(state, &state->d, &state->l); break; // MOV D,L
-        case 0x56:                                          // MOV D,M
-            addr_offset = combine_immediates(state->h, state->l);
-            mov(state, &state->d, &state->memory[addr_offset]);
-            break;
-        case 0x57: mov(state, &state->d, &state->a); break; // MOV D,A
-        case 0x58: mov(state, &state->e, &state->b); break; // MOV E,B
-        case 0x59: mov(state, &state->e, &state->c); break; // MOV E,C
-        case 0x5a: mov(state, &state->e, &state->d); break; // MOV E,D
-        case 0x5b: mov(state, &state->e, &state->e); break; // MOV E,E
-        case 0x5c: mov(state, &state->e, &state->h); break; // MOV E,H
-        case 0x5d: mov(state, &state->e, &state->l); break; // MOV E,L
-        case 0x5e:                                          // MOV E,M
-            addr_offset = combine_immediates(state->h, state->l);
-            mov(state, &state->e, &state->memory[addr_offset]);
-            break;
-        case 0x5f: mov(state, &state->e, &state->a); break; // MOV E,A
-
-        case 0x60: mov(state, &state->h, &state->b); break; // MOV H,B
-        case 0x61: mov(state, &state->h, &state->c); break; // MOV H,C
-        case 0x62: mov(state, &state->h, &state->d); break; // MOV H,D
-        case 0x63: mov(state, &state->h, &state->e); break; // MOV H,E
-        case 0x64: mov(state, &state->h, &state->h); break; // MOV H,H
-        case 0x65: mov(state, &state->h, &state->l); break; // MOV H,L
-        case 0x66:                                          // MOV H,M
-            addr_offset = combine_immediates(state->h, state->l);
-            mov(state, &state->h, &state->memory[addr_offset]);
-            break;
-        case 0x67: mov(state, &state->h, &state->a); break; // MOV H,A
-        case 0x68: mov(state, &state->l, &state->b); break; // MOV L,B
-        case 0x69: mov(state, &state->l, &state->c); break; // MOV L,C
-        case 0x6a: mov(state, &state->l, &state->d); break; // MOV L,D
-        case 0x6b: mov(state, &state->l, &state->e); break; // MOV L,E
-        case 0x6c: mov(state, &state->l, &state->h); break; // MOV L,H
-        case 0x6d: mov(state, &state->l, &state->l); break; // MOV L,L
-        case 0x6e:                                          // MOV L,M
-            addr_offset = combine_immediates(state->h, state->l);
-            mov(state, &state->l, &state->memory[addr_offset]);
-            break;
-        case 0x6f: mov(state, &state->l, &state->a); break; // MOV L,A
-
-        case 0x70:                                          // MOV M,B
-            addr_offset = combine_immediates(state->h, state->l);
-            mov(state, &state->memory[addr_offset], &state->b);
-            break;
-        case 0x71:                                          // MOV M,C
-            addr_offset = combine_immediates(state->h, state->l);
-            mov(state, &state->memory[addr_offset], &state->c);
-            break;
-        case 0x72:                                          // MOV M,D
-            addr_offset = combine_immediates(state->h, state->l);
-            mov(state, &state->memory[addr_offset], &state->d);
-            break;
-        case 0x73:                                          // MOV M,E
-            addr_offset = combine_immediates(state->h, state->l);
-            mov(state, &state->memory[addr_offset], &state->e);
-            break;
-        case 0x74:                                          // MOV M,H
-            addr_offset = combine_immediates(state->h, state->l);
-            mov(state, &state->memory[addr_offset], &state->h);
-            break;
-        case 0x75:                                          // MOV M,L
-            addr_offset = combine_immediates(state->h, state->l);
-            mov(state, &state->memory[addr_offset], &state->l);
-            break;
-        case 0x76: unimplemented_op_error(state); break;
-        case 0x77:                                          // MOV M,A
-            addr_offset = combine_immediates(state->h, state->l);
-            mov(state, &state->memory[addr_offset], &state->a);
-            break;
-        case 0x78: mov(state, &state->a, &state->b); break; // MOV A,B
-        case 0x79: mov(state, &state->a, &state->c); break; // MOV A,C
-        case 0x7a: mov(state, &state->a, &state->d); break; // MOV A,D
-        case 0x7b: mov(state, &state->a, &state->e); break; // MOV A,E
-        case 0x7c: mov(state, &state->a, &state->h); break; // MOV A,H
-        case 0x7d: mov(state, &state->a, &state->l); break; // MOV A,L
-        case 0x7e:                                          // MOV A,M
-            addr_offset = combine_immediates(state->h, state->l);
-            mov(state, &state->a, &state->memory[addr_offset]);
-            break;
-        case 0x7f: mov(state, &state->a, &state->a); break; // MOV A,A
-
-        case 0x80: add(state, state->b); break;     // ADD B
-        case 0x81: add(state, state->c); break;     // ADD C
-        case 0x82: add(state, state->d); break;     // ADD D
-        case 0x83: add(state, state->e); break;     // ADD E
-        case 0x84: add(state, state->h); break;     // ADD H
-        case 0x85: add(state, state->l); break;     // ADD L
-        case 0x86:                                  // ADD M
-            addr_offset = combine_immediates(state->h, state->l);
-            add(state, state->memory[addr_offset]);
-            break;
-        case 0x87: add(state, state->a); break;     // ADD A
-        case 0x88: adc(state, state->b); break;     // ADC B
-        case 0x89: adc(state, state->c); break;     // ADC C
-        case 0x8a: adc(state, state->d); break;     // ADC D
-        case 0x8b: adc(state, state->e); break;     // ADC E
-        case 0x8c: adc(state, state->h); break;     // ADC H
-        case 0x8d: adc(state, state->l); break;     // ADC L
-        case 0x8e:                                  // ADC M
-            addr_offset = combine_immediates(state->h, state->l);
-            adc(state, state->memory[addr_offset]);
-            break;
-        case 0x8f: adc(state, state->a); break;     // ADC A
-
-        case 0x90: sub(state, state->b); break;     // SUB B
-        case 0x91: sub(state, state->c); break;     // SUB C
-        case 0x92: sub(state, state->d); break;     // SUB D
-        case 0x93: sub(state, state->e); break;     // SUB E
-        case 0x94: sub(state, state->h); break;     // SUB H
-        case 0x95: sub(state, state->l); break;     // SUB L
-        case 0x96:                                  // SUB M
-            addr_offset = combine_immediates(state->h, state->l);
-            sub(state, state->memory[addr_offset]);
-            break;
-        case 0x97: sub(state, state->a); break;     // SUB A
-        case 0x98: sbb(state, state->b); break;     // SBB B
-        case 0x99: sbb(state, state->c); break;     // SBB C
-        case 0x9a: sbb(state, state->d); break;     // SBB D
-        case 0x9b: sbb(state, state->e); break;     // SBB E
-        case 0x9c: sbb(state, state->h); break;     // SBB H
-        case 0x9d: sbb(state, state->l); break;     // SBB L
-        case 0x9e:                                  // SBB M
-            addr_offset = combine_immediates(state->h, state->l);
-            sbb(state, state->memory[addr_offset]);
-            break;
-        case 0x9f: sbb(state, state->a); break;     // SBB A
-
-        case 0xa0: ana(state, state->b);            // ANA B
-        case 0xa1: ana(state, state->c);            // ANA C
-        case 0xa2: ana(state, state->d);            // ANA D
-        case 0xa3: ana(state, state->e);            // ANA E
-        case 0xa4: ana(state, state->h);            // ANA H
-        case 0xa5: ana(state, state->l);            // ANA L
-        case 0xa6:                                  // ANA M
-            addr_offset = combine_immediates(state->h, state->l);
-            ana(state, state->memory[addr_offset]);
-            break;
-        case 0xa7: ana(state, state->a);            // ANA A
-        case 0xa8: xra(state, state->b);            // XRA B
-        case 0xa9: xra(state, state->c);            // XRA C
-        case 0xaa: xra(state, state->d);            // XRA D
-        case 0xab: xra(state, state->e);            // XRA E
-        case 0xac: xra(state, state->h);            // XRA H
-        case 0xad: xra(state, state->l);            // XRA L
-        case 0xae:                                  // XRA M
-            addr_offset = combine_immediates(state->h, state->l);
-            xra(state, state->memory[addr_offset]);
-            break;
-        case 0xaf: xra(state, state->a);            // XRA A
-
-        case 0xb0: ora(state, state->b);            // ORA B
-        case 0xb1: ora(state, state->c);            // ORA C
-        case 0xb2: ora(state, state->d);            // ORA D
-        case 0xb3: ora(state, state->e);            // ORA E
-        case 0xb4: ora(state, state->h);            // ORA H
-        case 0xb5: ora(state, state->l);            // ORA L
-        case 0xb6:                                  // ORA M
-            addr_offset = combine_immediates(state->h, state->l);
-            ora(state, state->memory[addr_offset]);
-            break;
-        case 0xb7: ora(state, state->l);            // ORA L
-        case 0xb8: unimplemented_op_error(state); break;
-        case 0xb9: unimplemented_op_error(state); break;
-        case 0xba: unimplemented_op_error(state); break;
-        case 0xbb: unimplemented_op_error(state); break;
-        case 0xbc: unimplemented_op_error(state); break;
-        case 0xbd: unimplemented_op_error(state); break;
-        case 0xbe: unimplemented_op_error(state); break;
-        case 0xbf: unimplemented_op_error(state); break;
-
-        case 0xc0: unimplemented_op_error(state); break;
-        case 0xc1: pop(state, &state->b, &state->c); break;     // POP B
-        case 0xc2:                                              // JNZ address
-            if (state->codes.z == 0) {
-                jmp(state, opcode);
-            }
-            else {
-                state->pc += 2;
-            }
-            break;
-        case 0xc3: jmp(state, opcode); break;                   // JMP address
-        case 0xc4: unimplemented_op_error(state); break;
-        case 0xc5: push(state, &state->b, &state->c); break;    // PUSH B
-        case 0xc6: add(state, opcode[1]); state->pc++; break;   // ADI 1-byte-immediate
-        case 0xc7: unimplemented_op_error(state); break;
-        case 0xc8: unimplemented_op_error(state); break;
-        case 0xc9: ret(state); break;                           // RET
-        case 0xca:                                              // JZ address
-            if (state->codes.z != 0) {
-                jmp(state, opcode);
-            }
-            else {
-                state->pc += 2;
-            }
-            break;
-        case 0xcb: unimplemented_op_error(state); break;
-        case 0xcc: unimplemented_op_error(state); break;
-        case 0xcd: call(state, opcode); break;
-        case 0xce: adc(state, opcode[1]); state->pc++; break;   // ACI 1-byte-immediate
-        case 0xcf: unimplemented_op_error(state); break;
-
-        case 0xd0: unimplemented_op_error(state); break;
-        case 0xd1: pop(state, &state->d, &state->e); break;     // POP D
-        case 0xd2:                                              // JNC address
-            if (state->codes.cy == 0) {
-                jmp(state, opcode);
-            }
-            else {
-                state->pc += 2;
-            }
-            break;
-        case 0xd3: /*TODO*/ state->pc++; break;                 // OUT 1-byte-immediate
-        case 0xd4: unimplemented_op_error(state); break;
-        case 0xd5: push(state, &state->d, &state->e); break;    // PUSH D
-        case 0xd6: sub(state, opcode[1]); state->pc++; break;   // SUI 1-byte-immediate
-        case 0xd7: unimplemented_op_error(state); break;
-        case 0xd8: unimplemented_op_error(state); break;
-        case 0xd9: unimplemented_op_error(state); break;
-        case 0xda:                                              // JC address
-            if (state->codes.cy != 0) {
-                jmp(state, opcode);
-            }
-            else {
-                state->pc += 2;
-            }
-            break;
-        case 0xdb: unimplemented_op_error(state); break;
-        case 0xdc: unimplemented_op_error(state); break;
-        case 0xdd: unimplemented_op_error(state); break;
-        case 0xde: unimplemented_op_error(state); break;
-        case 0xdf: unimplemented_op_error(state); break;
-
-        case 0xe0: unimplemented_op_error(state); break;
-        case 0xe1: pop(state, &state->h, &state->l); break;     // POP H
-        case 0xe2:                                              // JPO address
-            if (state->codes.p == 0) {
-                jmp(state, opcode);
-            }
-            else {
-                state->pc += 2;
-            }
-            break;
-        case 0xe3: unimplemented_op_error(state); break;
-        case 0xe4: unimplemented_op_error(state); break;
-        case 0xe5: push(state, &state->h, &state->l); break;    // PUSH H
-        case 0xe6: ana(state, opcode[1]); state->pc++; break;   // ANA 1-byte-immediate
-        case 0xe7: unimplemented_op_error(state); break;
-        case 0xe8: unimplemented_op_error(state); break;
-        case 0xe9: unimplemented_op_error(state); break;
-        case 0xea:                                              // JPE address
-            if (state->codes.p != 0) {
-                jmp(state, opcode);
-            }
-            else {
-                state->pc += 2;
-            }
-            break;
-        case 0xeb:                                              // XCHG
-            value = state->d;
-            state->d = state->h;
-            state->h = (uint8_t)value;
-            value = state->e;
-            state->e = state->l;
-            state->l = (uint8_t)value;
-            break;
-        case 0xec: unimplemented_op_error(state); break;
-        case 0xed: unimplemented_op_error(state); break;
-        case 0xee: unimplemented_op_error(state); break;
-        case 0xef: unimplemented_op_error(state); break;
-
-        case 0xf0: unimplemented_op_error(state); break;
-        case 0xf1:                                          // POP PSW
-            value = state->memory[state->sp];
-            state->codes.z = (value & 0b1) != 0;
-            state->codes.s = (value & 0b10) != 0;
-            state->codes.p = (value & 0b100) != 0;
-            state->codes.cy = (value & 0b1000) != 0;
-            state->codes.ac = (value & 0b10000) != 0;
-            state->a = state->memory[state->sp + 1];
-            state->sp += 2;
-            break;
-        case 0xf2:                                          // JP address
-            if (state->codes.s == 0) {
-                jmp(state, opcode);
-            }
-            else {
-                state->pc += 2;
-            }
-            break;
-        case 0xf3: unimplemented_op_error(state); break;
-        case 0xf4: unimplemented_op_error(state); break;
-        case 0xf5:                                          // PUSH PSW
-            value = (state->codes.z |
-                state->codes.s << 1 |
-                state->codes.p << 2 |
-                state->codes.cy << 3 |
-                state->codes.ac << 4);
-            push(state, &state->a, (uint8_t*)&value);
-            break;
-        case 0xf6: unimplemented_op_error(state); break;
-        case 0xf7: unimplemented_op_error(state); break;
-        case 0xf8: unimplemented_op_error(state); break;
-        case 0xf9: unimplemented_op_error(state); break;
-        case 0xfa:                                          // JM address
-            if (state->codes.s != 0) {
-                jmp(state, opcode);
-            }
-            else {
-                state->pc += 2;
-            }
-            break;
-        case 0xfb: state->int_enable = 1; break;            // EI
-        case 0xfc: unimplemented_op_error(state); break;
-        case 0xfd: unimplemented_op_error(state); break;
-        case 0xfe: cpi(state, opcode[1]); break;            // CPI 1-byte-immediate
-        case 0xff: unimplemented_op_error(state); break;
-
-        default: unimplemented_op_error(state); break;
+/**
+ * @brief Loads the input scripts listed in a file, one path per line.
+ */
+static Child* load_children(const char* path, int* count) {
+    FILE* list = fopen(path, "r");
+    if (list == NULL) {
+        printf("\nError: Could not open %s\n", path);
+        exit(1);
     }
 
-    state->pc += 1;
+    Child* children = NULL;
+    int capacity = 0;
+    char line[1024];
+    *count = 0;
+    while (fgets(line, sizeof(line), list) != NULL) {
+        line[strcspn(line, "\r\n")] = '\0';
+        if (line[0] == '\0' || line[0] == '#') {
+            continue;
+        }
+        if (*count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            children = realloc(children, capacity * sizeof(Child));
+        }
+        Child* child = &children[(*count)++];
+        memset(child, 0, sizeof(Child));
+        child->script_path = strdup(line);
+        child->script = input_script_load(line);
+        if (child->script == NULL) {
+            printf("\nError: Could not load input script %s\n", line);
+            exit(1);
+        }
+    }
+    fclose(list);
+    return children;
 }
 
-#pragma endregion
+/**
+ * @brief Runs a machine to the snapshot point (-K): a cycle count, or the first time pc gets
+ *  to an address. Exits if the address isn't reached within -f frames.
+ * 
+ * @param emulator 
+ * @return Invaders* The machine, stopped at the point
+ */
+Invaders* run_to_snapshot_point(Emulator* emulator) {
+    Options* options = emulator->options;
+    uint64_t cycle_limit = emulator->state->cycles + options->frames * CPU_HZ / FPS;
+    int32_t breakpoint = -1;
+    char* point = options->snapshot_point != NULL ? options->snapshot_point : "0";
+    if (strncmp(point, "pc=", 3) == 0) {
+        breakpoint = strtol(&point[3], NULL, 16) & 0xffff;
+    }
+    else {
+        cycle_limit = emulator->state->cycles + strtoull(point, NULL, 10);
+    }
 
-#pragma region Emulator Initialization
+    Invaders* invaders = invaders_create(emulator->state);
+    invaders->superinstructions = !options->no_superinstructions;
+    invaders->idle_skipping = !options->no_idle_skipping;
+    if (!invaders_run_until(invaders, cycle_limit, breakpoint) && breakpoint >= 0) {
+        printf("\nError: pc never reached 0x%04x before frame %llu\n", breakpoint,
+            (unsigned long long)options->frames);
+        exit(1);
+    }
+    return invaders;
+}
 
 /**
- * @brief Initializes an 8080 state with 64kb memory allocated.
+ * @brief Runs the machine to the snapshot point (-K), freezes it, then forks a child from it for
+ *  every input script in the list (-k) and runs them all to frame -f on a pool of threads.
  * 
- * @return State8080* 
+ * @param emulator 
  */
-State8080* init_8080() {
-    // Initializing 8080 state and allocating 64kb of memory
-    State8080* state = calloc(1, sizeof(State8080));
-    state->memory = malloc(0x10000);
-    return state;
+void run_children(Emulator* emulator) {
+    Options* options = emulator->options;
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    Invaders* invaders = run_to_snapshot_point(emulator);
+    Snapshot* snapshot = snapshot_take(invaders);
+    double boot_seconds = elapsed_seconds(&start);
+    if (snapshot == NULL) {
+        printf("\nError: Could not create the memory image\n");
+        exit(1);
+    }
+    printf("Snapshot at frame %llu, cycle %llu, pc 0x%04x after %.3f s\n",
+        (unsigned long long)invaders->frame, (unsigned long long)emulator->state->cycles,
+        emulator->state->pc, boot_seconds);
+    invaders_free(invaders);
+
+    Children children = { 0 };
+    children.snapshot = snapshot;
+    children.frames = options->frames;
+    children.children = load_children(options->children_path, &children.count);
+    atomic_init(&children.next, 0);
+
+    int threads = options->threads > 0 ? options->threads : sysconf(_SC_NPROCESSORS_ONLN);
+    pthread_t* workers = malloc(threads * sizeof(pthread_t));
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    int i;
+    for (i = 0; i < threads; i++) {
+        pthread_create(&workers[i], NULL, child_thread, &children);
+    }
+    for (i = 0; i < threads; i++) {
+        pthread_join(workers[i], NULL);
+    }
+    double seconds = elapsed_seconds(&start);
+
+    uint64_t fork_nanoseconds = 0;
+    for (i = 0; i < children.count; i++) {
+        Child* child = &children.children[i];
+        printf("%s: frame %llu, registers %016llx, memory %016llx\n", child->script_path,
+            (unsigned long long)child->frame, (unsigned long long)child->registers_hash,
+            (unsigned long long)child->memory_hash);
+        fork_nanoseconds += child->fork_nanoseconds;
+        input_script_free(child->script);
+        free(child->script_path);
+    }
+    printf("Ran %d children on %d threads in %.3f s (%.0f children/s), %.1f us per fork\n",
+        children.count, threads, seconds, seconds > 0 ? children.count / seconds : 0.0,
+        children.count ? fork_nanoseconds / 1e3 / children.count : 0.0);
+
+    free(children.children);
+    free(workers);
+    snapshot_free(snapshot);
 }
 
 /**
- * @brief Reads a binary file into a state's memory.
+ * @brief Runs the machine to the snapshot point (-K), then explores every combination of the
+ *  buttons in -E for -f frames, breadth first, and reports how many distinct states there were.
  * 
- * @param state The 8080 state
- * @param filename Path to the file
- * @param offset The memory offset where the beginning of the file will start
- * @return uint16_t The size of the file that was read
+ * @param emulator 
  */
-uint16_t read_file_into_memory(State8080* state, char* filename, uint16_t offset) {
-    // Open the file and verify it's valid
-    FILE *file = fopen(filename, "rb");
+void run_explore(Emulator* emulator) {
+    Options* options = emulator->options;
+    char* buttons[EXPLORE_MAX_BUTTONS];
+    int button_count = 0;
+    char* list = strdup(options->explore_buttons);
+    char* name;
+    for (name = strtok(list, ","); name != NULL; name = strtok(NULL, ",")) {
+        if (button_count == EXPLORE_MAX_BUTTONS) {
+            printf("\nError: At most %d buttons can be explored\n", EXPLORE_MAX_BUTTONS);
+            exit(1);
+        }
+        buttons[button_count++] = name;
+    }
 
-    if (file == NULL) {
-        printf("\nError: Could not open %s\n", filename);
+    Invaders* invaders = run_to_snapshot_point(emulator);
+    printf("Exploring %d input combinations from frame %llu, cycle %llu, pc 0x%04x\n",
+        1 << button_count, (unsigned long long)invaders->frame,
+        (unsigned long long)emulator->state->cycles, emulator->state->pc);
+
+    int threads = options->threads > 0 ? options->threads : sysconf(_SC_NPROCESSORS_ONLN);
+    ExploreResult result;
+    if (explore(invaders, buttons, button_count, options->frames, options->explore_limit,
+            threads, stdout, &result) < 0) {
+        printf("\nError: Unknown button in %s\n", options->explore_buttons);
         exit(1);
     }
+    printf("%llu distinct states in %llu frames%s, %llu generated in %.3f s on %d threads "
+        "(%.0f states/s), %.1f%% duplicates, largest frontier %llu\n",
+        (unsigned long long)result.unique, (unsigned long long)result.frames,
+        result.truncated ? " (stopped at the state limit)" : "",
+        (unsigned long long)result.generated, result.seconds, threads,
+        result.seconds > 0 ? result.generated / result.seconds : 0.0,
+        result.generated ? 100.0 * result.duplicates / result.generated : 0.0,
+        (unsigned long long)result.peak_frontier);
+
+    invaders_free(invaders);
+    free(list);
+}
 
-    // Get the file size and read it into the memory buffer
-    fseek(file, 0L, SEEK_END);
-    uint16_t file_size = ftell(file);
-    fseek(file, 0L, SEEK_SET);
-
-    fread(&state->memory[offset], file_size, 1, file);
-    fclose(file);
+/**
+ * @brief Runs a CP/M program until it warm boots, with the console on stdin and stdout and the
+ *  disk images from -D mounted from A:.
+ * 
+ * @param emulator 
+ */
+void run_cpm(Emulator* emulator) {
+    State8080* state = emulator->state;
+    Options* options = emulator->options;
+    Cpm* cpm = cpm_create(state);
+    cpm->superinstructions = !options->no_superinstructions;
+    int i;
+    for (i = 0; i < options->disk_count; i++) {
+        if (cpm_mount(cpm, i, options->disk_paths[i]) < 0) {
+            printf("\nError: Could not use disk image %s\n", options->disk_paths[i]);
+            exit(1);
+        }
+    }
+    cpm_set_command_line(cpm, options->program_args, options->program_arg_count);
+    fflush(stdout);
+
+    // Nothing to hook into each operation, so let the machine run by itself.
+    int plain = emulator->profiler == NULL && emulator->debugger == NULL && !options->trace;
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (!cpm->exited && !finished(emulator)) {
+        if (plain) {
+            cpm_run(cpm, state->cycles + CPU_HZ);
+            if (emulator->metrics != NULL) {
+                metrics_update(emulator->metrics, state);
+            }
+        }
+        else {
+            run(emulator, UINT64_MAX, state->cycles + CPU_HZ);
+        }
+    }
+    double seconds = elapsed_seconds(&start);
+    cpm_flush(cpm);
 
-    // Set the program counter to the beginning of the rom
-    state->pc = offset;
+    if (cpm->message[0] != '\0') {
+        printf("\n%s\n", cpm->message);
+    }
+    printf("\nRan %llu instructions in %.3f s (%.1f MIPS), %llu BDOS and %llu BIOS calls\n",
+        (unsigned long long)state->instructions, seconds,
+        seconds > 0 ? state->instructions / seconds / 1e6 : 0.0,
+        (unsigned long long)cpm->bdos_calls, (unsigned long long)cpm->bios_calls);
+    cpm_free(cpm);
+}
 
-    return file_size;
+/**
+ * @brief Runs a bare ROM in frame-sized batches of cycles, so it can be paced like a machine.
+ * 
+ * @param emulator 
+ */
+void run_paced(Emulator* emulator) {
+    uint64_t op_limit = emulator->options->op_limit;
+    uint64_t frame = 0;
+    while (!finished(emulator) && emulator->opcounter < op_limit) {
+        frame++;
+        run(emulator, op_limit, frame * CPU_HZ / FPS);
+        if (emulator->metrics != NULL) {
+            metrics_set(&emulator->metrics->frames, frame);
+        }
+        pacer_wait(emulator->pacer);
+    }
 }
 
 #pragma endregion
 
+void print_usage() {
+    printf("Usage: emulator [options] <rom>...\n");
+    printf("  -q         Don't print the state after every operation\n");
+    printf("  -t         Print the state after every operation (the default without -m)\n");
+    printf("  -p report  Profile the program, writing a report sorted by cycles to the given\n");
+    printf("             file and a bitmap of every executed ROM byte to <report>.cov\n");
+    printf("  -d address Wait for a GDB remote protocol debugger on a localhost TCP port or a\n");
+    printf("             Unix socket path\n");
+    printf("  -m machine Run a whole machine instead of a bare ROM at 0x100. Machines:\n");
+    printf("             invaders  Space Invaders. The ROM files are loaded one after the\n");
+    printf("                       other from 0x0000 (invaders.h, .g, .f, .e)\n");
+    printf("             cpm       CP/M 2.2. The ROM is a .COM program, loaded at 0x100, and\n");
+    printf("                       the arguments after it are its command line\n");
+    printf("  -f frames  Number of frames to run a machine for (default 3600)\n");
+    printf("  -s script  Input script for the machine\n");
+    printf("  -o file    Write the machine's screen to a PBM file at the end\n");
+    printf("  -w file    Mix the machine's sound into a WAV file\n");
+    printf("  -a dir     Directory with the sound samples (default sounds)\n");
+    printf("  -v file    Capture the machine's screen every frame to a video file, as Y4M if\n");
+    printf("             the name ends in .y4m and as compressed video RAM otherwise\n");
+    printf("  -V policy  What video capture does when the encoder falls behind: wait for it\n");
+    printf("             (the default) or drop frames\n");
+    printf("  -x speed   Run in real time at the given speed (1 is real time, 2 twice as fast),\n");
+    printf("             or max to run flat out (the default)\n");
+    printf("  -l file    Write how late every frame was to a CSV file when running with -x\n");
+    printf("  -R log     Record the machine's inputs, interrupts and frame hashes to a log\n");
+    printf("  -P log     Replay a log, checking the state at every frame against it\n");
+    printf("  -L         Run the reference core in lockstep and stop at the first difference\n");
+    printf("  -U         Don't fuse common operation sequences into superinstructions\n");
+    printf("  -I         Don't fast-forward through idle loops and HLT\n");
+    printf("  -M address Serve live metrics over HTTP on a localhost TCP port or a Unix socket\n");
+    printf("             path, in Prometheus format at /metrics and as JSON at /metrics.json\n");
+    printf("  -J         Print a JSON summary of the metrics and final state at the end\n");
+    printf("  -K point   Where to snapshot the machine for -k or -E: a cycle count, or pc=<hex>\n");
+    printf("             for the first time pc gets there (default 0)\n");
+    printf("  -k list    Fork a child from the snapshot for every input script in the list file\n");
+    printf("             (one path per line) and run each to frame -f\n");
+    printf("  -j threads Threads to run the children or the exploration on (default all\n");
+    printf("             cores)\n");
+    printf("  -E buttons Explore every combination of these buttons (comma separated, named as\n");
+    printf("             in input scripts) frame by frame from the snapshot point for -f frames\n");
+    printf("  -e states  Stop exploring after this many distinct states (default 1000000)\n");
+    printf("  -C count   Run this many instances of the machine for -f frames each, first with\n");
+    printf("             private memory and then sharing unwritten pages, and compare the memory\n");
+    printf("             they take\n");
+    printf("  -D image   Mount a CP/M disk image on the next drive, from A: (8\" floppy or\n");
+    printf("             1-8MB hard disk). One that doesn't exist is created as a floppy\n");
+    printf("  -n ops     Stop a bare ROM after this many operations, 0 for no limit\n");
+    printf("             (default 50001)\n");
+}
+
 /**
  * @brief Main method where program starts.
  * 
@@ -831,33 +973,198 @@ uint16_t read_file_into_memory(State8080* state, char* filename, uint16_t offset
  * @return int Return code
  */
 int main(int argc, char** argv) {
-    if (argc <= 1) {
+    Options options = { 0 };
+    options.trace = -1;
+    options.frames = 3600;
+    options.sound_directory = "sounds";
+    options.op_limit = 50001;
+    options.explore_limit = 1000000;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "qtp:d:m:f:s:o:w:a:v:V:x:l:n:R:P:M:C:K:k:j:E:e:D:LUIJh")) != -1) {
+        switch (opt) {
+            case 'q': options.trace = 0; break;
+            case 't': options.trace = 1; break;
+            case 'p': options.profile_path = optarg; break;
+            case 'd': options.debugger_address = optarg; break;
+            case 'm': options.machine = optarg; break;
+            case 'f': options.frames = strtoull(optarg, NULL, 10); break;
+            case 's': options.script_path = optarg; break;
+            case 'o': options.screen_path = optarg; break;
+            case 'w': options.wav_path = optarg; break;
+            case 'a': options.sound_directory = optarg; break;
+            case 'v': options.video_path = optarg; break;
+            case 'V':
+                if (strcmp(optarg, "drop") != 0 && strcmp(optarg, "wait") != 0) {
+                    printf("Error: The video policy is drop or wait, not %s\n", optarg);
+                    exit(1);
+                }
+                options.drop_frames = strcmp(optarg, "drop") == 0;
+                break;
+            case 'x': options.speed = strcmp(optarg, "max") == 0 ? 0 : atof(optarg); break;
+            case 'l': options.lateness_path = optarg; break;
+            case 'n': options.op_limit = strtoull(optarg, NULL, 10); break;
+            case 'R': options.record_path = optarg; break;
+            case 'P': options.replay_path = optarg; break;
+            case 'L': options.lockstep = 1; break;
+            case 'U': options.no_superinstructions = 1; break;
+            case 'I': options.no_idle_skipping = 1; break;
+            case 'M': options.metrics_address = optarg; break;
+            case 'J': options.json_summary = 1; break;
+            case 'C': options.instances = atoi(optarg); break;
+            case 'K': options.snapshot_point = optarg; break;
+            case 'k': options.children_path = optarg; break;
+            case 'j': options.threads = atoi(optarg); break;
+            case 'E': options.explore_buttons = optarg; break;
+            case 'e': options.explore_limit = strtoull(optarg, NULL, 10); break;
+            case 'D':
+                if (options.disk_count == CPM_MAX_DISKS) {
+                    printf("Error: At most %d disk images can be mounted\n", CPM_MAX_DISKS);
+                    exit(1);
+                }
+                options.disk_paths[options.disk_count++] = optarg;
+                break;
+            default: print_usage(); exit(1);
+        }
+    }
+
+    if (optind >= argc) {
         printf("Please provide a ROM file as an argument.");
         exit(1);
     }
+    if (options.machine != NULL && strcmp(options.machine, "invaders") != 0 &&
+        strcmp(options.machine, "cpm") != 0) {
+        printf("Error: Unknown machine %s\n", options.machine);
+        exit(1);
+    }
+    int invaders = options.machine != NULL && strcmp(options.machine, "invaders") == 0;
+    int cpm = options.machine != NULL && strcmp(options.machine, "cpm") == 0;
+    if (!invaders && options.video_path != NULL) {
+        printf("Error: Video capture needs the invaders machine (-m invaders)\n");
+        exit(1);
+    }
+    if (!invaders && (options.record_path != NULL || options.replay_path != NULL)) {
+        printf("Error: Recording and replaying need the invaders machine (-m invaders)\n");
+        exit(1);
+    }
+    if (!invaders && (options.instances > 0 || options.children_path != NULL ||
+        options.explore_buttons != NULL)) {
+        printf("Error: Running instances, children or an exploration needs the invaders "
+            "machine (-m invaders)\n");
+        exit(1);
+    }
+    if (!cpm && options.disk_count > 0) {
+        printf("Error: Disk images need the CP/M machine (-m cpm)\n");
+        exit(1);
+    }
 
+    Emulator emulator = { 0 };
+    emulator.options = &options;
     State8080* state = init_8080();
-    uint16_t file_size = read_file_into_memory(state, argv[1], 0x100);
+    emulator.state = state;
+
+    if (options.machine == NULL) {
+        // A bare ROM loads at 0x100 and is finished once it runs off the end.
+        options.rom_start = 0x100;
+        options.rom_size = read_file_into_memory(state, argv[optind], options.rom_start);
+        options.end_address = options.rom_size;
+    }
+    else if (cpm) {
+        // A CP/M program loads at the start of the TPA, and the rest of the command line is
+        // its arguments. It's finished once it warm boots.
+        options.rom_start = CPM_TPA;
+        options.rom_size = read_file_into_memory(state, argv[optind], options.rom_start);
+        if (options.rom_start + options.rom_size > CPM_BDOS) {
+            printf("Error: %s doesn't fit in the TPA\n", argv[optind]);
+            exit(1);
+        }
+        options.program_args = &argv[optind + 1];
+        options.program_arg_count = argc - optind - 1;
+        options.end_address = CPM_EXIT;
+    }
+    else {
+        // A machine's ROM files are loaded back to back from 0x0000 and never finish by
+        // themselves.
+        int i;
+        for (i = optind; i < argc; i++) {
+            options.rom_size += read_file_into_memory(state, argv[i], options.rom_size);
+        }
+        options.end_address = 0x10000;
+    }
+    if (options.trace < 0) {
+        options.trace = options.machine == NULL;
+    }
+
+    if (options.profile_path != NULL) {
+        emulator.profiler = profiler_create();
+    }
     
     printf("Init -- ");
     print_state(state);
 
-    // Read through the buffer and emulate each operation.
-    unsigned int opcounter = 0;
-    while(state->pc < file_size) {
-        uint8_t cur_op = state->memory[state->pc];
-        printf("%04u -- ", opcounter);
-        emulate_op(state);
-        print_state(state);
+    if (options.debugger_address != NULL) {
+        emulator.debugger = debugger_create(options.debugger_address);
+        if (emulator.debugger == NULL) {
+            printf("\nError: Could not listen on %s\n", options.debugger_address);
+            exit(1);
+        }
+    }
+
+    if (options.metrics_address != NULL || options.json_summary) {
+        emulator.metrics = metrics_create(options.machine != NULL ? options.machine : "rom",
+            CPU_HZ, state);
+    }
+    if (options.metrics_address != NULL) {
+        if (metrics_serve(emulator.metrics, options.metrics_address) < 0) {
+            printf("\nError: Could not listen on %s\n", options.metrics_address);
+            exit(1);
+        }
+        printf("Serving metrics on %s\n", options.metrics_address);
+    }
 
-        opcounter++;
+    if (options.op_limit == 0) {
+        options.op_limit = UINT64_MAX;
+    }
+    if (options.speed < 0) {
+        printf("Error: The speed can't be negative\n");
+        exit(1);
+    }
+    emulator.pacer = pacer_create(FPS, options.speed);
 
-        if (opcounter > 50000) {
-            shutdown(state);
+    if (options.instances > 0) {
+        run_instances(&emulator);
+    }
+    else if (options.children_path != NULL) {
+        run_children(&emulator);
+    }
+    else if (options.explore_buttons != NULL) {
+        run_explore(&emulator);
+    }
+    else if (cpm) {
+        run_cpm(&emulator);
+    }
+    else if (invaders) {
+        run_invaders(&emulator);
+    }
+    else {
+        if (options.lockstep) {
+            emulator.lockstep = lockstep_create(state);
+        }
+        if (options.speed > 0) {
+            run_paced(&emulator);
+        }
+        else {
+            // Read through the buffer and emulate each operation.
+            run(&emulator, options.op_limit, UINT64_MAX);
+        }
+        if (emulator.lockstep != NULL) {
+            lockstep_write_report(emulator.lockstep, stdout);
+            lockstep_free(emulator.lockstep);
+            emulator.lockstep = NULL;
         }
     }
 
-    shutdown(state);
+    shutdown(&emulator);
 
     return 0;
-}
\ No newline at end of file
+}
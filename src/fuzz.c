@@ -0,0 +1,378 @@
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "lib/cpu8080.h"
+#include "lib/idle.h"
+#include "lib/lockstep.h"
+
+// Input layout: a header with the starting registers, then the program.
+#define FUZZ_HEADER_SIZE 12
+#define FUZZ_MAX_CYCLES 20000           // Cycles each input runs for
+#define FUZZ_INTERRUPT_CYCLES 1000      // How often an interrupt is raised, if the header asks
+#define FUZZ_MAX_OP_CYCLES 18           // XTHL, the slowest instruction
+
+/**
+ * @brief The instance every input runs on. It's allocated once and reset between inputs by
+ *  clearing only the memory pages the last run wrote.
+ */
+typedef struct Fuzzer {
+    State8080* state;
+    Lockstep* lockstep;         // NULL unless running differentially
+    State8080* fused;           // NULL unless checking superinstructions and idle skipping
+    IdleSkipper idle;
+    uint8_t input_counter;      // Makes IN return something different every time
+    int running;                // Set while an input runs, to catch a call to exit()
+} Fuzzer;
+
+static Fuzzer fuzzer;
+
+#pragma region Invariants
+
+/**
+ * @brief Reports a broken invariant and aborts, which the fuzzer records as a crash.
+ */
+static void fail(const char* message) {
+    fprintf(stderr, "Invariant broken: %s\n", message);
+    print_state(fuzzer.state);
+    abort();
+}
+
+static void exit_guard() {
+    if (fuzzer.running) {
+        fail("exit() was called while running an input");
+    }
+}
+
+static uint8_t fuzz_in(void* context, uint8_t port) {
+    (void)context;
+    return port ^ fuzzer.input_counter++;
+}
+
+#pragma endregion
+
+#pragma region Instance
+
+static void setup(int differential, int fused) {
+    fuzzer.state = init_8080();
+    fuzzer.state->port_in = fuzz_in;
+    if (differential) {
+        fuzzer.lockstep = lockstep_create(fuzzer.state);
+    }
+    if (fused) {
+        fuzzer.fused = init_8080();
+        fuzzer.fused->port_in = fuzz_in;
+    }
+    atexit(exit_guard);
+}
+
+/**
+ * @brief Puts the instance back to all zeroes. Only pages that were written since the last
+ *  reset need clearing, which is usually a handful.
+ */
+static void reset(State8080* state) {
+    int page;
+    for (page = 0; page < 256; page++) {
+        if (state->page_versions[page] != 0) {
+            memset(&state->memory[page << 8], 0, 256);
+            state->page_versions[page] = 0;
+        }
+    }
+
+    state->a = state->b = state->c = state->d = state->e = state->h = state->l = 0;
+    state->sp = state->pc = 0;
+    unpack_codes(state, 0);
+    state->int_enable = state->halted = 0;
+    state->cycles = state->instructions = state->fused_instructions = state->interrupts = 0;
+    fuzzer.input_counter = 0;
+}
+
+/**
+ * @brief Loads an input: the header sets the registers (a, b, c, d, e, h, l, flags, sp, an
+ *  interrupt byte and the page to load at), and the rest is the program, wrapping around the
+ *  top of memory. The interrupt byte's bit 3 raises RST (bits 0-2) every so often.
+ * 
+ * @return int The interrupt byte
+ */
+static int load(State8080* state, const uint8_t* data, size_t size) {
+    uint8_t header[FUZZ_HEADER_SIZE] = { 0 };
+    size_t header_size = size < FUZZ_HEADER_SIZE ? size : FUZZ_HEADER_SIZE;
+    memcpy(header, data, header_size);
+    data += header_size;
+    size -= header_size;
+
+    state->a = header[0];
+    state->b = header[1];
+    state->c = header[2];
+    state->d = header[3];
+    state->e = header[4];
+    state->h = header[5];
+    state->l = header[6];
+    unpack_codes(state, header[7]);
+    state->sp = header[8] | (header[9] << 8);
+    state->pc = header[11] << 8;
+    state->int_enable = (header[10] & 0x08) != 0;
+
+    if (size > 0x10000) {
+        size = 0x10000;
+    }
+    size_t first = size < 0x10000u - state->pc ? size : 0x10000u - state->pc;
+    memcpy(&state->memory[state->pc], data, first);
+    memcpy(state->memory, data + first, size - first);
+    mark_written(state, state->pc, first);
+    mark_written(state, 0, size - first);
+    return header[10];
+}
+
+/**
+ * @brief Runs an input for a fixed number of cycles, checking the invariants after every
+ *  instruction (and against the reference core, if running differentially).
+ */
+static void run(const uint8_t* data, size_t size) {
+    State8080* state = fuzzer.state;
+    reset(state);
+    int interrupt = load(state, data, size);
+    if (fuzzer.lockstep != NULL) {
+        lockstep_reset(fuzzer.lockstep);
+    }
+
+    fuzzer.running = 1;
+    uint64_t next_interrupt = FUZZ_INTERRUPT_CYCLES;
+    while (state->cycles < FUZZ_MAX_CYCLES) {
+        if (state->halted && !state->int_enable) {
+            break;                          // Nothing will ever wake it up
+        }
+
+        uint16_t pc = state->pc;
+        uint64_t cycles_before = state->cycles;
+        if (fuzzer.lockstep != NULL) {
+            lockstep_before_op(fuzzer.lockstep);
+        }
+
+        int cycles = emulate_op(state);
+
+        if (cycles < 4 || cycles > FUZZ_MAX_OP_CYCLES) {
+            fail("an instruction took an impossible number of cycles");
+        }
+        if (state->cycles != cycles_before + cycles) {
+            fail("the cycle counter doesn't match the cycles returned");
+        }
+        if (state->halted && state->pc != pc && state->memory[pc] != 0x76) {
+            fail("pc moved while halted");
+        }
+        if (fuzzer.lockstep != NULL && !lockstep_after_op(fuzzer.lockstep)) {
+            lockstep_write_report(fuzzer.lockstep, stderr);
+            fail("the core diverged from the reference core");
+        }
+
+        if ((interrupt & 0x08) && state->cycles >= next_interrupt) {
+            next_interrupt += FUZZ_INTERRUPT_CYCLES;
+            generate_interrupt(state, interrupt & 0x07);
+            if (fuzzer.lockstep != NULL && !lockstep_interrupt(fuzzer.lockstep, interrupt & 0x07)) {
+                lockstep_write_report(fuzzer.lockstep, stderr);
+                fail("the core diverged from the reference core on an interrupt");
+            }
+        }
+    }
+    fuzzer.running = 0;
+}
+
+/**
+ * @brief Runs an input again on the second instance with superinstructions and idle skipping,
+ *  stopping for the interrupts at the same cycles, and checks that it ends up in exactly the
+ *  same state. A CPU halted with interrupts off is the one exception: the plain run stops there,
+ *  while idle skipping runs the clock out, so only the cycle counter may differ.
+ */
+static void run_fused(const uint8_t* data, size_t size) {
+    State8080* state = fuzzer.fused;
+    reset(state);
+    int interrupt = load(state, data, size);
+
+    fuzzer.running = 1;
+    uint64_t next_interrupt = FUZZ_INTERRUPT_CYCLES;
+    while (state->cycles < FUZZ_MAX_CYCLES) {
+        if (state->halted && !state->int_enable) {
+            break;
+        }
+
+        uint64_t limit = FUZZ_MAX_CYCLES;
+        if ((interrupt & 0x08) && next_interrupt < limit) {
+            limit = next_interrupt;
+        }
+        idle_run(&fuzzer.idle, state, limit, 1);
+
+        if ((interrupt & 0x08) && state->cycles >= next_interrupt) {
+            next_interrupt += FUZZ_INTERRUPT_CYCLES;
+            generate_interrupt(state, interrupt & 0x07);
+        }
+    }
+    fuzzer.running = 0;
+
+    State8080* plain = fuzzer.state;
+    if (state->a != plain->a || state->b != plain->b || state->c != plain->c ||
+        state->d != plain->d || state->e != plain->e || state->h != plain->h ||
+        state->l != plain->l || pack_codes(state) != pack_codes(plain) ||
+        state->sp != plain->sp || state->pc != plain->pc ||
+        state->int_enable != plain->int_enable || state->halted != plain->halted ||
+        state->instructions != plain->instructions ||
+        (state->cycles != plain->cycles && !(plain->halted && !plain->int_enable))) {
+        print_state(state);
+        fail("superinstructions or idle skipping left different registers");
+    }
+    if (memcmp(state->memory, plain->memory, 0x10000) != 0) {
+        fail("superinstructions or idle skipping left different memory");
+    }
+}
+
+#pragma endregion
+
+#pragma region Entry Points
+
+static int environment_flag(const char* name) {
+    const char* value = getenv(name);
+    return value != NULL && strcmp(value, "0") != 0;
+}
+
+/**
+ * @brief libFuzzer setup. Set FUZZ_REFERENCE=1 in the environment to run differentially, and
+ *  FUZZ_FUSED=1 to check superinstructions and idle skipping against single operations.
+ */
+int LLVMFuzzerInitialize(int* argc, char*** argv) {
+    (void)argc;
+    (void)argv;
+    setup(environment_flag("FUZZ_REFERENCE"), environment_flag("FUZZ_FUSED"));
+    return 0;
+}
+
+/**
+ * @brief libFuzzer entry point, also used by the AFL and standalone builds.
+ */
+int LLVMFuzzerTestOneInput(const uint8_t* data, size_t size) {
+    if (fuzzer.state == NULL) {
+        LLVMFuzzerInitialize(NULL, NULL);
+    }
+    run(data, size);
+    if (fuzzer.fused != NULL) {
+        run_fused(data, size);
+    }
+    return 0;
+}
+
+#ifndef FUZZ_LIBFUZZER
+
+static uint8_t* read_input(FILE* file, size_t* size) {
+    size_t capacity = 4096;
+    uint8_t* data = malloc(capacity);
+    *size = 0;
+    size_t count;
+    while ((count = fread(&data[*size], 1, capacity - *size, file)) > 0) {
+        *size += count;
+        if (*size == capacity) {
+            capacity *= 2;
+            data = realloc(data, capacity);
+        }
+    }
+    return data;
+}
+
+/**
+ * @brief Runs random inputs for a while and reports the executions per second.
+ */
+static void benchmark(uint64_t iterations) {
+    uint8_t data[FUZZ_HEADER_SIZE + 256];
+    uint64_t i;
+    size_t j;
+    srand(1);
+
+    struct timespec start, end;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    for (i = 0; i < iterations; i++) {
+        for (j = 0; j < sizeof(data); j++) {
+            data[j] = rand();
+        }
+        LLVMFuzzerTestOneInput(data, sizeof(data));
+    }
+    clock_gettime(CLOCK_MONOTONIC, &end);
+
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+    printf("%llu inputs of %d cycles in %.3f s (%.0f exec/s)%s\n", (unsigned long long)iterations,
+        FUZZ_MAX_CYCLES, seconds, iterations / seconds,
+        fuzzer.lockstep != NULL ? ", against the reference core" : "");
+}
+
+void print_usage() {
+    printf("Usage: fuzz [-r] [-s] [-b iterations] [input]...\n");
+    printf("  -r            Check every instruction against the reference core\n");
+    printf("  -s            Check that superinstructions and idle skipping end up in the same state\n");
+    printf("  -b iterations Run random inputs and report exec/s\n");
+    printf("Runs each input file, or stdin if there are none (for AFL).\n");
+}
+
+/**
+ * @brief Main method for the standalone and AFL builds.
+ * 
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return int Return code
+ */
+int main(int argc, char** argv) {
+    int differential = 0;
+    int fused = 0;
+    uint64_t iterations = 0;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "rsb:h")) != -1) {
+        switch (opt) {
+            case 'r': differential = 1; break;
+            case 's': fused = 1; break;
+            case 'b': iterations = strtoull(optarg, NULL, 10); break;
+            default: print_usage(); exit(1);
+        }
+    }
+    setup(differential, fused);
+
+    if (iterations > 0) {
+        benchmark(iterations);
+        return 0;
+    }
+
+    size_t size;
+    uint8_t* data;
+    if (optind == argc) {
+#ifdef __AFL_LOOP
+        // AFL++ persistent mode: many inputs per process.
+        while (__AFL_LOOP(10000)) {
+            data = read_input(stdin, &size);
+            LLVMFuzzerTestOneInput(data, size);
+            free(data);
+        }
+#else
+        data = read_input(stdin, &size);
+        LLVMFuzzerTestOneInput(data, size);
+        free(data);
+#endif
+        return 0;
+    }
+
+    int i;
+    for (i = optind; i < argc; i++) {
+        FILE* file = fopen(argv[i], "rb");
+        if (file == NULL) {
+            printf("Error: Could not open %s\n", argv[i]);
+            exit(1);
+        }
+        data = read_input(file, &size);
+        fclose(file);
+        LLVMFuzzerTestOneInput(data, size);
+        free(data);
+    }
+    return 0;
+}
+
+#endif
+
+#pragma endregion
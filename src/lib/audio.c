@@ -0,0 +1,313 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "audio.h"
+
+enum { EVENT_PLAY, EVENT_STOP, EVENT_ADVANCE, EVENT_END };
+
+#pragma region WAV Files
+
+static uint32_t read_le(const uint8_t* bytes, int count) {
+    uint32_t value = 0;
+    int i;
+    for (i = count - 1; i >= 0; i--) {
+        value = (value << 8) | bytes[i];
+    }
+    return value;
+}
+
+static void write_le(FILE* out, uint32_t value, int count) {
+    int i;
+    for (i = 0; i < count; i++) {
+        fputc((value >> (8 * i)) & 0xff, out);
+    }
+}
+
+/**
+ * @brief Loads an uncompressed 8 or 16-bit WAV file as one of the sounds, mixing it down to mono
+ *  and resampling it to AUDIO_RATE.
+ * 
+ * @param audio 
+ * @param sound Which sound to load
+ * @param filename Path to the WAV file
+ * @return int 0 on success, -1 if the file is missing or not a WAV we can read
+ */
+int audio_load_sound(Audio* audio, int sound, const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    rewind(file);
+    uint8_t* buffer = malloc(size);
+    size_t length = fread(buffer, 1, size, file);
+    fclose(file);
+
+    if (length < 12 || memcmp(buffer, "RIFF", 4) != 0 || memcmp(&buffer[8], "WAVE", 4) != 0) {
+        free(buffer);
+        return -1;
+    }
+
+    // Walk the chunks for the format and the data.
+    uint32_t channels = 0, rate = 0, bits = 0;
+    uint8_t* data = NULL;
+    uint32_t data_size = 0;
+    size_t offset = 12;
+    while (offset + 8 <= length) {
+        uint32_t chunk_size = read_le(&buffer[offset + 4], 4);
+        uint8_t* chunk = &buffer[offset + 8];
+        if (chunk_size > length - offset - 8) {
+            chunk_size = length - offset - 8;
+        }
+        if (memcmp(&buffer[offset], "fmt ", 4) == 0 && chunk_size >= 16) {
+            if (read_le(chunk, 2) != 1) {
+                break;                              // Not plain PCM
+            }
+            channels = read_le(&chunk[2], 2);
+            rate = read_le(&chunk[4], 4);
+            bits = read_le(&chunk[14], 2);
+        }
+        else if (memcmp(&buffer[offset], "data", 4) == 0) {
+            data = chunk;
+            data_size = chunk_size;
+        }
+        offset += 8 + chunk_size + (chunk_size & 1);
+    }
+
+    if (data == NULL || channels == 0 || rate == 0 || (bits != 8 && bits != 16)) {
+        free(buffer);
+        return -1;
+    }
+
+    uint32_t frame_size = channels * bits / 8;
+    uint32_t frames = data_size / frame_size;
+    Sound* out = &audio->sounds[sound];
+    free(out->samples);
+    out->length = (uint64_t)frames * AUDIO_RATE / rate;
+    out->samples = malloc((out->length + 1) * sizeof(int16_t));
+
+    uint32_t i, channel;
+    for (i = 0; i < out->length; i++) {
+        uint8_t* frame = &data[(uint64_t)i * rate / AUDIO_RATE * frame_size];
+        int32_t total = 0;
+        for (channel = 0; channel < channels; channel++) {
+            if (bits == 8) {
+                total += (frame[channel] - 128) << 8;   // 8-bit WAV is unsigned
+            }
+            else {
+                total += (int16_t)read_le(&frame[channel * 2], 2);
+            }
+        }
+        out->samples[i] = total / (int32_t)channels;
+    }
+
+    free(buffer);
+    return 0;
+}
+
+/**
+ * @brief Writes a 16-bit mono WAV header. The sizes are patched by finish_wav once the length
+ *  is known.
+ */
+static void start_wav(FILE* out) {
+    fwrite("RIFF", 1, 4, out);
+    write_le(out, 0, 4);
+    fwrite("WAVEfmt ", 1, 8, out);
+    write_le(out, 16, 4);
+    write_le(out, 1, 2);                        // PCM
+    write_le(out, 1, 2);                        // Mono
+    write_le(out, AUDIO_RATE, 4);
+    write_le(out, AUDIO_RATE * 2, 4);           // Bytes per second
+    write_le(out, 2, 2);                        // Bytes per frame
+    write_le(out, 16, 2);
+    fwrite("data", 1, 4, out);
+    write_le(out, 0, 4);
+}
+
+static void finish_wav(FILE* out, uint64_t samples) {
+    uint32_t data_size = samples * 2;
+    fseek(out, 4, SEEK_SET);
+    write_le(out, 36 + data_size, 4);
+    fseek(out, 40, SEEK_SET);
+    write_le(out, data_size, 4);
+    fseek(out, 0, SEEK_END);
+}
+
+#pragma endregion
+
+#pragma region Mixer
+
+static uint64_t now_nanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+/**
+ * @brief Mixes the next block of samples from every active voice and writes it out.
+ */
+static void mix_block(Audio* audio, int count) {
+    int32_t mix[AUDIO_BLOCK] = { 0 };
+    uint8_t bytes[AUDIO_BLOCK * 2];
+
+    int sound, i;
+    for (sound = 0; sound < AUDIO_MAX_SOUNDS; sound++) {
+        Voice* voice = &audio->voices[sound];
+        Sound* samples = &audio->sounds[sound];
+        if (!voice->active || samples->length == 0) {
+            continue;
+        }
+
+        for (i = 0; i < count; i++) {
+            if (voice->position >= samples->length) {
+                if (!voice->loop) {
+                    voice->active = 0;
+                    break;
+                }
+                voice->position = 0;
+            }
+            mix[i] += samples->samples[voice->position++];
+        }
+    }
+
+    for (i = 0; i < count; i++) {
+        int32_t sample = mix[i] > INT16_MAX ? INT16_MAX : mix[i] < INT16_MIN ? INT16_MIN : mix[i];
+        bytes[i * 2] = sample & 0xff;
+        bytes[i * 2 + 1] = (sample >> 8) & 0xff;
+    }
+    fwrite(bytes, 2, count, audio->out);
+    audio->mixed += count;
+}
+
+/**
+ * @brief Mixes everything up to the given time, one block at a time.
+ */
+static void mix_until(Audio* audio, uint64_t time) {
+    if (time <= audio->mixed) {
+        return;
+    }
+
+    uint64_t start = now_nanoseconds();
+    while (audio->mixed < time) {
+        uint64_t count = time - audio->mixed;
+        mix_block(audio, count < AUDIO_BLOCK ? count : AUDIO_BLOCK);
+    }
+    audio->mix_nanoseconds += now_nanoseconds() - start;
+}
+
+/**
+ * @brief The mixer thread. Events are handled in order, mixing up to each one's time first, so
+ *  the output only depends on the events and not on how far behind the mixer is.
+ */
+static void* mixer_thread(void* argument) {
+    Audio* audio = argument;
+    struct timespec idle = { 0, 1000000 };
+    AudioEvent event;
+
+    while (1) {
+        if (!ring_pop(audio->events, &event)) {
+            nanosleep(&idle, NULL);
+            continue;
+        }
+
+        mix_until(audio, event.time);
+        switch (event.type) {
+            case EVENT_PLAY:
+                audio->voices[event.sound].active = 1;
+                audio->voices[event.sound].loop = event.loop;
+                audio->voices[event.sound].position = 0;
+                break;
+            case EVENT_STOP:
+                audio->voices[event.sound].active = 0;
+                break;
+            case EVENT_END:
+                finish_wav(audio->out, audio->mixed);
+                return NULL;
+            default:
+                break;
+        }
+    }
+}
+
+#pragma endregion
+
+#pragma region Emulation Thread
+
+/**
+ * @brief Creates the audio and starts the mixer thread. Load the sounds before anything is
+ *  played.
+ * 
+ * @param out Stream the mixed WAV file is written to. It has to be seekable.
+ * @return Audio* 
+ */
+Audio* audio_create(FILE* out) {
+    Audio* audio = calloc(1, sizeof(Audio));
+    audio->events = ring_create(AUDIO_QUEUE, sizeof(AudioEvent));
+    audio->out = out;
+    start_wav(out);
+    pthread_create(&audio->mixer, NULL, mixer_thread, audio);
+    return audio;
+}
+
+static void queue_event(Audio* audio, uint8_t type, uint8_t sound, int loop, uint64_t time) {
+    AudioEvent event = { time, type, sound, loop };
+    if (!ring_push(audio->events, &event)) {
+        audio->dropped++;
+    }
+}
+
+/**
+ * @brief Starts a sound from the beginning. Never blocks: if the mixer has fallen too far
+ *  behind, the event is dropped and counted instead.
+ * 
+ * @param audio 
+ * @param sound Which sound to play
+ * @param loop Whether to repeat it until it's stopped
+ * @param time When to start it, in samples since the start
+ */
+void audio_play(Audio* audio, int sound, int loop, uint64_t time) {
+    queue_event(audio, EVENT_PLAY, sound, loop, time);
+}
+
+void audio_stop(Audio* audio, int sound, uint64_t time) {
+    queue_event(audio, EVENT_STOP, sound, 0, time);
+}
+
+/**
+ * @brief Lets the mixer mix up to the given time. Call once per frame so the output keeps up
+ *  while nothing is being played or stopped.
+ */
+void audio_advance(Audio* audio, uint64_t time) {
+    queue_event(audio, EVENT_ADVANCE, 0, 0, time);
+}
+
+/**
+ * @brief Mixes everything up to the given time, finishes the WAV file and stops the mixer. This
+ *  is the only call that waits for the mixer.
+ * 
+ * @param audio 
+ * @param time Where the output ends, in samples since the start
+ */
+void audio_finish(Audio* audio, uint64_t time) {
+    AudioEvent event = { time, EVENT_END, 0, 0 };
+    struct timespec wait = { 0, 1000000 };
+    while (!ring_push(audio->events, &event)) {
+        nanosleep(&wait, NULL);
+    }
+    pthread_join(audio->mixer, NULL);
+}
+
+void audio_free(Audio* audio) {
+    int i;
+    for (i = 0; i < AUDIO_MAX_SOUNDS; i++) {
+        free(audio->sounds[i].samples);
+    }
+    ring_free(audio->events);
+    free(audio);
+}
+
+#pragma endregion
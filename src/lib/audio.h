@@ -0,0 +1,68 @@
+#ifndef AUDIO_H
+#define AUDIO_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ring.h"
+
+#define AUDIO_RATE 44100
+#define AUDIO_MAX_SOUNDS 16
+#define AUDIO_BLOCK 512             // Most samples mixed at once
+#define AUDIO_QUEUE 4096            // Events the emulator can get ahead of the mixer
+
+/**
+ * @brief A sound loaded from a WAV file, converted to 16-bit mono at AUDIO_RATE.
+ */
+typedef struct Sound {
+    int16_t* samples;
+    uint32_t length;
+} Sound;
+
+/**
+ * @brief A sound that is currently playing.
+ */
+typedef struct Voice {
+    int active;
+    int loop;
+    uint32_t position;
+} Voice;
+
+/**
+ * @brief Something for the mixer to do, at a time measured in output samples since the start.
+ */
+typedef struct AudioEvent {
+    uint64_t time;
+    uint8_t type;
+    uint8_t sound;
+    uint8_t loop;
+} AudioEvent;
+
+/**
+ * @brief Sample-triggered audio. The emulation thread queues play/stop events on a lock-free
+ *  ring and never waits; a mixer thread turns them into 16-bit mono PCM and writes it out as a
+ *  WAV file.
+ */
+typedef struct Audio {
+    Sound sounds[AUDIO_MAX_SOUNDS];
+    Voice voices[AUDIO_MAX_SOUNDS];
+
+    Ring* events;
+    uint64_t dropped;           // Events the emulation thread couldn't queue because it was full
+
+    pthread_t mixer;
+    FILE* out;
+    uint64_t mixed;             // Samples written so far
+    uint64_t mix_nanoseconds;   // Time the mixer spent mixing, without waiting for events
+} Audio;
+
+int audio_load_sound(Audio* audio, int sound, const char* filename);
+Audio* audio_create(FILE* out);
+void audio_play(Audio* audio, int sound, int loop, uint64_t time);
+void audio_stop(Audio* audio, int sound, uint64_t time);
+void audio_advance(Audio* audio, uint64_t time);
+void audio_finish(Audio* audio, uint64_t time);
+void audio_free(Audio* audio);
+
+#endif
@@ -0,0 +1,284 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "capture.h"
+#include "invaders.h"
+
+// The file starts with CAPTURE_MAGIC, then the size of a frame's video RAM (32 bits), the
+// picture's width and height and the frame rate (16 bits each), all little-endian. Then for
+// every frame captured:
+//
+//  varint  Frames since the last one in the file (1 unless some were dropped). The first one
+//          counts from frame 0.
+//  varint  Size of the rest of the record
+//  ...     The video RAM XORed with the previous frame's (all zeros before the first), as
+//          pairs of varints: bytes that didn't change, then bytes that did, followed by that
+//          many XORed bytes. Pairs carry on until they cover the whole of video RAM.
+//
+// Varints are 7 bits a byte, least significant first, with the top bit set on all but the
+// last byte. A frame where nothing changed takes 5 bytes. If frames were dropped at the very
+// end, the file ends with one of those, so it's as long as the run.
+
+// Unchanged bytes in a row that end a run of changed ones. Fewer cost less as XORed bytes than
+// as another pair.
+#define MIN_SKIP 3
+
+typedef struct CaptureSlot {
+    uint64_t frame;
+    int end;                    // Finish, padding the video out to the frame
+    uint8_t vram[INVADERS_VRAM_SIZE];
+} CaptureSlot;
+
+static uint64_t now_nanoseconds() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (uint64_t)now.tv_sec * 1000000000 + now.tv_nsec;
+}
+
+#pragma region Encoder
+
+static size_t put_varint(uint8_t* out, uint64_t value) {
+    size_t length = 0;
+    while (value >= 0x80) {
+        out[length++] = (value & 0x7f) | 0x80;
+        value >>= 7;
+    }
+    out[length++] = value;
+    return length;
+}
+
+static void write_le(Capture* capture, uint32_t value, int count) {
+    int i;
+    for (i = 0; i < count; i++) {
+        fputc((value >> (8 * i)) & 0xff, capture->out);
+    }
+    capture->bytes += count;
+}
+
+static void write_header(Capture* capture) {
+    if (capture->format == CAPTURE_Y4M) {
+        capture->bytes += fprintf(capture->out, "YUV4MPEG2 W%d H%d F%d:1 Ip A1:1 Cmono\n",
+            INVADERS_SCREEN_WIDTH, INVADERS_SCREEN_HEIGHT, INVADERS_FPS);
+        return;
+    }
+    fwrite(CAPTURE_MAGIC, 1, strlen(CAPTURE_MAGIC), capture->out);
+    capture->bytes += strlen(CAPTURE_MAGIC);
+    write_le(capture, INVADERS_VRAM_SIZE, 4);
+    write_le(capture, INVADERS_SCREEN_WIDTH, 2);
+    write_le(capture, INVADERS_SCREEN_HEIGHT, 2);
+    write_le(capture, INVADERS_FPS, 2);
+}
+
+/**
+ * @brief Encodes the changes from the previous frame as runs of unchanged and XORed bytes.
+ *
+ * @return size_t Size of the encoded frame
+ */
+static size_t encode_delta(const uint8_t* previous, const uint8_t* vram, uint8_t* out) {
+    size_t length = 0;
+    size_t position = 0;
+    while (position < INVADERS_VRAM_SIZE) {
+        size_t start = position;
+        // Unchanged bytes a word at a time first, since most of the screen doesn't change.
+        while (position + 8 <= INVADERS_VRAM_SIZE) {
+            uint64_t a, b;
+            memcpy(&a, &vram[position], 8);
+            memcpy(&b, &previous[position], 8);
+            if (a != b) {
+                break;
+            }
+            position += 8;
+        }
+        while (position < INVADERS_VRAM_SIZE && vram[position] == previous[position]) {
+            position++;
+        }
+        length += put_varint(&out[length], position - start);
+
+        // Changed bytes run on over short gaps, up to MIN_SKIP unchanged bytes in a row.
+        start = position;
+        size_t end = position;
+        while (position < INVADERS_VRAM_SIZE && position - end < MIN_SKIP) {
+            if (vram[position] != previous[position]) {
+                end = position + 1;
+            }
+            position++;
+        }
+        position = end;
+        length += put_varint(&out[length], end - start);
+        for (; start < end; start++) {
+            out[length++] = vram[start] ^ previous[start];
+        }
+    }
+    return length;
+}
+
+/**
+ * @brief Turns video RAM into the picture, rotated upright like invaders_write_vram, with a
+ *  byte per pixel.
+ */
+static void render(const uint8_t* vram, uint8_t* picture) {
+    int x, y;
+    for (y = 0; y < INVADERS_SCREEN_HEIGHT; y++) {
+        int line = INVADERS_SCREEN_HEIGHT - 1 - y;
+        const uint8_t* column = &vram[line / 8];
+        uint8_t* row = &picture[y * INVADERS_SCREEN_WIDTH];
+        for (x = 0; x < INVADERS_SCREEN_WIDTH; x++) {
+            row[x] = (column[x * 32] >> (line % 8)) & 1 ? 0xff : 0x00;
+        }
+    }
+}
+
+/**
+ * @brief Encodes a frame. The video RAM in an end slot is ignored: the last frame encoded is
+ *  repeated up to its frame number instead.
+ */
+static void encode_frame(Capture* capture, const CaptureSlot* slot) {
+    if (slot->frame <= capture->last_frame || (slot->end && capture->written == 0)) {
+        return;
+    }
+    uint64_t skipped = slot->frame - capture->last_frame;
+    capture->last_frame = slot->frame;
+    const uint8_t* vram = slot->end ? capture->previous : slot->vram;
+
+    if (capture->format == CAPTURE_Y4M) {
+        // A Y4M stream has no timestamps, so frames that were dropped repeat the last picture.
+        size_t size = INVADERS_SCREEN_WIDTH * INVADERS_SCREEN_HEIGHT;
+        for (; skipped > 1 && capture->written > 0; skipped--) {
+            capture->bytes += fprintf(capture->out, "FRAME\n");
+            capture->bytes += fwrite(capture->buffer, 1, size, capture->out);
+            capture->written++;
+        }
+        if (!slot->end) {
+            render(vram, capture->buffer);
+        }
+        capture->bytes += fprintf(capture->out, "FRAME\n");
+        capture->bytes += fwrite(capture->buffer, 1, size, capture->out);
+        capture->written++;
+        return;
+    }
+
+    uint8_t prefix[20];
+    size_t length = encode_delta(capture->previous, vram, capture->buffer);
+    size_t prefix_length = put_varint(prefix, skipped);
+    prefix_length += put_varint(&prefix[prefix_length], length);
+    fwrite(prefix, 1, prefix_length, capture->out);
+    fwrite(capture->buffer, 1, length, capture->out);
+    capture->bytes += prefix_length + length;
+    memcpy(capture->previous, vram, INVADERS_VRAM_SIZE);
+    capture->written++;
+}
+
+/**
+ * @brief The encoder thread. Frames are encoded in place on the ring and only then given back,
+ *  so the emulation thread copies each frame once.
+ */
+static void* encoder_thread(void* argument) {
+    Capture* capture = argument;
+    struct timespec idle = { 0, 1000000 };
+
+    while (1) {
+        const CaptureSlot* slot = ring_peek(capture->frames);
+        if (slot == NULL) {
+            nanosleep(&idle, NULL);
+            continue;
+        }
+        uint64_t start = now_nanoseconds();
+        int end = slot->end;
+        encode_frame(capture, slot);
+        ring_release(capture->frames);
+        capture->encode_nanoseconds += now_nanoseconds() - start;
+        if (end) {
+            fflush(capture->out);
+            return NULL;
+        }
+    }
+}
+
+#pragma endregion
+
+#pragma region Emulation Thread
+
+/**
+ * @brief Writes the file header and starts the encoder thread.
+ *
+ * @param out Stream the video is written to
+ * @param format What to write
+ * @param drop Whether to drop frames when the encoder falls behind, rather than wait for it
+ * @return Capture*
+ */
+Capture* capture_create(FILE* out, CaptureFormat format, int drop) {
+    Capture* capture = calloc(1, sizeof(Capture));
+    capture->frames = ring_create(CAPTURE_QUEUE, sizeof(CaptureSlot));
+    capture->format = format;
+    capture->drop = drop;
+    capture->out = out;
+    capture->previous = calloc(INVADERS_VRAM_SIZE, 1);
+    // Big enough for a picture, or a frame where every byte changed plus its varints.
+    capture->buffer = malloc(INVADERS_SCREEN_WIDTH * INVADERS_SCREEN_HEIGHT);
+    write_header(capture);
+    pthread_create(&capture->encoder, NULL, encoder_thread, capture);
+    return capture;
+}
+
+/**
+ * @brief Hands a frame to the encoder: one copy of video RAM into the queue. If the queue is
+ *  full, it waits for a free slot or drops the frame, depending on the policy.
+ *
+ * @param capture
+ * @param frame The frame number
+ * @param vram Video RAM (INVADERS_VRAM_SIZE bytes)
+ */
+void capture_frame(Capture* capture, uint64_t frame, const uint8_t* vram) {
+    uint64_t start = now_nanoseconds();
+    CaptureSlot* slot = ring_reserve(capture->frames);
+    if (slot == NULL) {
+        if (capture->drop) {
+            capture->dropped++;
+            capture->capture_nanoseconds += now_nanoseconds() - start;
+            return;
+        }
+        struct timespec wait = { 0, 100000 };
+        while ((slot = ring_reserve(capture->frames)) == NULL) {
+            nanosleep(&wait, NULL);
+        }
+        capture->wait_nanoseconds += now_nanoseconds() - start;
+    }
+
+    slot->frame = frame;
+    slot->end = 0;
+    memcpy(slot->vram, vram, INVADERS_VRAM_SIZE);
+    ring_commit(capture->frames);
+    capture->captured++;
+    capture->capture_nanoseconds += now_nanoseconds() - start;
+}
+
+/**
+ * @brief Waits for the encoder to write everything queued and stops it. Frames dropped at the
+ *  end are filled in with the last one captured, so the video lasts as long as the run.
+ *
+ * @param capture
+ * @param frame The last frame of the run
+ */
+void capture_finish(Capture* capture, uint64_t frame) {
+    struct timespec wait = { 0, 1000000 };
+    CaptureSlot* slot;
+    while ((slot = ring_reserve(capture->frames)) == NULL) {
+        nanosleep(&wait, NULL);
+    }
+    slot->frame = frame;
+    slot->end = 1;
+    ring_commit(capture->frames);
+    pthread_join(capture->encoder, NULL);
+}
+
+void capture_free(Capture* capture) {
+    ring_free(capture->frames);
+    free(capture->previous);
+    free(capture->buffer);
+    free(capture);
+}
+
+#pragma endregion
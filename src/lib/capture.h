@@ -0,0 +1,52 @@
+#ifndef CAPTURE_H
+#define CAPTURE_H
+
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+
+#include "ring.h"
+
+#define CAPTURE_QUEUE 64            // Frames the emulator can get ahead of the encoder
+#define CAPTURE_MAGIC "8080VID1"
+
+/**
+ * @brief What goes in the file: the board's own video RAM as deltas (see capture.c for the
+ *  layout), or a Y4M stream of the picture that any video tool can read.
+ */
+typedef enum CaptureFormat {
+    CAPTURE_DELTA,
+    CAPTURE_Y4M,
+} CaptureFormat;
+
+/**
+ * @brief Video capture of the Space Invaders screen. The emulation thread copies video RAM
+ *  straight into a slot of a lock-free ring once a frame, and an encoder thread compresses and
+ *  writes it, so the emulator never waits on the disk. When the encoder falls a whole queue
+ *  behind, the emulator either waits for it or drops the frame, depending on the policy.
+ */
+typedef struct Capture {
+    Ring* frames;
+    CaptureFormat format;
+    int drop;                   // Drop frames when the queue is full instead of waiting
+    uint64_t captured;          // Frames the emulation thread handed over
+    uint64_t dropped;           // Frames it couldn't, because the queue was full
+    uint64_t capture_nanoseconds;   // Time the emulation thread spent capturing, waits included
+    uint64_t wait_nanoseconds;      // The part of it spent waiting for a free slot
+
+    pthread_t encoder;
+    FILE* out;
+    uint64_t written;           // Frames in the file, including repeats for dropped ones
+    uint64_t last_frame;        // Frame number of the last one encoded
+    uint8_t* previous;          // Video RAM as of the last frame encoded
+    uint8_t* buffer;            // Encoded frame (or picture for Y4M) being written
+    uint64_t bytes;             // Size of the file so far
+    uint64_t encode_nanoseconds;    // Time the encoder spent encoding and writing
+} Capture;
+
+Capture* capture_create(FILE* out, CaptureFormat format, int drop);
+void capture_frame(Capture* capture, uint64_t frame, const uint8_t* vram);
+void capture_finish(Capture* capture, uint64_t frame);
+void capture_free(Capture* capture);
+
+#endif
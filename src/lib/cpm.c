@@ -0,0 +1,1123 @@
+#include <ctype.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+
+#include "cpm.h"
+
+// Fields of a file control block.
+#define FCB_DRIVE 0
+#define FCB_NAME 1                  // 8 bytes of name, then 3 of type (t1-t3)
+#define FCB_T1 9                    // High bit set when the file is read-only
+#define FCB_EX 12                   // Logical extent, 0-31
+#define FCB_S2 14                   // Extent / 32. The high bit is set until the FCB is written
+#define FCB_RC 15                   // Records used in the current logical extent
+#define FCB_CR 32                   // Current record in the extent
+#define FCB_R0 33                   // Random record number, low byte first
+#define FCB_SIZE 36
+#define FCB_SEQUENTIAL_SIZE 33      // Programs only have to allocate this much
+#define FCB_UNMODIFIED 0x80
+
+#define RECORDS_PER_EXTENT 128
+
+static void cpm_out(void* context, uint8_t port, uint8_t value);
+
+// The board's own build of the core. Traps look at and change the registers, so OUT syncs.
+// Once a trap has ended the program, the block stops instead of idling out the rest of it.
+#define CORE_BLOCK cpm_emulate_block
+#define CORE_IN(state, port) ((void)(port), 0)
+#define CORE_OUT(state, port, value) cpm_out((state)->io_context, port, value)
+#define CORE_SYNC_IN 0
+#define CORE_BLOCK_ENTRY(state, pc) (((Cpm*)(state)->io_context)->exited)
+#include "cpu8080_core.h"
+
+#pragma region Memory
+
+static void copy_from_memory(Cpm* cpm, uint16_t addr, uint8_t* out, size_t length) {
+    size_t i;
+    for (i = 0; i < length; i++) {
+        out[i] = cpm->state->memory[(uint16_t)(addr + i)];
+    }
+}
+
+static void copy_to_memory(Cpm* cpm, uint16_t addr, const uint8_t* data, size_t length) {
+    size_t i;
+    for (i = 0; i < length; i++) {
+        cpm->state->memory[(uint16_t)(addr + i)] = data[i];
+    }
+    mark_written(cpm->state, addr, length);
+}
+
+static void store_word(Cpm* cpm, uint16_t addr, uint16_t value) {
+    uint8_t bytes[2] = { value & 0xff, value >> 8 };
+    copy_to_memory(cpm, addr, bytes, 2);
+}
+
+/**
+ * @brief Ends the run, as if the program had warm booted. The OUT that trapped still steps over
+ *  its two bytes afterwards, which leaves pc at CPM_EXIT.
+ */
+static void stop(Cpm* cpm, const char* message) {
+    cpm->exited = 1;
+    cpm->state->halted = 1;
+    cpm->state->pc = CPM_EXIT - 2;
+    if (message != NULL) {
+        snprintf(cpm->message, sizeof(cpm->message), "%s", message);
+    }
+}
+
+#pragma endregion
+
+#pragma region Console
+
+/**
+ * @brief Writes out everything the program has printed so far.
+ */
+void cpm_flush(Cpm* cpm) {
+    size_t written = 0;
+    while (written < cpm->output_length) {
+        ssize_t count = write(cpm->output_fd, &cpm->output[written],
+            cpm->output_length - written);
+        if (count <= 0) {
+            break;
+        }
+        written += count;
+    }
+    cpm->output_length = 0;
+}
+
+/**
+ * @brief Prints a character as it is (BIOS CONOUT).
+ */
+static void console_put(Cpm* cpm, uint8_t c) {
+    if (cpm->output_length == sizeof(cpm->output)) {
+        cpm_flush(cpm);
+    }
+    cpm->output[cpm->output_length++] = c;
+    if (c == '\r') {
+        cpm->column = 0;
+    }
+    else if (c == '\b') {
+        cpm->column -= cpm->column > 0;
+    }
+    else if (c >= ' ') {
+        cpm->column++;
+    }
+}
+
+/**
+ * @brief Prints a character the way the BDOS does, expanding tabs to every 8th column.
+ */
+static void console_out(Cpm* cpm, uint8_t c) {
+    if (c != '\t') {
+        console_put(cpm, c);
+        return;
+    }
+    do {
+        console_put(cpm, ' ');
+    } while (cpm->column % 8 != 0);
+}
+
+static void console_print(Cpm* cpm, const char* text) {
+    while (*text) {
+        console_out(cpm, *text++);
+    }
+}
+
+static void fill_input(Cpm* cpm) {
+    ssize_t count = read(cpm->input_fd, cpm->input, sizeof(cpm->input));
+    cpm->input_start = 0;
+    cpm->input_end = count > 0 ? count : 0;
+    cpm->input_eof = count <= 0;
+}
+
+/**
+ * @brief Whether a character can be read without waiting. Nothing is pending once the input
+ *  has ended, so a program polling for a key then just keeps polling, like a real machine no
+ *  one is typing at.
+ */
+static int console_pending(Cpm* cpm) {
+    if (cpm->input_start < cpm->input_end) {
+        return 1;
+    }
+    if (cpm->input_eof) {
+        return 0;
+    }
+    if (cpm->output_tty) {
+        cpm_flush(cpm);
+    }
+    struct pollfd input = { cpm->input_fd, POLLIN, 0 };
+    if (poll(&input, 1, 0) <= 0) {
+        return 0;
+    }
+    fill_input(cpm);
+    return cpm->input_start < cpm->input_end;
+}
+
+/**
+ * @brief Reads a character, waiting for one if need be. Host line endings become the CR that
+ *  CP/M programs expect.
+ *
+ * @return int The character, or -1 at the end of the input
+ */
+static int console_get(Cpm* cpm) {
+    for (;;) {
+        if (cpm->input_start == cpm->input_end) {
+            if (cpm->input_eof) {
+                return -1;
+            }
+            cpm_flush(cpm);
+            fill_input(cpm);
+            continue;
+        }
+        uint8_t c = cpm->input[cpm->input_start++];
+        if (c != '\r') {
+            return c == '\n' ? '\r' : c;
+        }
+    }
+}
+
+/**
+ * @brief Reads a character for a program. At the end of the input it gets a ^Z (CP/M's end of
+ *  file) once, and if it asks again the run ends, since nothing else will ever be typed.
+ */
+static uint8_t console_in(Cpm* cpm) {
+    int c = console_get(cpm);
+    if (c >= 0) {
+        return c;
+    }
+    if (cpm->input_ended) {
+        stop(cpm, "Console input ran out");
+        return 0x1a;
+    }
+    cpm->input_ended = 1;
+    return 0x1a;
+}
+
+/**
+ * @brief Echoes a typed character, with control characters shown as ^X.
+ */
+static void console_echo(Cpm* cpm, uint8_t c) {
+    if (c < ' ' && c != '\t' && c != '\r' && c != '\n') {
+        console_put(cpm, '^');
+        console_put(cpm, c + '@');
+        return;
+    }
+    console_out(cpm, c);
+}
+
+/**
+ * @brief BDOS 10: reads a line into a buffer whose first byte is its size, with the length in
+ *  the second byte and the characters after it. The line is echoed, and backspace and delete
+ *  edit it. ^C at the start of a line warm boots, and so does running out of input.
+ */
+static void read_line(Cpm* cpm, uint16_t addr) {
+    uint8_t size = cpm->state->memory[addr];
+    uint8_t line[256];
+    int length = 0;
+    while (length < size) {
+        int c = console_get(cpm);
+        if (c < 0) {
+            if (length == 0) {
+                stop(cpm, "Console input ran out");
+                return;
+            }
+            break;
+        }
+        if (c == '\r') {
+            break;
+        }
+        if (c == 0x03 && length == 0) {
+            console_print(cpm, "^C");
+            stop(cpm, NULL);
+            return;
+        }
+        if (c == '\b' || c == 0x7f) {
+            if (length > 0) {
+                length--;
+                console_print(cpm, "\b \b");
+            }
+            continue;
+        }
+        line[length++] = c;
+        console_echo(cpm, c);
+    }
+    console_put(cpm, '\r');
+
+    uint8_t count = length;
+    copy_to_memory(cpm, addr + 1, &count, 1);
+    copy_to_memory(cpm, addr + 2, line, length);
+}
+
+#pragma endregion
+
+#pragma region Disks
+
+/**
+ * @brief Mounts a disk image on a drive, and sets up the disk parameter header and block that
+ *  SELDSK and BDOS 31 hand out for it.
+ *
+ * @param cpm
+ * @param drive 0 for A: and so on
+ * @param path Image file. One that doesn't exist is created as an empty 8" floppy.
+ * @return int 0, or -1 if the image can't be used
+ */
+int cpm_mount(Cpm* cpm, int drive, const char* path) {
+    if (drive < 0 || drive >= CPM_MAX_DISKS) {
+        return -1;
+    }
+    Disk* disk = disk_open(path);
+    if (disk == NULL) {
+        return -1;
+    }
+    if (cpm->disks[drive] != NULL) {
+        disk_close(cpm->disks[drive]);
+    }
+    cpm->disks[drive] = disk;
+
+    DiskFormat* format = &disk->format;
+    uint16_t dpb = CPM_DPB + drive * 16;
+    uint8_t block[15] = {
+        format->spt & 0xff, format->spt >> 8, format->bsh, format->blm, format->exm,
+        format->dsm & 0xff, format->dsm >> 8, format->drm & 0xff, format->drm >> 8,
+        format->al0, format->al1, format->cks & 0xff, format->cks >> 8,
+        format->off & 0xff, format->off >> 8,
+    };
+    copy_to_memory(cpm, dpb, block, sizeof(block));
+    if (format->skew != NULL) {
+        copy_to_memory(cpm, CPM_SKEW, format->skew, format->spt);
+    }
+
+    uint16_t header[8] = {
+        format->skew != NULL ? CPM_SKEW : 0, 0, 0, 0, CPM_DIRBUF, dpb, 0,
+        CPM_ALV + drive * CPM_ALV_SIZE,
+    };
+    int i;
+    for (i = 0; i < 8; i++) {
+        store_word(cpm, CPM_DPH + drive * 16 + i * 2, header[i]);
+    }
+    return 0;
+}
+
+/**
+ * @brief Prints one of the BDOS's fatal errors and ends the run, as CP/M would warm boot.
+ */
+static void bdos_error(Cpm* cpm, int drive, const char* error) {
+    char message[48];
+    snprintf(message, sizeof(message), "Bdos Err On %c: %s", 'A' + drive, error);
+    console_print(cpm, "\r\n");
+    console_print(cpm, message);
+    console_print(cpm, "\r\n");
+    stop(cpm, message);
+}
+
+static Disk* select_disk(Cpm* cpm, int drive) {
+    if (drive >= CPM_MAX_DISKS || cpm->disks[drive] == NULL) {
+        bdos_error(cpm, drive & 0x0f, "Select");
+        return NULL;
+    }
+    return cpm->disks[drive];
+}
+
+/**
+ * @brief The drive an FCB is on: its first byte, or the current drive if that's 0.
+ */
+static int fcb_drive(Cpm* cpm, const uint8_t* fcb) {
+    return fcb[FCB_DRIVE] == 0 || fcb[FCB_DRIVE] == '?' ? cpm->drive : (fcb[FCB_DRIVE] - 1) & 0x0f;
+}
+
+/**
+ * @brief Checks that a drive can be written to, ending the run with a BDOS error if not.
+ */
+static int check_writable(Cpm* cpm, int drive) {
+    if (cpm->disks[drive]->read_only || (cpm->read_only & (1 << drive))) {
+        bdos_error(cpm, drive, "R/O");
+        return -1;
+    }
+    return 0;
+}
+
+static int names_match(const uint8_t* pattern, const uint8_t* entry) {
+    int i;
+    for (i = FCB_NAME; i < FCB_EX; i++) {
+        uint8_t c = pattern[i] & 0x7f;
+        if (c != '?' && c != (entry[i] & 0x7f)) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/**
+ * @brief Whether a directory entry holds the FCB's logical extent. An entry holds exm + 1 of
+ *  them, and its own extent number is the last one in use.
+ */
+static int extents_match(Disk* disk, const uint8_t* fcb, const uint8_t* entry) {
+    uint8_t mask = ~disk->format.exm & 0x1f;
+    return (fcb[FCB_EX] & mask) == (entry[FCB_EX] & mask) &&
+        (fcb[FCB_S2] & 0x3f) == (entry[FCB_S2] & 0x3f);
+}
+
+/**
+ * @brief Finds the current user's directory entry for a file's extent, or any of its
+ *  extents.
+ *
+ * @return int The entry's index, or -1
+ */
+static int find_entry(Cpm* cpm, Disk* disk, const uint8_t* fcb, int start, int any_extent) {
+    int i;
+    for (i = start; i <= disk->format.drm; i++) {
+        uint8_t* entry = disk_entry(disk, i);
+        if (entry != NULL && entry[0] == cpm->user && names_match(fcb, entry) &&
+            (any_extent || extents_match(disk, fcb, entry))) {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Opens the FCB's current extent, copying the name and block pointers from the
+ *  directory. The record count is worked out from where the extent is in the entry: logical
+ *  extents before the entry's last one are full, and ones after it are empty.
+ *
+ * @return int The entry's index, or -1 if the extent doesn't exist
+ */
+static int open_extent(Cpm* cpm, Disk* disk, uint8_t* fcb) {
+    int index = find_entry(cpm, disk, fcb, 0, 0);
+    if (index < 0) {
+        return -1;
+    }
+    uint8_t* entry = disk_entry(disk, index);
+    memcpy(&fcb[FCB_NAME], &entry[FCB_NAME], FCB_EX - FCB_NAME);
+    memcpy(&fcb[16], &entry[16], 16);
+
+    uint8_t extent = fcb[FCB_EX] & 0x1f;
+    uint8_t last = entry[FCB_EX] & 0x1f;
+    fcb[FCB_RC] = extent < last ? RECORDS_PER_EXTENT : extent == last ? entry[FCB_RC] : 0;
+    fcb[FCB_S2] |= FCB_UNMODIFIED;
+    return index;
+}
+
+/**
+ * @brief Writes the FCB's block pointers and record count back to its directory entry, if it
+ *  was written to since it was opened.
+ *
+ * @return int 0, or -1 if the entry is gone
+ */
+static int close_extent(Cpm* cpm, Disk* disk, uint8_t* fcb) {
+    if (fcb[FCB_S2] & FCB_UNMODIFIED) {
+        return 0;
+    }
+    int index = find_entry(cpm, disk, fcb, 0, 0);
+    if (index < 0) {
+        return -1;
+    }
+
+    uint8_t* entry = disk_entry(disk, index);
+    int i;
+    for (i = 0; i < disk_pointers(disk); i++) {
+        if (disk_get_block(disk, entry, i) == 0) {
+            disk_set_block(disk, entry, i, disk_get_block(disk, fcb, i));
+        }
+    }
+    uint8_t extent = fcb[FCB_EX] & 0x1f;
+    uint8_t last = entry[FCB_EX] & 0x1f;
+    if (extent > last) {
+        entry[FCB_EX] = extent;
+        entry[FCB_RC] = fcb[FCB_RC];
+    }
+    else if (extent == last && fcb[FCB_RC] > entry[FCB_RC]) {
+        entry[FCB_RC] = fcb[FCB_RC];
+    }
+    fcb[FCB_S2] |= FCB_UNMODIFIED;
+    return 0;
+}
+
+/**
+ * @brief Creates an empty directory entry for the FCB's current extent.
+ *
+ * @return int The entry's index, or -1 if the directory is full
+ */
+static int make_entry(Cpm* cpm, Disk* disk, uint8_t* fcb) {
+    int i;
+    for (i = 0; i <= disk->format.drm; i++) {
+        uint8_t* entry = disk_entry(disk, i);
+        if (entry == NULL || entry[0] != DISK_ENTRY_FREE) {
+            continue;
+        }
+        memset(entry, 0, DISK_ENTRY_SIZE);
+        entry[0] = cpm->user;
+        memcpy(&entry[FCB_NAME], &fcb[FCB_NAME], FCB_EX - FCB_NAME);
+        entry[FCB_EX] = fcb[FCB_EX] & 0x1f;
+        entry[FCB_S2] = fcb[FCB_S2] & 0x3f;
+
+        fcb[FCB_RC] = 0;
+        memset(&fcb[16], 0, 16);
+        fcb[FCB_S2] |= FCB_UNMODIFIED;
+        return i;
+    }
+    return -1;
+}
+
+/**
+ * @brief Moves the FCB on to its next logical extent, without opening it.
+ *
+ * @return int 0, or -1 past the largest file CP/M can have (8MB)
+ */
+static int next_extent(uint8_t* fcb) {
+    uint8_t extent = (fcb[FCB_EX] & 0x1f) + 1;
+    uint8_t s2 = fcb[FCB_S2] & 0x3f;
+    if (extent == 32) {
+        extent = 0;
+        s2++;
+    }
+    if (s2 >= 16) {
+        return -1;
+    }
+    fcb[FCB_EX] = extent;
+    fcb[FCB_S2] = s2 | (fcb[FCB_S2] & FCB_UNMODIFIED);
+    fcb[FCB_CR] = 0;
+    return 0;
+}
+
+/**
+ * @brief Reads the FCB's current record into the DMA buffer.
+ *
+ * @return uint8_t 0, or 1 if the record hasn't been written
+ */
+static uint8_t read_record(Cpm* cpm, Disk* disk, uint8_t* fcb) {
+    DiskFormat* format = &disk->format;
+    if (fcb[FCB_CR] >= fcb[FCB_RC]) {
+        return 1;
+    }
+    uint16_t record = (fcb[FCB_EX] & format->exm) * RECORDS_PER_EXTENT + fcb[FCB_CR];
+    uint16_t block = disk_get_block(disk, fcb, record >> format->bsh);
+    uint8_t* data = block != 0 ? disk_record(disk, block, record & format->blm) : NULL;
+    if (data == NULL) {
+        return 1;
+    }
+    copy_to_memory(cpm, cpm->dma, data, DISK_RECORD_SIZE);
+    return 0;
+}
+
+/**
+ * @brief Writes the DMA buffer to the FCB's current record, allocating its block if it doesn't
+ *  have one yet.
+ *
+ * @param zero_fill Clear a newly allocated block first (BDOS 40)
+ * @return uint8_t 0, or 2 if the disk is full
+ */
+static uint8_t write_record(Cpm* cpm, Disk* disk, uint8_t* fcb, int zero_fill) {
+    DiskFormat* format = &disk->format;
+    uint16_t record = (fcb[FCB_EX] & format->exm) * RECORDS_PER_EXTENT + fcb[FCB_CR];
+    int pointer = record >> format->bsh;
+    uint16_t block = disk_get_block(disk, fcb, pointer);
+    if (block == 0) {
+        block = disk_allocate(disk);
+        if (block == 0) {
+            return 2;
+        }
+        disk_set_block(disk, fcb, pointer, block);
+        int i;
+        for (i = 0; zero_fill && i <= format->blm; i++) {
+            memset(disk_record(disk, block, i), 0, DISK_RECORD_SIZE);
+        }
+    }
+
+    uint8_t* data = disk_record(disk, block, record & format->blm);
+    if (data == NULL) {
+        return 2;
+    }
+    copy_from_memory(cpm, cpm->dma, data, DISK_RECORD_SIZE);
+    fcb[FCB_S2] &= ~FCB_UNMODIFIED;
+    if (fcb[FCB_CR] >= fcb[FCB_RC]) {
+        fcb[FCB_RC] = fcb[FCB_CR] + 1;
+    }
+    return 0;
+}
+
+/**
+ * @brief Points the FCB at its random record (r0-r2), opening that extent if it's a different
+ *  one. Writing creates the extent if it doesn't exist.
+ *
+ * @return uint8_t 0, or the random access error code
+ */
+static uint8_t seek_random(Cpm* cpm, Disk* disk, uint8_t* fcb, int writing) {
+    if (fcb[FCB_R0 + 2] != 0) {
+        return 6;
+    }
+    uint16_t record = fcb[FCB_R0] | fcb[FCB_R0 + 1] << 8;
+    uint8_t extent = (record / RECORDS_PER_EXTENT) & 0x1f;
+    uint8_t s2 = record / RECORDS_PER_EXTENT / 32;
+    fcb[FCB_CR] = record % RECORDS_PER_EXTENT;
+    if (extent == (fcb[FCB_EX] & 0x1f) && s2 == (fcb[FCB_S2] & 0x3f)) {
+        return 0;
+    }
+
+    if (close_extent(cpm, disk, fcb) < 0) {
+        return 3;
+    }
+    fcb[FCB_EX] = extent;
+    fcb[FCB_S2] = s2 | FCB_UNMODIFIED;
+    if (open_extent(cpm, disk, fcb) < 0) {
+        if (!writing) {
+            return 4;
+        }
+        if (make_entry(cpm, disk, fcb) < 0) {
+            return 5;
+        }
+    }
+    return 0;
+}
+
+#pragma endregion
+
+#pragma region BDOS
+
+/**
+ * @brief BDOS 17 and 18: finds the next directory entry matching the FCB, and copies the
+ *  directory record it's in to the DMA buffer. A ? drive matches every entry, even empty ones.
+ *
+ * @return uint16_t Which of the record's 4 entries it is, or 0xff if there are no more
+ */
+static uint16_t search(Cpm* cpm, int first) {
+    if (first) {
+        copy_from_memory(cpm, cpm->state->de, cpm->search, FCB_SIZE);
+        cpm->search_drive = fcb_drive(cpm, cpm->search);
+        cpm->search_index = 0;
+    }
+    Disk* disk = select_disk(cpm, cpm->search_drive);
+    if (disk == NULL) {
+        return 0xff;
+    }
+
+    uint8_t* pattern = cpm->search;
+    for (; cpm->search_index <= disk->format.drm; cpm->search_index++) {
+        int index = cpm->search_index;
+        uint8_t* entry = disk_entry(disk, index);
+        if (entry == NULL) {
+            break;
+        }
+        int match = pattern[FCB_DRIVE] == '?' || (entry[0] == cpm->user &&
+            names_match(pattern, entry) &&
+            (pattern[FCB_EX] == '?' || extents_match(disk, pattern, entry)));
+        if (match) {
+            int slot = index % (DISK_RECORD_SIZE / DISK_ENTRY_SIZE);
+            copy_to_memory(cpm, cpm->dma, entry - slot * DISK_ENTRY_SIZE, DISK_RECORD_SIZE);
+            cpm->search_index++;
+            return slot;
+        }
+    }
+    return 0xff;
+}
+
+/**
+ * @brief The BDOS calls that take an FCB (15-23, 30 and 33-40).
+ */
+static uint16_t file_call(Cpm* cpm, uint8_t function) {
+    uint16_t addr = cpm->state->de;
+    uint8_t fcb[FCB_SIZE];
+    copy_from_memory(cpm, addr, fcb, FCB_SIZE);
+    int drive = fcb_drive(cpm, fcb);
+    Disk* disk = select_disk(cpm, drive);
+    if (disk == NULL) {
+        return 0xff;
+    }
+
+    int writes = function == 19 || function == 21 || function == 22 || function == 23 ||
+        function == 30 || function == 34 || function == 40;
+    if (writes && check_writable(cpm, drive) < 0) {
+        return 0xff;
+    }
+    if ((function == 21 || function == 34 || function == 40) && (fcb[FCB_T1] & 0x80)) {
+        bdos_error(cpm, drive, "File R/O");
+        return 0xff;
+    }
+
+    uint16_t result = 0;
+    int random = function >= 33;
+    int index, found;
+    switch (function) {
+        case 15:                                            // Open file
+            fcb[FCB_S2] = 0;
+            index = open_extent(cpm, disk, fcb);
+            result = index < 0 ? 0xff : index & 3;
+            break;
+        case 16:                                            // Close file
+            result = close_extent(cpm, disk, fcb) < 0 ? 0xff : 0;
+            break;
+        case 19:                                            // Delete file
+        case 23:                                            // Rename file
+        case 30:                                            // Set file attributes
+            found = 0;
+            for (index = 0; (index = find_entry(cpm, disk, fcb, index, 1)) >= 0; index++) {
+                uint8_t* entry = disk_entry(disk, index);
+                int i;
+                if (function == 19) {
+                    if (entry[FCB_T1] & 0x80) {
+                        bdos_error(cpm, drive, "File R/O");
+                        return 0xff;
+                    }
+                    disk_release(disk, entry);
+                    entry[0] = DISK_ENTRY_FREE;
+                }
+                for (i = FCB_NAME; i < FCB_EX && function == 23; i++) {
+                    entry[i] = (fcb[16 + i] & 0x7f) | (entry[i] & 0x80);
+                }
+                for (i = FCB_NAME; i < FCB_EX && function == 30; i++) {
+                    entry[i] = fcb[i];
+                }
+                found = 1;
+            }
+            result = found ? 0 : 0xff;
+            break;
+        case 20:                                            // Read sequential
+            if (fcb[FCB_CR] >= RECORDS_PER_EXTENT) {
+                close_extent(cpm, disk, fcb);
+                if (next_extent(fcb) < 0 || open_extent(cpm, disk, fcb) < 0) {
+                    result = 1;
+                    break;
+                }
+            }
+            result = read_record(cpm, disk, fcb);
+            fcb[FCB_CR] += result == 0;
+            break;
+        case 21:                                            // Write sequential
+            if (fcb[FCB_CR] >= RECORDS_PER_EXTENT) {
+                if (close_extent(cpm, disk, fcb) < 0 || next_extent(fcb) < 0) {
+                    result = 1;
+                    break;
+                }
+                if (open_extent(cpm, disk, fcb) < 0 && make_entry(cpm, disk, fcb) < 0) {
+                    result = 1;
+                    break;
+                }
+            }
+            result = write_record(cpm, disk, fcb, 0);
+            fcb[FCB_CR] += result == 0;
+            break;
+        case 22:                                            // Make file
+            index = make_entry(cpm, disk, fcb);
+            result = index < 0 ? 0xff : index & 3;
+            break;
+        case 33:                                            // Read random
+            result = seek_random(cpm, disk, fcb, 0);
+            if (result == 0) {
+                result = read_record(cpm, disk, fcb);
+            }
+            break;
+        case 34:                                            // Write random
+        case 40:                                            // Write random with zero fill
+            result = seek_random(cpm, disk, fcb, 1);
+            if (result == 0) {
+                result = write_record(cpm, disk, fcb, function == 40);
+            }
+            break;
+        case 35: {                                          // Compute file size
+            uint32_t size = 0;
+            for (index = 0; (index = find_entry(cpm, disk, fcb, index, 1)) >= 0; index++) {
+                uint8_t* entry = disk_entry(disk, index);
+                uint32_t extent = (entry[FCB_S2] & 0x3f) * 32 + (entry[FCB_EX] & 0x1f);
+                uint32_t end = extent * RECORDS_PER_EXTENT + entry[FCB_RC];
+                size = end > size ? end : size;
+            }
+            fcb[FCB_R0] = size & 0xff;
+            fcb[FCB_R0 + 1] = size >> 8;
+            fcb[FCB_R0 + 2] = size >> 16;
+            break;
+        }
+        case 36: {                                          // Set random record
+            uint32_t record = ((fcb[FCB_S2] & 0x3f) * 32 + (fcb[FCB_EX] & 0x1f)) *
+                RECORDS_PER_EXTENT + fcb[FCB_CR];
+            fcb[FCB_R0] = record & 0xff;
+            fcb[FCB_R0 + 1] = record >> 8;
+            fcb[FCB_R0 + 2] = record >> 16;
+            break;
+        }
+        default:
+            break;
+    }
+
+    copy_to_memory(cpm, addr, fcb, random ? FCB_SIZE : FCB_SEQUENTIAL_SIZE);
+    return result;
+}
+
+/**
+ * @brief Handles a BDOS call: the function is in C and its parameter in DE (or E). The result
+ *  goes in HL, and in A and B as well, like CP/M does.
+ */
+static void bdos(Cpm* cpm) {
+    State8080* state = cpm->state;
+    uint8_t function = state->c;
+    uint8_t e = state->e;
+    uint16_t result = 0;
+    cpm->bdos_calls++;
+
+    switch (function) {
+        case 0:                                             // System reset
+            stop(cpm, NULL);
+            break;
+        case 1:                                             // Console input
+            result = console_in(cpm);
+            if (!cpm->exited) {
+                console_echo(cpm, result);
+            }
+            break;
+        case 2:                                             // Console output
+            console_out(cpm, e);
+            break;
+        case 3:                                             // Reader input
+            result = 0x1a;
+            break;
+        case 4:                                             // Punch output
+        case 5:                                             // List output
+            break;
+        case 6:                                             // Direct console I/O
+            if (e == 0xff) {
+                result = console_pending(cpm) ? console_in(cpm) : 0;
+            }
+            else if (e == 0xfe) {
+                result = console_pending(cpm) ? 0xff : 0;
+            }
+            else {
+                console_put(cpm, e);
+            }
+            break;
+        case 7:                                             // Get IOBYTE
+            result = state->memory[0x0003];
+            break;
+        case 8:                                             // Set IOBYTE
+            copy_to_memory(cpm, 0x0003, &e, 1);
+            break;
+        case 9: {                                           // Print string
+            uint16_t addr = state->de;
+            int i;
+            for (i = 0; i < 0x10000 && state->memory[addr] != '$'; i++) {
+                console_out(cpm, state->memory[addr++]);
+            }
+            break;
+        }
+        case 10:                                            // Read console buffer
+            read_line(cpm, state->de);
+            break;
+        case 11:                                            // Console status
+            result = console_pending(cpm) ? 0xff : 0;
+            break;
+        case 12:                                            // Version: CP/M 2.2
+            result = 0x0022;
+            break;
+        case 13: {                                          // Reset disk system
+            int drive;
+            for (drive = 0; drive < CPM_MAX_DISKS; drive++) {
+                if (cpm->disks[drive] != NULL) {
+                    disk_login(cpm->disks[drive]);
+                }
+            }
+            cpm->drive = 0;
+            cpm->dma = 0x0080;
+            cpm->read_only = 0;
+            break;
+        }
+        case 14:                                            // Select disk
+            if (select_disk(cpm, e) != NULL) {
+                cpm->drive = e;
+                uint8_t drive = cpm->user << 4 | cpm->drive;
+                copy_to_memory(cpm, 0x0004, &drive, 1);
+            }
+            break;
+        case 24: {                                          // Login vector
+            int drive;
+            for (drive = 0; drive < CPM_MAX_DISKS; drive++) {
+                result |= (cpm->disks[drive] != NULL) << drive;
+            }
+            break;
+        }
+        case 25:                                            // Current disk
+            result = cpm->drive;
+            break;
+        case 26:                                            // Set DMA address
+            cpm->dma = state->de;
+            break;
+        case 27: {                                          // Allocation vector address
+            Disk* disk = select_disk(cpm, cpm->drive);
+            if (disk == NULL) {
+                break;
+            }
+            uint8_t vector[CPM_ALV_SIZE] = { 0 };
+            int block;
+            for (block = 0; block <= disk->format.dsm; block++) {
+                vector[block / 8] |= disk->allocation[block] << (7 - block % 8);
+            }
+            result = CPM_ALV + cpm->drive * CPM_ALV_SIZE;
+            copy_to_memory(cpm, result, vector, (disk->format.dsm + 8) / 8);
+            break;
+        }
+        case 28:                                            // Write protect disk
+            cpm->read_only |= 1 << cpm->drive;
+            break;
+        case 29: {                                          // Read-only vector
+            int drive;
+            result = cpm->read_only;
+            for (drive = 0; drive < CPM_MAX_DISKS; drive++) {
+                if (cpm->disks[drive] != NULL && cpm->disks[drive]->read_only) {
+                    result |= 1 << drive;
+                }
+            }
+            break;
+        }
+        case 31:                                            // Disk parameter block address
+            result = CPM_DPB + cpm->drive * 16;
+            break;
+        case 32:                                            // Get or set user code
+            if (e == 0xff) {
+                result = cpm->user;
+            }
+            else {
+                cpm->user = e & 0x0f;
+                uint8_t drive = cpm->user << 4 | cpm->drive;
+                copy_to_memory(cpm, 0x0004, &drive, 1);
+            }
+            break;
+        case 17:                                            // Search for first
+        case 18:                                            // Search for next
+            result = search(cpm, function == 17);
+            break;
+        case 15: case 16: case 19: case 20: case 21: case 22: case 23: case 30:
+        case 33: case 34: case 35: case 36: case 40:
+            result = file_call(cpm, function);
+            break;
+        default:                                            // 37 (reset drive) and unknown
+            break;
+    }
+
+    state->hl = result;
+    state->a = result & 0xff;
+    state->b = result >> 8;
+}
+
+#pragma endregion
+
+#pragma region BIOS
+
+/**
+ * @brief Handles a call to one of the 17 BIOS entry points. Programs rarely call these
+ *  directly, but the disk ones work on the same images as the BDOS, a sector at a time.
+ */
+static void bios(Cpm* cpm, int function) {
+    State8080* state = cpm->state;
+    Disk* disk = cpm->bios_drive < CPM_MAX_DISKS ? cpm->disks[cpm->bios_drive] : NULL;
+    uint8_t* data;
+    cpm->bios_calls++;
+
+    switch (function) {
+        case 0:                                             // BOOT
+        case 1:                                             // WBOOT
+            stop(cpm, NULL);
+            break;
+        case 2:                                             // CONST
+            state->a = console_pending(cpm) ? 0xff : 0;
+            break;
+        case 3:                                             // CONIN
+            state->a = console_in(cpm);
+            break;
+        case 4:                                             // CONOUT
+            console_put(cpm, state->c);
+            break;
+        case 7:                                             // READER
+            state->a = 0x1a;
+            break;
+        case 8:                                             // HOME
+            cpm->track = 0;
+            break;
+        case 9:                                             // SELDSK
+            cpm->bios_drive = state->c;
+            state->hl = state->c < CPM_MAX_DISKS && cpm->disks[state->c] != NULL ?
+                CPM_DPH + state->c * 16 : 0;
+            break;
+        case 10:                                            // SETTRK
+            cpm->track = state->bc;
+            break;
+        case 11:                                            // SETSEC
+            cpm->sector = state->bc;
+            break;
+        case 12:                                            // SETDMA
+            cpm->dma = state->bc;
+            break;
+        case 13:                                            // READ
+            data = disk != NULL ? disk_sector(disk, cpm->track, cpm->sector) : NULL;
+            if (data != NULL) {
+                copy_to_memory(cpm, cpm->dma, data, DISK_RECORD_SIZE);
+            }
+            state->a = data == NULL;
+            break;
+        case 14:                                            // WRITE
+            data = disk != NULL && !disk->read_only ?
+                disk_sector(disk, cpm->track, cpm->sector) : NULL;
+            if (data != NULL) {
+                copy_from_memory(cpm, cpm->dma, data, DISK_RECORD_SIZE);
+            }
+            state->a = data == NULL;
+            break;
+        case 15:                                            // LISTST
+            state->a = 0xff;
+            break;
+        case 16:                                            // SECTRAN
+            state->hl = state->de != 0 ? state->memory[(uint16_t)(state->de + state->bc)] :
+                state->bc;
+            break;
+        default:                                            // LIST, PUNCH
+            break;
+    }
+}
+
+/**
+ * @brief OUT handler. Only the OUTs in the trap stubs do anything: the port says which call
+ *  it is, and pc makes sure it was the stub and not the program that made it.
+ */
+static void cpm_out(void* context, uint8_t port, uint8_t value) {
+    Cpm* cpm = context;
+    uint16_t pc = cpm->state->pc;
+    (void)value;
+    if (pc == CPM_BDOS && port == CPM_BDOS_PORT) {
+        bdos(cpm);
+    }
+    else if (pc >= CPM_BIOS && pc < CPM_BIOS + 17 * 3 && (pc - CPM_BIOS) % 3 == 0 &&
+             port == CPM_BIOS_PORT + (pc - CPM_BIOS) / 3) {
+        bios(cpm, (pc - CPM_BIOS) / 3);
+    }
+}
+
+#pragma endregion
+
+/**
+ * @brief Creates a CP/M machine around a state, with the program loaded at 0x100 already.
+ *  Page zero gets its jumps to the BIOS warm boot and the BDOS, each entry point becomes a
+ *  trap stub, and the stack starts under the BDOS with a return address of 0, so a program
+ *  that returns warm boots.
+ *
+ * @param state The 8080 state
+ * @return Cpm*
+ */
+Cpm* cpm_create(State8080* state) {
+    Cpm* cpm = calloc(1, sizeof(Cpm));
+    cpm->state = state;
+    cpm->dma = 0x0080;
+    cpm->input_fd = STDIN_FILENO;
+    cpm->output_fd = STDOUT_FILENO;
+    cpm->output_tty = isatty(STDOUT_FILENO);
+    state->port_in = NULL;
+    state->port_out = cpm_out;
+    state->io_context = cpm;
+
+    uint8_t page_zero[8] = {
+        0xc3, (CPM_BIOS + 3) & 0xff, (CPM_BIOS + 3) >> 8,   // JMP WBOOT
+        0x00,                                               // IOBYTE
+        0x00,                                               // User and drive
+        0xc3, CPM_BDOS & 0xff, CPM_BDOS >> 8,               // JMP BDOS
+    };
+    copy_to_memory(cpm, 0x0000, page_zero, sizeof(page_zero));
+    uint8_t stub[3] = { 0xd3, CPM_BDOS_PORT, 0xc9 };       // OUT port, RET
+    copy_to_memory(cpm, CPM_BDOS, stub, sizeof(stub));
+    int i;
+    for (i = 0; i < 17; i++) {
+        stub[1] = CPM_BIOS_PORT + i;
+        copy_to_memory(cpm, CPM_BIOS + i * 3, stub, sizeof(stub));
+    }
+
+    state->sp = CPM_BDOS - 8;
+    store_word(cpm, state->sp, 0x0000);
+    state->pc = CPM_TPA;
+    return cpm;
+}
+
+void cpm_free(Cpm* cpm) {
+    cpm_flush(cpm);
+    int i;
+    for (i = 0; i < CPM_MAX_DISKS; i++) {
+        if (cpm->disks[i] != NULL) {
+            disk_close(cpm->disks[i]);
+        }
+    }
+    cpm->state->port_out = NULL;
+    cpm->state->io_context = NULL;
+    free(cpm);
+}
+
+/**
+ * @brief Fills in a file name the way the CCP does for the default FCBs: an optional drive,
+ *  upper case, padded with spaces, and * turned into ?s.
+ */
+static void parse_name(const char* text, uint8_t* fcb) {
+    memset(fcb, 0, 16);
+    memset(&fcb[FCB_NAME], ' ', FCB_EX - FCB_NAME);
+    if (text[0] != '\0' && text[1] == ':') {
+        fcb[FCB_DRIVE] = toupper((unsigned char)text[0]) - 'A' + 1;
+        text += 2;
+    }
+
+    int field, i;
+    for (field = 0; field < 2; field++) {
+        int start = field == 0 ? FCB_NAME : FCB_T1;
+        int length = field == 0 ? 8 : 3;
+        for (i = 0; *text != '\0' && *text != '.'; text++) {
+            if (*text == '*') {
+                memset(&fcb[start + i], '?', length - i);
+                i = length;
+            }
+            else if (i < length) {
+                fcb[start + i++] = toupper((unsigned char)*text);
+            }
+        }
+        if (*text == '.') {
+            text++;
+        }
+    }
+}
+
+/**
+ * @brief Sets up the command line as the CCP would: the tail (upper case, after a space) at
+ *  0x80 with its length first, and the first two arguments parsed into the FCBs at 0x5c and
+ *  0x6c.
+ *
+ * @param cpm
+ * @param args Arguments after the program name
+ * @param count Number of arguments
+ */
+void cpm_set_command_line(Cpm* cpm, char** args, int count) {
+    uint8_t tail[128] = { 0 };
+    int length = 0;
+    int i;
+    for (i = 0; i < count; i++) {
+        const char* arg = args[i];
+        if (length < 127) {
+            tail[1 + length++] = ' ';
+        }
+        for (; *arg != '\0' && length < 127; arg++) {
+            tail[1 + length++] = toupper((unsigned char)*arg);
+        }
+    }
+    tail[0] = length;
+    copy_to_memory(cpm, 0x0080, tail, sizeof(tail));
+
+    uint8_t fcbs[0x24];
+    parse_name(count > 0 ? args[0] : "", fcbs);
+    parse_name(count > 1 ? args[1] : "", &fcbs[16]);
+    memset(&fcbs[FCB_CR], 0, FCB_SIZE - FCB_CR);
+    copy_to_memory(cpm, 0x005c, fcbs, sizeof(fcbs));
+}
+
+/**
+ * @brief Runs the program until it exits or the cycle counter reaches a limit.
+ *
+ * @param cpm
+ * @param cycle_limit Value of the cycle counter to stop at
+ */
+void cpm_run(Cpm* cpm, uint64_t cycle_limit) {
+    State8080* state = cpm->state;
+    while (!cpm->exited && state->cycles < cycle_limit) {
+        cpm_emulate_block(state, cycle_limit, cpm->superinstructions, 0, NULL);
+    }
+}
@@ -0,0 +1,77 @@
+#ifndef CPM_H
+#define CPM_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu8080.h"
+#include "disk.h"
+
+#define CPM_MAX_DISKS 4
+#define CPM_TPA 0x0100
+#define CPM_CONSOLE_BUFFER 65536
+
+// Top of memory. The TPA runs up to the BDOS entry point, which is what 0x0006 points to.
+#define CPM_BDOS 0xf006
+#define CPM_BIOS 0xf100             // Jump table, 3 bytes per function
+#define CPM_DPH 0xf140              // Disk parameter header per drive, 16 bytes each
+#define CPM_DPB 0xf180              // Disk parameter block per drive, 16 bytes each
+#define CPM_SKEW 0xf1c0             // Sector translation table for 8" floppies
+#define CPM_DIRBUF 0xf200           // 128 byte directory buffer
+#define CPM_ALV 0xf300              // Allocation vector per drive, CPM_ALV_SIZE bytes each
+#define CPM_ALV_SIZE 512            // Enough for the 4096 blocks of an 8MB disk
+#define CPM_EXIT 0xffff             // pc is parked here once the program has finished
+
+// Traps: each BIOS entry and the BDOS entry is an OUT to one of these ports, then a RET.
+#define CPM_BIOS_PORT 0xe0          // Plus the BIOS function number
+#define CPM_BDOS_PORT 0xff
+
+/**
+ * @brief A CP/M 2.2 machine. There's no CCP or BDOS code: the BIOS and BDOS entry points trap
+ *  out to C, with a file layer that works directly on the disk images (mapped into memory) in
+ *  CP/M's own on-disk format. The console is stdin and stdout, through buffers.
+ */
+typedef struct Cpm {
+    State8080* state;
+    Disk* disks[CPM_MAX_DISKS];
+    uint8_t drive;                  // Current drive (0 is A:)
+    uint8_t user;
+    uint16_t dma;
+    uint16_t read_only;             // Drives write protected by BDOS 28, a bit each
+
+    uint8_t bios_drive;             // Set by the BIOS disk calls
+    uint16_t track;
+    uint16_t sector;
+
+    uint8_t search[36];             // FCB being searched for by BDOS 17 and 18
+    uint8_t search_drive;
+    int search_index;
+
+    int input_fd;
+    int output_fd;
+    uint8_t input[CPM_CONSOLE_BUFFER];
+    size_t input_start, input_end;
+    int input_eof;                  // stdin has no more to read
+    int input_ended;                // The program was already given a ^Z for it
+    uint8_t output[CPM_CONSOLE_BUFFER];
+    size_t output_length;
+    int output_tty;                 // Flush before polling for input, so prompts show up
+    int column;                     // For expanding tabs
+
+    int superinstructions;
+    int exited;                     // The program warm booted (or couldn't carry on)
+    char message[64];               // Why it stopped, if it wasn't the program's choice
+    uint64_t bdos_calls;
+    uint64_t bios_calls;
+} Cpm;
+
+Cpm* cpm_create(State8080* state);
+void cpm_free(Cpm* cpm);
+int cpm_mount(Cpm* cpm, int drive, const char* path);
+void cpm_set_command_line(Cpm* cpm, char** args, int count);
+void cpm_run(Cpm* cpm, uint64_t cycle_limit);
+void cpm_flush(Cpm* cpm);
+int cpm_emulate_block(State8080* state, uint64_t cycle_limit, int fused, uint16_t loop_window,
+    const uint8_t* ignored_loops);
+
+#endif
@@ -0,0 +1,269 @@
+#define _GNU_SOURCE
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "cpu8080.h"
+
+// The generic build of the core: flat memory, ports through the state's callbacks.
+#define CORE_BLOCK emulate_block
+#include "cpu8080_core.h"
+
+#pragma region Helpers
+
+/**
+ * @brief Prints the codes/flags for an 8080 state
+ * 
+ * @param state 
+ */
+void print_codes(State8080* state) {
+    printf("Codes {z: %u, s: %u, p: %u, cy: %u, ac: %u}\n", 
+        state->codes.z,
+        state->codes.s,
+        state->codes.p,
+        state->codes.cy,
+        state->codes.ac);
+}
+
+/**
+ * @brief Prints a state
+ * 
+ * @param state 
+ */
+void print_state(State8080* state) {
+    printf("State {a: 0x%02x, bc: 0x%04x, de: 0x%04x, hl: 0x%04x, pc: 0x%04x, sp: 0x%04x}\n\t\t", 
+        state->a,
+        state->bc,
+        state->de,
+        state->hl,
+        state->pc, 
+        state->sp);
+
+    print_codes(state);
+}
+
+#pragma endregion
+
+#pragma region Generic Build
+
+// The fields every operation touches should share a cache line.
+_Static_assert(offsetof(State8080, halted) < 64, "State8080's hot fields don't fit a cache line");
+
+/**
+ * @brief Delivers an interrupt, which runs RST interrupt_num. Does nothing if interrupts are
+ *  disabled. Delivering one disables interrupts until the program runs EI again, and wakes the
+ *  processor up from HLT.
+ * 
+ * @param state The 8080 state
+ * @param interrupt_num Interrupt number (0-7)
+ * @return int 1 if the interrupt was delivered, 0 if interrupts are disabled
+ */
+int generate_interrupt(State8080* state, int interrupt_num) {
+    if (!state->int_enable) {
+        return 0;
+    }
+
+    push_address(state, state->pc);
+    state->pc = 8 * interrupt_num;
+    state->int_enable = 0;
+    state->halted = 0;
+    state->cycles += OP_CYCLES[0xc7];
+    state->interrupts++;
+    return 1;
+}
+
+/**
+ * @brief Emulates the operation at the program counter.
+ * 
+ * @param state The 8080 state
+ * @return int Number of clock cycles the operation took
+ */
+int emulate_op(State8080* state) {
+    return execute(state);
+}
+
+/**
+ * @brief Same as emulate_op, except that common sequences of operations run as one fused step
+ *  when they can (see execute_fused).
+ * 
+ * @param state The 8080 state
+ * @param cycle_limit Cycle count the caller stops at (e.g. the next interrupt)
+ * @return int Cycles taken, by one operation or the whole group
+ */
+int emulate_fused(State8080* state, uint64_t cycle_limit) {
+    return execute_fused(state, cycle_limit);
+}
+
+#pragma endregion
+
+#pragma region Emulator Initialization
+
+/**
+ * @brief Bumps the page versions for memory written from outside the emulated program (loading
+ *  a file, a debugger writing memory).
+ * 
+ * @param state The 8080 state
+ * @param addr First address written
+ * @param length Number of bytes written
+ */
+void mark_written(State8080* state, uint16_t addr, uint32_t length) {
+    uint32_t page;
+    if (length == 0) {
+        return;
+    }
+    for (page = addr >> 8; page <= (addr + length - 1) >> 8; page++) {
+        state->page_versions[page & 0xff]++;
+    }
+}
+
+/**
+ * @brief Allocates a zeroed state and its page versions, without any memory, for a caller that
+ *  maps its own. The state starts on a cache line boundary so its hot fields share one.
+ * 
+ * @return State8080* The state, with memory NULL
+ */
+State8080* init_8080_without_memory() {
+    size_t size = (sizeof(State8080) + 63) / 64 * 64;
+    State8080* state = aligned_alloc(64, size);
+    memset(state, 0, size);
+    state->page_versions = calloc(256, sizeof(uint32_t));
+    return state;
+}
+
+/**
+ * @brief Initializes an 8080 state with 64kb memory allocated.
+ * 
+ * @return State8080* 
+ */
+State8080* init_8080() {
+    State8080* state = init_8080_without_memory();
+    state->memory = calloc(0x10000, 1);
+    return state;
+}
+
+/**
+ * @brief Same as init_8080, but the memory starts out as a copy-on-write mapping of an image
+ *  instead of a private 64KB allocation.
+ * 
+ * @param image The image, which stays alive at least as long as the state
+ * @return State8080* The state, or NULL if the image couldn't be mapped
+ */
+State8080* init_8080_shared(MemoryImage* image) {
+    uint8_t* memory = mmap(NULL, 0x10000, PROT_READ | PROT_WRITE, MAP_PRIVATE, image->fd, 0);
+    if (memory == MAP_FAILED) {
+        return NULL;
+    }
+
+    State8080* state = init_8080_without_memory();
+    state->memory = memory;
+    state->image = image;
+    atomic_fetch_add(&image->references, 1);
+    return state;
+}
+
+/**
+ * @brief Frees a state from init_8080 or init_8080_shared, along with its memory. A state from
+ *  init_8080_without_memory needs its memory released by the caller and set back to NULL first.
+ * 
+ * @param state The 8080 state
+ */
+void free_8080(State8080* state) {
+    if (state->image != NULL) {
+        munmap(state->memory, 0x10000);
+        release_memory_image(state->image);
+    }
+    else {
+        free(state->memory);
+    }
+    free(state->page_versions);
+    free(state);
+}
+
+/**
+ * @brief Snapshots a state's memory as an image for init_8080_shared. Host pages that are all
+ *  zero are left as holes in the file, so they take no memory until a state writes them.
+ * 
+ * @param state The 8080 state
+ * @return MemoryImage* The image, holding one reference for the caller, or NULL on failure
+ */
+MemoryImage* create_memory_image(State8080* state) {
+    int fd = memfd_create("8080-image", MFD_CLOEXEC);
+    if (fd < 0 || ftruncate(fd, 0x10000) < 0) {
+        if (fd >= 0) {
+            close(fd);
+        }
+        return NULL;
+    }
+
+    size_t page_size = sysconf(_SC_PAGESIZE);
+    if (page_size > 0x10000) {
+        page_size = 0x10000;
+    }
+    size_t offset, i;
+    for (offset = 0; offset < 0x10000; offset += page_size) {
+        for (i = 0; i < page_size && state->memory[offset + i] == 0; i++);
+        if (i < page_size && pwrite(fd, &state->memory[offset], page_size, offset) < 0) {
+            close(fd);
+            return NULL;
+        }
+    }
+
+    MemoryImage* image = malloc(sizeof(MemoryImage));
+    image->fd = fd;
+    atomic_init(&image->references, 1);
+    return image;
+}
+
+/**
+ * @brief Drops a reference to an image. It's freed once the creator and every state using it
+ *  have let go.
+ * 
+ * @param image 
+ */
+void release_memory_image(MemoryImage* image) {
+    if (atomic_fetch_sub(&image->references, 1) == 1) {
+        close(image->fd);
+        free(image);
+    }
+}
+
+/**
+ * @brief Reads a binary file into a state's memory.
+ * 
+ * @param state The 8080 state
+ * @param filename Path to the file
+ * @param offset The memory offset where the beginning of the file will start
+ * @return uint32_t The size of the file that was read
+ */
+uint32_t read_file_into_memory(State8080* state, char* filename, uint16_t offset) {
+    // Open the file and verify it's valid
+    FILE *file = fopen(filename, "rb");
+
+    if (file == NULL) {
+        printf("\nError: Could not open %s\n", filename);
+        exit(1);
+    }
+
+    // Get the file size and read it into the memory buffer, cutting it off at the top of memory
+    fseek(file, 0L, SEEK_END);
+    long file_size = ftell(file);
+    fseek(file, 0L, SEEK_SET);
+    if (file_size > 0x10000 - offset) {
+        file_size = 0x10000 - offset;
+    }
+
+    fread(&state->memory[offset], file_size, 1, file);
+    fclose(file);
+    mark_written(state, offset, file_size);
+
+    // Set the program counter to the beginning of the rom
+    state->pc = offset;
+
+    return file_size;
+}
+
+#pragma endregion
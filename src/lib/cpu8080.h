@@ -0,0 +1,121 @@
+#ifndef CPU8080_H
+#define CPU8080_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+typedef struct ConditionCodes {
+    uint8_t z : 1;
+    uint8_t s : 1;
+    uint8_t p : 1;
+    uint8_t cy : 1;
+    uint8_t ac : 1;
+} ConditionCodes;
+
+// A register pair and its two halves share storage, so a pair can be used as one 16-bit value
+// without rebuilding it from bytes. The halves are laid out in host byte order.
+#if __BYTE_ORDER__ == __ORDER_BIG_ENDIAN__
+#define REGISTER_PAIR(high, low, pair) \
+    union { struct { uint8_t high; uint8_t low; }; uint16_t pair; }
+#else
+#define REGISTER_PAIR(high, low, pair) \
+    union { struct { uint8_t low; uint8_t high; }; uint16_t pair; }
+#endif
+
+/**
+ * @brief A 64KB memory image that states can share. Each state maps it copy-on-write, so a page
+ *  it never writes stays a single copy in the host however many states there are, and a state
+ *  only costs the pages it dirtied. Pages are the host's (usually 4KB), not the 256 byte pages
+ *  the page versions count.
+ */
+typedef struct MemoryImage {
+    int fd;                         // memfd holding the contents
+    atomic_int references;          // The creator's, plus one per state mapping it
+} MemoryImage;
+
+typedef struct State8080 {
+    // Everything an operation touches comes first, so it all fits in one cache line.
+    uint8_t* memory;
+
+    // 256 counters, one bumped on every write to each 256 byte page, so anything that caches
+    // something about memory (like a hash) can tell which pages changed since it last looked.
+    uint32_t* page_versions;
+
+    uint64_t cycles;
+    uint64_t instructions;          // Operations run, not counting a halted CPU idling
+    uint64_t fused_instructions;    // The ones that ran as part of a superinstruction
+    uint16_t pc;
+    uint16_t sp;
+    uint8_t a;
+    struct ConditionCodes codes;
+    REGISTER_PAIR(b, c, bc);
+    REGISTER_PAIR(d, e, de);
+    REGISTER_PAIR(h, l, hl);
+    uint8_t int_enable;
+    uint8_t halted;
+
+    // I/O ports. IN reads 0 and OUT is ignored when these aren't set.
+    uint8_t (*port_in)(void* context, uint8_t port);
+    void (*port_out)(void* context, uint8_t port, uint8_t value);
+    void* io_context;
+
+    uint64_t interrupts;            // Interrupts delivered
+    MemoryImage* image;             // Memory is a copy-on-write mapping of this, or NULL
+} State8080;
+
+// Every build of the core uses these, so they're defined here where each one can inline them.
+
+/**
+ * @brief Combine two 1-byte immediates into a 2-byte immediate. Useful for register pairs.
+ * 
+ * @param a 1-byte immediate
+ * @param b 1-byte immediate
+ * @return uint16_t Resulting 2-byte immediate
+ */
+static inline uint16_t combine_immediates(uint8_t a, uint8_t b) {
+    return ((uint16_t)a << 8) | (uint16_t)b;
+}
+
+/**
+ * @brief Packs the codes into a flags byte, laid out the way PUSH PSW stores them:
+ *  S Z 0 AC 0 P 1 CY.
+ * 
+ * @param state 
+ * @return uint8_t The flags byte
+ */
+static inline uint8_t pack_codes(State8080* state) {
+    return state->codes.s << 7 | state->codes.z << 6 | state->codes.ac << 4 |
+        state->codes.p << 2 | 1 << 1 | state->codes.cy;
+}
+
+/**
+ * @brief Unpacks a flags byte laid out the way POP PSW loads it.
+ * 
+ * @param state 
+ * @param flags The flags byte
+ */
+static inline void unpack_codes(State8080* state, uint8_t flags) {
+    state->codes.s = (flags >> 7) & 1;
+    state->codes.z = (flags >> 6) & 1;
+    state->codes.ac = (flags >> 4) & 1;
+    state->codes.p = (flags >> 2) & 1;
+    state->codes.cy = flags & 1;
+}
+
+void print_codes(State8080* state);
+void print_state(State8080* state);
+int generate_interrupt(State8080* state, int interrupt_num);
+int emulate_op(State8080* state);
+int emulate_fused(State8080* state, uint64_t cycle_limit);
+int emulate_block(State8080* state, uint64_t cycle_limit, int fused, uint16_t loop_window,
+    const uint8_t* ignored_loops);
+void mark_written(State8080* state, uint16_t addr, uint32_t length);
+State8080* init_8080();
+State8080* init_8080_shared(MemoryImage* image);
+State8080* init_8080_without_memory();
+void free_8080(State8080* state);
+MemoryImage* create_memory_image(State8080* state);
+void release_memory_image(MemoryImage* image);
+uint32_t read_file_into_memory(State8080* state, char* filename, uint16_t offset);
+
+#endif
@@ -0,0 +1,1042 @@
+/**
+ * The 8080 core as macro-instantiated C: everything from decoding an operation to running a
+ *  block of them. This isn't a normal header. A translation unit defines a machine's traits and
+ *  then includes it once, which defines CORE_BLOCK (that machine's emulate_block) and the static
+ *  helpers behind it. cpu8080.c includes it with the defaults for the generic build, where
+ *  memory is flat and the ports go through the state's callbacks. A board includes it again
+ *  with its own memory and port handlers, which then get inlined into the run loop instead of
+ *  called through function pointers.
+ * 
+ * Traits:
+ *  CORE_BLOCK                      Name of the block function to define (required)
+ *  CORE_READ(state, addr)          Reads a byte of memory, opcodes and operands included
+ *  CORE_WRITE(state, addr, value)  Writes a byte of memory, bumping its page version
+ *  CORE_IN(state, port)            Value IN reads from a port
+ *  CORE_OUT(state, port, value)    Handles OUT
+ *  CORE_SYNC_IN, CORE_SYNC_OUT     0 if the IN (or OUT) handler doesn't look at the state, so
+ *                                  CORE_BLOCK needn't write its local copy back around it
+ *  CORE_BLOCK_ENTRY(state, pc)     Nonzero to make CORE_BLOCK stop before the operation at pc.
+ *                                  It's only looked at where straight-line code starts: when
+ *                                  CORE_BLOCK is called and after an operation in OP_ENDS_BLOCK
+ *                                  or a fused group. 0 by default, which compiles away
+ *  CORE_BLOCK_RECHECK(state)       Nonzero to look at CORE_BLOCK_ENTRY again before the next
+ *                                  operation, e.g. after a write to memory it depends on. Looked
+ *                                  at after every operation. 0 by default
+ */
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu8080.h"
+
+#ifndef CORE_BLOCK
+#error "Define CORE_BLOCK before including cpu8080_core.h"
+#endif
+
+#ifndef CORE_READ
+#define CORE_READ(state, addr) ((state)->memory[addr])
+#endif
+
+#ifndef CORE_WRITE
+#define CORE_WRITE(state, addr, value) \
+    ((state)->memory[addr] = (value), (state)->page_versions[(addr) >> 8]++)
+#endif
+
+#ifndef CORE_IN
+#define CORE_IN(state, port) \
+    ((state)->port_in != NULL ? (state)->port_in((state)->io_context, port) : 0)
+#endif
+
+#ifndef CORE_OUT
+#define CORE_OUT(state, port, value) \
+    do { \
+        if ((state)->port_out != NULL) { \
+            (state)->port_out((state)->io_context, port, value); \
+        } \
+    } while (0)
+#endif
+
+#ifndef CORE_SYNC_IN
+#define CORE_SYNC_IN 1
+#endif
+
+#ifndef CORE_SYNC_OUT
+#define CORE_SYNC_OUT 1
+#endif
+
+#ifndef CORE_BLOCK_ENTRY
+#define CORE_BLOCK_ENTRY(state, pc) 0
+#endif
+
+#ifndef CORE_BLOCK_RECHECK
+#define CORE_BLOCK_RECHECK(state) 0
+#endif
+
+// Operations that can be followed by something other than the next operation in memory: jumps,
+// calls, returns and RSTs (with the undocumented aliases), PCHL, and IN and OUT, whose handlers
+// can move pc.
+static const uint8_t OP_ENDS_BLOCK[256] = {
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0,
+    1, 0, 1, 1, 1, 0, 0, 1, 1, 1, 1, 1, 1, 1, 0, 1,
+    1, 0, 1, 1, 1, 0, 0, 1, 1, 1, 1, 1, 1, 1, 0, 1,
+    1, 0, 1, 0, 1, 0, 0, 1, 1, 1, 1, 0, 1, 1, 0, 1,
+    1, 0, 1, 0, 1, 0, 0, 1, 1, 0, 1, 0, 1, 1, 0, 1,
+};
+
+// Clock cycles taken by each opcode. Conditional calls and returns are listed with their
+// branch-taken timings.
+static const uint8_t OP_CYCLES[256] = {
+     4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4,   // 0x00
+     4, 10,  7,  5,  5,  5,  7,  4,  4, 10,  7,  5,  5,  5,  7,  4,   // 0x10
+     4, 10, 16,  5,  5,  5,  7,  4,  4, 10, 16,  5,  5,  5,  7,  4,   // 0x20
+     4, 10, 13,  5, 10, 10, 10,  4,  4, 10, 13,  5,  5,  5,  7,  4,   // 0x30
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,   // 0x40
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,   // 0x50
+     5,  5,  5,  5,  5,  5,  7,  5,  5,  5,  5,  5,  5,  5,  7,  5,   // 0x60
+     7,  7,  7,  7,  7,  7,  7,  7,  5,  5,  5,  5,  5,  5,  7,  5,   // 0x70
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,   // 0x80
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,   // 0x90
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,   // 0xa0
+     4,  4,  4,  4,  4,  4,  7,  4,  4,  4,  4,  4,  4,  4,  7,  4,   // 0xb0
+    11, 10, 10, 10, 17, 11,  7, 11, 11, 10, 10, 10, 17, 17,  7, 11,   // 0xc0
+    11, 10, 10, 10, 17, 11,  7, 11, 11, 10, 10, 10, 17, 17,  7, 11,   // 0xd0
+    11, 10, 10, 18, 17, 11,  7, 11, 11,  5, 10,  5, 17, 17,  7, 11,   // 0xe0
+    11, 10, 10,  4, 17, 11,  7, 11, 11,  5, 10,  4, 17, 17,  7, 11,   // 0xf0
+};
+
+#pragma region Memory
+
+static uint8_t read_memory(State8080* state, uint16_t addr) {
+    return CORE_READ(state, addr);
+}
+
+/**
+ * @brief Every write the emulated program makes goes through here.
+ */
+static void write_memory(State8080* state, uint16_t addr, uint8_t value) {
+    CORE_WRITE(state, addr, value);
+}
+
+/**
+ * @brief 16-bit values are stored low byte first.
+ */
+static uint16_t read_word(State8080* state, uint16_t addr) {
+    return read_memory(state, addr) | (read_memory(state, addr + 1) << 8);
+}
+
+static void write_word(State8080* state, uint16_t addr, uint16_t value) {
+    write_memory(state, addr, value & 0xff);
+    write_memory(state, addr + 1, value >> 8);
+}
+
+#pragma endregion
+
+#pragma region Arithmetic Codes/Flags Calculations
+
+static void calculate_codes_z(State8080* state, uint8_t result) {
+    state->codes.z = (result & 0xff) == 0;
+}
+
+static void calculate_codes_s(State8080* state, uint8_t result) {
+    state->codes.s = (result & 0x80) != 0;
+}
+
+static void calculate_codes_p(State8080* state, uint8_t result) {
+    state->codes.p = !__builtin_parity(result);
+}
+
+/**
+ * @brief The carry is set when an 8-bit operation overflowed (or borrowed) into bit 8.
+ */
+static void calculate_codes_cy(State8080* state, uint16_t result) {
+    state->codes.cy = result > 0xff;
+}
+
+static void calculate_codes_zsp(State8080* state, uint8_t result) {
+    calculate_codes_z(state, result);
+    calculate_codes_s(state, result);
+    calculate_codes_p(state, result);
+}
+
+#pragma endregion
+
+#pragma region Arithmetic Operations
+
+static void add_with_carry(State8080* state, uint8_t value, uint8_t carry) {
+    uint16_t result = (uint16_t)state->a + (uint16_t)value + (uint16_t)carry;
+    state->codes.ac = ((state->a & 0x0f) + (value & 0x0f) + carry) > 0x0f;
+    calculate_codes_cy(state, result);
+    calculate_codes_zsp(state, result);
+    state->a = result & 0xff;
+}
+
+/**
+ * @brief Subtracts by adding the two's complement like the 8080 does, so AC is the carry out of
+ *  bit 3 of that addition and CY is set on a borrow.
+ * 
+ * @return uint8_t The result, which only SUB and SBB store back into the accumulator
+ */
+static uint8_t subtract_with_borrow(State8080* state, uint8_t value, uint8_t borrow) {
+    uint16_t result = (uint16_t)state->a - (uint16_t)value - (uint16_t)borrow;
+    state->codes.ac = ((state->a & 0x0f) - (value & 0x0f) - borrow) >= 0;
+    calculate_codes_cy(state, result);
+    calculate_codes_zsp(state, result);
+    return result & 0xff;
+}
+
+static void add(State8080* state, uint8_t value) {
+    add_with_carry(state, value, 0);
+}
+
+static void adc(State8080* state, uint8_t value) {
+    add_with_carry(state, value, state->codes.cy);
+}
+
+static void dad(State8080* state, uint16_t value) {
+    uint32_t result = (uint32_t)state->hl + value;
+    state->codes.cy = result > 0xffff;
+    state->hl = result;
+}
+
+static void sub(State8080* state, uint8_t value) {
+    state->a = subtract_with_borrow(state, value, 0);
+}
+
+static void sbb(State8080* state, uint8_t value) {
+    state->a = subtract_with_borrow(state, value, state->codes.cy);
+}
+
+static void cmp(State8080* state, uint8_t value) {
+    subtract_with_borrow(state, value, 0);
+}
+
+static void inr(State8080* state, uint8_t* reg) {
+    (*reg)++;
+    state->codes.ac = (*reg & 0x0f) == 0;
+    calculate_codes_zsp(state, *reg);
+}
+
+static void dcr(State8080* state, uint8_t* reg) {
+    (*reg)--;
+    state->codes.ac = (*reg & 0x0f) != 0x0f;
+    calculate_codes_zsp(state, *reg);
+}
+
+static void inx(State8080* state, uint16_t* pair) {
+    (*pair)++;
+}
+
+static void dcx(State8080* state, uint16_t* pair) {
+    (*pair)--;
+}
+
+static void cpi(State8080* state, uint8_t value) {
+    cmp(state, value);
+    state->pc++;
+}
+
+static void daa(State8080* state) {
+    uint8_t correction = 0;
+    uint8_t cy = state->codes.cy;
+    uint8_t low = state->a & 0x0f;
+    uint8_t high = state->a >> 4;
+
+    if (state->codes.ac || low > 9) {
+        correction |= 0x06;
+    }
+    if (state->codes.cy || high > 9 || (high >= 9 && low > 9)) {
+        correction |= 0x60;
+        cy = 1;
+    }
+
+    add(state, correction);
+    state->codes.cy = cy;
+}
+
+#pragma endregion
+
+#pragma region Logical and Bitwise Operations
+
+static void rlc(State8080* state) {
+    state->codes.cy = state->a >> 7;
+    state->a = (state->a << 1) | state->codes.cy;
+}
+
+static void rrc(State8080* state) {
+    state->codes.cy = state->a & 1;
+    state->a = ((state->a & 1) << 7) | (state->a >> 1);    
+}
+
+static void ral(State8080* state) {
+    uint8_t carry = state->codes.cy;
+    state->codes.cy = state->a >> 7;
+    state->a = (state->a << 1) | carry;
+}
+
+static void rar(State8080* state) {
+    uint8_t carry = state->codes.cy;
+    state->codes.cy = state->a & 1;
+    state->a = (carry << 7) | (state->a >> 1);
+}
+
+static void ana(State8080* state, uint8_t value) {
+    // AND sets AC from bit 3 of the operands rather than from a carry.
+    state->codes.ac = ((state->a | value) & 0x08) != 0;
+    state->codes.cy = 0;
+    state->a = state->a & value;
+    calculate_codes_zsp(state, state->a);
+}
+
+static void xra(State8080* state, uint8_t value) {
+    state->codes.ac = 0;
+    state->codes.cy = 0;
+    state->a = state->a ^ value;
+    calculate_codes_zsp(state, state->a);
+}
+
+static void ora(State8080* state, uint8_t value) {
+    state->codes.ac = 0;
+    state->codes.cy = 0;
+    state->a = state->a | value;
+    calculate_codes_zsp(state, state->a);
+}
+
+#pragma endregion
+
+#pragma region Data Transfer Operations
+
+static void mvi(State8080* state, uint8_t* reg, uint8_t value) {
+    *reg = value;
+    state->pc++;
+}
+
+static void mov(State8080* state, uint8_t* move_to_reg, uint8_t* move_from_reg) {
+    *move_to_reg = *move_from_reg;
+}
+
+static void lxi(State8080* state, uint16_t* pair, uint8_t* opcode) {
+    *pair = combine_immediates(opcode[2], opcode[1]);
+    state->pc += 2;
+}
+
+static void ldax(State8080* state, uint16_t addr) {
+    state->a = read_memory(state, addr);
+}
+
+static void stax(State8080* state, uint16_t addr) {
+    write_memory(state, addr, state->a);
+}
+
+static void shld(State8080* state, uint8_t* opcode) {
+    write_word(state, combine_immediates(opcode[2], opcode[1]), state->hl);
+    state->pc += 2;
+}
+
+static void lhld(State8080* state, uint8_t* opcode) {
+    state->hl = read_word(state, combine_immediates(opcode[2], opcode[1]));
+    state->pc += 2;
+}
+
+static void xchg(State8080* state) {
+    uint16_t value = state->de;
+    state->de = state->hl;
+    state->hl = value;
+}
+
+#pragma endregion
+
+#pragma region Branch Operations
+
+// Every branch leaves the program counter one short of its target, since emulate_op always
+// moves it forward by one at the end.
+
+static void jmp(State8080* state, unsigned char* opcode) {
+    // Combine the next 2 bytes into an address and assign the program counter to it.
+    state->pc = combine_immediates(opcode[2], opcode[1]);
+    state->pc -= 1;
+}
+
+static void jmp_if(State8080* state, unsigned char* opcode, int condition) {
+    if (condition) {
+        jmp(state, opcode);
+    }
+    else {
+        state->pc += 2;
+    }
+}
+
+static void push_address(State8080* state, uint16_t address) {
+    state->sp -= 2;
+    write_word(state, state->sp, address);
+}
+
+static void call(State8080* state, unsigned char* opcode) {
+    // Push the address of the next instruction, which is 3 bytes past the CALL, then jump.
+    push_address(state, state->pc + 3);
+    jmp(state, opcode);
+}
+
+/**
+ * @return int Whether the call was taken, since a skipped call takes fewer cycles
+ */
+static int call_if(State8080* state, unsigned char* opcode, int condition) {
+    if (condition) {
+        call(state, opcode);
+        return 1;
+    }
+    state->pc += 2;
+    return 0;
+}
+
+static void ret(State8080* state) {
+    // Assign the program counter to the address at the top of the stack, then move the stack
+    // pointer back down to "pop" it.
+    state->pc = read_word(state, state->sp) - 1;
+    state->sp += 2;
+}
+
+/**
+ * @return int Whether the return was taken, since a skipped return takes fewer cycles
+ */
+static int ret_if(State8080* state, int condition) {
+    if (condition) {
+        ret(state);
+    }
+    return condition;
+}
+
+static void rst(State8080* state, int interrupt_num) {
+    push_address(state, state->pc + 1);
+    state->pc = 8 * interrupt_num - 1;
+}
+
+static void pchl(State8080* state) {
+    state->pc = state->hl - 1;
+}
+
+#pragma endregion
+
+#pragma region Stack Operations
+
+static void push(State8080* state, uint16_t value) {
+    state->sp -= 2;
+    write_word(state, state->sp, value);
+}
+
+static uint16_t pop(State8080* state) {
+    uint16_t value = read_word(state, state->sp);
+    state->sp += 2;
+    return value;
+}
+
+static void xthl(State8080* state) {
+    uint16_t value = read_word(state, state->sp);
+    write_word(state, state->sp, state->hl);
+    state->hl = value;
+}
+
+#pragma endregion
+
+#pragma region I/O and Machine Control
+
+static void in(State8080* state, uint8_t port) {
+    state->a = CORE_IN(state, port);
+    state->pc++;
+}
+
+static void out(State8080* state, uint8_t port) {
+    CORE_OUT(state, port, state->a);
+    state->pc++;
+}
+
+static void hlt(State8080* state) {
+    state->halted = 1;
+}
+
+#pragma endregion
+
+#pragma region Main Operation Emulation Switch Case
+
+/**
+ * @brief Emulates the operation at the program counter. Always inlined, so emulate_block can
+ *  run it on a local copy of the state.
+ * 
+ * @param state The 8080 state
+ * @return int Number of clock cycles the operation took
+ */
+static inline __attribute__((always_inline)) int execute(State8080* state) {
+    // A halted processor just idles until an interrupt wakes it up.
+    if (state->halted) {
+        state->cycles += 4;
+        return 4;
+    }
+
+    // Copy the operation out so operands wrap around at the top of memory.
+    uint8_t opcode[3] = {
+        read_memory(state, state->pc),
+        read_memory(state, state->pc + 1),
+        read_memory(state, state->pc + 2),
+    };
+    int cycles = OP_CYCLES[opcode[0]];
+
+    uint16_t addr_offset;
+    uint8_t value;
+
+    switch(opcode[0]) {
+        case 0x00: break;                                   // NOP
+        case 0x01:                                          // LXI B,2-byte-immediate
+            lxi(state, &state->bc, opcode); 
+            break;
+        case 0x02: stax(state, state->bc); break;  // STAX B
+        case 0x03: inx(state, &state->bc); break; // INX B
+        case 0x04: inr(state, &state->b); break;            // INR B
+        case 0x05: dcr(state, &state->b); break;            // DCR B
+        case 0x06: mvi(state, &state->b, opcode[1]); break; // MVI B,1-byte-imeddiate
+        case 0x07: rlc(state); break;                       // RLC
+        case 0x08: break;                                   // NOP (undocumented)
+        case 0x09:                                          // DAD B
+            dad(state, state->bc);
+            break;
+        case 0x0a: ldax(state, state->bc); break;  // LDAX B
+        case 0x0b: dcx(state, &state->bc); break; // DCX B
+        case 0x0c: inr(state, &state->c); break;            // INR C
+        case 0x0d: dcr(state, &state->c); break;            // DCR C
+        case 0x0e: mvi(state, &state->c, opcode[1]); break; // MVI C,1-byte-imeddiate
+        case 0x0f: rrc(state); break;                       // RRC
+
+        case 0x10: break;                                   // NOP (undocumented)
+        case 0x11:                                          // LXI D,2-byte-immediate
+            lxi(state, &state->de, opcode); 
+            break;
+        case 0x12: stax(state, state->de); break;  // STAX D
+        case 0x13: inx(state, &state->de); break; // INX D
+        case 0x14: inr(state, &state->d); break;            // INR D
+        case 0x15: dcr(state, &state->d); break;            // DCR D
+        case 0x16: mvi(state, &state->d, opcode[1]); break; // MVI D,1-byte-imeddiate
+        case 0x17: ral(state); break;                       // RAL
+        case 0x18: break;                                   // NOP (undocumented)
+        case 0x19:                                          // DAD D
+            dad(state, state->de);
+            break;
+        case 0x1a: ldax(state, state->de); break;  // LDAX D
+        case 0x1b: dcx(state, &state->de); break; // DCX D
+        case 0x1c: inr(state, &state->e); break;            // INR E
+        case 0x1d: dcr(state, &state->e); break;            // DCR E
+        case 0x1e: mvi(state, &state->e, opcode[1]); break; // MVI E,1-byte-imeddiate
+        case 0x1f: rar(state); break;                       // RAR
+
+        case 0x20: break;                                   // NOP (undocumented)
+        case 0x21:                                          // LXI H,2-byte-immediate
+            lxi(state, &state->hl, opcode); 
+            break;
+        case 0x22: shld(state, opcode); break;              // SHLD address
+        case 0x23: inx(state, &state->hl); break; // INX H
+        case 0x24: inr(state, &state->h); break;            // INR H
+        case 0x25: dcr(state, &state->h); break;            // DCR H
+        case 0x26: mvi(state, &state->h, opcode[1]); break; // MVI H,1-byte-imeddiate
+        case 0x27: daa(state); break;                       // DAA
+        case 0x28: break;                                   // NOP (undocumented)
+        case 0x29:                                          // DAD H
+            dad(state, state->hl);
+            break;
+        case 0x2a: lhld(state, opcode); break;              // LHLD address
+        case 0x2b: dcx(state, &state->hl); break; // DCX H
+        case 0x2c: inr(state, &state->l); break;            // INR L
+        case 0x2d: dcr(state, &state->l); break;            // DCR L
+        case 0x2e: mvi(state, &state->l, opcode[1]); break; // MVI L,1-byte-imeddiate
+        case 0x2f: state->a = ~state->a; break;             // CMA
+
+        case 0x30: break;                                   // NOP (undocumented)
+        case 0x31:                                          // LXI SP,2-byte-immediate
+            state->sp = combine_immediates(opcode[2], opcode[1]);
+            state->pc += 2;
+            break;
+        case 0x32:                                          // STA 2-byte-immediate
+            stax(state, combine_immediates(opcode[2], opcode[1]));
+            state->pc += 2;
+            break;
+        case 0x33: state->sp++; break;                      // INX SP
+        case 0x34:                                          // INR M
+            addr_offset = state->hl;
+            value = read_memory(state, addr_offset);
+            inr(state, &value);
+            write_memory(state, addr_offset, value);
+            break;
+        case 0x35:                                          // DCR M
+            addr_offset = state->hl;
+            value = read_memory(state, addr_offset);
+            dcr(state, &value);
+            write_memory(state, addr_offset, value);
+            break;
+        case 0x36:                                          // MVI M,1-byte-imeddiate
+            write_memory(state, state->hl, opcode[1]);
+            state->pc++;
+            break;
+        case 0x37: state->codes.cy = 1; break;              // STC
+        case 0x38: break;                                   // NOP (undocumented)
+        case 0x39:                                          // DAD SP
+            dad(state, state->sp);
+            break;
+        case 0x3a:                                          // LDA 2-byte-immediate
+            ldax(state, combine_immediates(opcode[2], opcode[1]));
+            state->pc += 2;
+            break;
+        case 0x3b: state->sp--; break;                      // DCX SP
+        case 0x3c: inr(state, &state->a); break;            // INR A
+        case 0x3d: dcr(state, &state->a); break;            // DCR A
+        case 0x3e: mvi(state, &state->a, opcode[1]); break; // MVI A,1-byte-imeddiate
+        case 0x3f: state->codes.cy = !state->codes.cy; break;   // CMC
+
+        case 0x40: mov(state, &state->b, &state->b); break; // MOV B,B
+        case 0x41: mov(state, &state->b, &state->c); break; // MOV B,C
+        case 0x42: mov(state, &state->b, &state->d); break; // MOV B,D
+        case 0x43: mov(state, &state->b, &state->e); break; // MOV B,E
+        case 0x44: mov(state, &state->b, &state->h); break; // MOV B,H
+        case 0x45: mov(state, &state->b, &state->l); break; // MOV B,L
+        case 0x46: state->b = read_memory(state, state->hl); break; // MOV B,M
+        case 0x47: mov(state, &state->b, &state->a); break; // MOV B,A
+        case 0x48: mov(state, &state->c, &state->b); break; // MOV C,B
+        case 0x49: mov(state, &state->c, &state->c); break; // MOV C,C
+        case 0x4a: mov(state, &state->c, &state->d); break; // MOV C,D
+        case 0x4b: mov(state, &state->c, &state->e); break; // MOV C,E
+        case 0x4c: mov(state, &state->c, &state->h); break; // MOV C,H
+        case 0x4d: mov(state, &state->c, &state->l); break; // MOV C,L
+        case 0x4e: state->c = read_memory(state, state->hl); break; // MOV C,M
+        case 0x4f: mov(state, &state->c, &state->a); break; // MOV C,A
+
+        case 0x50: mov(state, &state->d, &state->b); break; // MOV D,B
+        case 0x51: mov(state, &state->d, &state->c); break; // MOV D,C
+        case 0x52: mov(state, &state->d, &state->d); break; // MOV D,D
+        case 0x53: mov(state, &state->d, &state->e); break; // MOV D,E
+        case 0x54: mov(state, &state->d, &state->h); break; // MOV D,H
+        case 0x55: mov(state, &state->d, &state->l); break; // MOV D,L
+        case 0x56: state->d = read_memory(state, state->hl); break; // MOV D,M
+        case 0x57: mov(state, &state->d, &state->a); break; // MOV D,A
+        case 0x58: mov(state, &state->e, &state->b); break; // MOV E,B
+        case 0x59: mov(state, &state->e, &state->c); break; // MOV E,C
+        case 0x5a: mov(state, &state->e, &state->d); break; // MOV E,D
+        case 0x5b: mov(state, &state->e, &state->e); break; // MOV E,E
+        case 0x5c: mov(state, &state->e, &state->h); break; // MOV E,H
+        case 0x5d: mov(state, &state->e, &state->l); break; // MOV E,L
+        case 0x5e: state->e = read_memory(state, state->hl); break; // MOV E,M
+        case 0x5f: mov(state, &state->e, &state->a); break; // MOV E,A
+
+        case 0x60: mov(state, &state->h, &state->b); break; // MOV H,B
+        case 0x61: mov(state, &state->h, &state->c); break; // MOV H,C
+        case 0x62: mov(state, &state->h, &state->d); break; // MOV H,D
+        case 0x63: mov(state, &state->h, &state->e); break; // MOV H,E
+        case 0x64: mov(state, &state->h, &state->h); break; // MOV H,H
+        case 0x65: mov(state, &state->h, &state->l); break; // MOV H,L
+        case 0x66: state->h = read_memory(state, state->hl); break; // MOV H,M
+        case 0x67: mov(state, &state->h, &state->a); break; // MOV H,A
+        case 0x68: mov(state, &state->l, &state->b); break; // MOV L,B
+        case 0x69: mov(state, &state->l, &state->c); break; // MOV L,C
+        case 0x6a: mov(state, &state->l, &state->d); break; // MOV L,D
+        case 0x6b: mov(state, &state->l, &state->e); break; // MOV L,E
+        case 0x6c: mov(state, &state->l, &state->h); break; // MOV L,H
+        case 0x6d: mov(state, &state->l, &state->l); break; // MOV L,L
+        case 0x6e: state->l = read_memory(state, state->hl); break; // MOV L,M
+        case 0x6f: mov(state, &state->l, &state->a); break; // MOV L,A
+
+        case 0x70: write_memory(state, state->hl, state->b); break; // MOV M,B
+        case 0x71: write_memory(state, state->hl, state->c); break; // MOV M,C
+        case 0x72: write_memory(state, state->hl, state->d); break; // MOV M,D
+        case 0x73: write_memory(state, state->hl, state->e); break; // MOV M,E
+        case 0x74: write_memory(state, state->hl, state->h); break; // MOV M,H
+        case 0x75: write_memory(state, state->hl, state->l); break; // MOV M,L
+        case 0x76: hlt(state); break;                       // HLT
+        case 0x77: write_memory(state, state->hl, state->a); break; // MOV M,A
+        case 0x78: mov(state, &state->a, &state->b); break; // MOV A,B
+        case 0x79: mov(state, &state->a, &state->c); break; // MOV A,C
+        case 0x7a: mov(state, &state->a, &state->d); break; // MOV A,D
+        case 0x7b: mov(state, &state->a, &state->e); break; // MOV A,E
+        case 0x7c: mov(state, &state->a, &state->h); break; // MOV A,H
+        case 0x7d: mov(state, &state->a, &state->l); break; // MOV A,L
+        case 0x7e: state->a = read_memory(state, state->hl); break; // MOV A,M
+        case 0x7f: mov(state, &state->a, &state->a); break; // MOV A,A
+
+        case 0x80: add(state, state->b); break;     // ADD B
+        case 0x81: add(state, state->c); break;     // ADD C
+        case 0x82: add(state, state->d); break;     // ADD D
+        case 0x83: add(state, state->e); break;     // ADD E
+        case 0x84: add(state, state->h); break;     // ADD H
+        case 0x85: add(state, state->l); break;     // ADD L
+        case 0x86: add(state, read_memory(state, state->hl)); break;   // ADD M
+        case 0x87: add(state, state->a); break;     // ADD A
+        case 0x88: adc(state, state->b); break;     // ADC B
+        case 0x89: adc(state, state->c); break;     // ADC C
+        case 0x8a: adc(state, state->d); break;     // ADC D
+        case 0x8b: adc(state, state->e); break;     // ADC E
+        case 0x8c: adc(state, state->h); break;     // ADC H
+        case 0x8d: adc(state, state->l); break;     // ADC L
+        case 0x8e: adc(state, read_memory(state, state->hl)); break;   // ADC M
+        case 0x8f: adc(state, state->a); break;     // ADC A
+
+        case 0x90: sub(state, state->b); break;     // SUB B
+        case 0x91: sub(state, state->c); break;     // SUB C
+        case 0x92: sub(state, state->d); break;     // SUB D
+        case 0x93: sub(state, state->e); break;     // SUB E
+        case 0x94: sub(state, state->h); break;     // SUB H
+        case 0x95: sub(state, state->l); break;     // SUB L
+        case 0x96: sub(state, read_memory(state, state->hl)); break;   // SUB M
+        case 0x97: sub(state, state->a); break;     // SUB A
+        case 0x98: sbb(state, state->b); break;     // SBB B
+        case 0x99: sbb(state, state->c); break;     // SBB C
+        case 0x9a: sbb(state, state->d); break;     // SBB D
+        case 0x9b: sbb(state, state->e); break;     // SBB E
+        case 0x9c: sbb(state, state->h); break;     // SBB H
+        case 0x9d: sbb(state, state->l); break;     // SBB L
+        case 0x9e: sbb(state, read_memory(state, state->hl)); break;   // SBB M
+        case 0x9f: sbb(state, state->a); break;     // SBB A
+
+        case 0xa0: ana(state, state->b); break;     // ANA B
+        case 0xa1: ana(state, state->c); break;     // ANA C
+        case 0xa2: ana(state, state->d); break;     // ANA D
+        case 0xa3: ana(state, state->e); break;     // ANA E
+        case 0xa4: ana(state, state->h); break;     // ANA H
+        case 0xa5: ana(state, state->l); break;     // ANA L
+        case 0xa6: ana(state, read_memory(state, state->hl)); break;   // ANA M
+        case 0xa7: ana(state, state->a); break;     // ANA A
+        case 0xa8: xra(state, state->b); break;     // XRA B
+        case 0xa9: xra(state, state->c); break;     // XRA C
+        case 0xaa: xra(state, state->d); break;     // XRA D
+        case 0xab: xra(state, state->e); break;     // XRA E
+        case 0xac: xra(state, state->h); break;     // XRA H
+        case 0xad: xra(state, state->l); break;     // XRA L
+        case 0xae: xra(state, read_memory(state, state->hl)); break;   // XRA M
+        case 0xaf: xra(state, state->a); break;     // XRA A
+
+        case 0xb0: ora(state, state->b); break;     // ORA B
+        case 0xb1: ora(state, state->c); break;     // ORA C
+        case 0xb2: ora(state, state->d); break;     // ORA D
+        case 0xb3: ora(state, state->e); break;     // ORA E
+        case 0xb4: ora(state, state->h); break;     // ORA H
+        case 0xb5: ora(state, state->l); break;     // ORA L
+        case 0xb6: ora(state, read_memory(state, state->hl)); break;   // ORA M
+        case 0xb7: ora(state, state->a); break;     // ORA A
+        case 0xb8: cmp(state, state->b); break;     // CMP B
+        case 0xb9: cmp(state, state->c); break;     // CMP C
+        case 0xba: cmp(state, state->d); break;     // CMP D
+        case 0xbb: cmp(state, state->e); break;     // CMP E
+        case 0xbc: cmp(state, state->h); break;     // CMP H
+        case 0xbd: cmp(state, state->l); break;     // CMP L
+        case 0xbe: cmp(state, read_memory(state, state->hl)); break;   // CMP M
+        case 0xbf: cmp(state, state->a); break;     // CMP A
+
+        case 0xc0: cycles -= ret_if(state, !state->codes.z) ? 0 : 6; break;    // RNZ
+        case 0xc1: state->bc = pop(state); break;                     // POP B
+        case 0xc2: jmp_if(state, opcode, !state->codes.z); break;               // JNZ address
+        case 0xc3: jmp(state, opcode); break;                                   // JMP address
+        case 0xc4: cycles -= call_if(state, opcode, !state->codes.z) ? 0 : 6; break;   // CNZ address
+        case 0xc5: push(state, state->bc); break;                    // PUSH B
+        case 0xc6: add(state, opcode[1]); state->pc++; break;                   // ADI 1-byte-immediate
+        case 0xc7: rst(state, 0); break;                                        // RST 0
+        case 0xc8: cycles -= ret_if(state, state->codes.z) ? 0 : 6; break;     // RZ
+        case 0xc9: ret(state); break;                                           // RET
+        case 0xca: jmp_if(state, opcode, state->codes.z); break;                // JZ address
+        case 0xcb: jmp(state, opcode); break;                                   // JMP (undocumented)
+        case 0xcc: cycles -= call_if(state, opcode, state->codes.z) ? 0 : 6; break;    // CZ address
+        case 0xcd: call(state, opcode); break;                                  // CALL address
+        case 0xce: adc(state, opcode[1]); state->pc++; break;                   // ACI 1-byte-immediate
+        case 0xcf: rst(state, 1); break;                                        // RST 1
+
+        case 0xd0: cycles -= ret_if(state, !state->codes.cy) ? 0 : 6; break;   // RNC
+        case 0xd1: state->de = pop(state); break;                     // POP D
+        case 0xd2: jmp_if(state, opcode, !state->codes.cy); break;              // JNC address
+        case 0xd3: out(state, opcode[1]); break;                                // OUT port
+        case 0xd4: cycles -= call_if(state, opcode, !state->codes.cy) ? 0 : 6; break;  // CNC address
+        case 0xd5: push(state, state->de); break;                    // PUSH D
+        case 0xd6: sub(state, opcode[1]); state->pc++; break;                   // SUI 1-byte-immediate
+        case 0xd7: rst(state, 2); break;                                        // RST 2
+        case 0xd8: cycles -= ret_if(state, state->codes.cy) ? 0 : 6; break;    // RC
+        case 0xd9: ret(state); break;                                           // RET (undocumented)
+        case 0xda: jmp_if(state, opcode, state->codes.cy); break;               // JC address
+        case 0xdb: in(state, opcode[1]); break;                                 // IN port
+        case 0xdc: cycles -= call_if(state, opcode, state->codes.cy) ? 0 : 6; break;   // CC address
+        case 0xdd: call(state, opcode); break;                                  // CALL (undocumented)
+        case 0xde: sbb(state, opcode[1]); state->pc++; break;                   // SBI 1-byte-immediate
+        case 0xdf: rst(state, 3); break;                                        // RST 3
+
+        case 0xe0: cycles -= ret_if(state, !state->codes.p) ? 0 : 6; break;    // RPO
+        case 0xe1: state->hl = pop(state); break;                     // POP H
+        case 0xe2: jmp_if(state, opcode, !state->codes.p); break;               // JPO address
+        case 0xe3: xthl(state); break;                                          // XTHL
+        case 0xe4: cycles -= call_if(state, opcode, !state->codes.p) ? 0 : 6; break;   // CPO address
+        case 0xe5: push(state, state->hl); break;                    // PUSH H
+        case 0xe6: ana(state, opcode[1]); state->pc++; break;                   // ANI 1-byte-immediate
+        case 0xe7: rst(state, 4); break;                                        // RST 4
+        case 0xe8: cycles -= ret_if(state, state->codes.p) ? 0 : 6; break;     // RPE
+        case 0xe9: pchl(state); break;                                          // PCHL
+        case 0xea: jmp_if(state, opcode, state->codes.p); break;                // JPE address
+        case 0xeb: xchg(state); break;                                          // XCHG
+        case 0xec: cycles -= call_if(state, opcode, state->codes.p) ? 0 : 6; break;    // CPE address
+        case 0xed: call(state, opcode); break;                                  // CALL (undocumented)
+        case 0xee: xra(state, opcode[1]); state->pc++; break;                   // XRI 1-byte-immediate
+        case 0xef: rst(state, 5); break;                                        // RST 5
+
+        case 0xf0: cycles -= ret_if(state, !state->codes.s) ? 0 : 6; break;    // RP
+        case 0xf1: {                                                            // POP PSW
+            uint16_t psw = pop(state);
+            unpack_codes(state, psw & 0xff);
+            state->a = psw >> 8;
+            break;
+        }
+        case 0xf2: jmp_if(state, opcode, !state->codes.s); break;               // JP address
+        case 0xf3: state->int_enable = 0; break;                                // DI
+        case 0xf4: cycles -= call_if(state, opcode, !state->codes.s) ? 0 : 6; break;   // CP address
+        case 0xf5:                                                              // PUSH PSW
+            push(state, state->a << 8 | pack_codes(state));
+            break;
+        case 0xf6: ora(state, opcode[1]); state->pc++; break;                   // ORI 1-byte-immediate
+        case 0xf7: rst(state, 6); break;                                        // RST 6
+        case 0xf8: cycles -= ret_if(state, state->codes.s) ? 0 : 6; break;     // RM
+        case 0xf9: state->sp = state->hl; break;                        // SPHL
+        case 0xfa: jmp_if(state, opcode, state->codes.s); break;                // JM address
+        case 0xfb: state->int_enable = 1; break;                                // EI
+        case 0xfc: cycles -= call_if(state, opcode, state->codes.s) ? 0 : 6; break;    // CM address
+        case 0xfd: call(state, opcode); break;                                  // CALL (undocumented)
+        case 0xfe: cpi(state, opcode[1]); break;                                // CPI 1-byte-immediate
+        case 0xff: rst(state, 7); break;                                        // RST 7
+    }
+
+    state->pc += 1;
+    state->cycles += cycles;
+    state->instructions++;
+
+    return cycles;
+}
+
+#pragma region Superinstructions
+
+static uint8_t byte_at(State8080* state, uint16_t offset) {
+    return read_memory(state, state->pc + offset);
+}
+
+static uint16_t word_at(State8080* state, uint16_t offset) {
+    return combine_immediates(byte_at(state, offset + 1), byte_at(state, offset));
+}
+
+/**
+ * @brief The register an opcode's low 3 bits name (B, C, D, E, H, L, -, A). 6 is M, which the
+ *  fused patterns never use.
+ */
+static uint8_t* low_register(State8080* state, uint8_t opcode) {
+    switch (opcode & 7) {
+        case 0: return &state->b;
+        case 1: return &state->c;
+        case 2: return &state->d;
+        case 3: return &state->e;
+        case 4: return &state->h;
+        case 5: return &state->l;
+        default: return &state->a;
+    }
+}
+
+static int is_fused_jump(uint8_t opcode) {
+    return opcode == 0xc2 || opcode == 0xca || opcode == 0xd2 || opcode == 0xda;   // JNZ JZ JNC JC
+}
+
+/**
+ * @brief Finishes a fused group with the JNZ, JZ, JNC or JC at the given offset from pc.
+ */
+static int fused_jump(State8080* state, uint16_t offset, int ops, int cycles) {
+    uint8_t opcode = byte_at(state, offset);
+    int flag = (opcode & 0x10) ? state->codes.cy : state->codes.z;
+    int condition = (opcode & 0x08) ? flag : !flag;
+
+    state->pc = condition ? word_at(state, offset + 1) : state->pc + offset + 3;
+    state->cycles += cycles;
+    state->instructions += ops;
+    state->fused_instructions += ops;
+    return cycles;
+}
+
+static int fused_done(State8080* state, uint16_t length, int ops, int cycles) {
+    state->pc += length;
+    state->cycles += cycles;
+    state->instructions += ops;
+    state->fused_instructions += ops;
+    return cycles;
+}
+
+/**
+ * @brief Same as emulate_op, except that common sequences of two or three operations run as one
+ *  fused step when they can. The result is exactly the same as running them one at a time:
+ *  only operations that can't branch, do I/O, or write memory are fused in front of another, so
+ *  self-modifying code can't change what follows, and a group is only fused if every operation
+ *  but the last ends before cycle_limit, which is when an interrupt would have come in between.
+ * 
+ * @param state The 8080 state
+ * @param cycle_limit Cycle count the caller stops at (e.g. the next interrupt)
+ * @return int Cycles taken, by one operation or the whole group
+ */
+static inline __attribute__((always_inline)) int execute_fused(State8080* state,
+    uint64_t cycle_limit) {
+    uint8_t opcode = read_memory(state, state->pc);
+    uint64_t cycles = state->cycles;
+    if (state->halted) {
+        return execute(state);
+    }
+
+    switch (opcode) {
+        case 0xfe:                                          // CPI / Jcc
+            if (is_fused_jump(byte_at(state, 2)) && cycles + 7 < cycle_limit) {
+                cmp(state, byte_at(state, 1));
+                return fused_jump(state, 2, 2, 17);
+            }
+            break;
+
+        case 0x05: case 0x0d: case 0x15: case 0x1d:         // DCR r / JNZ
+        case 0x25: case 0x2d: case 0x3d:
+            if (byte_at(state, 1) == 0xc2 && cycles + 5 < cycle_limit) {
+                dcr(state, low_register(state, opcode >> 3));
+                return fused_jump(state, 1, 2, 15);
+            }
+            break;
+
+        case 0x23:
+            if (byte_at(state, 1) == 0x05 && byte_at(state, 2) == 0xc2 &&
+                cycles + 10 < cycle_limit) {                // INX H / DCR B / JNZ
+                inx(state, &state->hl);
+                dcr(state, &state->b);
+                return fused_jump(state, 2, 3, 20);
+            }
+            if (byte_at(state, 1) == 0x13 && cycles + 5 < cycle_limit) {   // INX H / INX D
+                inx(state, &state->hl);
+                inx(state, &state->de);
+                return fused_done(state, 2, 2, 10);
+            }
+            break;
+
+        case 0x21: {                                        // LXI H / MOV M,r
+            uint8_t next = byte_at(state, 3);
+            if ((next & 0xf8) == 0x70 && next != 0x76 && cycles + 10 < cycle_limit) {
+                state->hl = word_at(state, 1);
+                write_memory(state, state->hl, *low_register(state, next));
+                return fused_done(state, 4, 2, 17);
+            }
+            break;
+        }
+
+        case 0x7e:                                          // MOV A,M / INX H
+            if (byte_at(state, 1) == 0x23 && cycles + 7 < cycle_limit) {
+                state->a = read_memory(state, state->hl);
+                inx(state, &state->hl);
+                return fused_done(state, 2, 2, 12);
+            }
+            break;
+
+        case 0x1a:                                          // LDAX D / MOV M,A
+            if (byte_at(state, 1) == 0x77 && cycles + 7 < cycle_limit) {
+                ldax(state, state->de);
+                write_memory(state, state->hl, state->a);
+                return fused_done(state, 2, 2, 14);
+            }
+            break;
+    }
+
+    return execute(state);
+}
+
+#pragma endregion
+
+#pragma region Run Loop
+
+/**
+ * @brief Runs the operation at pc on the state itself, for I/O whose handlers look at it. It's
+ *  kept out of CORE_BLOCK so the handlers aren't inlined into the run loop with everything else.
+ */
+static __attribute__((noinline)) void execute_out_of_line(State8080* state) {
+    execute(state);
+}
+
+/**
+ * @brief Runs operations until the cycle counter reaches cycle_limit, with the same result as
+ *  calling emulate_op (or emulate_fused) until then. The block runs on a copy of the state in a
+ *  local, with every operation inlined into the loop (flatten). Nothing else can point to the
+ *  local, so the compiler doesn't have to reload the registers through the state pointer after
+ *  every memory write, and can keep the hottest ones in host registers. The copy
+ *  is written back when the block ends, and around IN and OUT (unless the machine says its
+ *  port handlers don't need it) so the handlers see, and can change, the current state.
+ * 
+ * @param state The 8080 state
+ * @param cycle_limit Cycle count to stop at (e.g. the next interrupt)
+ * @param fused Whether to run common sequences as superinstructions
+ * @param loop_window If not 0, also stop on HLT and right after a branch that went back this
+ *  many bytes or less, so the caller can look for idle loops
+ * @param ignored_loops NULL, or a bit per address for loops not to stop at
+ * @return int 1 if it stopped early for loop_window or CORE_BLOCK_ENTRY, 0 if it reached
+ *  cycle_limit
+ */
+__attribute__((flatten))
+int CORE_BLOCK(State8080* state, uint64_t cycle_limit, int fused, uint16_t loop_window,
+    const uint8_t* ignored_loops) {
+    State8080 local = *state;
+    int stopped = 0;
+    int entry = 1;
+
+    while (local.cycles < cycle_limit) {
+        uint16_t pc = local.pc;
+        uint8_t opcode = CORE_READ(&local, pc);
+        if (entry && CORE_BLOCK_ENTRY(&local, pc)) {
+            stopped = 1;
+            break;
+        }
+        if ((CORE_SYNC_IN && opcode == 0xdb) || (CORE_SYNC_OUT && opcode == 0xd3)) {
+            *state = local;
+            execute_out_of_line(state);
+            local = *state;
+            entry = 1;
+            continue;
+        }
+
+        uint64_t instructions = local.instructions;
+        if (fused) {
+            execute_fused(&local, cycle_limit);
+        }
+        else {
+            execute(&local);
+        }
+        entry = OP_ENDS_BLOCK[opcode] || local.instructions != instructions + 1 ||
+            CORE_BLOCK_RECHECK(&local);
+
+        if (loop_window != 0) {
+            int looped = local.pc <= pc && pc - local.pc <= loop_window;
+            if (looped && ignored_loops != NULL) {
+                looped = !(ignored_loops[local.pc >> 3] & (1 << (local.pc & 7)));
+            }
+            if (looped || local.halted) {
+                stopped = 1;
+                break;
+            }
+        }
+    }
+
+    *state = local;
+    return stopped;
+}
+
+#pragma endregion
+
+#pragma endregion
+
+#undef CORE_BLOCK
+#undef CORE_READ
+#undef CORE_WRITE
+#undef CORE_IN
+#undef CORE_OUT
+#undef CORE_SYNC_IN
+#undef CORE_SYNC_OUT
+#undef CORE_BLOCK_ENTRY
+#undef CORE_BLOCK_RECHECK
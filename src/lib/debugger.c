@@ -0,0 +1,758 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "debugger.h"
+#include "disasm.h"
+#include "net.h"
+
+#define MAX_PACKET_SIZE 4096
+#define INTERRUPT_BYTE 0x03
+
+// The debugger's own build of the core, for running whole blocks while breakpoints are set. It
+// stops where straight-line code that runs into a breakpoint starts, and keeps track of the
+// program writing to the code that was worked out from. Memory and ports are the generic ones.
+static Debugger* block_debugger;        // The debugger in debugger_run_block
+static void update_block_stops(Debugger* debugger, State8080* state, uint16_t addr);
+static int take_stops_added(Debugger* debugger);
+#define CORE_BLOCK debugger_emulate_block
+#define CORE_WRITE(state, addr, value) \
+    ((state)->memory[addr] = (value), block_debugger->block_pages[(addr) >> 8] ? \
+        update_block_stops(block_debugger, state, addr) : \
+        (void)(state)->page_versions[(addr) >> 8]++)
+#define CORE_BLOCK_ENTRY(state, pc) (block_debugger->block_stops[pc])
+#define CORE_BLOCK_RECHECK(state) take_stops_added(block_debugger)
+#include "cpu8080_core.h"
+
+#pragma region Connection
+
+/**
+ * @brief Listens on the given address and waits for a debugger to connect. The program starts
+ *  out stopped so breakpoints can be set before the first operation.
+ * 
+ * @param address TCP port on localhost, or path of a Unix socket
+ * @return Debugger* The connected debugger, or NULL if the socket couldn't be opened
+ */
+Debugger* debugger_create(const char* address) {
+    int listen_fd = net_listen(address, 1);
+    if (listen_fd < 0) {
+        return NULL;
+    }
+
+    printf("Waiting for debugger on %s\n", address);
+    fflush(stdout);
+    int client_fd = accept(listen_fd, NULL, NULL);
+    if (client_fd < 0) {
+        close(listen_fd);
+        return NULL;
+    }
+
+    Debugger* debugger = calloc(1, sizeof(Debugger));
+    debugger->listen_fd = listen_fd;
+    debugger->client_fd = client_fd;
+    debugger->breakpoints = calloc(0x10000, 1);
+    debugger->block_stops = calloc(0x10000, 1);
+    debugger->block_stops_stale = 1;
+    debugger->stopped = 1;
+    return debugger;
+}
+
+static void clear_watchpoints(Debugger* debugger) {
+    int i;
+    for (i = 0; i < debugger->watchpoint_count; i++) {
+        free(debugger->watchpoints[i].shadow);
+    }
+    debugger->watchpoint_count = 0;
+}
+
+void debugger_free(Debugger* debugger) {
+    if (debugger->client_fd >= 0) {
+        close(debugger->client_fd);
+    }
+    close(debugger->listen_fd);
+    clear_watchpoints(debugger);
+    free(debugger->breakpoints);
+    free(debugger->block_stops);
+    free(debugger);
+}
+
+/**
+ * @brief Drops the client and every breakpoint, letting the program run freely.
+ */
+static void detach(Debugger* debugger) {
+    if (debugger->client_fd >= 0) {
+        close(debugger->client_fd);
+        debugger->client_fd = -1;
+    }
+    memset(debugger->breakpoints, 0, 0x10000);
+    debugger->breakpoint_count = 0;
+    debugger->block_stops_stale = 1;
+    clear_watchpoints(debugger);
+    debugger->stopped = 0;
+    debugger->stepping = 0;
+    debugger->detached = 1;
+}
+
+/**
+ * @brief Reads whatever the client has sent into the input buffer.
+ * 
+ * @param debugger 
+ * @param blocking Whether to wait for at least one byte
+ * @return int 0 on success, -1 if the client went away
+ */
+static int fill_input(Debugger* debugger, int blocking) {
+    if (debugger->input_start == debugger->input_end) {
+        debugger->input_start = debugger->input_end = 0;
+    }
+    if (debugger->input_end == sizeof(debugger->input)) {
+        memmove(debugger->input, &debugger->input[debugger->input_start],
+            debugger->input_end - debugger->input_start);
+        debugger->input_end -= debugger->input_start;
+        debugger->input_start = 0;
+    }
+
+    ssize_t received = recv(debugger->client_fd, &debugger->input[debugger->input_end],
+        sizeof(debugger->input) - debugger->input_end, blocking ? 0 : MSG_DONTWAIT);
+    if (received > 0) {
+        debugger->input_end += received;
+        return 0;
+    }
+    if (received < 0 && !blocking) {
+        return 0;
+    }
+
+    detach(debugger);
+    return -1;
+}
+
+static int read_byte(Debugger* debugger) {
+    if (debugger->input_start == debugger->input_end && fill_input(debugger, 1) < 0) {
+        return -1;
+    }
+    return debugger->input[debugger->input_start++];
+}
+
+static int hex_value(int c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+}
+
+/**
+ * @brief Reads one packet, acknowledging it unless no-ack mode is on. A lone interrupt byte
+ *  comes back as a packet containing just that byte.
+ * 
+ * @return int Length of the packet, or -1 if the client went away
+ */
+static int read_packet(Debugger* debugger, char* packet) {
+    while (1) {
+        int c = read_byte(debugger);
+        if (c < 0) {
+            return -1;
+        }
+        if (c == INTERRUPT_BYTE) {
+            packet[0] = INTERRUPT_BYTE;
+            packet[1] = '\0';
+            return 1;
+        }
+        if (c != '$') {
+            continue;
+        }
+
+        int length = 0;
+        uint8_t checksum = 0;
+        while ((c = read_byte(debugger)) != '#') {
+            if (c < 0) {
+                return -1;
+            }
+            if (length < MAX_PACKET_SIZE - 1) {
+                packet[length++] = c;
+            }
+            checksum += c;
+        }
+        packet[length] = '\0';
+
+        int high = hex_value(read_byte(debugger));
+        int low = hex_value(read_byte(debugger));
+        if (debugger->client_fd < 0) {
+            return -1;
+        }
+        if (debugger->no_ack) {
+            return length;
+        }
+        if (high >= 0 && low >= 0 && ((high << 4) | low) == checksum) {
+            send(debugger->client_fd, "+", 1, MSG_NOSIGNAL);
+            return length;
+        }
+        send(debugger->client_fd, "-", 1, MSG_NOSIGNAL);
+    }
+}
+
+static void send_packet(Debugger* debugger, const char* data) {
+    if (debugger->client_fd < 0) {
+        return;
+    }
+
+    int length = strlen(data);
+    char* packet = malloc(length + 5);
+    uint8_t checksum = 0;
+    int i;
+    for (i = 0; i < length; i++) {
+        checksum += data[i];
+    }
+    sprintf(packet, "$%s#%02x", data, checksum);
+
+    // Resend until the client acknowledges it.
+    while (1) {
+        send(debugger->client_fd, packet, length + 4, MSG_NOSIGNAL);
+        if (debugger->no_ack) {
+            break;
+        }
+        int c;
+        do {
+            c = read_byte(debugger);
+        } while (c >= 0 && c != '+' && c != '-');
+        if (c != '-') {
+            break;
+        }
+    }
+    free(packet);
+}
+
+#pragma endregion
+
+#pragma region Registers and Memory
+
+// Register numbers for the p/P packets: a, flags, b, c, d, e, h, l, sp, pc
+#define REGISTER_COUNT 10
+
+static uint16_t get_register(State8080* state, int number) {
+    switch (number) {
+        case 0: return state->a;
+        case 1: return pack_codes(state);
+        case 2: return state->b;
+        case 3: return state->c;
+        case 4: return state->d;
+        case 5: return state->e;
+        case 6: return state->h;
+        case 7: return state->l;
+        case 8: return state->sp;
+        default: return state->pc;
+    }
+}
+
+static void set_register(State8080* state, int number, uint16_t value) {
+    switch (number) {
+        case 0: state->a = value; break;
+        case 1: unpack_codes(state, value); break;
+        case 2: state->b = value; break;
+        case 3: state->c = value; break;
+        case 4: state->d = value; break;
+        case 5: state->e = value; break;
+        case 6: state->h = value; break;
+        case 7: state->l = value; break;
+        case 8: state->sp = value; break;
+        default: state->pc = value; break;
+    }
+}
+
+static int register_size(int number) {
+    return number >= 8 ? 2 : 1;
+}
+
+/**
+ * @brief Writes a register as little-endian hex, the way GDB expects it.
+ */
+static char* write_register(char* out, State8080* state, int number) {
+    uint16_t value = get_register(state, number);
+    int i;
+    for (i = 0; i < register_size(number); i++) {
+        out += sprintf(out, "%02x", (value >> (8 * i)) & 0xff);
+    }
+    return out;
+}
+
+static const char* read_register(const char* in, State8080* state, int number) {
+    uint16_t value = 0;
+    int i;
+    for (i = 0; i < register_size(number); i++) {
+        if (hex_value(in[0]) < 0 || hex_value(in[1]) < 0) {
+            return NULL;
+        }
+        value |= (hex_value(in[0]) << 4 | hex_value(in[1])) << (8 * i);
+        in += 2;
+    }
+    set_register(state, number, value);
+    return in;
+}
+
+/**
+ * @brief Refreshes the watchpoint shadows, so writes made by the debugger itself don't trigger
+ *  them.
+ */
+static void sync_watchpoints(Debugger* debugger, State8080* state) {
+    int i;
+    for (i = 0; i < debugger->watchpoint_count; i++) {
+        Watchpoint* watch = &debugger->watchpoints[i];
+        memcpy(watch->shadow, &state->memory[watch->addr], watch->length);
+    }
+}
+
+#pragma endregion
+
+#pragma region Commands
+
+static int set_point(Debugger* debugger, State8080* state, char* args, int insert) {
+    int type = 0;
+    unsigned int addr = 0;
+    unsigned int length = 0;
+    if (sscanf(args, "%d,%x,%x", &type, &addr, &length) < 2 || addr > 0xffff) {
+        return -1;
+    }
+
+    // Software and hardware breakpoints are the same thing here.
+    if (type == 0 || type == 1) {
+        if (insert && !debugger->breakpoints[addr]) {
+            debugger->breakpoints[addr] = 1;
+            debugger->breakpoint_count++;
+        }
+        else if (!insert && debugger->breakpoints[addr]) {
+            debugger->breakpoints[addr] = 0;
+            debugger->breakpoint_count--;
+        }
+        debugger->block_stops_stale = 1;
+        return 0;
+    }
+
+    // Only write watchpoints are supported.
+    if (type != 2) {
+        return 1;
+    }
+
+    if (length == 0) {
+        length = 1;
+    }
+    if (length > 0x10000 - addr) {
+        length = 0x10000 - addr;
+    }
+
+    int i;
+    if (insert) {
+        if (debugger->watchpoint_count == MAX_WATCHPOINTS) {
+            return -1;
+        }
+        Watchpoint* watch = &debugger->watchpoints[debugger->watchpoint_count++];
+        watch->addr = addr;
+        watch->length = length;
+        watch->shadow = malloc(length);
+        memcpy(watch->shadow, &state->memory[addr], length);
+        return 0;
+    }
+
+    for (i = 0; i < debugger->watchpoint_count; i++) {
+        if (debugger->watchpoints[i].addr == addr && debugger->watchpoints[i].length == length) {
+            free(debugger->watchpoints[i].shadow);
+            debugger->watchpoints[i] = debugger->watchpoints[--debugger->watchpoint_count];
+            return 0;
+        }
+    }
+    return -1;
+}
+
+static void handle_query(Debugger* debugger, char* packet) {
+    if (strncmp(packet, "qSupported", 10) == 0) {
+        send_packet(debugger, "PacketSize=1000;QStartNoAckMode+;swbreak+;hwbreak+");
+    }
+    else if (strcmp(packet, "qAttached") == 0) {
+        send_packet(debugger, "1");
+    }
+    else if (strcmp(packet, "qC") == 0) {
+        send_packet(debugger, "QC1");
+    }
+    else if (strcmp(packet, "qfThreadInfo") == 0) {
+        send_packet(debugger, "m1");
+    }
+    else if (strcmp(packet, "qsThreadInfo") == 0) {
+        send_packet(debugger, "l");
+    }
+    else if (strcmp(packet, "QStartNoAckMode") == 0) {
+        send_packet(debugger, "OK");
+        debugger->no_ack = 1;
+    }
+    else {
+        send_packet(debugger, "");
+    }
+}
+
+/**
+ * @brief Handles packets until the program is resumed, detached or killed.
+ */
+static void serve(Debugger* debugger, State8080* state) {
+    char* packet = malloc(MAX_PACKET_SIZE);
+    char* reply = malloc(MAX_PACKET_SIZE * 2 + 1);
+    unsigned int addr;
+    unsigned int length;
+    unsigned int i;
+    int number;
+
+    while (debugger->stopped) {
+        if (read_packet(debugger, packet) < 0) {
+            break;
+        }
+
+        char* out = reply;
+        const char* in;
+        switch (packet[0]) {
+            case INTERRUPT_BYTE:
+            case '?':
+                send_packet(debugger, "S05");
+                break;
+
+            case 'g':
+                for (number = 0; number < REGISTER_COUNT; number++) {
+                    out = write_register(out, state, number);
+                }
+                send_packet(debugger, reply);
+                break;
+
+            case 'G':
+                in = &packet[1];
+                for (number = 0; number < REGISTER_COUNT && in != NULL; number++) {
+                    in = read_register(in, state, number);
+                }
+                send_packet(debugger, in != NULL ? "OK" : "E01");
+                break;
+
+            case 'p':
+                number = strtol(&packet[1], NULL, 16);
+                if (number >= REGISTER_COUNT) {
+                    send_packet(debugger, "E01");
+                    break;
+                }
+                write_register(out, state, number);
+                send_packet(debugger, reply);
+                break;
+
+            case 'P':
+                number = strtol(&packet[1], &out, 16);
+                in = number < REGISTER_COUNT && *out == '=' ? read_register(out + 1, state, number) : NULL;
+                send_packet(debugger, in != NULL ? "OK" : "E01");
+                break;
+
+            case 'm':
+                if (sscanf(&packet[1], "%x,%x", &addr, &length) != 2 || length > MAX_PACKET_SIZE) {
+                    send_packet(debugger, "E01");
+                    break;
+                }
+                for (i = 0; i < length; i++) {
+                    out += sprintf(out, "%02x", state->memory[(uint16_t)(addr + i)]);
+                }
+                *out = '\0';
+                send_packet(debugger, reply);
+                break;
+
+            case 'M':
+                in = strchr(packet, ':');
+                if (sscanf(&packet[1], "%x,%x", &addr, &length) != 2 || in == NULL ||
+                        length > MAX_PACKET_SIZE || strlen(in + 1) < (size_t)length * 2) {
+                    send_packet(debugger, "E01");
+                    break;
+                }
+                // Check every digit first, so a bad packet doesn't write half its bytes.
+                in++;
+                i = 0;
+                while (i < length * 2 && hex_value(in[i]) >= 0) {
+                    i++;
+                }
+                if (i < length * 2) {
+                    send_packet(debugger, "E01");
+                    break;
+                }
+                for (i = 0; i < length; i++, in += 2) {
+                    state->memory[(uint16_t)(addr + i)] = hex_value(in[0]) << 4 | hex_value(in[1]);
+                }
+                mark_written(state, addr, length);
+                sync_watchpoints(debugger, state);
+                send_packet(debugger, "OK");
+                break;
+
+            case 'c':
+            case 's':
+                if (packet[1] != '\0') {
+                    state->pc = strtol(&packet[1], NULL, 16);
+                }
+                debugger->stepping = packet[0] == 's';
+                debugger->resuming = 1;
+                debugger->stopped = 0;
+                break;
+
+            case 'Z':
+            case 'z':
+                number = set_point(debugger, state, &packet[1], packet[0] == 'Z');
+                send_packet(debugger, number == 0 ? "OK" : number > 0 ? "" : "E01");
+                break;
+
+            case 'q':
+            case 'Q':
+                handle_query(debugger, packet);
+                break;
+
+            case 'H':
+                send_packet(debugger, "OK");
+                break;
+
+            case 'k':
+                debugger->killed = 1;
+                debugger->stopped = 0;
+                break;
+
+            case 'D':
+                send_packet(debugger, "OK");
+                detach(debugger);
+                break;
+
+            default:
+                send_packet(debugger, "");
+                break;
+        }
+    }
+
+    free(packet);
+    free(reply);
+}
+
+static void stop(Debugger* debugger, State8080* state, const char* reason) {
+    debugger->stopped = 1;
+    debugger->stepping = 0;
+    send_packet(debugger, reason);
+    serve(debugger, state);
+}
+
+#pragma endregion
+
+#pragma region Emulator Hooks
+
+/**
+ * @brief Whether the emulator needs to call debugger_before_op/debugger_after_op around every
+ *  operation. When this is false the normal loop can run untouched.
+ */
+int debugger_armed(Debugger* debugger) {
+    return debugger->stopped || debugger->stepping ||
+        debugger->breakpoint_count > 0 || debugger->watchpoint_count > 0;
+}
+
+/**
+ * @brief Checks for an interrupt request from the client without blocking, and serves commands
+ *  if the program is stopped. Call between batches of operations.
+ */
+void debugger_poll(Debugger* debugger, State8080* state) {
+    if (debugger->client_fd < 0) {
+        return;
+    }
+
+    if (!debugger->stopped) {
+        fill_input(debugger, 0);
+        int i;
+        for (i = debugger->input_start; i < debugger->input_end; i++) {
+            if (debugger->input[i] == INTERRUPT_BYTE) {
+                debugger->input_start = i + 1;
+                stop(debugger, state, "S02");
+                return;
+            }
+        }
+        return;
+    }
+
+    serve(debugger, state);
+}
+
+/**
+ * @brief Stops at a breakpoint on the operation about to run.
+ */
+void debugger_before_op(Debugger* debugger, State8080* state) {
+    if (debugger->stopped) {
+        serve(debugger, state);
+    }
+    if (debugger->breakpoints[state->pc] && !debugger->resuming) {
+        stop(debugger, state, "S05");
+    }
+    debugger->resuming = 0;
+}
+
+/**
+ * @brief Stops after a single step, or when the operation wrote to a watched range.
+ */
+void debugger_after_op(Debugger* debugger, State8080* state) {
+    int i;
+    for (i = 0; i < debugger->watchpoint_count; i++) {
+        Watchpoint* watch = &debugger->watchpoints[i];
+        if (memcmp(watch->shadow, &state->memory[watch->addr], watch->length) != 0) {
+            char reason[32];
+            sprintf(reason, "T05watch:%x;", watch->addr);
+            sync_watchpoints(debugger, state);
+            stop(debugger, state, reason);
+            return;
+        }
+    }
+
+    if (debugger->stepping) {
+        stop(debugger, state, "S05");
+    }
+}
+
+/**
+ * @brief Whether debugger_run_block can run instead of checking every operation: nothing but
+ *  breakpoints is armed. Watchpoints and single steps still need to look after every operation.
+ */
+int debugger_can_run_blocks(Debugger* debugger) {
+    return !debugger->stopped && !debugger->stepping && debugger->watchpoint_count == 0;
+}
+
+/**
+ * @brief Whether an operation can be followed by something other than the next one in memory.
+ *  After stepping through a block that debugger_run_block stopped at, blocks can run again once
+ *  one of these has run.
+ */
+int debugger_ends_block(uint8_t opcode) {
+    return OP_ENDS_BLOCK[opcode];
+}
+
+/**
+ * @brief Whether straight-line code from addr reaches a breakpoint without passing an operation
+ *  that ends a block: it is one, or the operation after it does.
+ */
+static int reaches_breakpoint(Debugger* debugger, State8080* state, int addr) {
+    uint8_t opcode = state->memory[addr];
+    int next = addr + op_length(opcode);
+    return debugger->breakpoints[addr] ||
+        (!OP_ENDS_BLOCK[opcode] && next <= 0xffff && debugger->block_stops[next]);
+}
+
+/**
+ * @brief Remembers the pages where a write could change whether addr is marked: its own, and
+ *  the bytes just before it, where a changed operation could join on.
+ */
+static void watch_block_stop(Debugger* debugger, int addr) {
+    debugger->block_pages[addr >> 8] = 1;
+    debugger->block_pages[((addr - 3) & 0xffff) >> 8] = 1;
+}
+
+/**
+ * @brief Works out block_stops from the breakpoints and the code. One pass from the top of
+ *  memory down does it, since each address only depends on the one after its operation. The
+ *  pages it depends on are remembered with their versions, so writes made outside the block
+ *  loop (by interrupts, the machine or the debugger) are noticed.
+ */
+static void build_block_stops(Debugger* debugger, State8080* state) {
+    memset(debugger->block_pages, 0, sizeof(debugger->block_pages));
+
+    int addr;
+    for (addr = 0xffff; addr >= 0; addr--) {
+        debugger->block_stops[addr] = reaches_breakpoint(debugger, state, addr);
+        if (debugger->block_stops[addr]) {
+            watch_block_stop(debugger, addr);
+        }
+    }
+
+    memcpy(debugger->block_versions, state->page_versions, sizeof(debugger->block_versions));
+    debugger->block_stops_stale = 0;
+}
+
+/**
+ * @brief Works out block_stops again for the addresses from top down to bottom after their
+ *  memory changed, and for the ones leading into them until three in a row come out the same
+ *  (each address only depends on the three after it).
+ */
+static void refresh_block_stops(Debugger* debugger, State8080* state, int top, int bottom) {
+    int same = 3;
+    int at;
+    for (at = top; at >= 0 && (at >= bottom || same < 3); at--) {
+        int stop = reaches_breakpoint(debugger, state, at);
+        if (stop == debugger->block_stops[at]) {
+            same++;
+            continue;
+        }
+        same = 0;
+        debugger->block_stops[at] = stop;
+        if (stop) {
+            watch_block_stop(debugger, at);
+            debugger->stops_added = 1;
+        }
+    }
+}
+
+/**
+ * @brief The rest of a write by the program in debugger_run_block to one of block_pages. The
+ *  page version is bumped like any write, and the remembered one with it unless something else
+ *  had written the page already.
+ */
+static void update_block_stops(Debugger* debugger, State8080* state, uint16_t addr) {
+    uint8_t page = addr >> 8;
+    if (debugger->block_versions[page] == state->page_versions[page]) {
+        debugger->block_versions[page]++;
+    }
+    state->page_versions[page]++;
+    refresh_block_stops(debugger, state, addr, addr);
+}
+
+/**
+ * @brief Whether the program marked more stops since the last call, so the block loop has to
+ *  look at the next operation even in the middle of straight-line code.
+ */
+static int take_stops_added(Debugger* debugger) {
+    int added = debugger->stops_added;
+    debugger->stops_added = 0;
+    return added;
+}
+
+/**
+ * @brief Runs operations up to cycle_limit with the block loop, the way emulate_block does, but
+ *  stops where straight-line code that runs into a breakpoint starts. The caller then steps
+ *  through that code with debugger_before_op and debugger_after_op until an operation that
+ *  ends the block (debugger_ends_block) has run. The breakpoints themselves are only looked at
+ *  when the stops are worked out, after they change or the code under them is rewritten.
+ * 
+ * @param debugger 
+ * @param state The 8080 state
+ * @param cycle_limit Cycle count to stop at
+ * @param fused Whether to run common sequences as superinstructions
+ * @return int 1 if it stopped early at such a block, 0 if it reached cycle_limit
+ */
+int debugger_run_block(Debugger* debugger, State8080* state, uint64_t cycle_limit, int fused) {
+    if (debugger->block_stops_stale) {
+        build_block_stops(debugger, state);
+    }
+    // Pages written since some other way, e.g. by interrupts or the debugger
+    int page;
+    for (page = 255; page >= 0; page--) {
+        if (debugger->block_pages[page] &&
+            debugger->block_versions[page] != state->page_versions[page]) {
+            refresh_block_stops(debugger, state, page * 256 + 255, page * 256);
+            debugger->block_versions[page] = state->page_versions[page];
+        }
+    }
+
+    block_debugger = debugger;
+    debugger->stops_added = 0;
+    int stopped = debugger_emulate_block(state, cycle_limit, fused, 0, NULL);
+    block_debugger = NULL;
+    return stopped;
+}
+
+/**
+ * @brief Tells the client the program has finished.
+ * 
+ * @param debugger 
+ * @param status Exit status reported to the client
+ */
+void debugger_exited(Debugger* debugger, int status) {
+    char reply[8];
+    sprintf(reply, "W%02x", status & 0xff);
+    send_packet(debugger, reply);
+}
+
+#pragma endregion
@@ -0,0 +1,64 @@
+#ifndef DEBUGGER_H
+#define DEBUGGER_H
+
+#include <stdint.h>
+
+#include "cpu8080.h"
+
+#define MAX_WATCHPOINTS 16
+
+/**
+ * @brief A range of memory that stops the program when it is written to.
+ */
+typedef struct Watchpoint {
+    uint16_t addr;
+    uint32_t length;        // Up to 0x10000, all of memory
+    uint8_t* shadow;        // Last seen contents of the range
+} Watchpoint;
+
+/**
+ * @brief A GDB remote protocol stub served over a local TCP or Unix socket.
+ * 
+ * The emulator only has to call debugger_before_op and debugger_after_op while the debugger is
+ * armed (stopped, stepping, or with breakpoints or watchpoints set). Otherwise it can run its
+ * normal loop and just call debugger_poll between batches of operations. With only breakpoints
+ * set, it can still run whole blocks with debugger_run_block, which looks at them where
+ * straight-line code starts rather than before every operation.
+ */
+typedef struct Debugger {
+    int listen_fd;
+    int client_fd;
+    int no_ack;
+    uint8_t input[1024];        // Bytes received but not yet parsed
+    int input_start;
+    int input_end;
+
+    uint8_t* breakpoints;       // Flag per address
+    int breakpoint_count;
+    uint8_t* block_stops;       // Flag per address that runs into a breakpoint in straight line
+    uint8_t block_pages[256];   // Pages of the code block_stops was worked out from
+    uint32_t block_versions[256];   // Their page versions then
+    int block_stops_stale;      // The breakpoints changed since
+    int stops_added;            // The program's writes marked more of block_stops
+    Watchpoint watchpoints[MAX_WATCHPOINTS];
+    int watchpoint_count;
+
+    int stopped;
+    int stepping;
+    int resuming;               // Don't stop on the breakpoint the program was resumed from
+    int detached;
+    int killed;
+} Debugger;
+
+Debugger* debugger_create(const char* address);
+void debugger_free(Debugger* debugger);
+int debugger_armed(Debugger* debugger);
+void debugger_poll(Debugger* debugger, State8080* state);
+void debugger_before_op(Debugger* debugger, State8080* state);
+void debugger_after_op(Debugger* debugger, State8080* state);
+int debugger_can_run_blocks(Debugger* debugger);
+int debugger_run_block(Debugger* debugger, State8080* state, uint64_t cycle_limit, int fused);
+int debugger_ends_block(uint8_t opcode);
+void debugger_exited(Debugger* debugger, int status);
+
+#endif
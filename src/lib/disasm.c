@@ -0,0 +1,345 @@
+#include <stdio.h>
+
+#include "disasm.h"
+
+/**
+ * @brief For a valid hex 8080 operation, outputs a valid 8080 assembly operation.
+ * 
+ * @param out Stream the assembly is written to
+ * @param codebuffer Pointer to hex code
+ * @param pc Program counter (offset)
+ * @return int Number of bytes used for the operation (1-3)
+ */
+int disassemble_op(FILE* out, unsigned char *codebuffer, int pc) {
+    // Get the opcode at the program counter and print it's position
+    unsigned char *code = &codebuffer[pc];
+    int opbytes = 0;
+    fprintf(out, "%04x ", pc);
+
+    // Main switch statement for 8080 opcodes.
+    switch(*code) {
+        case 0x00: fprintf(out, "NOP"); opbytes = 1; break;
+        case 0x01: fprintf(out, "LXI     B,#$%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0x02: fprintf(out, "STAX    B"); opbytes = 1; break;
+        case 0x03: fprintf(out, "INX     B"); opbytes = 1; break;
+        case 0x04: fprintf(out, "INR     B"); opbytes = 1; break;
+        case 0x05: fprintf(out, "DCR     B"); opbytes = 1; break;
+        case 0x06: fprintf(out, "MVI     B,#$%02x", code[1]); opbytes = 2; break;
+        case 0x07: fprintf(out, "RLC     B"); opbytes = 1; break;
+        case 0x08: fprintf(out, "NOP"); opbytes = 1; break;
+        case 0x09: fprintf(out, "DAD     B"); opbytes = 1; break;
+        case 0x0a: fprintf(out, "LDAX    B"); opbytes = 1; break;
+        case 0x0b: fprintf(out, "DCX     B"); opbytes = 1; break;
+        case 0x0c: fprintf(out, "INR     C"); opbytes = 1; break;
+        case 0x0d: fprintf(out, "DCR     C"); opbytes = 1; break;
+        case 0x0e: fprintf(out, "MVI     C,#$%02x", code[1]); opbytes = 2; break;
+        case 0x0f: fprintf(out, "RRC"); opbytes = 1; break;
+
+        case 0x10: fprintf(out, "NOP"); opbytes = 1; break;
+        case 0x11: fprintf(out, "LXI     D,#$%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0x12: fprintf(out, "STAX    D"); opbytes = 1; break;
+        case 0x13: fprintf(out, "INX     D"); opbytes = 1; break;
+        case 0x14: fprintf(out, "INR     D"); opbytes = 1; break;
+        case 0x15: fprintf(out, "DCR     D"); opbytes = 1; break;
+        case 0x16: fprintf(out, "MVI     D,#$%02x", code[1]); opbytes = 2; break;
+        case 0x17: fprintf(out, "RAL"); opbytes = 1; break;
+        case 0x18: fprintf(out, "NOP"); opbytes = 1; break;
+        case 0x19: fprintf(out, "DAD     D"); opbytes = 1; break;
+        case 0x1a: fprintf(out, "LDAX    D"); opbytes = 1; break;
+        case 0x1b: fprintf(out, "DCX     D"); opbytes = 1; break;
+        case 0x1c: fprintf(out, "INR     E"); opbytes = 1; break;
+        case 0x1d: fprintf(out, "DCR     E"); opbytes = 1; break;
+        case 0x1e: fprintf(out, "MVI     E,#$%02x", code[1]); opbytes = 2; break;
+        case 0x1f: fprintf(out, "RAR"); opbytes = 1; break;
+
+        case 0x20: fprintf(out, "NOP"); opbytes = 1; break;
+        case 0x21: fprintf(out, "LXI     H,#$%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0x22: fprintf(out, "SHLD    $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0x23: fprintf(out, "INX     H"); opbytes = 1; break;
+        case 0x24: fprintf(out, "INR     H"); opbytes = 1; break;
+        case 0x25: fprintf(out, "DCR     H"); opbytes = 1; break;
+        case 0x26: fprintf(out, "MVI     H,#$%02x", code[1]); opbytes = 2; break;
+        case 0x27: fprintf(out, "DAA"); opbytes = 1; break;
+        case 0x28: fprintf(out, "NOP"); opbytes = 1; break;
+        case 0x29: fprintf(out, "DAD     H"); opbytes = 1; break;
+        case 0x2a: fprintf(out, "LHLD    $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0x2b: fprintf(out, "DCX     H"); opbytes = 1; break;
+        case 0x2c: fprintf(out, "INR     L"); opbytes = 1; break;
+        case 0x2d: fprintf(out, "DCR     L"); opbytes = 1; break;
+        case 0x2e: fprintf(out, "MVI     L,#$%02x", code[1]); opbytes = 2; break;
+        case 0x2f: fprintf(out, "CMA"); opbytes = 1; break;
+
+        case 0x30: fprintf(out, "NOP"); opbytes = 1; break;
+        case 0x31: fprintf(out, "LXI     SP,#$%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0x32: fprintf(out, "STA     $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0x33: fprintf(out, "INX     SP"); opbytes = 1; break;
+        case 0x34: fprintf(out, "INR     M"); opbytes = 1; break;
+        case 0x35: fprintf(out, "DCR     M"); opbytes = 1; break;
+        case 0x36: fprintf(out, "MVI     M,#$%02x", code[1]); opbytes = 2; break;
+        case 0x37: fprintf(out, "STC"); opbytes = 1; break;
+        case 0x38: fprintf(out, "NOP"); opbytes = 1; break;
+        case 0x39: fprintf(out, "DAD     SP"); opbytes = 1; break;
+        case 0x3a: fprintf(out, "LDA     $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0x3b: fprintf(out, "DCX     SP"); opbytes = 1; break;
+        case 0x3c: fprintf(out, "INR     A"); opbytes = 1; break;
+        case 0x3d: fprintf(out, "DCR     A"); opbytes = 1; break;
+        case 0x3e: fprintf(out, "MVI     A,#$%02x", code[1]); opbytes = 2; break;
+        case 0x3f: fprintf(out, "CMC"); opbytes = 1; break;
+
+        case 0x40: fprintf(out, "MOV     B,B"); opbytes = 1; break;
+        case 0x41: fprintf(out, "MOV     B,C"); opbytes = 1; break;
+        case 0x42: fprintf(out, "MOV     B,D"); opbytes = 1; break;
+        case 0x43: fprintf(out, "MOV     B,E"); opbytes = 1; break;
+        case 0x44: fprintf(out, "MOV     B,H"); opbytes = 1; break;
+        case 0x45: fprintf(out, "MOV     B,L"); opbytes = 1; break;
+        case 0x46: fprintf(out, "MOV     B,M"); opbytes = 1; break;
+        case 0x47: fprintf(out, "MOV     B,A"); opbytes = 1; break;
+        case 0x48: fprintf(out, "MOV     C,B"); opbytes = 1; break;
+        case 0x49: fprintf(out, "MOV     C,C"); opbytes = 1; break;
+        case 0x4a: fprintf(out, "MOV     C,D"); opbytes = 1; break;
+        case 0x4b: fprintf(out, "MOV     C,E"); opbytes = 1; break;
+        case 0x4c: fprintf(out, "MOV     C,H"); opbytes = 1; break;
+        case 0x4d: fprintf(out, "MOV     C,L"); opbytes = 1; break;
+        case 0x4e: fprintf(out, "MOV     C,M"); opbytes = 1; break;
+        case 0x4f: fprintf(out, "MOV     C,A"); opbytes = 1; break;
+
+        case 0x50: fprintf(out, "MOV     D,B"); opbytes = 1; break;
+        case 0x51: fprintf(out, "MOV     D,C"); opbytes = 1; break;
+        case 0x52: fprintf(out, "MOV     D,D"); opbytes = 1; break;
+        case 0x53: fprintf(out, "MOV     D,E"); opbytes = 1; break;
+        case 0x54: fprintf(out, "MOV     D,H"); opbytes = 1; break;
+        case 0x55: fprintf(out, "MOV     D,L"); opbytes = 1; break;
+        case 0x56: fprintf(out, "MOV     D,M"); opbytes = 1; break;
+        case 0x57: fprintf(out, "MOV     D,A"); opbytes = 1; break;
+        case 0x58: fprintf(out, "MOV     E,B"); opbytes = 1; break;
+        case 0x59: fprintf(out, "MOV     E,C"); opbytes = 1; break;
+        case 0x5a: fprintf(out, "MOV     E,D"); opbytes = 1; break;
+        case 0x5b: fprintf(out, "MOV     E,E"); opbytes = 1; break;
+        case 0x5c: fprintf(out, "MOV     E,H"); opbytes = 1; break;
+        case 0x5d: fprintf(out, "MOV     E,L"); opbytes = 1; break;
+        case 0x5e: fprintf(out, "MOV     E,M"); opbytes = 1; break;
+        case 0x5f: fprintf(out, "MOV     E,A"); opbytes = 1; break;
+
+        case 0x60: fprintf(out, "MOV     H,B"); opbytes = 1; break;
+        case 0x61: fprintf(out, "MOV     H,C"); opbytes = 1; break;
+        case 0x62: fprintf(out, "MOV     H,D"); opbytes = 1; break;
+        case 0x63: fprintf(out, "MOV     H,E"); opbytes = 1; break;
+        case 0x64: fprintf(out, "MOV     H,H"); opbytes = 1; break;
+        case 0x65: fprintf(out, "MOV     H,L"); opbytes = 1; break;
+        case 0x66: fprintf(out, "MOV     H,M"); opbytes = 1; break;
+        case 0x67: fprintf(out, "MOV     H,A"); opbytes = 1; break;
+        case 0x68: fprintf(out, "MOV     L,B"); opbytes = 1; break;
+        case 0x69: fprintf(out, "MOV     L,C"); opbytes = 1; break;
+        case 0x6a: fprintf(out, "MOV     L,D"); opbytes = 1; break;
+        case 0x6b: fprintf(out, "MOV     L,E"); opbytes = 1; break;
+        case 0x6c: fprintf(out, "MOV     L,H"); opbytes = 1; break;
+        case 0x6d: fprintf(out, "MOV     L,L"); opbytes = 1; break;
+        case 0x6e: fprintf(out, "MOV     L,M"); opbytes = 1; break;
+        case 0x6f: fprintf(out, "MOV     L,A"); opbytes = 1; break;
+
+        case 0x70: fprintf(out, "MOV     M,B"); opbytes = 1; break;
+        case 0x71: fprintf(out, "MOV     M,C"); opbytes = 1; break;
+        case 0x72: fprintf(out, "MOV     M,D"); opbytes = 1; break;
+        case 0x73: fprintf(out, "MOV     M,E"); opbytes = 1; break;
+        case 0x74: fprintf(out, "MOV     M,H"); opbytes = 1; break;
+        case 0x75: fprintf(out, "MOV     M,L"); opbytes = 1; break;
+        case 0x76: fprintf(out, "HLT"); opbytes = 1; break;
+        case 0x77: fprintf(out, "MOV     M,A"); opbytes = 1; break;
+        case 0x78: fprintf(out, "MOV     A,B"); opbytes = 1; break;
+        case 0x79: fprintf(out, "MOV     A,C"); opbytes = 1; break;
+        case 0x7a: fprintf(out, "MOV     A,D"); opbytes = 1; break;
+        case 0x7b: fprintf(out, "MOV     A,E"); opbytes = 1; break;
+        case 0x7c: fprintf(out, "MOV     A,H"); opbytes = 1; break;
+        case 0x7d: fprintf(out, "MOV     A,L"); opbytes = 1; break;
+        case 0x7e: fprintf(out, "MOV     A,M"); opbytes = 1; break;
+        case 0x7f: fprintf(out, "MOV     A,A"); opbytes = 1; break;
+
+        case 0x80: fprintf(out, "ADD     B"); opbytes = 1; break;
+        case 0x81: fprintf(out, "ADD     C"); opbytes = 1; break;
+        case 0x82: fprintf(out, "ADD     D"); opbytes = 1; break;
+        case 0x83: fprintf(out, "ADD     E"); opbytes = 1; break;
+        case 0x84: fprintf(out, "ADD     H"); opbytes = 1; break;
+        case 0x85: fprintf(out, "ADD     L"); opbytes = 1; break;
+        case 0x86: fprintf(out, "ADD     M"); opbytes = 1; break;
+        case 0x87: fprintf(out, "ADD     A"); opbytes = 1; break;
+        case 0x88: fprintf(out, "ADC     B"); opbytes = 1; break;
+        case 0x89: fprintf(out, "ADC     C"); opbytes = 1; break;
+        case 0x8a: fprintf(out, "ADC     D"); opbytes = 1; break;
+        case 0x8b: fprintf(out, "ADC     E"); opbytes = 1; break;
+        case 0x8c: fprintf(out, "ADC     H"); opbytes = 1; break;
+        case 0x8d: fprintf(out, "ADC     L"); opbytes = 1; break;
+        case 0x8e: fprintf(out, "ADC     M"); opbytes = 1; break;
+        case 0x8f: fprintf(out, "ADC     A"); opbytes = 1; break;
+
+        case 0x90: fprintf(out, "SUB     B"); opbytes = 1; break;
+        case 0x91: fprintf(out, "SUB     C"); opbytes = 1; break;
+        case 0x92: fprintf(out, "SUB     D"); opbytes = 1; break;
+        case 0x93: fprintf(out, "SUB     E"); opbytes = 1; break;
+        case 0x94: fprintf(out, "SUB     H"); opbytes = 1; break;
+        case 0x95: fprintf(out, "SUB     L"); opbytes = 1; break;
+        case 0x96: fprintf(out, "SUB     M"); opbytes = 1; break;
+        case 0x97: fprintf(out, "SUB     A"); opbytes = 1; break;
+        case 0x98: fprintf(out, "SBB     B"); opbytes = 1; break;
+        case 0x99: fprintf(out, "SBB     C"); opbytes = 1; break;
+        case 0x9a: fprintf(out, "SBB     D"); opbytes = 1; break;
+        case 0x9b: fprintf(out, "SBB     E"); opbytes = 1; break;
+        case 0x9c: fprintf(out, "SBB     H"); opbytes = 1; break;
+        case 0x9d: fprintf(out, "SBB     L"); opbytes = 1; break;
+        case 0x9e: fprintf(out, "SBB     M"); opbytes = 1; break;
+        case 0x9f: fprintf(out, "SBB     A"); opbytes = 1; break;
+
+        case 0xa0: fprintf(out, "ANA     B"); opbytes = 1; break;
+        case 0xa1: fprintf(out, "ANA     C"); opbytes = 1; break;
+        case 0xa2: fprintf(out, "ANA     D"); opbytes = 1; break;
+        case 0xa3: fprintf(out, "ANA     E"); opbytes = 1; break;
+        case 0xa4: fprintf(out, "ANA     H"); opbytes = 1; break;
+        case 0xa5: fprintf(out, "ANA     L"); opbytes = 1; break;
+        case 0xa6: fprintf(out, "ANA     M"); opbytes = 1; break;
+        case 0xa7: fprintf(out, "ANA     A"); opbytes = 1; break;
+        case 0xa8: fprintf(out, "XRA     B"); opbytes = 1; break;
+        case 0xa9: fprintf(out, "XRA     C"); opbytes = 1; break;
+        case 0xaa: fprintf(out, "XRA     D"); opbytes = 1; break;
+        case 0xab: fprintf(out, "XRA     E"); opbytes = 1; break;
+        case 0xac: fprintf(out, "XRA     H"); opbytes = 1; break;
+        case 0xad: fprintf(out, "XRA     L"); opbytes = 1; break;
+        case 0xae: fprintf(out, "XRA     M"); opbytes = 1; break;
+        case 0xaf: fprintf(out, "XRA     A"); opbytes = 1; break;
+
+        case 0xb0: fprintf(out, "ORA     B"); opbytes = 1; break;
+        case 0xb1: fprintf(out, "ORA     C"); opbytes = 1; break;
+        case 0xb2: fprintf(out, "ORA     D"); opbytes = 1; break;
+        case 0xb3: fprintf(out, "ORA     E"); opbytes = 1; break;
+        case 0xb4: fprintf(out, "ORA     H"); opbytes = 1; break;
+        case 0xb5: fprintf(out, "ORA     L"); opbytes = 1; break;
+        case 0xb6: fprintf(out, "ORA     M"); opbytes = 1; break;
+        case 0xb7: fprintf(out, "ORA     A"); opbytes = 1; break;
+        case 0xb8: fprintf(out, "CMP     B"); opbytes = 1; break;
+        case 0xb9: fprintf(out, "CMP     C"); opbytes = 1; break;
+        case 0xba: fprintf(out, "CMP     D"); opbytes = 1; break;
+        case 0xbb: fprintf(out, "CMP     E"); opbytes = 1; break;
+        case 0xbc: fprintf(out, "CMP     H"); opbytes = 1; break;
+        case 0xbd: fprintf(out, "CMP     L"); opbytes = 1; break;
+        case 0xbe: fprintf(out, "CMP     M"); opbytes = 1; break;
+        case 0xbf: fprintf(out, "CMP     A"); opbytes = 1; break;
+
+        case 0xc0: fprintf(out, "RNZ"); opbytes = 1; break;
+        case 0xc1: fprintf(out, "POP     B"); opbytes = 1; break;
+        case 0xc2: fprintf(out, "JNZ     $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xc3: fprintf(out, "JMP     $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xc4: fprintf(out, "CNZ     $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xc5: fprintf(out, "PUSH    B"); opbytes = 1; break;
+        case 0xc6: fprintf(out, "ADI     #$%02x", code[1]); opbytes = 2; break;
+        case 0xc7: fprintf(out, "RST     0"); opbytes = 1; break;
+        case 0xc8: fprintf(out, "RZ"); opbytes = 1; break;
+        case 0xc9: fprintf(out, "RET"); opbytes = 1; break;
+        case 0xca: fprintf(out, "JZ      $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xcb: fprintf(out, "NOP"); opbytes = 1; break;
+        case 0xcc: fprintf(out, "CZ      $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xcd: fprintf(out, "CALL    $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xce: fprintf(out, "ACI     #$%02x", code[1]); opbytes = 2; break;
+        case 0xcf: fprintf(out, "RST     1"); opbytes = 1; break;
+
+        case 0xd0: fprintf(out, "RNC"); opbytes = 1; break;
+        case 0xd1: fprintf(out, "POP     D"); opbytes = 1; break;
+        case 0xd2: fprintf(out, "JNC     $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xd3: fprintf(out, "OUT     #$%02x", code[1]); opbytes = 2; break;
+        case 0xd4: fprintf(out, "CNC     $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xd5: fprintf(out, "PUSH    D"); opbytes = 1; break;
+        case 0xd6: fprintf(out, "SUI     #$%02x", code[1]); opbytes = 2; break;
+        case 0xd7: fprintf(out, "RST     2"); opbytes = 1; break;
+        case 0xd8: fprintf(out, "RC"); opbytes = 1; break;
+        case 0xd9: fprintf(out, "NOP"); opbytes = 1; break;
+        case 0xda: fprintf(out, "JC      $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xdb: fprintf(out, "IN      #$%02x", code[1]); opbytes = 2; break;
+        case 0xdc: fprintf(out, "CC      $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xdd: fprintf(out, "NOP"); opbytes = 1; break;
+        case 0xde: fprintf(out, "SBI     #$%02x", code[1]); opbytes = 2; break;
+        case 0xdf: fprintf(out, "RST     3"); opbytes = 1; break;
+
+        case 0xe0: fprintf(out, "RPO"); opbytes = 1; break;
+        case 0xe1: fprintf(out, "POP     H"); opbytes = 1; break;
+        case 0xe2: fprintf(out, "JPO     $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xe3: fprintf(out, "XTHL"); opbytes = 1; break;
+        case 0xe4: fprintf(out, "CPO     $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xe5: fprintf(out, "PUSH    H"); opbytes = 1; break;
+        case 0xe6: fprintf(out, "ANI     #$%02x", code[1]); opbytes = 2; break;
+        case 0xe7: fprintf(out, "RST     4"); opbytes = 1; break;
+        case 0xe8: fprintf(out, "RPE"); opbytes = 1; break;
+        case 0xe9: fprintf(out, "PCHL"); opbytes = 1; break;
+        case 0xea: fprintf(out, "JPE     $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xeb: fprintf(out, "XCHG"); opbytes = 1; break;
+        case 0xec: fprintf(out, "CPE     $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xed: fprintf(out, "NOP"); opbytes = 1; break;
+        case 0xee: fprintf(out, "XRI     #$%02x", code[1]); opbytes = 2; break;
+        case 0xef: fprintf(out, "RST     5"); opbytes = 1; break;
+
+        case 0xf0: fprintf(out, "RP"); opbytes = 1; break;
+        case 0xf1: fprintf(out, "POP     PSW"); opbytes = 1; break;
+        case 0xf2: fprintf(out, "JP      $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xf3: fprintf(out, "DI"); opbytes = 1; break;
+        case 0xf4: fprintf(out, "CP      $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xf5: fprintf(out, "PUSH    PSW"); opbytes = 1; break;
+        case 0xf6: fprintf(out, "ORI     #$%02x", code[1]); opbytes = 2; break;
+        case 0xf7: fprintf(out, "RST     6"); opbytes = 1; break;
+        case 0xf8: fprintf(out, "RM"); opbytes = 1; break;
+        case 0xf9: fprintf(out, "SPHL"); opbytes = 1; break;
+        case 0xfa: fprintf(out, "JM      $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xfb: fprintf(out, "EI"); opbytes = 1; break;
+        case 0xfc: fprintf(out, "CM      $%02x%02x", code[2], code[1]); opbytes = 3; break;
+        case 0xfd: fprintf(out, "NOP"); opbytes = 1; break;
+        case 0xfe: fprintf(out, "CPI     #$%02x", code[1]); opbytes = 2; break;
+        case 0xff: fprintf(out, "RST     7"); opbytes = 1; break;
+
+        default: fprintf(out, "undefined opcode: 0x%02x", code[0]); opbytes = 1; break;
+    }
+
+    fprintf(out, "\n");
+
+    return opbytes;
+}
+
+/**
+ * @brief Returns the size of an operation without disassembling it. Must agree with the byte
+ *  counts returned by disassemble_op.
+ * 
+ * @param opcode The first byte of the operation
+ * @return int Number of bytes used for the operation (1-3)
+ */
+int op_length(unsigned char opcode) {
+    switch(opcode) {
+        case 0x01: case 0x11: case 0x21: case 0x31:             // LXI
+        case 0x22: case 0x2a: case 0x32: case 0x3a:             // SHLD, LHLD, STA, LDA
+        case 0xc2: case 0xc3: case 0xc4: case 0xca: case 0xcc: case 0xcd:
+        case 0xd2: case 0xd4: case 0xda: case 0xdc:
+        case 0xe2: case 0xe4: case 0xea: case 0xec:
+        case 0xf2: case 0xf4: case 0xfa: case 0xfc:             // Jumps and calls
+            return 3;
+
+        case 0x06: case 0x0e: case 0x16: case 0x1e:
+        case 0x26: case 0x2e: case 0x36: case 0x3e:             // MVI
+        case 0xc6: case 0xce: case 0xd3: case 0xd6: case 0xdb: case 0xde:
+        case 0xe6: case 0xee: case 0xf6: case 0xfe:             // Immediate ALU and I/O
+            return 2;
+
+        default:
+            return 1;
+    }
+}
+
+/**
+ * @brief Length of an operation as the core runs it. op_length goes by disassemble_op, which
+ *  prints the undocumented JMP and CALL aliases as 1-byte NOPs, but they take a 2-byte address
+ *  like the originals.
+ * 
+ * @param opcode The first byte of the operation
+ * @return int Number of bytes used for the operation (1-3)
+ */
+int trace_length(unsigned char opcode) {
+    switch(opcode) {
+        case 0xcb: case 0xdd: case 0xed: case 0xfd:
+            return 3;
+
+        default:
+            return op_length(opcode);
+    }
+}
@@ -0,0 +1,10 @@
+#ifndef DISASM_H
+#define DISASM_H
+
+#include <stdio.h>
+
+int disassemble_op(FILE* out, unsigned char *codebuffer, int pc);
+int op_length(unsigned char opcode);
+int trace_length(unsigned char opcode);
+
+#endif
@@ -0,0 +1,236 @@
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include "disk.h"
+
+// The usual skew of 6 for 8" floppies.
+static const uint8_t FLOPPY_SKEW[26] = {
+     1,  7, 13, 19, 25,  5, 11, 17, 23,  3,  9, 15, 21,
+     2,  8, 14, 20, 26,  6, 12, 18, 24,  4, 10, 16, 22,
+};
+
+static const DiskFormat FLOPPY_FORMAT = {
+    "8\" SSSD", 26, 3, 7, 0, 242, 63, 0xc0, 0x00, 16, 2, FLOPPY_SKEW,
+};
+
+/**
+ * @brief Picks the format from the size of the image. Hard disks use the same parameters as
+ *  z80pack's, with 2KB blocks and 1024 directory entries.
+ */
+static int choose_format(size_t size, DiskFormat* format) {
+    if (size == DISK_FLOPPY_SIZE) {
+        *format = FLOPPY_FORMAT;
+        return 0;
+    }
+    if (size % DISK_HD_TRACK_SIZE != 0 || size < DISK_HD_MIN_SIZE || size > DISK_HD_MAX_SIZE) {
+        return -1;
+    }
+
+    DiskFormat hard_disk = {
+        "hard disk", 128, 4, 15, 0, size / 2048 - 1, 1023, 0xff, 0xff, 0, 0, NULL,
+    };
+    *format = hard_disk;
+    return 0;
+}
+
+/**
+ * @brief Maps a disk image. A path that doesn't exist yet gets a new, empty 8" floppy image.
+ *  Images that can't be opened for writing are mapped read-only.
+ *
+ * @param path The image file
+ * @return Disk* The disk, or NULL if the image can't be opened or isn't a size CP/M uses
+ */
+Disk* disk_open(const char* path) {
+    int read_only = 0;
+    int fd = open(path, O_RDWR);
+    if (fd < 0) {
+        fd = open(path, O_RDONLY);
+        read_only = 1;
+    }
+    if (fd < 0) {
+        fd = open(path, O_RDWR | O_CREAT | O_EXCL, 0644);
+        if (fd < 0) {
+            return NULL;
+        }
+        // A formatted disk is all 0xe5, which is also what an empty directory entry starts with.
+        uint8_t track[26 * DISK_RECORD_SIZE];
+        memset(track, DISK_ENTRY_FREE, sizeof(track));
+        int i;
+        for (i = 0; i < DISK_FLOPPY_SIZE / (int)sizeof(track); i++) {
+            if (write(fd, track, sizeof(track)) != sizeof(track)) {
+                close(fd);
+                return NULL;
+            }
+        }
+        read_only = 0;
+    }
+
+    struct stat info;
+    DiskFormat format;
+    if (fstat(fd, &info) < 0 || choose_format(info.st_size, &format) < 0) {
+        close(fd);
+        return NULL;
+    }
+    int protection = read_only ? PROT_READ : PROT_READ | PROT_WRITE;
+    uint8_t* data = mmap(NULL, info.st_size, protection, MAP_SHARED, fd, 0);
+    close(fd);
+    if (data == MAP_FAILED) {
+        return NULL;
+    }
+
+    Disk* disk = calloc(1, sizeof(Disk));
+    disk->format = format;
+    disk->data = data;
+    disk->size = info.st_size;
+    disk->read_only = read_only;
+    disk->allocation = calloc(format.dsm + 1, 1);
+    disk_login(disk);
+    return disk;
+}
+
+void disk_close(Disk* disk) {
+    if (!disk->read_only) {
+        msync(disk->data, disk->size, MS_SYNC);
+    }
+    munmap(disk->data, disk->size);
+    free(disk->allocation);
+    free(disk);
+}
+
+/**
+ * @brief Works out which blocks are in use from the directory, like CP/M does when a disk is
+ *  logged in.
+ */
+void disk_login(Disk* disk) {
+    DiskFormat* format = &disk->format;
+    memset(disk->allocation, 0, format->dsm + 1);
+    uint16_t reserved = format->al0 << 8 | format->al1;
+    int i, pointer;
+    for (i = 0; i < 16; i++) {
+        if (reserved & (0x8000 >> i)) {
+            disk->allocation[i] = 1;
+        }
+    }
+
+    for (i = 0; i <= format->drm; i++) {
+        uint8_t* entry = disk_entry(disk, i);
+        if (entry == NULL || entry[0] == DISK_ENTRY_FREE) {
+            continue;
+        }
+        for (pointer = 0; pointer < disk_pointers(disk); pointer++) {
+            uint16_t block = disk_get_block(disk, entry, pointer);
+            if (block != 0 && block <= format->dsm) {
+                disk->allocation[block] = 1;
+            }
+        }
+    }
+}
+
+/**
+ * @brief A sector as the BIOS addresses it: sectors count from 1 on skewed disks (where they
+ *  come out of SECTRAN) and from 0 otherwise.
+ *
+ * @return uint8_t* The sector's 128 bytes in the image, or NULL if it's off the disk
+ */
+uint8_t* disk_sector(Disk* disk, uint16_t track, uint16_t sector) {
+    if (disk->format.skew != NULL) {
+        if (sector == 0) {
+            return NULL;
+        }
+        sector--;
+    }
+    if (sector >= disk->format.spt) {
+        return NULL;
+    }
+    size_t offset = ((size_t)track * disk->format.spt + sector) * DISK_RECORD_SIZE;
+    return offset + DISK_RECORD_SIZE <= disk->size ? &disk->data[offset] : NULL;
+}
+
+/**
+ * @brief A record (128 bytes) of a block, found through the reserved tracks and the skew.
+ *
+ * @return uint8_t* The record in the image, or NULL if it's off the disk
+ */
+uint8_t* disk_record(Disk* disk, uint16_t block, uint16_t record) {
+    DiskFormat* format = &disk->format;
+    uint32_t logical = (uint32_t)format->off * format->spt + ((uint32_t)block << format->bsh) +
+        record;
+    uint16_t sector = logical % format->spt;
+    if (format->skew != NULL) {
+        sector = format->skew[sector];
+    }
+    return disk_sector(disk, logical / format->spt, sector);
+}
+
+/**
+ * @brief A 32 byte directory entry. The directory fills the first blocks of the disk.
+ *
+ * @return uint8_t* The entry in the image, or NULL if it's off the disk
+ */
+uint8_t* disk_entry(Disk* disk, int index) {
+    int record = index / (DISK_RECORD_SIZE / DISK_ENTRY_SIZE);
+    uint8_t* data = disk_record(disk, record >> disk->format.bsh, record & disk->format.blm);
+    return data != NULL ? &data[(index % (DISK_RECORD_SIZE / DISK_ENTRY_SIZE)) * DISK_ENTRY_SIZE]
+        : NULL;
+}
+
+/**
+ * @brief Number of block pointers in a directory entry: 16 bytes, or 8 words once there are
+ *  more than 256 blocks.
+ */
+int disk_pointers(Disk* disk) {
+    return disk->format.dsm > 255 ? 8 : 16;
+}
+
+/**
+ * @brief Reads one of the block pointers of a directory entry or FCB (from byte 16 on).
+ */
+uint16_t disk_get_block(Disk* disk, const uint8_t* entry, int index) {
+    if (disk->format.dsm > 255) {
+        return entry[16 + index * 2] | entry[17 + index * 2] << 8;
+    }
+    return entry[16 + index];
+}
+
+void disk_set_block(Disk* disk, uint8_t* entry, int index, uint16_t block) {
+    if (disk->format.dsm > 255) {
+        entry[16 + index * 2] = block & 0xff;
+        entry[17 + index * 2] = block >> 8;
+    }
+    else {
+        entry[16 + index] = block;
+    }
+}
+
+/**
+ * @brief Takes the first free block.
+ *
+ * @return uint16_t The block, or 0 if the disk is full
+ */
+uint16_t disk_allocate(Disk* disk) {
+    uint16_t block;
+    for (block = 1; block <= disk->format.dsm; block++) {
+        if (!disk->allocation[block]) {
+            disk->allocation[block] = 1;
+            return block;
+        }
+    }
+    return 0;
+}
+
+/**
+ * @brief Frees the blocks of a directory entry that's being deleted.
+ */
+void disk_release(Disk* disk, const uint8_t* entry) {
+    int i;
+    for (i = 0; i < disk_pointers(disk); i++) {
+        uint16_t block = disk_get_block(disk, entry, i);
+        if (block != 0 && block <= disk->format.dsm) {
+            disk->allocation[block] = 0;
+        }
+    }
+}
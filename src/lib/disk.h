@@ -0,0 +1,61 @@
+#ifndef DISK_H
+#define DISK_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define DISK_RECORD_SIZE 128
+#define DISK_ENTRY_SIZE 32
+#define DISK_ENTRY_FREE 0xe5
+
+// Standard 8" single sided, single density floppy (IBM 3740): 77 tracks of 26 sectors.
+#define DISK_FLOPPY_SIZE 256256
+
+// Hard disk images are tracks of 128 sectors, 1-8MB (the most CP/M 2.2 can address).
+#define DISK_HD_TRACK_SIZE 16384
+#define DISK_HD_MIN_SIZE 0x100000
+#define DISK_HD_MAX_SIZE 0x800000
+
+/**
+ * @brief Layout of a CP/M disk, the fields of its disk parameter block plus the sector skew.
+ */
+typedef struct DiskFormat {
+    const char* name;
+    uint16_t spt;                   // 128 byte sectors per track
+    uint8_t bsh;                    // Block size is 128 << bsh
+    uint8_t blm;                    // Records per block - 1
+    uint8_t exm;                    // Logical extents per directory entry - 1
+    uint16_t dsm;                   // Blocks - 1
+    uint16_t drm;                   // Directory entries - 1
+    uint8_t al0, al1;               // Blocks the directory takes, as a bitmap
+    uint16_t cks;                   // Size of the directory check vector
+    uint16_t off;                   // Reserved (system) tracks
+    const uint8_t* skew;            // Physical sector (from 1) for each logical one, or NULL
+} DiskFormat;
+
+/**
+ * @brief A CP/M disk image, mapped into memory so sectors are read and written in place. Only
+ *  the directory is looked at when it's logged in, so even a large image costs nothing until
+ *  its sectors are used.
+ */
+typedef struct Disk {
+    DiskFormat format;
+    uint8_t* data;
+    size_t size;
+    int read_only;                  // The image file couldn't be opened for writing
+    uint8_t* allocation;            // A byte per block, 1 if it's in use
+} Disk;
+
+Disk* disk_open(const char* path);
+void disk_close(Disk* disk);
+void disk_login(Disk* disk);
+uint8_t* disk_sector(Disk* disk, uint16_t track, uint16_t sector);
+uint8_t* disk_record(Disk* disk, uint16_t block, uint16_t record);
+uint8_t* disk_entry(Disk* disk, int index);
+uint16_t disk_get_block(Disk* disk, const uint8_t* entry, int index);
+void disk_set_block(Disk* disk, uint8_t* entry, int index, uint16_t block);
+int disk_pointers(Disk* disk);
+uint16_t disk_allocate(Disk* disk);
+void disk_release(Disk* disk, const uint8_t* entry);
+
+#endif
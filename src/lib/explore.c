@@ -0,0 +1,412 @@
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "explore.h"
+#include "hash.h"
+#include "hashset.h"
+
+/**
+ * @brief A state waiting to be expanded. Memory is kept as just the 256 byte pages that differ
+ *  from the starting state, which for a game is its RAM at most, so a node is a few KB and
+ *  loading one only touches those pages.
+ */
+typedef struct Node {
+    uint64_t cycles;
+    uint16_t pc, sp, bc, de, hl;
+    uint8_t a, flags, int_enable, halted;
+    uint8_t port1, port2, port3, port5, shift_offset, half;
+    uint16_t shift;
+    uint64_t frame;
+    int page_count;
+    uint8_t* pages;             // page_count page numbers, then page_count * 256 bytes
+} Node;
+
+/**
+ * @brief One combination of held buttons, as the bits it sets on each input port.
+ */
+typedef struct Input {
+    uint8_t mask[3];            // Indexed by port, 1 and 2 are used
+    uint8_t value[3];
+} Input;
+
+typedef struct Explorer Explorer;
+
+/**
+ * @brief A thread's own machine, which nodes are loaded into to be expanded.
+ */
+typedef struct Worker {
+    Explorer* explorer;
+    pthread_t thread;
+    State8080* state;
+    Invaders* machine;
+    StateHasher hasher;
+    uint8_t dirty[256];         // Pages that may differ from the starting state
+    uint32_t versions[256];     // Page versions when the node was loaded
+
+    Node* children;             // New states for the next level
+    uint64_t child_count;
+    uint64_t child_capacity;
+    uint64_t generated;
+    uint64_t duplicates;
+} Worker;
+
+struct Explorer {
+    uint8_t* memory;            // Starting memory, which nodes are stored against
+    Input inputs[1 << EXPLORE_MAX_BUTTONS];
+    int input_count;
+
+    HashSet* seen;
+    uint64_t max_states;
+    atomic_ullong states;       // Distinct states kept, never more than max_states
+    atomic_int full;
+
+    Node* frontier;
+    uint64_t frontier_count;
+    atomic_ullong next;
+};
+
+#pragma region Nodes
+
+/**
+ * @brief Puts a node into a worker's machine. Only the pages that differ from the starting
+ *  state in the node, or might in the machine, are copied.
+ */
+static void load_node(Worker* worker, Node* node) {
+    Explorer* explorer = worker->explorer;
+    State8080* state = worker->state;
+    uint8_t in_node[256] = { 0 };
+    int i;
+    for (i = 0; i < node->page_count; i++) {
+        int page = node->pages[i];
+        in_node[page] = 1;
+        memcpy(&state->memory[page << 8], &node->pages[node->page_count + i * 256], 256);
+        mark_written(state, page << 8, 256);
+    }
+    for (i = 0; i < 256; i++) {
+        if (worker->dirty[i] && !in_node[i]) {
+            memcpy(&state->memory[i << 8], &explorer->memory[i << 8], 256);
+            mark_written(state, i << 8, 256);
+        }
+    }
+    memcpy(worker->dirty, in_node, sizeof(in_node));
+    memcpy(worker->versions, state->page_versions, sizeof(worker->versions));
+
+    state->cycles = node->cycles;
+    state->pc = node->pc;
+    state->sp = node->sp;
+    state->bc = node->bc;
+    state->de = node->de;
+    state->hl = node->hl;
+    state->a = node->a;
+    unpack_codes(state, node->flags);
+    state->int_enable = node->int_enable;
+    state->halted = node->halted;
+
+    Invaders* machine = worker->machine;
+    machine->port1 = node->port1;
+    machine->port2 = node->port2;
+    machine->port3 = node->port3;
+    machine->port5 = node->port5;
+    machine->shift = node->shift;
+    machine->shift_offset = node->shift_offset;
+    machine->half = node->half;
+    machine->frame = node->frame;
+}
+
+/**
+ * @brief Stores a machine's state as a node, keeping only the pages that differ from the
+ *  starting state. Pages not marked in dirty are known to match it and aren't compared.
+ */
+static void save_node(Explorer* explorer, Invaders* machine, const uint8_t* dirty, Node* node) {
+    State8080* state = machine->state;
+    uint8_t pages[256];
+    int count = 0;
+    int i;
+    for (i = 0; i < 256; i++) {
+        if (dirty[i] && memcmp(&state->memory[i << 8], &explorer->memory[i << 8], 256) != 0) {
+            pages[count++] = i;
+        }
+    }
+
+    node->page_count = count;
+    node->pages = malloc(count * 257);
+    memcpy(node->pages, pages, count);
+    for (i = 0; i < count; i++) {
+        memcpy(&node->pages[count + i * 256], &state->memory[pages[i] << 8], 256);
+    }
+
+    node->cycles = state->cycles;
+    node->pc = state->pc;
+    node->sp = state->sp;
+    node->bc = state->bc;
+    node->de = state->de;
+    node->hl = state->hl;
+    node->a = state->a;
+    node->flags = pack_codes(state);
+    node->int_enable = state->int_enable;
+    node->halted = state->halted;
+
+    node->port1 = machine->port1;
+    node->port2 = machine->port2;
+    node->port3 = machine->port3;
+    node->port5 = machine->port5;
+    node->shift = machine->shift;
+    node->shift_offset = machine->shift_offset;
+    node->half = machine->half;
+    node->frame = machine->frame;
+}
+
+/**
+ * @brief Hash of everything that decides how the machine carries on: the registers and cycle
+ *  counter, memory, and the board's ports and shift register. The buttons being explored are
+ *  left out, since they're set again before the next frame, so states that only differ in
+ *  which of them were held count as the same.
+ */
+static uint64_t hash_machine(Worker* worker) {
+    Explorer* explorer = worker->explorer;
+    Invaders* machine = worker->machine;
+    uint8_t port1 = machine->port1 & ~explorer->inputs[0].mask[1];
+    uint8_t port2 = machine->port2 & ~explorer->inputs[0].mask[2];
+    uint64_t parts[3] = {
+        hash_registers(worker->state),
+        hasher_update(&worker->hasher, worker->state),
+        (uint64_t)port1 | (uint64_t)port2 << 8 | (uint64_t)machine->port3 << 16 |
+            (uint64_t)machine->port5 << 24 | (uint64_t)machine->shift << 32 |
+            (uint64_t)machine->shift_offset << 48 | (uint64_t)machine->half << 56,
+    };
+    return hash64(parts, sizeof(parts), 0);
+}
+
+#pragma endregion
+
+#pragma region Expansion
+
+/**
+ * @brief Counts a new state against the limit. Threads claim their place before keeping a state,
+ *  so together they stop at exactly max_states.
+ *
+ * @return int 1 if the state can be kept, 0 if the limit has been reached
+ */
+static int claim_state(Explorer* explorer) {
+    uint64_t states = atomic_load(&explorer->states);
+    do {
+        if (states >= explorer->max_states) {
+            return 0;
+        }
+    } while (!atomic_compare_exchange_weak(&explorer->states, &states, states + 1));
+    return 1;
+}
+
+/**
+ * @brief Runs a frame from the node with every input, keeping the states not seen before.
+ */
+static void expand(Worker* worker, Node* node) {
+    Explorer* explorer = worker->explorer;
+    int i;
+    for (i = 0; i < explorer->input_count; i++) {
+        load_node(worker, node);
+        Invaders* machine = worker->machine;
+        Input* input = &explorer->inputs[i];
+        machine->port1 = (machine->port1 & ~input->mask[1]) | input->value[1];
+        machine->port2 = (machine->port2 & ~input->mask[2]) | input->value[2];
+        invaders_run_frame(machine);
+
+        int page;
+        for (page = 0; page < 256; page++) {
+            if (worker->versions[page] != worker->state->page_versions[page]) {
+                worker->dirty[page] = 1;
+            }
+        }
+
+        worker->generated++;
+        int added = hashset_insert(explorer->seen, hash_machine(worker));
+        if (added == 0) {
+            worker->duplicates++;
+            continue;
+        }
+        if (added < 0 || !claim_state(explorer)) {
+            atomic_store(&explorer->full, 1);
+            return;
+        }
+
+        if (worker->child_count == worker->child_capacity) {
+            worker->child_capacity = worker->child_capacity ? worker->child_capacity * 2 : 256;
+            worker->children = realloc(worker->children, worker->child_capacity * sizeof(Node));
+        }
+        save_node(explorer, worker->machine, worker->dirty,
+            &worker->children[worker->child_count++]);
+    }
+}
+
+static void* worker_thread(void* arg) {
+    Worker* worker = arg;
+    Explorer* explorer = worker->explorer;
+    uint64_t i;
+    while (!atomic_load(&explorer->full) &&
+           (i = atomic_fetch_add(&explorer->next, 1)) < explorer->frontier_count) {
+        expand(worker, &explorer->frontier[i]);
+    }
+    return NULL;
+}
+
+static int build_inputs(Explorer* explorer, char** buttons, int button_count) {
+    uint8_t ports[EXPLORE_MAX_BUTTONS];
+    uint8_t masks[EXPLORE_MAX_BUTTONS];
+    int i, combination;
+    for (i = 0; i < button_count; i++) {
+        if (invaders_find_button(buttons[i], &ports[i], &masks[i]) < 0) {
+            return -1;
+        }
+    }
+
+    explorer->input_count = 1 << button_count;
+    for (combination = 0; combination < explorer->input_count; combination++) {
+        Input* input = &explorer->inputs[combination];
+        memset(input, 0, sizeof(Input));
+        for (i = 0; i < button_count; i++) {
+            input->mask[ports[i]] |= masks[i];
+            if (combination & (1 << i)) {
+                input->value[ports[i]] |= masks[i];
+            }
+        }
+    }
+    return 0;
+}
+
+static double elapsed_seconds(struct timespec* start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+/**
+ * @brief Breadth-first search over the inputs, a frame per level. Every state in a level is
+ *  run for one frame with every combination of the buttons held, and the states that come out
+ *  are hashed and dropped if they were seen before. The levels are expanded in parallel, each
+ *  thread with its own machine, and only the new states go on to the next level.
+ *
+ * @param root Machine to start from. It isn't changed.
+ * @param buttons Names of the buttons to try, as in input scripts
+ * @param button_count Number of buttons, at most EXPLORE_MAX_BUTTONS
+ * @param frames Number of frames to explore, one level each
+ * @param max_states Stop once this many distinct states have been found
+ * @param threads Threads to expand on
+ * @param log Where to print a line per level, or NULL
+ * @param result Filled in with what was found
+ * @return int 0, or -1 if a button is unknown
+ */
+int explore(Invaders* root, char** buttons, int button_count, uint64_t frames,
+    uint64_t max_states, int threads, FILE* log, ExploreResult* result) {
+    Explorer* explorer = calloc(1, sizeof(Explorer));
+    if (button_count > EXPLORE_MAX_BUTTONS || build_inputs(explorer, buttons, button_count) < 0) {
+        free(explorer);
+        return -1;
+    }
+    explorer->memory = malloc(0x10000);
+    memcpy(explorer->memory, root->state->memory, 0x10000);
+    explorer->seen = hashset_create(max_states + 1);
+    explorer->max_states = max_states;
+    atomic_init(&explorer->states, 1);
+    atomic_init(&explorer->full, 0);
+
+    Worker* workers = calloc(threads, sizeof(Worker));
+    int i;
+    for (i = 0; i < threads; i++) {
+        Worker* worker = &workers[i];
+        worker->explorer = explorer;
+        worker->state = init_8080();
+        memcpy(worker->state->memory, explorer->memory, 0x10000);
+        worker->machine = invaders_create(worker->state);
+        worker->machine->start_cycles = root->start_cycles;
+        worker->machine->superinstructions = root->superinstructions;
+        worker->machine->idle_skipping = root->idle_skipping;
+        hasher_init(&worker->hasher, worker->state);
+    }
+
+    // The starting state is the first level. Its memory is where nodes are stored from, so it
+    // has no pages of its own.
+    memset(result, 0, sizeof(ExploreResult));
+    uint8_t clean[256] = { 0 };
+    explorer->frontier = malloc(sizeof(Node));
+    explorer->frontier_count = 1;
+    save_node(explorer, root, clean, &explorer->frontier[0]);
+    load_node(&workers[0], &explorer->frontier[0]);
+    hashset_insert(explorer->seen, hash_machine(&workers[0]));
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+    while (explorer->frontier_count > 0 && result->frames < frames &&
+           !atomic_load(&explorer->full)) {
+        atomic_store(&explorer->next, 0);
+        for (i = 0; i < threads; i++) {
+            pthread_create(&workers[i].thread, NULL, worker_thread, &workers[i]);
+        }
+        for (i = 0; i < threads; i++) {
+            pthread_join(workers[i].thread, NULL);
+        }
+
+        // The new states from every thread make up the next level.
+        uint64_t count = 0, generated = 0, duplicates = 0;
+        for (i = 0; i < threads; i++) {
+            count += workers[i].child_count;
+            generated += workers[i].generated;
+            duplicates += workers[i].duplicates;
+        }
+        uint64_t level = result->frames + 1;
+        uint64_t n;
+        for (n = 0; n < explorer->frontier_count; n++) {
+            free(explorer->frontier[n].pages);
+        }
+        explorer->frontier = realloc(explorer->frontier, (count ? count : 1) * sizeof(Node));
+        explorer->frontier_count = 0;
+        for (i = 0; i < threads; i++) {
+            if (workers[i].child_count > 0) {
+                memcpy(&explorer->frontier[explorer->frontier_count], workers[i].children,
+                    workers[i].child_count * sizeof(Node));
+                explorer->frontier_count += workers[i].child_count;
+                workers[i].child_count = 0;
+            }
+        }
+        if (explorer->frontier_count > result->peak_frontier) {
+            result->peak_frontier = explorer->frontier_count;
+        }
+
+        if (log != NULL) {
+            fprintf(log, "Frame %llu: %llu new states, %.1f%% duplicates so far\n",
+                (unsigned long long)level, (unsigned long long)count,
+                generated ? 100.0 * duplicates / generated : 0.0);
+        }
+        result->frames = level;
+        result->generated = generated;
+        result->duplicates = duplicates;
+    }
+    result->seconds = elapsed_seconds(&start);
+    result->unique = atomic_load(&explorer->states);
+    result->truncated = atomic_load(&explorer->full);
+
+    uint64_t n;
+    for (n = 0; n < explorer->frontier_count; n++) {
+        free(explorer->frontier[n].pages);
+    }
+    for (i = 0; i < threads; i++) {
+        Worker* worker = &workers[i];
+        uint64_t c;
+        for (c = 0; c < worker->child_count; c++) {
+            free(worker->children[c].pages);
+        }
+        free(worker->children);
+        invaders_free(worker->machine);
+        free_8080(worker->state);
+    }
+    free(workers);
+    free(explorer->frontier);
+    hashset_free(explorer->seen);
+    free(explorer->memory);
+    free(explorer);
+    return 0;
+}
+
+#pragma endregion
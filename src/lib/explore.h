@@ -0,0 +1,27 @@
+#ifndef EXPLORE_H
+#define EXPLORE_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "invaders.h"
+
+#define EXPLORE_MAX_BUTTONS 8
+
+/**
+ * @brief What an exploration found.
+ */
+typedef struct ExploreResult {
+    uint64_t frames;            // Levels explored, one per frame
+    uint64_t generated;         // States produced by running a frame with some input
+    uint64_t duplicates;        // Ones that had already been seen
+    uint64_t unique;            // Distinct states, including the starting one
+    uint64_t peak_frontier;     // Most states waiting to be expanded at once
+    int truncated;              // Stopped because the state limit was reached
+    double seconds;
+} ExploreResult;
+
+int explore(Invaders* root, char** buttons, int button_count, uint64_t frames,
+    uint64_t max_states, int threads, FILE* log, ExploreResult* result);
+
+#endif
@@ -0,0 +1,166 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "hash.h"
+
+#pragma region xxHash64
+
+static const uint64_t PRIME1 = 0x9e3779b185ebca87ULL;
+static const uint64_t PRIME2 = 0xc2b2ae3d27d4eb4fULL;
+static const uint64_t PRIME3 = 0x165667b19e3779f9ULL;
+static const uint64_t PRIME4 = 0x85ebca77c2b2ae63ULL;
+static const uint64_t PRIME5 = 0x27d4eb2f165667c5ULL;
+
+static uint64_t rotate_left(uint64_t value, int bits) {
+    return (value << bits) | (value >> (64 - bits));
+}
+
+static uint64_t read64(const uint8_t* bytes) {
+    uint64_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static uint32_t read32(const uint8_t* bytes) {
+    uint32_t value;
+    memcpy(&value, bytes, sizeof(value));
+    return value;
+}
+
+static uint64_t round64(uint64_t accumulator, uint64_t input) {
+    accumulator += input * PRIME2;
+    accumulator = rotate_left(accumulator, 31);
+    return accumulator * PRIME1;
+}
+
+static uint64_t merge_round(uint64_t hash, uint64_t accumulator) {
+    hash ^= round64(0, accumulator);
+    return hash * PRIME1 + PRIME4;
+}
+
+/**
+ * @brief xxHash64 (on a little-endian host). Fast enough to hash a 256 byte page in well under
+ *  a microsecond.
+ * 
+ * @param data Bytes to hash
+ * @param length Number of bytes
+ * @param seed 
+ * @return uint64_t 
+ */
+uint64_t hash64(const void* data, size_t length, uint64_t seed) {
+    const uint8_t* bytes = data;
+    const uint8_t* end = bytes + length;
+    uint64_t hash;
+
+    if (length >= 32) {
+        uint64_t v1 = seed + PRIME1 + PRIME2;
+        uint64_t v2 = seed + PRIME2;
+        uint64_t v3 = seed;
+        uint64_t v4 = seed - PRIME1;
+        do {
+            v1 = round64(v1, read64(bytes));
+            v2 = round64(v2, read64(bytes + 8));
+            v3 = round64(v3, read64(bytes + 16));
+            v4 = round64(v4, read64(bytes + 24));
+            bytes += 32;
+        } while (bytes + 32 <= end);
+
+        hash = rotate_left(v1, 1) + rotate_left(v2, 7) + rotate_left(v3, 12) +
+            rotate_left(v4, 18);
+        hash = merge_round(hash, v1);
+        hash = merge_round(hash, v2);
+        hash = merge_round(hash, v3);
+        hash = merge_round(hash, v4);
+    }
+    else {
+        hash = seed + PRIME5;
+    }
+
+    hash += length;
+    while (bytes + 8 <= end) {
+        hash ^= round64(0, read64(bytes));
+        hash = rotate_left(hash, 27) * PRIME1 + PRIME4;
+        bytes += 8;
+    }
+    if (bytes + 4 <= end) {
+        hash ^= read32(bytes) * PRIME1;
+        hash = rotate_left(hash, 23) * PRIME2 + PRIME3;
+        bytes += 4;
+    }
+    while (bytes < end) {
+        hash ^= *bytes * PRIME5;
+        hash = rotate_left(hash, 11) * PRIME1;
+        bytes++;
+    }
+
+    hash ^= hash >> 33;
+    hash *= PRIME2;
+    hash ^= hash >> 29;
+    hash *= PRIME3;
+    hash ^= hash >> 32;
+    return hash;
+}
+
+#pragma endregion
+
+#pragma region State Hashing
+
+/**
+ * @brief Hash of the registers, flags, interrupt state and cycle counter.
+ * 
+ * @param state The 8080 state
+ * @return uint64_t 
+ */
+uint64_t hash_registers(State8080* state) {
+    uint8_t registers[24] = {
+        state->a, state->b, state->c, state->d, state->e, state->h, state->l,
+        pack_codes(state),
+        state->sp & 0xff, state->sp >> 8, state->pc & 0xff, state->pc >> 8,
+        state->int_enable, state->halted,
+    };
+    memcpy(&registers[16], &state->cycles, sizeof(state->cycles));
+    return hash64(registers, sizeof(registers), 0);
+}
+
+static uint64_t hash_page(State8080* state, int page) {
+    return hash64(&state->memory[page << 8], 256, page);
+}
+
+/**
+ * @brief Hashes all of memory from scratch.
+ * 
+ * @param hasher 
+ * @param state The 8080 state
+ */
+void hasher_init(StateHasher* hasher, State8080* state) {
+    int page;
+    hasher->memory_hash = 0;
+    for (page = 0; page < 256; page++) {
+        hasher->page_hashes[page] = hash_page(state, page);
+        hasher->page_versions[page] = state->page_versions[page];
+        hasher->memory_hash ^= hasher->page_hashes[page];
+    }
+}
+
+/**
+ * @brief Brings the memory hash up to date, only hashing the pages written since the last
+ *  update. Memory written without bumping the page versions (see mark_written) is missed.
+ * 
+ * @param hasher 
+ * @param state The 8080 state
+ * @return uint64_t The memory hash
+ */
+uint64_t hasher_update(StateHasher* hasher, State8080* state) {
+    int page;
+    for (page = 0; page < 256; page++) {
+        if (hasher->page_versions[page] != state->page_versions[page]) {
+            uint64_t page_hash = hash_page(state, page);
+            hasher->memory_hash ^= hasher->page_hashes[page] ^ page_hash;
+            hasher->page_hashes[page] = page_hash;
+            hasher->page_versions[page] = state->page_versions[page];
+        }
+    }
+    return hasher->memory_hash;
+}
+
+#pragma endregion
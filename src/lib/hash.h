@@ -0,0 +1,25 @@
+#ifndef HASH_H
+#define HASH_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu8080.h"
+
+/**
+ * @brief Hash of an 8080's memory, kept up to date a page at a time. Only pages whose version
+ *  changed since the last update are hashed again, and the page hashes are combined with XOR so
+ *  replacing one doesn't touch the others.
+ */
+typedef struct StateHasher {
+    uint64_t page_hashes[256];
+    uint32_t page_versions[256];    // Version of each page when it was last hashed
+    uint64_t memory_hash;
+} StateHasher;
+
+uint64_t hash64(const void* data, size_t length, uint64_t seed);
+uint64_t hash_registers(State8080* state);
+void hasher_init(StateHasher* hasher, State8080* state);
+uint64_t hasher_update(StateHasher* hasher, State8080* state);
+
+#endif
@@ -0,0 +1,59 @@
+#include <stdlib.h>
+
+#include "hashset.h"
+
+/**
+ * @brief Creates a set with room for at least twice the expected number of hashes, so probe
+ *  sequences stay short.
+ * 
+ * @param expected Most hashes that will be inserted
+ * @return HashSet* 
+ */
+HashSet* hashset_create(uint64_t expected) {
+    uint64_t capacity = 64;
+    while (capacity < expected * 2) {
+        capacity *= 2;
+    }
+
+    HashSet* set = malloc(sizeof(HashSet));
+    set->slots = calloc(capacity, sizeof(uint64_t));
+    set->mask = capacity - 1;
+    atomic_init(&set->count, 0);
+    return set;
+}
+
+void hashset_free(HashSet* set) {
+    free((void*)set->slots);
+    free(set);
+}
+
+/**
+ * @brief Adds a hash. Hashes are assumed to be well mixed already, so the low bits pick the
+ *  slot. A hash of 0 is stored as 1, since 0 marks an empty slot.
+ * 
+ * @param set 
+ * @param hash The hash
+ * @return int 1 if it was new, 0 if it was already there, -1 if the set is full
+ */
+int hashset_insert(HashSet* set, uint64_t hash) {
+    if (hash == 0) {
+        hash = 1;
+    }
+
+    uint64_t i;
+    for (i = 0; i <= set->mask; i++) {
+        _Atomic uint64_t* slot = &set->slots[(hash + i) & set->mask];
+        uint64_t seen = atomic_load_explicit(slot, memory_order_relaxed);
+        if (seen == 0) {
+            if (atomic_compare_exchange_strong(slot, &seen, hash)) {
+                atomic_fetch_add_explicit(&set->count, 1, memory_order_relaxed);
+                return 1;
+            }
+            // Lost the race for this slot; seen is now whoever won it.
+        }
+        if (seen == hash) {
+            return 0;
+        }
+    }
+    return -1;
+}
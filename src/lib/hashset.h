@@ -0,0 +1,22 @@
+#ifndef HASHSET_H
+#define HASHSET_H
+
+#include <stdatomic.h>
+#include <stdint.h>
+
+/**
+ * @brief Lock-free set of 64-bit hashes for any number of threads: open addressing with linear
+ *  probing, where a slot is claimed with one compare-and-swap. It never grows, so size it for
+ *  everything that will go in. Nothing can be removed.
+ */
+typedef struct HashSet {
+    _Atomic uint64_t* slots;        // 0 is an empty slot
+    uint64_t mask;                  // Capacity - 1, the capacity is a power of two
+    atomic_ullong count;
+} HashSet;
+
+HashSet* hashset_create(uint64_t expected);
+void hashset_free(HashSet* set);
+int hashset_insert(HashSet* set, uint64_t hash);
+
+#endif
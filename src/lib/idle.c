@@ -0,0 +1,126 @@
+#include <stdint.h>
+#include <string.h>
+
+#include "idle.h"
+
+/**
+ * @brief Everything one pass of a spin loop could change, apart from memory.
+ */
+typedef struct LoopState {
+    uint8_t a, b, c, d, e, h, l, flags;
+    uint16_t sp;
+    uint8_t int_enable;
+} LoopState;
+
+static void capture(State8080* state, LoopState* out) {
+    memset(out, 0, sizeof(LoopState));      // The padding gets compared too
+    out->a = state->a;
+    out->b = state->b;
+    out->c = state->c;
+    out->d = state->d;
+    out->e = state->e;
+    out->h = state->h;
+    out->l = state->l;
+    out->flags = pack_codes(state);
+    out->sp = state->sp;
+    out->int_enable = state->int_enable;
+}
+
+/**
+ * @brief Remembers that the loop at head isn't idle, so the run loop doesn't stop for it again
+ *  until the next event.
+ */
+static void reject(IdleSkipper* idle, uint16_t head) {
+    if (idle->reject_count < IDLE_MAX_REJECTS) {
+        idle->rejected[head >> 3] |= 1 << (head & 7);
+        idle->reject_list[idle->reject_count++] = head;
+    }
+}
+
+/**
+ * @brief Runs one pass of the loop starting at pc, for real. If the pass didn't do any I/O or
+ *  write any memory and came back with every register exactly as it started, every following
+ *  pass will do exactly the same thing until an interrupt comes in, so the cycle counter skips
+ *  ahead by as many whole passes as fit before the target.
+ */
+static void probe(IdleSkipper* idle, State8080* state, uint64_t target) {
+    uint16_t head = state->pc;
+    uint64_t start = state->cycles;
+    uint64_t start_instructions = state->instructions;
+    uint32_t versions[256];
+    LoopState before, after;
+    capture(state, &before);
+    memcpy(versions, state->page_versions, sizeof(versions));
+
+    int ops;
+    for (ops = 0; ops < IDLE_MAX_LOOP_OPS; ops++) {
+        if (state->cycles >= target) {
+            return;                         // The event is due, try again next time
+        }
+        uint8_t opcode = state->memory[state->pc];
+        if (opcode == 0xdb || opcode == 0xd3 || opcode == 0x76) {
+            reject(idle, head);             // IN, OUT and HLT are handled elsewhere
+            return;
+        }
+        emulate_op(state);
+        if (state->pc == head) {
+            break;
+        }
+    }
+
+    capture(state, &after);
+    if (state->pc != head || memcmp(&before, &after, sizeof(LoopState)) != 0 ||
+        memcmp(versions, state->page_versions, sizeof(versions)) != 0) {
+        reject(idle, head);
+        return;
+    }
+
+    // Every operation in the skipped passes starts before the target, like it would have.
+    uint64_t length = state->cycles - start;
+    if (state->cycles < target) {
+        uint64_t skip = (target - state->cycles) / length * length;
+        state->cycles += skip;
+        state->instructions += skip / length * (state->instructions - start_instructions);
+        idle->skipped_cycles += skip;
+        idle->skips++;
+    }
+}
+
+/**
+ * @brief Runs until the cycle counter reaches the target, with exactly the same result as
+ *  calling emulate_op until then. Spin loops (a short backward branch whose pass changes
+ *  nothing) and HLT are fast-forwarded instead of run.
+ * 
+ * @param idle 
+ * @param state The 8080 state
+ * @param target Cycle count to stop at, normally the next interrupt
+ * @param superinstructions Whether to use emulate_fused for everything else
+ */
+void idle_run(IdleSkipper* idle, State8080* state, uint64_t target, int superinstructions) {
+    BlockFunction block = idle->block != NULL ? idle->block : emulate_block;
+
+    // A loop that wasn't idle before the event may be now.
+    int i;
+    for (i = 0; i < idle->reject_count; i++) {
+        idle->rejected[idle->reject_list[i] >> 3] = 0;
+    }
+    idle->reject_count = 0;
+
+    while (state->cycles < target) {
+        if (state->halted) {
+            // A halted CPU idles 4 cycles at a time.
+            uint64_t skip = (target - state->cycles + 3) / 4 * 4;
+            state->cycles += skip;
+            idle->skipped_cycles += skip;
+            idle->skips++;
+            return;
+        }
+
+        // Stops right after a short backward branch to a loop not rejected yet, which may have
+        // closed a spin loop.
+        if (block(state, target, superinstructions, IDLE_MAX_LOOP_BYTES, idle->rejected) &&
+            !state->halted && state->cycles < target) {
+            probe(idle, state, target);
+        }
+    }
+}
@@ -0,0 +1,30 @@
+#ifndef IDLE_H
+#define IDLE_H
+
+#include <stdint.h>
+
+#include "cpu8080.h"
+
+#define IDLE_MAX_LOOP_BYTES 32      // Furthest a backward branch can go and still be a spin loop
+#define IDLE_MAX_LOOP_OPS 16        // Most operations in one pass of a spin loop
+#define IDLE_MAX_REJECTS 64         // Loops remembered as not idle until the next event
+
+// emulate_block, or a board's build of it (see cpu8080_core.h)
+typedef int (*BlockFunction)(State8080* state, uint64_t cycle_limit, int fused,
+    uint16_t loop_window, const uint8_t* ignored_loops);
+
+/**
+ * @brief Runs the CPU up to the next event, fast-forwarding through spin loops and HLT.
+ */
+typedef struct IdleSkipper {
+    BlockFunction block;            // NULL for emulate_block
+    uint8_t rejected[0x10000 / 8];  // A bit per address, set if the loop starting there isn't idle
+    uint16_t reject_list[IDLE_MAX_REJECTS];     // The set bits, to clear them again
+    int reject_count;
+    uint64_t skipped_cycles;
+    uint64_t skips;
+} IdleSkipper;
+
+void idle_run(IdleSkipper* idle, State8080* state, uint64_t target, int superinstructions);
+
+#endif
@@ -0,0 +1,510 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "invaders.h"
+
+#pragma region Sound
+
+/**
+ * @brief A sound triggered by one of the bits on output port 3 or 5.
+ */
+typedef struct SoundBit {
+    uint8_t port;
+    uint8_t mask;
+    int loop;               // Repeats for as long as the bit is set
+} SoundBit;
+
+// Indexed by sound number, which is also the name of the standard sample file (0.wav...).
+static const SoundBit SOUND_BITS[] = {
+    { 3, 0x01, 1 },         // UFO
+    { 3, 0x02, 0 },         // Shot
+    { 3, 0x04, 0 },         // Player dies
+    { 3, 0x08, 0 },         // Invader dies
+    { 5, 0x01, 0 },         // Fleet movement 1-4
+    { 5, 0x02, 0 },
+    { 5, 0x04, 0 },
+    { 5, 0x08, 0 },
+    { 5, 0x10, 0 },         // UFO hit
+    { 3, 0x10, 0 },         // Extended play, missing from some sample sets
+};
+
+#define SOUND_COUNT (int)(sizeof(SOUND_BITS) / sizeof(SOUND_BITS[0]))
+
+/**
+ * @brief Plays the sounds for bits that were just set, and stops looping ones that were cleared.
+ */
+static void sound_port_changed(Invaders* invaders, uint8_t port, uint8_t old, uint8_t value) {
+    uint8_t rising = value & ~old;
+    uint8_t falling = old & ~value;
+    if (invaders->audio == NULL || (rising | falling) == 0) {
+        return;
+    }
+
+    uint64_t time = invaders_audio_time(invaders);
+    int sound;
+    for (sound = 0; sound < SOUND_COUNT; sound++) {
+        const SoundBit* bit = &SOUND_BITS[sound];
+        if (bit->port != port) {
+            continue;
+        }
+        if (rising & bit->mask) {
+            audio_play(invaders->audio, sound, bit->loop, time);
+        }
+        else if ((falling & bit->mask) && bit->loop) {
+            audio_stop(invaders->audio, sound, time);
+        }
+    }
+}
+
+/**
+ * @brief Turns on sound, loading the standard samples (0.wav to 9.wav) from a directory.
+ *  Missing samples are just silent.
+ * 
+ * @param invaders 
+ * @param audio Audio to play the sounds on
+ * @param sound_directory Directory with the samples
+ * @return int Number of samples that were loaded
+ */
+int invaders_set_audio(Invaders* invaders, Audio* audio, const char* sound_directory) {
+    char* path = malloc(strlen(sound_directory) + 16);
+    int sound, loaded = 0;
+    for (sound = 0; sound < SOUND_COUNT; sound++) {
+        sprintf(path, "%s/%d.wav", sound_directory, sound);
+        if (audio_load_sound(audio, sound, path) == 0) {
+            loaded++;
+        }
+    }
+    free(path);
+
+    invaders->audio = audio;
+    return loaded;
+}
+
+/**
+ * @brief Current emulated time in audio samples, which is what the audio events are stamped
+ *  with.
+ * 
+ * @param invaders 
+ * @return uint64_t 
+ */
+uint64_t invaders_audio_time(Invaders* invaders) {
+    return (invaders->state->cycles - invaders->start_cycles) * AUDIO_RATE / INVADERS_CPU_HZ;
+}
+
+#pragma endregion
+
+#pragma region I/O Ports
+
+static uint8_t invaders_in(void* context, uint8_t port) {
+    Invaders* invaders = context;
+    if (invaders->metrics != NULL) {
+        metrics_add(&invaders->metrics->port_reads[port], 1);
+    }
+    switch (port) {
+        case 0: return 0x0e;
+        case 1: return invaders->port1 | 0x08;      // Bit 3 is always set
+        case 2: return invaders->port2;
+        case 3: return (invaders->shift >> (8 - invaders->shift_offset)) & 0xff;
+        default: return 0;
+    }
+}
+
+static void invaders_out(void* context, uint8_t port, uint8_t value) {
+    Invaders* invaders = context;
+    if (invaders->metrics != NULL) {
+        metrics_add(&invaders->metrics->port_writes[port], 1);
+    }
+    switch (port) {
+        case 2: invaders->shift_offset = value & 0x07; break;
+        case 3:
+            sound_port_changed(invaders, 3, invaders->port3, value);
+            invaders->port3 = value;
+            break;
+        case 4: invaders->shift = (value << 8) | (invaders->shift >> 8); break;
+        case 5:
+            sound_port_changed(invaders, 5, invaders->port5, value);
+            invaders->port5 = value;
+            break;
+        default: break;                             // Port 6 is the watchdog
+    }
+}
+
+#pragma endregion
+
+#pragma region Core
+
+// The Space Invaders build of the core. Memory is flat like the generic build's, but the ports
+// call the handlers above directly, so they're inlined into the run loop. The IN handler only
+// looks at the board, so the run loop doesn't write its copy of the state back around IN.
+#define CORE_BLOCK invaders_emulate_block
+#define CORE_IN(state, port) invaders_in((state)->io_context, port)
+#define CORE_OUT(state, port, value) invaders_out((state)->io_context, port, value)
+#define CORE_SYNC_IN 0
+#include "cpu8080_core.h"
+
+#pragma endregion
+
+#pragma region Machine
+
+/**
+ * @brief Wires a state up as a Space Invaders board. The ROM should already be loaded at 0x0000.
+ * 
+ * @param state The 8080 state
+ * @return Invaders* 
+ */
+Invaders* invaders_create(State8080* state) {
+    Invaders* invaders = calloc(1, sizeof(Invaders));
+    invaders->state = state;
+    invaders->start_cycles = state->cycles;
+    invaders->superinstructions = 1;
+    invaders->idle_skipping = 1;
+
+    state->pc = 0;
+    state->port_in = invaders_in;
+    state->port_out = invaders_out;
+    state->io_context = invaders;
+    return invaders;
+}
+
+void invaders_free(Invaders* invaders) {
+    invaders->state->port_in = NULL;
+    invaders->state->port_out = NULL;
+    invaders->state->io_context = NULL;
+    free(invaders);
+}
+
+static void apply_script(Invaders* invaders) {
+    InputScript* script = invaders->script;
+    while (script != NULL && invaders->script_pos < script->count &&
+           script->events[invaders->script_pos].frame <= invaders->frame) {
+        InputEvent* event = &script->events[invaders->script_pos++];
+        uint8_t* port = event->port == 1 ? &invaders->port1 : &invaders->port2;
+        *port = (*port & ~event->mask) | (event->value & event->mask);
+    }
+}
+
+/**
+ * @brief Uses a script for the inputs, starting with the events for the current frame.
+ * 
+ * @param invaders 
+ * @param script The script, or NULL to stop using one
+ */
+void invaders_set_script(Invaders* invaders, InputScript* script) {
+    invaders->script = script;
+    invaders->script_pos = 0;
+    while (script != NULL && invaders->script_pos < script->count &&
+           script->events[invaders->script_pos].frame < invaders->frame) {
+        invaders->script_pos++;
+    }
+    apply_script(invaders);
+}
+
+/**
+ * @brief Cycle count at which the next interrupt is due. Computed from the frame number rather
+ *  than accumulated, so the 16,666.67 cycle half frames never drift.
+ * 
+ * @param invaders 
+ * @return uint64_t 
+ */
+uint64_t invaders_next_event(Invaders* invaders) {
+    uint64_t half_frames = invaders->frame * 2 + invaders->half + 1;
+    return invaders->start_cycles + half_frames * INVADERS_CPU_HZ / (INVADERS_FPS * 2);
+}
+
+/**
+ * @brief Delivers the interrupt that is due: RST 1 halfway through the frame, RST 2 at the end.
+ *  After RST 2 the finished frame goes to the video capture, then the next frame starts and the
+ *  script's inputs for it are applied.
+ * 
+ * @param invaders 
+ * @return int Whether the interrupt was delivered (interrupts may be disabled)
+ */
+int invaders_handle_event(Invaders* invaders) {
+    int interrupt_num = invaders->half == 0 ? 1 : 2;
+    int delivered = generate_interrupt(invaders->state, interrupt_num);
+    if (delivered && invaders->replay != NULL) {
+        replay_interrupt(invaders->replay, interrupt_num);
+    }
+
+    if (invaders->half == 0) {
+        invaders->half = 1;
+    }
+    else {
+        invaders->half = 0;
+        invaders->frame++;
+        if (invaders->replay != NULL) {
+            replay_frame(invaders->replay);
+        }
+        apply_script(invaders);
+        if (invaders->audio != NULL) {
+            audio_advance(invaders->audio, invaders_audio_time(invaders));
+        }
+        if (invaders->capture != NULL) {
+            capture_frame(invaders->capture, invaders->frame,
+                &invaders->state->memory[INVADERS_VRAM]);
+        }
+    }
+
+    return delivered;
+}
+
+/**
+ * @brief Runs exactly one 60 Hz frame's worth of cycles, including both interrupts.
+ * 
+ * @param invaders 
+ */
+void invaders_run_frame(Invaders* invaders) {
+    State8080* state = invaders->state;
+
+    // The board's own build of the core, unless something (like a replay) wrapped the ports.
+    BlockFunction block = emulate_block;
+    if (state->port_in == invaders_in && state->port_out == invaders_out) {
+        block = invaders_emulate_block;
+    }
+    invaders->idle.block = block;
+
+    do {
+        uint64_t target = invaders_next_event(invaders);
+        if (invaders->idle_skipping) {
+            idle_run(&invaders->idle, state, target, invaders->superinstructions);
+        }
+        else {
+            block(state, target, invaders->superinstructions, 0, NULL);
+        }
+        invaders_handle_event(invaders);
+    } while (invaders->half != 0);
+}
+
+/**
+ * @brief Runs until the cycle counter reaches a limit or pc reaches a breakpoint, delivering
+ *  the interrupts on time. Unlike invaders_run_frame it can stop in the middle of a frame.
+ *  Operations are stepped one at a time while looking for a breakpoint.
+ * 
+ * @param invaders 
+ * @param cycle_limit Value of the cycle counter to stop at
+ * @param breakpoint Address to stop at, or -1 for none
+ * @return int 1 if it stopped at the breakpoint, 0 if it ran to the cycle limit
+ */
+int invaders_run_until(Invaders* invaders, uint64_t cycle_limit, int32_t breakpoint) {
+    State8080* state = invaders->state;
+    while (state->cycles < cycle_limit) {
+        uint64_t event = invaders_next_event(invaders);
+        uint64_t target = event < cycle_limit ? event : cycle_limit;
+        if (breakpoint < 0) {
+            emulate_block(state, target, invaders->superinstructions, 0, NULL);
+        }
+        else {
+            while (state->cycles < target) {
+                if (state->pc == breakpoint) {
+                    return 1;
+                }
+                emulate_op(state);
+            }
+        }
+        if (state->cycles >= event) {
+            invaders_handle_event(invaders);
+        }
+    }
+    return breakpoint >= 0 && state->pc == breakpoint;
+}
+
+/**
+ * @brief Writes the screen as a binary PBM. The monitor is mounted sideways, so video RAM is
+ *  rotated 90 degrees counter-clockwise to get the picture the player sees.
+ * 
+ * @param invaders 
+ * @param out Stream the image is written to
+ */
+void invaders_write_screen(Invaders* invaders, FILE* out) {
+    invaders_write_vram(&invaders->state->memory[INVADERS_VRAM], out);
+}
+
+/**
+ * @brief Same as invaders_write_screen, from a copy of video RAM (INVADERS_VRAM_SIZE bytes).
+ */
+void invaders_write_vram(const uint8_t* vram, FILE* out) {
+    uint8_t row[INVADERS_SCREEN_WIDTH / 8];
+
+    fprintf(out, "P4\n%d %d\n", INVADERS_SCREEN_WIDTH, INVADERS_SCREEN_HEIGHT);
+    int x, y;
+    for (y = 0; y < INVADERS_SCREEN_HEIGHT; y++) {
+        memset(row, 0, sizeof(row));
+        int line = INVADERS_SCREEN_HEIGHT - 1 - y;
+        for (x = 0; x < INVADERS_SCREEN_WIDTH; x++) {
+            if ((vram[x * 32 + line / 8] >> (line % 8)) & 1) {
+                row[x / 8] |= 0x80 >> (x % 8);
+            }
+        }
+        fwrite(row, 1, sizeof(row), out);
+    }
+}
+
+#pragma endregion
+
+#pragma region Input Scripts
+
+typedef struct ButtonName {
+    const char* name;
+    uint8_t port;
+    uint8_t mask;
+} ButtonName;
+
+static const ButtonName BUTTONS[] = {
+    { "coin", 1, INVADERS_COIN },
+    { "start1", 1, INVADERS_START1 },
+    { "start2", 1, INVADERS_START2 },
+    { "fire1", 1, INVADERS_FIRE1 },
+    { "left1", 1, INVADERS_LEFT1 },
+    { "right1", 1, INVADERS_RIGHT1 },
+    { "tilt", 2, INVADERS_TILT },
+    { "fire2", 2, INVADERS_FIRE2 },
+    { "left2", 2, INVADERS_LEFT2 },
+    { "right2", 2, INVADERS_RIGHT2 },
+};
+
+/**
+ * @brief Parses one action: +button, -button, or port1=value / port2=value to set a whole port
+ *  (useful for the dip switches on port 2).
+ */
+static int parse_action(const char* action, InputEvent* event) {
+    int value;
+    if (sscanf(action, "port%hhu=%i", &event->port, &value) == 2) {
+        event->mask = 0xff;
+        event->value = value;
+        return event->port == 1 || event->port == 2 ? 0 : -1;
+    }
+
+    if (action[0] != '+' && action[0] != '-') {
+        return -1;
+    }
+
+    size_t i;
+    for (i = 0; i < sizeof(BUTTONS) / sizeof(BUTTONS[0]); i++) {
+        if (strcmp(&action[1], BUTTONS[i].name) == 0) {
+            event->port = BUTTONS[i].port;
+            event->mask = BUTTONS[i].mask;
+            event->value = action[0] == '+' ? BUTTONS[i].mask : 0;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Looks up a button by the name scripts use for it, without the + or -.
+ * 
+ * @param name The button, e.g. "fire1"
+ * @param port Set to the input port it's on (1 or 2)
+ * @param mask Set to its bit
+ * @return int 0, or -1 if there's no such button
+ */
+int invaders_find_button(const char* name, uint8_t* port, uint8_t* mask) {
+    size_t i;
+    for (i = 0; i < sizeof(BUTTONS) / sizeof(BUTTONS[0]); i++) {
+        if (strcmp(name, BUTTONS[i].name) == 0) {
+            *port = BUTTONS[i].port;
+            *mask = BUTTONS[i].mask;
+            return 0;
+        }
+    }
+    return -1;
+}
+
+/**
+ * @brief Applies one script action right away, e.g. "+coin" or "port2=0x03".
+ * 
+ * @param invaders 
+ * @param action The action
+ * @return int 0 on success, -1 if the action isn't one a script could have
+ */
+int invaders_input(Invaders* invaders, const char* action) {
+    InputEvent event;
+    if (parse_action(action, &event) < 0) {
+        return -1;
+    }
+    uint8_t* port = event.port == 1 ? &invaders->port1 : &invaders->port2;
+    *port = (*port & ~event.mask) | (event.value & event.mask);
+    return 0;
+}
+
+/**
+ * @brief Stable insertion sort by frame, so events on the same frame stay in file order.
+ *  Scripts are usually written in order already, which makes this close to linear.
+ */
+static void sort_events(InputScript* script) {
+    int i;
+    for (i = 1; i < script->count; i++) {
+        InputEvent event = script->events[i];
+        int j = i - 1;
+        while (j >= 0 && script->events[j].frame > event.frame) {
+            script->events[j + 1] = script->events[j];
+            j--;
+        }
+        script->events[j + 1] = event;
+    }
+}
+
+/**
+ * @brief Loads an input script. Each line is a frame number followed by actions, e.g.
+ *  "120 +coin" or "300 -fire1 +left1". A # starts a comment that runs to the end of the line.
+ * 
+ * @param filename Path to the script
+ * @return InputScript* The script, or NULL if it couldn't be read or has a bad line
+ */
+InputScript* input_script_load(const char* filename) {
+    FILE* file = fopen(filename, "r");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    InputScript* script = calloc(1, sizeof(InputScript));
+    int capacity = 0;
+    char line[256];
+    int line_number = 0;
+    while (fgets(line, sizeof(line), file) != NULL) {
+        line_number++;
+        char* token = strtok(line, " \t\r\n");
+        if (token == NULL || token[0] == '#') {
+            continue;
+        }
+
+        char* end;
+        unsigned long long frame = strtoull(token, &end, 10);
+        if (*end != '\0') {
+            fprintf(stderr, "%s:%d: expected a frame number\n", filename, line_number);
+            input_script_free(script);
+            fclose(file);
+            return NULL;
+        }
+
+        // Everything from a token starting with # on is a comment.
+        while ((token = strtok(NULL, " \t\r\n")) != NULL && token[0] != '#') {
+            if (script->count == capacity) {
+                capacity = capacity ? capacity * 2 : 64;
+                script->events = realloc(script->events, capacity * sizeof(InputEvent));
+            }
+            InputEvent* event = &script->events[script->count];
+            event->frame = frame;
+            if (parse_action(token, event) < 0) {
+                fprintf(stderr, "%s:%d: unknown action %s\n", filename, line_number, token);
+                input_script_free(script);
+                fclose(file);
+                return NULL;
+            }
+            script->count++;
+        }
+    }
+    fclose(file);
+
+    sort_events(script);
+    return script;
+}
+
+void input_script_free(InputScript* script) {
+    free(script->events);
+    free(script);
+}
+
+#pragma endregion
@@ -0,0 +1,103 @@
+#ifndef INVADERS_H
+#define INVADERS_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "audio.h"
+#include "capture.h"
+#include "cpu8080.h"
+#include "idle.h"
+#include "metrics.h"
+#include "replay.h"
+
+#define INVADERS_CPU_HZ 2000000
+#define INVADERS_FPS 60
+#define INVADERS_ROM_SIZE 0x2000
+#define INVADERS_VRAM 0x2400
+#define INVADERS_VRAM_SIZE 0x1c00
+#define INVADERS_SCREEN_WIDTH 224
+#define INVADERS_SCREEN_HEIGHT 256
+
+// Input port 1
+#define INVADERS_COIN       0x01
+#define INVADERS_START2     0x02
+#define INVADERS_START1     0x04
+#define INVADERS_FIRE1      0x10
+#define INVADERS_LEFT1      0x20
+#define INVADERS_RIGHT1     0x40
+
+// Input port 2
+#define INVADERS_TILT       0x04
+#define INVADERS_FIRE2      0x10
+#define INVADERS_LEFT2      0x20
+#define INVADERS_RIGHT2     0x40
+
+/**
+ * @brief A change to one of the input ports at the start of a frame.
+ */
+typedef struct InputEvent {
+    uint64_t frame;
+    uint8_t port;           // 1 or 2
+    uint8_t mask;           // Bits to change
+    uint8_t value;          // What to change them to
+} InputEvent;
+
+/**
+ * @brief Timestamped input changes, sorted by frame.
+ */
+typedef struct InputScript {
+    InputEvent* events;
+    int count;
+} InputScript;
+
+/**
+ * @brief The Space Invaders arcade board: 8KB of ROM at 0x0000, RAM at 0x2000 with video RAM
+ *  from 0x2400, a hardware shift register on ports 2-4, inputs on ports 1 and 2, and two
+ *  interrupts per frame (RST 1 halfway down the screen, RST 2 at vblank).
+ */
+typedef struct Invaders {
+    State8080* state;
+
+    uint8_t port1;
+    uint8_t port2;
+    uint16_t shift;
+    uint8_t shift_offset;
+    uint8_t port3;              // Last values written to the sound ports
+    uint8_t port5;
+    Audio* audio;               // NULL if sound is off
+    Capture* capture;           // NULL unless capturing video
+    Replay* replay;             // NULL unless recording or replaying
+    Metrics* metrics;           // NULL unless counting port hits
+    int superinstructions;      // Whether invaders_run_frame fuses common operation sequences
+    int idle_skipping;          // Whether invaders_run_frame fast-forwards through spin loops
+    IdleSkipper idle;
+
+    uint64_t frame;
+    int half;                   // Which half of the frame is running (0 or 1)
+    uint64_t start_cycles;      // Cycle counter when frame 0 started
+
+    InputScript* script;
+    int script_pos;
+} Invaders;
+
+Invaders* invaders_create(State8080* state);
+void invaders_free(Invaders* invaders);
+uint64_t invaders_next_event(Invaders* invaders);
+int invaders_handle_event(Invaders* invaders);
+void invaders_run_frame(Invaders* invaders);
+int invaders_run_until(Invaders* invaders, uint64_t cycle_limit, int32_t breakpoint);
+int invaders_emulate_block(State8080* state, uint64_t cycle_limit, int fused,
+    uint16_t loop_window, const uint8_t* ignored_loops);
+int invaders_set_audio(Invaders* invaders, Audio* audio, const char* sound_directory);
+uint64_t invaders_audio_time(Invaders* invaders);
+void invaders_set_script(Invaders* invaders, InputScript* script);
+void invaders_write_screen(Invaders* invaders, FILE* out);
+void invaders_write_vram(const uint8_t* vram, FILE* out);
+int invaders_input(Invaders* invaders, const char* action);
+int invaders_find_button(const char* name, uint8_t* port, uint8_t* mask);
+
+InputScript* input_script_load(const char* filename);
+void input_script_free(InputScript* script);
+
+#endif
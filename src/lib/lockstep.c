@@ -0,0 +1,316 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disasm.h"
+#include "lockstep.h"
+
+#pragma region I/O Ports
+
+static uint8_t main_in(void* context, uint8_t port) {
+    Lockstep* lockstep = context;
+    uint8_t value = lockstep->port_in ? lockstep->port_in(lockstep->io_context, port) : 0;
+    if (lockstep->input_count < LOCKSTEP_MAX_IO) {
+        lockstep->inputs[lockstep->input_count++] = (LockstepAccess){ port, value };
+    }
+    return value;
+}
+
+static void main_out(void* context, uint8_t port, uint8_t value) {
+    Lockstep* lockstep = context;
+    if (lockstep->output_count < LOCKSTEP_MAX_IO) {
+        lockstep->outputs[lockstep->output_count++] = (LockstepAccess){ port, value };
+    }
+    if (lockstep->port_out) {
+        lockstep->port_out(lockstep->io_context, port, value);
+    }
+}
+
+static uint8_t reference_in(void* context, uint8_t port) {
+    Lockstep* lockstep = context;
+    if (lockstep->input_pos == lockstep->input_count) {
+        snprintf(lockstep->io_problem, sizeof(lockstep->io_problem),
+            "the reference core read port %d but the main core didn't", port);
+        return 0;
+    }
+
+    LockstepAccess* access = &lockstep->inputs[lockstep->input_pos++];
+    if (access->port != port) {
+        snprintf(lockstep->io_problem, sizeof(lockstep->io_problem),
+            "the main core read port %d but the reference core read port %d", access->port, port);
+    }
+    return access->value;
+}
+
+static void reference_out(void* context, uint8_t port, uint8_t value) {
+    Lockstep* lockstep = context;
+    if (lockstep->output_pos == lockstep->output_count) {
+        snprintf(lockstep->io_problem, sizeof(lockstep->io_problem),
+            "the reference core wrote 0x%02x to port %d but the main core didn't", value, port);
+        return;
+    }
+
+    LockstepAccess* access = &lockstep->outputs[lockstep->output_pos++];
+    if (access->port != port || access->value != value) {
+        snprintf(lockstep->io_problem, sizeof(lockstep->io_problem),
+            "the main core wrote 0x%02x to port %d but the reference core wrote 0x%02x to port %d",
+            access->value, access->port, value, port);
+    }
+}
+
+#pragma endregion
+
+#pragma region Comparing
+
+static void pack_main(State8080* state, LockstepRegisters* out) {
+    *out = (LockstepRegisters){ state->a, state->b, state->c, state->d, state->e, state->h,
+        state->l, pack_codes(state), state->sp, state->pc, state->int_enable != 0,
+        state->halted != 0, state->cycles };
+}
+
+static void pack_reference(Reference8080* cpu, LockstepRegisters* out) {
+    *out = (LockstepRegisters){ cpu->registers[REF_A], cpu->registers[REF_B],
+        cpu->registers[REF_C], cpu->registers[REF_D], cpu->registers[REF_E],
+        cpu->registers[REF_H], cpu->registers[REF_L], cpu->flags, cpu->sp, cpu->pc,
+        cpu->int_enable != 0, cpu->halted != 0, cpu->cycles };
+}
+
+static int registers_equal(LockstepRegisters* x, LockstepRegisters* y) {
+    return x->a == y->a && x->b == y->b && x->c == y->c && x->d == y->d && x->e == y->e &&
+        x->h == y->h && x->l == y->l && x->flags == y->flags && x->sp == y->sp &&
+        x->pc == y->pc && x->int_enable == y->int_enable && x->halted == y->halted &&
+        x->cycles == y->cycles;
+}
+
+static void check_byte(Lockstep* lockstep, uint16_t address) {
+    int i;
+    if (lockstep->state->memory[address] == lockstep->reference->memory[address]) {
+        return;
+    }
+    for (i = 0; i < lockstep->bad_count; i++) {
+        if (lockstep->bad_addresses[i] == address) {
+            return;
+        }
+    }
+    if (lockstep->bad_count < LOCKSTEP_MAX_REPORTED) {
+        lockstep->bad_addresses[lockstep->bad_count++] = address;
+    }
+}
+
+/**
+ * @brief Compares both cores after an instruction or interrupt. Memory is checked where the
+ *  reference core wrote and on every page the main core wrote to.
+ * 
+ * @return int 1 if they still match, 0 if they diverged
+ */
+static int compare(Lockstep* lockstep) {
+    State8080* state = lockstep->state;
+    Reference8080* reference = lockstep->reference;
+
+    pack_main(state, &lockstep->main_registers);
+    pack_reference(reference, &lockstep->reference_registers);
+
+    int i, page, offset;
+    for (i = 0; i < reference->write_count; i++) {
+        check_byte(lockstep, reference->writes[i]);
+    }
+    int written = memcmp(lockstep->page_versions, state->page_versions,
+        sizeof(lockstep->page_versions)) != 0;
+    for (page = 0; written && page < 256; page++) {
+        if (lockstep->page_versions[page] != state->page_versions[page]) {
+            lockstep->page_versions[page] = state->page_versions[page];
+            if (memcmp(&state->memory[page << 8], &reference->memory[page << 8], 256) != 0) {
+                for (offset = 0; offset < 256; offset++) {
+                    check_byte(lockstep, (page << 8) | offset);
+                }
+            }
+        }
+    }
+
+    if (lockstep->output_pos != lockstep->output_count && lockstep->io_problem[0] == '\0') {
+        snprintf(lockstep->io_problem, sizeof(lockstep->io_problem),
+            "the main core wrote 0x%02x to port %d but the reference core didn't",
+            lockstep->outputs[lockstep->output_pos].value,
+            lockstep->outputs[lockstep->output_pos].port);
+    }
+
+    lockstep->diverged = !registers_equal(&lockstep->main_registers,
+        &lockstep->reference_registers) || lockstep->bad_count > 0 ||
+        lockstep->io_problem[0] != '\0';
+    return !lockstep->diverged;
+}
+
+#pragma endregion
+
+#pragma region Lockstep
+
+/**
+ * @brief Starts the reference core from a copy of the main core's state and memory. Call once
+ *  the machine is set up, right before it starts running.
+ * 
+ * @param state The main core, with the machine's I/O callbacks already installed
+ * @return Lockstep* 
+ */
+Lockstep* lockstep_create(State8080* state) {
+    Lockstep* lockstep = calloc(1, sizeof(Lockstep));
+    lockstep->state = state;
+    lockstep->reference = reference_create(malloc(0x10000));
+    lockstep->reference->port_in = reference_in;
+    lockstep->reference->port_out = reference_out;
+    lockstep->reference->io_context = lockstep;
+    lockstep_reset(lockstep);
+
+    lockstep->port_in = state->port_in;
+    lockstep->port_out = state->port_out;
+    lockstep->io_context = state->io_context;
+    state->port_in = main_in;
+    state->port_out = main_out;
+    state->io_context = lockstep;
+    return lockstep;
+}
+
+/**
+ * @brief Copies the main core's registers and memory over to the reference core again and
+ *  forgets any divergence, so one lockstep can be reused for many runs.
+ * 
+ * @param lockstep 
+ */
+void lockstep_reset(Lockstep* lockstep) {
+    State8080* state = lockstep->state;
+    Reference8080* reference = lockstep->reference;
+
+    memcpy(reference->memory, state->memory, 0x10000);
+    reference->registers[REF_A] = state->a;
+    reference->registers[REF_B] = state->b;
+    reference->registers[REF_C] = state->c;
+    reference->registers[REF_D] = state->d;
+    reference->registers[REF_E] = state->e;
+    reference->registers[REF_H] = state->h;
+    reference->registers[REF_L] = state->l;
+    reference->flags = pack_codes(state);
+    reference->sp = state->sp;
+    reference->pc = state->pc;
+    reference->int_enable = state->int_enable;
+    reference->halted = state->halted;
+    reference->cycles = state->cycles;
+    memcpy(lockstep->page_versions, state->page_versions, sizeof(lockstep->page_versions));
+
+    lockstep->steps = 0;
+    lockstep->diverged = 0;
+    lockstep->bad_count = 0;
+    lockstep->io_problem[0] = '\0';
+}
+
+/**
+ * @brief Gives the main core its I/O callbacks back and frees the reference core.
+ */
+void lockstep_free(Lockstep* lockstep) {
+    State8080* state = lockstep->state;
+    state->port_in = lockstep->port_in;
+    state->port_out = lockstep->port_out;
+    state->io_context = lockstep->io_context;
+
+    free(lockstep->reference->memory);
+    reference_free(lockstep->reference);
+    free(lockstep);
+}
+
+/**
+ * @brief Call right before the main core runs an instruction.
+ */
+void lockstep_before_op(Lockstep* lockstep) {
+    uint16_t pc = lockstep->state->pc;
+    lockstep->pc = pc;
+    lockstep->instruction[0] = lockstep->state->memory[pc];
+    lockstep->instruction[1] = lockstep->state->memory[(uint16_t)(pc + 1)];
+    lockstep->instruction[2] = lockstep->state->memory[(uint16_t)(pc + 2)];
+    lockstep->input_count = lockstep->input_pos = 0;
+    lockstep->output_count = lockstep->output_pos = 0;
+}
+
+/**
+ * @brief Call right after the main core runs an instruction. Runs the same instruction on the
+ *  reference core and compares them.
+ * 
+ * @return int 1 if they still match, 0 if they diverged
+ */
+int lockstep_after_op(Lockstep* lockstep) {
+    reference_step(lockstep->reference);
+    lockstep->steps++;
+    return compare(lockstep);
+}
+
+/**
+ * @brief Call right after the machine tries to deliver an interrupt to the main core (whether
+ *  or not it was enabled). Does the same on the reference core and compares them.
+ * 
+ * @return int 1 if they still match, 0 if they diverged
+ */
+int lockstep_interrupt(Lockstep* lockstep, int interrupt_num) {
+    lockstep->pc = lockstep->reference->pc;
+    lockstep->instruction[0] = 0xc7 | (interrupt_num << 3);
+    lockstep->input_count = lockstep->input_pos = 0;
+    lockstep->output_count = lockstep->output_pos = 0;
+    reference_interrupt(lockstep->reference, interrupt_num);
+    return compare(lockstep);
+}
+
+static void report_row(FILE* out, const char* name, unsigned main, unsigned reference) {
+    fprintf(out, "  %-10s %10x %10x%s\n", name, main, reference,
+        main != reference ? "   <--" : "");
+}
+
+/**
+ * @brief Writes what the two cores disagreed about: the instruction, both sets of registers,
+ *  and the memory and ports that differ.
+ * 
+ * @param lockstep 
+ * @param out Stream the report is written to
+ */
+void lockstep_write_report(Lockstep* lockstep, FILE* out) {
+    if (!lockstep->diverged) {
+        fprintf(out, "Lockstep: the cores matched for %llu instructions\n",
+            (unsigned long long)lockstep->steps);
+        return;
+    }
+
+    // The disassembler wants the bytes at their address.
+    uint8_t* buffer = calloc(0x10003, 1);
+    memcpy(&buffer[lockstep->pc], lockstep->instruction, 3);
+    fprintf(out, "Lockstep: the cores diverged after %llu instructions, at\n    ",
+        (unsigned long long)lockstep->steps);
+    disassemble_op(out, buffer, lockstep->pc);
+    fprintf(out, "\n");
+    free(buffer);
+
+    LockstepRegisters* m = &lockstep->main_registers;
+    LockstepRegisters* r = &lockstep->reference_registers;
+    fprintf(out, "  %-10s %10s %10s\n", "", "main", "reference");
+    report_row(out, "a", m->a, r->a);
+    report_row(out, "b", m->b, r->b);
+    report_row(out, "c", m->c, r->c);
+    report_row(out, "d", m->d, r->d);
+    report_row(out, "e", m->e, r->e);
+    report_row(out, "h", m->h, r->h);
+    report_row(out, "l", m->l, r->l);
+    report_row(out, "flags", m->flags, r->flags);
+    report_row(out, "sp", m->sp, r->sp);
+    report_row(out, "pc", m->pc, r->pc);
+    report_row(out, "int_enable", m->int_enable, r->int_enable);
+    report_row(out, "halted", m->halted, r->halted);
+    fprintf(out, "  %-10s %10llu %10llu%s\n", "cycles", (unsigned long long)m->cycles,
+        (unsigned long long)r->cycles, m->cycles != r->cycles ? "   <--" : "");
+
+    int i;
+    for (i = 0; i < lockstep->bad_count; i++) {
+        uint16_t address = lockstep->bad_addresses[i];
+        fprintf(out, "  memory %04x: main %02x, reference %02x\n", address,
+            lockstep->state->memory[address], lockstep->reference->memory[address]);
+    }
+    if (lockstep->io_problem[0] != '\0') {
+        fprintf(out, "  ports: %s\n", lockstep->io_problem);
+    }
+}
+
+#pragma endregion
@@ -0,0 +1,71 @@
+#ifndef LOCKSTEP_H
+#define LOCKSTEP_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "cpu8080.h"
+#include "reference.h"
+
+#define LOCKSTEP_MAX_IO 4           // Port accesses remembered per instruction
+#define LOCKSTEP_MAX_REPORTED 8     // Memory differences listed in a report
+
+/**
+ * @brief A port access made by the main core, which the reference core has to repeat.
+ */
+typedef struct LockstepAccess {
+    uint8_t port;
+    uint8_t value;
+} LockstepAccess;
+
+/**
+ * @brief The registers, flags and interrupt state of one core, packed the same way for both.
+ */
+typedef struct LockstepRegisters {
+    uint8_t a, b, c, d, e, h, l, flags;
+    uint16_t sp, pc;
+    uint8_t int_enable, halted;
+    uint64_t cycles;
+} LockstepRegisters;
+
+/**
+ * @brief Runs the reference core next to the main one, on its own copy of the same memory
+ *  image. After every instruction (and every interrupt) the packed state of both is compared,
+ *  along with every byte of memory either of them might have written. IN gives the reference
+ *  core whatever the main core read, and OUT has to match what the main core wrote.
+ */
+typedef struct Lockstep {
+    State8080* state;
+    Reference8080* reference;
+    uint32_t page_versions[256];        // The main core's page versions after the last check
+
+    LockstepAccess inputs[LOCKSTEP_MAX_IO];
+    LockstepAccess outputs[LOCKSTEP_MAX_IO];
+    int input_count, input_pos;
+    int output_count, output_pos;
+
+    uint64_t steps;
+    int diverged;
+    char io_problem[128];               // What went wrong with the ports, if anything
+    uint16_t pc;                        // Address and bytes of the last instruction
+    uint8_t instruction[3];
+    LockstepRegisters main_registers;
+    LockstepRegisters reference_registers;
+    uint16_t bad_addresses[LOCKSTEP_MAX_REPORTED];
+    int bad_count;
+
+    // The main core's own I/O callbacks
+    uint8_t (*port_in)(void* context, uint8_t port);
+    void (*port_out)(void* context, uint8_t port, uint8_t value);
+    void* io_context;
+} Lockstep;
+
+Lockstep* lockstep_create(State8080* state);
+void lockstep_free(Lockstep* lockstep);
+void lockstep_reset(Lockstep* lockstep);
+void lockstep_before_op(Lockstep* lockstep);
+int lockstep_after_op(Lockstep* lockstep);
+int lockstep_interrupt(Lockstep* lockstep, int interrupt_num);
+void lockstep_write_report(Lockstep* lockstep, FILE* out);
+
+#endif
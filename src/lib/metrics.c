@@ -0,0 +1,297 @@
+#include <poll.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <unistd.h>
+
+#include "metrics.h"
+#include "net.h"
+
+// How often the exporter thread checks whether it should stop, in milliseconds.
+#define METRICS_POLL_MS 100
+
+/**
+ * @brief Starts counting for an emulator instance. Nothing is served until metrics_serve.
+ *
+ * @param machine Name of the machine, used as a label
+ * @param cpu_hz Emulated clock rate
+ * @param state The state whose counters are published by metrics_update
+ * @return Metrics*
+ */
+Metrics* metrics_create(const char* machine, uint64_t cpu_hz, State8080* state) {
+    Metrics* metrics = calloc(1, sizeof(Metrics));
+    metrics->machine = machine;
+    metrics->cpu_hz = cpu_hz;
+    metrics->start_cycles = state->cycles;
+    metrics->listen_fd = -1;
+    clock_gettime(CLOCK_MONOTONIC, &metrics->start);
+    return metrics;
+}
+
+/**
+ * @brief Publishes the state's counters. Call it from the emulation thread between batches;
+ *  it's a handful of stores, so once a frame costs nothing.
+ */
+void metrics_update(Metrics* metrics, State8080* state) {
+    metrics_set(&metrics->instructions, state->instructions);
+    metrics_set(&metrics->fused_instructions, state->fused_instructions);
+    metrics_set(&metrics->cycles, state->cycles - metrics->start_cycles);
+    metrics_set(&metrics->interrupts, state->interrupts);
+}
+
+#pragma region Formats
+
+static uint64_t load(_Atomic uint64_t* counter) {
+    return atomic_load_explicit(counter, memory_order_relaxed);
+}
+
+static double wall_seconds(Metrics* metrics) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - metrics->start.tv_sec) + (now.tv_nsec - metrics->start.tv_nsec) / 1e9;
+}
+
+typedef struct Rates {
+    uint64_t instructions;
+    uint64_t fused_instructions;
+    uint64_t cycles;
+    double wall_seconds;
+    double emulated_seconds;
+    double realtime_ratio;              // Emulated time over wall clock time
+    double superinstruction_ratio;      // Share of the instructions that ran fused
+} Rates;
+
+/**
+ * @brief Reads the counters the derived values come from. They're read one at a time, so a
+ *  scrape in the middle of an update can mix two batches, but no counter is ever torn.
+ */
+static void rates(Metrics* metrics, Rates* out) {
+    out->instructions = load(&metrics->instructions);
+    out->fused_instructions = load(&metrics->fused_instructions);
+    out->cycles = load(&metrics->cycles);
+    out->wall_seconds = wall_seconds(metrics);
+    out->emulated_seconds = metrics->cpu_hz ? (double)out->cycles / metrics->cpu_hz : 0.0;
+    out->realtime_ratio = out->wall_seconds > 0 ? out->emulated_seconds / out->wall_seconds : 0.0;
+    out->superinstruction_ratio = out->instructions ?
+        (double)out->fused_instructions / out->instructions : 0.0;
+}
+
+static void write_counter(Metrics* metrics, FILE* out, const char* name, const char* help,
+    uint64_t value) {
+    fprintf(out, "# HELP emulator_%s %s\n# TYPE emulator_%s counter\n", name, help, name);
+    fprintf(out, "emulator_%s{machine=\"%s\"} %llu\n", name, metrics->machine,
+        (unsigned long long)value);
+}
+
+static void write_gauge(Metrics* metrics, FILE* out, const char* name, const char* help,
+    double value) {
+    fprintf(out, "# HELP emulator_%s %s\n# TYPE emulator_%s gauge\n", name, help, name);
+    fprintf(out, "emulator_%s{machine=\"%s\"} %.6g\n", name, metrics->machine, value);
+}
+
+static void write_ports(Metrics* metrics, FILE* out, const char* name, const char* help,
+    _Atomic uint64_t* counters) {
+    fprintf(out, "# HELP emulator_%s %s\n# TYPE emulator_%s counter\n", name, help, name);
+    int port;
+    for (port = 0; port < 256; port++) {
+        uint64_t value = load(&counters[port]);
+        if (value != 0) {
+            fprintf(out, "emulator_%s{machine=\"%s\",port=\"%d\"} %llu\n", name,
+                metrics->machine, port, (unsigned long long)value);
+        }
+    }
+}
+
+/**
+ * @brief Writes the metrics in the Prometheus text exposition format.
+ *
+ * @param metrics
+ * @param out
+ */
+void metrics_write_prometheus(Metrics* metrics, FILE* out) {
+    Rates r;
+    rates(metrics, &r);
+
+    write_counter(metrics, out, "instructions_total", "Instructions executed.", r.instructions);
+    write_counter(metrics, out, "fused_instructions_total",
+        "Instructions executed as part of a superinstruction.", r.fused_instructions);
+    write_counter(metrics, out, "cycles_total", "Emulated clock cycles.", r.cycles);
+    write_counter(metrics, out, "interrupts_total", "Interrupts delivered.",
+        load(&metrics->interrupts));
+    write_counter(metrics, out, "frames_total", "Frames emulated.", load(&metrics->frames));
+    write_counter(metrics, out, "idle_skipped_cycles_total",
+        "Cycles fast-forwarded through idle loops and HLT.", load(&metrics->idle_skipped_cycles));
+    write_ports(metrics, out, "port_reads_total", "IN instructions by port.",
+        metrics->port_reads);
+    write_ports(metrics, out, "port_writes_total", "OUT instructions by port.",
+        metrics->port_writes);
+    write_gauge(metrics, out, "superinstruction_ratio",
+        "Share of the instructions that ran fused.", r.superinstruction_ratio);
+    write_gauge(metrics, out, "realtime_ratio", "Emulated time over wall clock time.",
+        r.realtime_ratio);
+    write_gauge(metrics, out, "uptime_seconds", "Wall clock time since the start.",
+        r.wall_seconds);
+}
+
+static void write_json_ports(FILE* out, const char* name, _Atomic uint64_t* counters) {
+    fprintf(out, "  \"%s\": {", name);
+    const char* separator = "";
+    int port;
+    for (port = 0; port < 256; port++) {
+        uint64_t value = load(&counters[port]);
+        if (value != 0) {
+            fprintf(out, "%s\"%d\": %llu", separator, port, (unsigned long long)value);
+            separator = ", ";
+        }
+    }
+    fprintf(out, "},\n");
+}
+
+/**
+ * @brief Writes the metrics as one JSON object.
+ *
+ * @param metrics
+ * @param state Final state to include, or NULL to leave it out
+ * @param out
+ */
+void metrics_write_json(Metrics* metrics, State8080* state, FILE* out) {
+    Rates r;
+    rates(metrics, &r);
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"machine\": \"%s\",\n", metrics->machine);
+    fprintf(out, "  \"instructions\": %llu,\n", (unsigned long long)r.instructions);
+    fprintf(out, "  \"fused_instructions\": %llu,\n", (unsigned long long)r.fused_instructions);
+    fprintf(out, "  \"superinstruction_ratio\": %.6g,\n", r.superinstruction_ratio);
+    fprintf(out, "  \"cycles\": %llu,\n", (unsigned long long)r.cycles);
+    fprintf(out, "  \"interrupts\": %llu,\n", (unsigned long long)load(&metrics->interrupts));
+    fprintf(out, "  \"frames\": %llu,\n", (unsigned long long)load(&metrics->frames));
+    fprintf(out, "  \"idle_skipped_cycles\": %llu,\n",
+        (unsigned long long)load(&metrics->idle_skipped_cycles));
+    write_json_ports(out, "port_reads", metrics->port_reads);
+    write_json_ports(out, "port_writes", metrics->port_writes);
+    fprintf(out, "  \"emulated_seconds\": %.6f,\n", r.emulated_seconds);
+    fprintf(out, "  \"wall_seconds\": %.6f,\n", r.wall_seconds);
+    if (state != NULL) {
+        fprintf(out, "  \"realtime_ratio\": %.6g,\n", r.realtime_ratio);
+        fprintf(out, "  \"state\": {\"a\": %u, \"bc\": %u, \"de\": %u, \"hl\": %u, "
+            "\"pc\": %u, \"sp\": %u, \"flags\": %u, \"int_enable\": %u, \"halted\": %u}\n",
+            state->a, state->bc, state->de, state->hl, state->pc, state->sp,
+            pack_codes(state), state->int_enable, state->halted);
+    }
+    else {
+        fprintf(out, "  \"realtime_ratio\": %.6g\n", r.realtime_ratio);
+    }
+    fprintf(out, "}\n");
+}
+
+#pragma endregion
+
+#pragma region Exporter
+
+static void send_all(int fd, const char* data, size_t length) {
+    while (length > 0) {
+        ssize_t sent = send(fd, data, length, MSG_NOSIGNAL);
+        if (sent <= 0) {
+            return;
+        }
+        data += sent;
+        length -= sent;
+    }
+}
+
+/**
+ * @brief Answers one HTTP request: /metrics (or /) in Prometheus format, /metrics.json as JSON.
+ *  Every response closes the connection, so there's no keep-alive state to track.
+ */
+static void answer(Metrics* metrics, int client_fd) {
+    char request[1024];
+    int length = 0;
+    struct pollfd pfd = { client_fd, POLLIN, 0 };
+    while (length < (int)sizeof(request) - 1 && poll(&pfd, 1, 1000) > 0) {
+        ssize_t received = recv(client_fd, &request[length], sizeof(request) - 1 - length, 0);
+        if (received <= 0) {
+            break;
+        }
+        length += received;
+        request[length] = '\0';
+        if (strstr(request, "\r\n\r\n") != NULL || strstr(request, "\n\n") != NULL) {
+            break;
+        }
+    }
+    request[length] = '\0';
+
+    char path[256] = "";
+    sscanf(request, "GET %255s", path);
+
+    char* body = NULL;
+    size_t body_length = 0;
+    FILE* out = open_memstream(&body, &body_length);
+    const char* status = "200 OK";
+    const char* type = "text/plain; version=0.0.4";
+    if (strcmp(path, "/") == 0 || strcmp(path, "/metrics") == 0) {
+        metrics_write_prometheus(metrics, out);
+    }
+    else if (strcmp(path, "/metrics.json") == 0) {
+        metrics_write_json(metrics, NULL, out);
+        type = "application/json";
+    }
+    else {
+        status = "404 Not Found";
+        fprintf(out, "Not found\n");
+    }
+    fclose(out);
+
+    char header[256];
+    int header_length = snprintf(header, sizeof(header),
+        "HTTP/1.0 %s\r\nContent-Type: %s\r\nContent-Length: %zu\r\nConnection: close\r\n\r\n",
+        status, type, body_length);
+    send_all(client_fd, header, header_length);
+    send_all(client_fd, body, body_length);
+    free(body);
+}
+
+static void* server_thread(void* arg) {
+    Metrics* metrics = arg;
+    struct pollfd pfd = { metrics->listen_fd, POLLIN, 0 };
+    while (atomic_load(&metrics->running)) {
+        if (poll(&pfd, 1, METRICS_POLL_MS) <= 0) {
+            continue;
+        }
+        int client_fd = accept(metrics->listen_fd, NULL, NULL);
+        if (client_fd >= 0) {
+            answer(metrics, client_fd);
+            close(client_fd);
+        }
+    }
+    return NULL;
+}
+
+/**
+ * @brief Serves the metrics over HTTP from a thread of their own, so a scrape never stops the
+ *  emulator.
+ *
+ * @param metrics
+ * @param address TCP port on localhost, or path of a Unix socket
+ * @return int 0 on success, -1 if the socket couldn't be opened
+ */
+int metrics_serve(Metrics* metrics, const char* address) {
+    metrics->listen_fd = net_listen(address, 16);
+    if (metrics->listen_fd < 0) {
+        return -1;
+    }
+    atomic_store(&metrics->running, 1);
+    pthread_create(&metrics->server, NULL, server_thread, metrics);
+    return 0;
+}
+
+void metrics_free(Metrics* metrics) {
+    if (metrics->listen_fd >= 0) {
+        atomic_store(&metrics->running, 0);
+        pthread_join(metrics->server, NULL);
+        close(metrics->listen_fd);
+    }
+    free(metrics);
+}
+
+#pragma endregion
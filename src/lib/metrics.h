@@ -0,0 +1,56 @@
+#ifndef METRICS_H
+#define METRICS_H
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+#include "cpu8080.h"
+
+/**
+ * @brief Counters for one emulator instance, readable while it runs. The emulation thread is the
+ *  only writer, so an update is a relaxed load and store (a plain move on x86), and the exporter
+ *  thread reads them with relaxed loads. Nothing ever takes a lock or makes the emulator wait.
+ */
+typedef struct Metrics {
+    _Atomic uint64_t instructions;
+    _Atomic uint64_t fused_instructions;    // Instructions run as part of a superinstruction
+    _Atomic uint64_t cycles;
+    _Atomic uint64_t interrupts;
+    _Atomic uint64_t frames;
+    _Atomic uint64_t idle_skipped_cycles;
+    _Atomic uint64_t port_reads[256];
+    _Atomic uint64_t port_writes[256];
+
+    const char* machine;        // Label on every metric
+    uint64_t cpu_hz;            // Emulated clock, for the real-time ratio
+    uint64_t start_cycles;
+    struct timespec start;
+
+    int listen_fd;              // -1 unless serving
+    pthread_t server;
+    atomic_int running;
+} Metrics;
+
+/**
+ * @brief Adds to a counter. Only the emulation thread may call this.
+ */
+static inline void metrics_add(_Atomic uint64_t* counter, uint64_t value) {
+    uint64_t old = atomic_load_explicit(counter, memory_order_relaxed);
+    atomic_store_explicit(counter, old + value, memory_order_relaxed);
+}
+
+static inline void metrics_set(_Atomic uint64_t* counter, uint64_t value) {
+    atomic_store_explicit(counter, value, memory_order_relaxed);
+}
+
+Metrics* metrics_create(const char* machine, uint64_t cpu_hz, State8080* state);
+void metrics_free(Metrics* metrics);
+int metrics_serve(Metrics* metrics, const char* address);
+void metrics_update(Metrics* metrics, State8080* state);
+void metrics_write_prometheus(Metrics* metrics, FILE* out);
+void metrics_write_json(Metrics* metrics, State8080* state, FILE* out);
+
+#endif
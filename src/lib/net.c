@@ -0,0 +1,94 @@
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <netinet/in.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/socket.h>
+#include <sys/un.h>
+#include <unistd.h>
+
+#include "net.h"
+
+static int is_port(const char* address) {
+    const char* c = address;
+    while (isdigit((unsigned char)*c)) {
+        c++;
+    }
+    return *address != '\0' && *c == '\0';
+}
+
+/**
+ * @brief Opens a listening socket. A plain number is a TCP port on localhost, anything else is
+ *  the path of a Unix socket.
+ * 
+ * @param address TCP port on localhost, or path of a Unix socket
+ * @param backlog Connections that can wait to be accepted
+ * @return int The socket, or -1 if it couldn't be opened
+ */
+int net_listen(const char* address, int backlog) {
+    int fd;
+    if (is_port(address)) {
+        struct sockaddr_in addr = { 0 };
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(atoi(address));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        int reuse = 1;
+        setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &reuse, sizeof(reuse));
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+    else {
+        struct sockaddr_un addr = { 0 };
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address, sizeof(addr.sun_path) - 1);
+        unlink(address);
+
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        if (bind(fd, (struct sockaddr*)&addr, sizeof(addr)) < 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    if (listen(fd, backlog) < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
+
+/**
+ * @brief Connects to a socket opened by net_listen, with the same kind of address.
+ * 
+ * @param address TCP port on localhost, or path of a Unix socket
+ * @return int The connected socket, or -1 if it couldn't connect
+ */
+int net_connect(const char* address) {
+    int fd;
+    int result;
+    if (is_port(address)) {
+        struct sockaddr_in addr = { 0 };
+        addr.sin_family = AF_INET;
+        addr.sin_port = htons(atoi(address));
+        addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        fd = socket(AF_INET, SOCK_STREAM, 0);
+        result = connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+    }
+    else {
+        struct sockaddr_un addr = { 0 };
+        addr.sun_family = AF_UNIX;
+        strncpy(addr.sun_path, address, sizeof(addr.sun_path) - 1);
+        fd = socket(AF_UNIX, SOCK_STREAM, 0);
+        result = connect(fd, (struct sockaddr*)&addr, sizeof(addr));
+    }
+
+    if (result < 0) {
+        close(fd);
+        return -1;
+    }
+    return fd;
+}
@@ -0,0 +1,7 @@
+#ifndef NET_H
+#define NET_H
+
+int net_listen(const char* address, int backlog);
+int net_connect(const char* address);
+
+#endif
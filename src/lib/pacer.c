@@ -0,0 +1,132 @@
+#include <errno.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include "pacer.h"
+
+static int64_t to_nanoseconds(struct timespec* time) {
+    return (int64_t)time->tv_sec * 1000000000 + time->tv_nsec;
+}
+
+static struct timespec from_nanoseconds(int64_t nanoseconds) {
+    struct timespec time = { nanoseconds / 1000000000, nanoseconds % 1000000000 };
+    return time;
+}
+
+/**
+ * @brief Creates a pacer. The schedule starts now, with frame 1 due one frame from now.
+ * 
+ * @param fps Frames per second at 1x
+ * @param speed Speed multiplier, or 0 to run unthrottled and only record timing
+ * @return Pacer* 
+ */
+Pacer* pacer_create(int fps, double speed) {
+    Pacer* pacer = calloc(1, sizeof(Pacer));
+    pacer->speed = speed;
+    pacer->rate = fps * speed;
+    pacer->frame_nanoseconds = speed > 0 ? (int64_t)(1e9 / pacer->rate) : 0;
+    clock_gettime(CLOCK_MONOTONIC, &pacer->start);
+    return pacer;
+}
+
+void pacer_free(Pacer* pacer) {
+    free(pacer->late);
+    free(pacer);
+}
+
+/**
+ * @brief Call after each frame is emulated. Sleeps until that frame's deadline and records how
+ *  late it was once awake. If it's already past the deadline it doesn't sleep at all, and when
+ *  unthrottled it does nothing.
+ * 
+ * @param pacer 
+ */
+void pacer_wait(Pacer* pacer) {
+    if (pacer->speed <= 0) {
+        return;
+    }
+    if (pacer->frames == pacer->capacity) {
+        pacer->capacity = pacer->capacity ? pacer->capacity * 2 : 4096;
+        pacer->late = realloc(pacer->late, pacer->capacity * sizeof(int64_t));
+    }
+
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+
+    // Worked out from the frame number every time, so rounding never adds up.
+    uint64_t frame = pacer->frames + 1 - pacer->start_frame;
+    int64_t deadline = to_nanoseconds(&pacer->start) + (int64_t)(frame * 1e9 / pacer->rate);
+    int64_t late = to_nanoseconds(&now) - deadline;
+
+    if (late > PACER_MAX_BEHIND * pacer->frame_nanoseconds) {
+        pacer->start = now;
+        pacer->start_frame = pacer->frames + 1;
+        pacer->resyncs++;
+    }
+    else if (late < 0) {
+        struct timespec wake = from_nanoseconds(deadline);
+        while (clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &wake, NULL) == EINTR) {
+        }
+        clock_gettime(CLOCK_MONOTONIC, &now);
+        late = to_nanoseconds(&now) - deadline;
+    }
+
+    pacer->late[pacer->frames++] = late;
+}
+
+static int compare_late(const void* a, const void* b) {
+    int64_t x = *(const int64_t*)a;
+    int64_t y = *(const int64_t*)b;
+    return (x > y) - (x < y);
+}
+
+/**
+ * @brief Writes a summary of how late the frames were.
+ * 
+ * @param pacer 
+ * @param out Stream the summary is written to
+ */
+void pacer_write_report(Pacer* pacer, FILE* out) {
+    if (pacer->speed <= 0 || pacer->frames == 0) {
+        return;
+    }
+
+    int64_t* sorted = malloc(pacer->frames * sizeof(int64_t));
+    memcpy(sorted, pacer->late, pacer->frames * sizeof(int64_t));
+    qsort(sorted, pacer->frames, sizeof(int64_t), compare_late);
+
+    double total = 0;
+    uint64_t i, missed = 0;
+    for (i = 0; i < pacer->frames; i++) {
+        total += sorted[i];
+        if (sorted[i] > pacer->frame_nanoseconds) {
+            missed++;
+        }
+    }
+
+    fprintf(out, "Pacing at %gx: %llu frames, late by %.1f us on average, %.1f us at the median, "
+        "%.1f us at the 99th percentile, %.1f us at most\n", pacer->speed,
+        (unsigned long long)pacer->frames, total / pacer->frames / 1e3,
+        sorted[pacer->frames / 2] / 1e3, sorted[pacer->frames * 99 / 100] / 1e3,
+        sorted[pacer->frames - 1] / 1e3);
+    fprintf(out, "%llu frames more than a frame late, %llu resyncs\n", (unsigned long long)missed,
+        (unsigned long long)pacer->resyncs);
+    free(sorted);
+}
+
+/**
+ * @brief Writes how late every frame was as CSV (frame, nanoseconds).
+ * 
+ * @param pacer 
+ * @param out Stream the log is written to
+ */
+void pacer_write_log(Pacer* pacer, FILE* out) {
+    fprintf(out, "frame,late_ns\n");
+    uint64_t i;
+    for (i = 0; i < pacer->frames; i++) {
+        fprintf(out, "%llu,%lld\n", (unsigned long long)i + 1, (long long)pacer->late[i]);
+    }
+}
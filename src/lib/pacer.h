@@ -0,0 +1,36 @@
+#ifndef PACER_H
+#define PACER_H
+
+#include <stdint.h>
+#include <stdio.h>
+#include <time.h>
+
+// A frame this far behind schedule means the emulator was paused (e.g. by the debugger), so the
+// schedule restarts from now instead of racing to catch up.
+#define PACER_MAX_BEHIND 30
+
+/**
+ * @brief Keeps frames in step with the wall clock. Deadlines are absolute (the start time plus
+ *  the frame number times the frame length), so a late frame never pushes the later ones back
+ *  and timing error doesn't build up.
+ */
+typedef struct Pacer {
+    double speed;                   // 1 is real time, 2 is twice as fast, 0 is unthrottled
+    double rate;                    // Frames per second at this speed
+    int64_t frame_nanoseconds;      // Wall clock length of a frame at this speed, rounded
+    struct timespec start;
+    uint64_t start_frame;           // Frame the schedule was (re)started at
+
+    int64_t* late;                  // How late each frame's deadline was met, in nanoseconds
+    uint64_t frames;
+    uint64_t capacity;
+    uint64_t resyncs;
+} Pacer;
+
+Pacer* pacer_create(int fps, double speed);
+void pacer_free(Pacer* pacer);
+void pacer_wait(Pacer* pacer);
+void pacer_write_report(Pacer* pacer, FILE* out);
+void pacer_write_log(Pacer* pacer, FILE* out);
+
+#endif
@@ -0,0 +1,298 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "disasm.h"
+#include "profiler.h"
+
+#define ADDRESS_SPACE 0x10000
+#define MAX_PROFILE_DEPTH 1024
+#define PROFILE_PAIRS 20            // Opcode pairs listed in the report
+
+/**
+ * @brief Creates a profiler with every counter zeroed.
+ * 
+ * @return Profiler* 
+ */
+Profiler* profiler_create() {
+    Profiler* profiler = calloc(1, sizeof(Profiler));
+    profiler->counts = calloc(ADDRESS_SPACE, sizeof(uint64_t));
+    profiler->cycles = calloc(ADDRESS_SPACE, sizeof(uint64_t));
+    profiler->coverage = calloc(ADDRESS_SPACE / 8, 1);
+    profiler->sub_calls = calloc(ADDRESS_SPACE, sizeof(uint64_t));
+    profiler->sub_cycles = calloc(ADDRESS_SPACE, sizeof(uint64_t));
+    profiler->sub_active = calloc(ADDRESS_SPACE, sizeof(uint32_t));
+    profiler->frames = calloc(MAX_PROFILE_DEPTH, sizeof(ProfileFrame));
+    profiler->capacity = MAX_PROFILE_DEPTH;
+    profiler->pair_counts = calloc(256 * 256, sizeof(uint64_t));
+    profiler->pair_examples = calloc(256 * 256, sizeof(uint16_t));
+    profiler->next_pc = 0xffff;
+    return profiler;
+}
+
+void profiler_free(Profiler* profiler) {
+    free(profiler->counts);
+    free(profiler->cycles);
+    free(profiler->coverage);
+    free(profiler->sub_calls);
+    free(profiler->sub_cycles);
+    free(profiler->sub_active);
+    free(profiler->frames);
+    free(profiler->pair_counts);
+    free(profiler->pair_examples);
+    free(profiler);
+}
+
+#pragma region Recording
+
+static int is_call_op(uint8_t opcode) {
+    // CALL and its undocumented aliases, every Ccc (11ccc100) and every RST (11nnn111)
+    return opcode == 0xcd || opcode == 0xdd || opcode == 0xed || opcode == 0xfd ||
+        (opcode & 0xc7) == 0xc4 || (opcode & 0xc7) == 0xc7;
+}
+
+static int is_ret_op(uint8_t opcode) {
+    // RET and its undocumented alias, and every Rcc (11ccc000)
+    return opcode == 0xc9 || opcode == 0xd9 || (opcode & 0xc7) == 0xc0;
+}
+
+static void push_frame(Profiler* profiler, State8080* state) {
+    uint16_t entry = state->pc;
+    profiler->sub_calls[entry]++;
+
+    // A program that never returns (e.g. resets SP and jumps) would grow the shadow stack
+    // forever, so anything past the limit just isn't tracked.
+    if (profiler->depth == profiler->capacity) {
+        return;
+    }
+
+    ProfileFrame* frame = &profiler->frames[profiler->depth++];
+    frame->entry = entry;
+    frame->sp = state->sp;
+    frame->start_cycles = state->cycles;
+    profiler->sub_active[entry]++;
+}
+
+/**
+ * @brief Pops every frame whose return address is now above sp. Usually that's just the top
+ *  one, but it also cleans up after code that discards return addresses. sp is 32 bits so
+ *  0x10000 can pop them all.
+ */
+static void pop_frames(Profiler* profiler, State8080* state, uint32_t sp) {
+    while (profiler->depth > 0 && profiler->frames[profiler->depth - 1].sp < sp) {
+        ProfileFrame* frame = &profiler->frames[--profiler->depth];
+        profiler->sub_active[frame->entry]--;
+        if (profiler->sub_active[frame->entry] == 0) {
+            profiler->sub_cycles[frame->entry] += state->cycles - frame->start_cycles;
+        }
+    }
+}
+
+/**
+ * @brief Records one executed operation. Call right after emulate_op.
+ * 
+ * @param profiler 
+ * @param state The 8080 state after the operation
+ * @param pc Program counter before the operation
+ * @param sp Stack pointer before the operation
+ * @param opcode The opcode fetched, before the operation could write over it
+ * @param cycles Cycles the operation took
+ */
+void profiler_record(Profiler* profiler, State8080* state, uint16_t pc, uint16_t sp,
+    uint8_t opcode, int cycles) {
+    profiler->counts[pc]++;
+    profiler->cycles[pc] += cycles;
+
+    int length = trace_length(opcode);
+    int i;
+    for (i = 0; i < length; i++) {
+        uint16_t addr = pc + i;
+        profiler->coverage[addr >> 3] |= 1 << (addr & 7);
+    }
+
+    if (pc == profiler->next_pc) {
+        int pair = (profiler->last_opcode << 8) | opcode;
+        if (profiler->pair_counts[pair]++ == 0) {
+            profiler->pair_examples[pair] = pc - trace_length(profiler->last_opcode);
+        }
+    }
+    profiler->next_pc = pc + length;
+    profiler->last_opcode = opcode;
+
+    // Only a taken call or return moves the stack pointer by exactly one return address.
+    if (is_call_op(opcode) && state->sp == (uint16_t)(sp - 2)) {
+        push_frame(profiler, state);
+    }
+    else if (is_ret_op(opcode) && state->sp == (uint16_t)(sp + 2)) {
+        pop_frames(profiler, state, state->sp);
+    }
+}
+
+/**
+ * @brief Records a delivered interrupt, which is profiled like a call to its RST vector. Call
+ *  right after generate_interrupt succeeds.
+ * 
+ * @param profiler 
+ * @param state The 8080 state after the interrupt
+ */
+void profiler_interrupt(Profiler* profiler, State8080* state) {
+    push_frame(profiler, state);
+}
+
+#pragma endregion
+
+#pragma region Reports
+
+typedef struct ProfileEntry {
+    uint16_t pc;
+    uint64_t count;
+    uint64_t cycles;
+} ProfileEntry;
+
+static int compare_entries(const void* a, const void* b) {
+    const ProfileEntry* entry_a = a;
+    const ProfileEntry* entry_b = b;
+    if (entry_a->cycles != entry_b->cycles) {
+        return entry_a->cycles < entry_b->cycles ? 1 : -1;
+    }
+    return entry_a->pc - entry_b->pc;
+}
+
+/**
+ * @brief Writes a table sorted by cycles, with each row annotated by its disassembly.
+ */
+static void write_table(FILE* out, ProfileEntry* entries, int count, uint64_t total_cycles,
+        unsigned char* memory) {
+    qsort(entries, count, sizeof(ProfileEntry), compare_entries);
+
+    fprintf(out, "      cycles       %%        count  operation\n");
+    int i;
+    for (i = 0; i < count; i++) {
+        fprintf(out, "%12llu  %5.1f%%  %11llu  ",
+            (unsigned long long)entries[i].cycles,
+            total_cycles ? 100.0 * entries[i].cycles / total_cycles : 0.0,
+            (unsigned long long)entries[i].count);
+        disassemble_op(out, memory, entries[i].pc);
+    }
+}
+
+static int compare_pairs(const void* a, const void* b) {
+    const ProfileEntry* entry_a = a;
+    const ProfileEntry* entry_b = b;
+    if (entry_a->count != entry_b->count) {
+        return entry_a->count < entry_b->count ? 1 : -1;
+    }
+    return entry_a->pc - entry_b->pc;
+}
+
+/**
+ * @brief Writes the opcode pairs that run one straight after the other most often, each with
+ *  the first place it was seen.
+ */
+static void write_pairs(Profiler* profiler, FILE* out, uint64_t total_count,
+        unsigned char* memory) {
+    ProfileEntry* pairs = malloc(256 * 256 * sizeof(ProfileEntry));
+    int count = 0;
+    int pair;
+    for (pair = 0; pair < 256 * 256; pair++) {
+        if (profiler->pair_counts[pair] > 0) {
+            pairs[count].pc = pair;
+            pairs[count].count = profiler->pair_counts[pair];
+            count++;
+        }
+    }
+    qsort(pairs, count, sizeof(ProfileEntry), compare_pairs);
+
+    fprintf(out, "\nOpcode pairs (count is times the second ran straight after the first)\n");
+    fprintf(out, "       count       %%  operations\n");
+    int i;
+    for (i = 0; i < count && i < PROFILE_PAIRS; i++) {
+        uint16_t example = profiler->pair_examples[pairs[i].pc];
+        fprintf(out, "%12llu  %5.1f%%  ", (unsigned long long)pairs[i].count,
+            total_count ? 100.0 * pairs[i].count / total_count : 0.0);
+        int length = disassemble_op(out, memory, example);
+        fprintf(out, "%22s", "");
+        disassemble_op(out, memory, (uint16_t)(example + length));
+    }
+    free(pairs);
+}
+
+/**
+ * @brief Writes the hot spot and subroutine tables, sorted by cycles.
+ * 
+ * @param profiler 
+ * @param state The 8080 state, used to disassemble the profiled addresses
+ * @param out Stream the report is written to
+ * @param rom_start First address of the ROM, for the coverage summary
+ * @param rom_size Size of the ROM
+ */
+void profiler_write_report(Profiler* profiler, State8080* state, FILE* out,
+        uint16_t rom_start, uint32_t rom_size) {
+    // Operations at the very top of memory would make the disassembler read past the end.
+    unsigned char* memory = calloc(ADDRESS_SPACE + 2, 1);
+    memcpy(memory, state->memory, ADDRESS_SPACE);
+
+    ProfileEntry* entries = malloc(ADDRESS_SPACE * sizeof(ProfileEntry));
+    uint64_t total_count = 0;
+    uint64_t total_cycles = 0;
+    int count = 0;
+    uint32_t pc;
+    for (pc = 0; pc < ADDRESS_SPACE; pc++) {
+        if (profiler->counts[pc] > 0) {
+            entries[count].pc = pc;
+            entries[count].count = profiler->counts[pc];
+            entries[count].cycles = profiler->cycles[pc];
+            total_count += entries[count].count;
+            total_cycles += entries[count].cycles;
+            count++;
+        }
+    }
+
+    uint32_t covered = 0;
+    uint32_t addr;
+    for (addr = rom_start; addr < (uint32_t)rom_start + rom_size && addr < ADDRESS_SPACE; addr++) {
+        covered += (profiler->coverage[addr >> 3] >> (addr & 7)) & 1;
+    }
+
+    fprintf(out, "Profile: %llu operations, %llu cycles\n",
+        (unsigned long long)total_count, (unsigned long long)total_cycles);
+    fprintf(out, "Coverage: %u of %u ROM bytes executed (%.1f%%)\n\n",
+        covered, rom_size, rom_size ? 100.0 * covered / rom_size : 0.0);
+
+    fprintf(out, "Hot spots\n");
+    write_table(out, entries, count, total_cycles, memory);
+
+    // Close any subroutines that are still running so they show up too.
+    pop_frames(profiler, state, 0x10000);
+
+    count = 0;
+    for (pc = 0; pc < ADDRESS_SPACE; pc++) {
+        if (profiler->sub_calls[pc] > 0) {
+            entries[count].pc = pc;
+            entries[count].count = profiler->sub_calls[pc];
+            entries[count].cycles = profiler->sub_cycles[pc];
+            count++;
+        }
+    }
+
+    fprintf(out, "\nSubroutines (inclusive cycles, count is calls)\n");
+    write_table(out, entries, count, total_cycles, memory);
+
+    write_pairs(profiler, out, total_count, memory);
+
+    free(entries);
+    free(memory);
+}
+
+/**
+ * @brief Writes the coverage bitmap: 8KB, one bit per address, least significant bit first.
+ * 
+ * @param profiler 
+ * @param out Stream the bitmap is written to
+ */
+void profiler_write_coverage(Profiler* profiler, FILE* out) {
+    fwrite(profiler->coverage, 1, ADDRESS_SPACE / 8, out);
+}
+
+#pragma endregion
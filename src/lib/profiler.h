@@ -0,0 +1,52 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "cpu8080.h"
+
+/**
+ * @brief A subroutine that is currently running, kept on the profiler's shadow stack.
+ */
+typedef struct ProfileFrame {
+    uint16_t entry;
+    uint16_t sp;            // Stack pointer right after the return address was pushed
+    uint64_t start_cycles;
+} ProfileFrame;
+
+/**
+ * @brief Execution counts and cycles for every address in the 64K address space, plus inclusive
+ *  cycles for every subroutine entry point seen through CALL, RST or an interrupt.
+ */
+typedef struct Profiler {
+    uint64_t* counts;
+    uint64_t* cycles;
+    uint8_t* coverage;          // Bitmap of every byte fetched as part of an executed operation
+
+    uint64_t* sub_calls;
+    uint64_t* sub_cycles;
+    uint32_t* sub_active;       // Frames on the shadow stack per entry, so recursion counts once
+
+    ProfileFrame* frames;
+    int depth;
+    int capacity;
+
+    // Operations that ran straight into the next one, counted by pair of opcodes. These are
+    // the candidates for superinstructions.
+    uint64_t* pair_counts;
+    uint16_t* pair_examples;    // Where each pair was first seen
+    uint16_t next_pc;           // Address right after the last operation
+    uint8_t last_opcode;
+} Profiler;
+
+Profiler* profiler_create();
+void profiler_free(Profiler* profiler);
+void profiler_record(Profiler* profiler, State8080* state, uint16_t pc, uint16_t sp,
+    uint8_t opcode, int cycles);
+void profiler_interrupt(Profiler* profiler, State8080* state);
+void profiler_write_report(Profiler* profiler, State8080* state, FILE* out,
+    uint16_t rom_start, uint32_t rom_size);
+void profiler_write_coverage(Profiler* profiler, FILE* out);
+
+#endif
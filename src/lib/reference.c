@@ -0,0 +1,451 @@
+#include <stdint.h>
+#include <stdlib.h>
+
+#include "reference.h"
+
+#pragma region Helpers
+
+static uint8_t fetch(Reference8080* cpu) {
+    return cpu->memory[cpu->pc++];
+}
+
+static uint16_t fetch16(Reference8080* cpu) {
+    uint8_t low = fetch(cpu);
+    return low | (fetch(cpu) << 8);
+}
+
+static void store(Reference8080* cpu, uint16_t address, uint8_t value) {
+    cpu->memory[address] = value;
+    if (cpu->write_count < 2) {
+        cpu->writes[cpu->write_count++] = address;
+    }
+}
+
+static uint16_t get_pair(Reference8080* cpu, int high) {
+    return (cpu->registers[high] << 8) | cpu->registers[high + 1];
+}
+
+static void set_pair(Reference8080* cpu, int high, uint16_t value) {
+    cpu->registers[high] = value >> 8;
+    cpu->registers[high + 1] = value & 0xff;
+}
+
+static uint16_t hl(Reference8080* cpu) {
+    return get_pair(cpu, REF_H);
+}
+
+/**
+ * @brief Reads register r from an opcode, where 6 means the byte at (HL).
+ */
+static uint8_t get_r(Reference8080* cpu, int r) {
+    return r == REF_M ? cpu->memory[hl(cpu)] : cpu->registers[r];
+}
+
+static void set_r(Reference8080* cpu, int r, uint8_t value) {
+    if (r == REF_M) {
+        store(cpu, hl(cpu), value);
+    }
+    else {
+        cpu->registers[r] = value;
+    }
+}
+
+/**
+ * @brief Reads register pair rp from an opcode: BC, DE, HL, then SP.
+ */
+static uint16_t get_rp(Reference8080* cpu, int rp) {
+    return rp == 3 ? cpu->sp : get_pair(cpu, rp * 2);
+}
+
+static void set_rp(Reference8080* cpu, int rp, uint16_t value) {
+    if (rp == 3) {
+        cpu->sp = value;
+    }
+    else {
+        set_pair(cpu, rp * 2, value);
+    }
+}
+
+static void push16(Reference8080* cpu, uint16_t value) {
+    cpu->sp -= 2;
+    store(cpu, cpu->sp + 1, value >> 8);
+    store(cpu, cpu->sp, value & 0xff);
+}
+
+static uint16_t pop16(Reference8080* cpu) {
+    uint16_t value = cpu->memory[cpu->sp] | (cpu->memory[(uint16_t)(cpu->sp + 1)] << 8);
+    cpu->sp += 2;
+    return value;
+}
+
+static void set_flag(Reference8080* cpu, uint8_t flag, int on) {
+    cpu->flags = on ? (cpu->flags | flag) : (cpu->flags & ~flag);
+}
+
+/**
+ * @brief Sets S, Z and P from a result, leaving the other flags alone.
+ */
+static void set_szp(Reference8080* cpu, uint8_t value) {
+    int bits = 0, i;
+    for (i = 0; i < 8; i++) {
+        bits += (value >> i) & 1;
+    }
+    set_flag(cpu, REF_S, value & 0x80);
+    set_flag(cpu, REF_Z, value == 0);
+    set_flag(cpu, REF_P, bits % 2 == 0);
+}
+
+/**
+ * @brief Condition ccc from an opcode: NZ, Z, NC, C, PO, PE, P, M.
+ */
+static int condition(Reference8080* cpu, int ccc) {
+    static const uint8_t FLAGS[4] = { REF_Z, REF_CY, REF_P, REF_S };
+    int set = (cpu->flags & FLAGS[ccc >> 1]) != 0;
+    return (ccc & 1) ? set : !set;
+}
+
+#pragma endregion
+
+#pragma region ALU
+
+/**
+ * @brief The 8-bit adder everything arithmetic goes through. The carries out of bits 3 and 7
+ *  come from comparing the result with the inputs.
+ */
+static uint8_t adder(Reference8080* cpu, uint8_t x, uint8_t y, int carry_in) {
+    unsigned result = x + y + carry_in;
+    unsigned carries = result ^ x ^ y;
+    set_flag(cpu, REF_CY, carries & 0x100);
+    set_flag(cpu, REF_AC, carries & 0x10);
+    set_szp(cpu, result & 0xff);
+    return result & 0xff;
+}
+
+/**
+ * @brief The ALU operation alu from an opcode: ADD, ADC, SUB, SBB, ANA, XRA, ORA, CMP.
+ *  Subtraction adds the complement, with CY inverted afterwards so it means borrow.
+ */
+static void alu(Reference8080* cpu, int operation, uint8_t value) {
+    uint8_t* a = &cpu->registers[REF_A];
+    int cy = cpu->flags & REF_CY;
+    uint8_t result;
+
+    switch (operation) {
+        case 0: *a = adder(cpu, *a, value, 0); break;
+        case 1: *a = adder(cpu, *a, value, cy); break;
+        case 2:
+            *a = adder(cpu, *a, ~value, 1);
+            cpu->flags ^= REF_CY;
+            break;
+        case 3:
+            *a = adder(cpu, *a, ~value, !cy);
+            cpu->flags ^= REF_CY;
+            break;
+        case 4:
+            result = *a & value;
+            set_flag(cpu, REF_AC, (*a | value) & 0x08);
+            set_flag(cpu, REF_CY, 0);
+            set_szp(cpu, result);
+            *a = result;
+            break;
+        case 5:
+        case 6:
+            *a = operation == 5 ? (*a ^ value) : (*a | value);
+            set_flag(cpu, REF_AC, 0);
+            set_flag(cpu, REF_CY, 0);
+            set_szp(cpu, *a);
+            break;
+        case 7:
+            adder(cpu, *a, ~value, 1);
+            cpu->flags ^= REF_CY;
+            break;
+    }
+}
+
+/**
+ * @brief The accumulator operations in the 00xxx111 block: RLC, RRC, RAL, RAR, DAA, CMA, STC,
+ *  CMC.
+ */
+static void accumulator_op(Reference8080* cpu, int operation) {
+    uint8_t* a = &cpu->registers[REF_A];
+    int cy = cpu->flags & REF_CY;
+
+    switch (operation) {
+        case 0:
+            set_flag(cpu, REF_CY, *a & 0x80);
+            *a = (*a << 1) | (*a >> 7);
+            break;
+        case 1:
+            set_flag(cpu, REF_CY, *a & 0x01);
+            *a = (*a >> 1) | (*a << 7);
+            break;
+        case 2:
+            set_flag(cpu, REF_CY, *a & 0x80);
+            *a = (*a << 1) | (cy ? 1 : 0);
+            break;
+        case 3:
+            set_flag(cpu, REF_CY, *a & 0x01);
+            *a = (*a >> 1) | (cy ? 0x80 : 0);
+            break;
+        case 4: {
+            // Decimal adjust: +6 for the low digit, +0x60 for the high one, CY only ever set.
+            uint8_t adjust = 0;
+            int carry = cy;
+            if ((cpu->flags & REF_AC) || (*a & 0x0f) > 9) {
+                adjust += 0x06;
+            }
+            if (cy || *a > 0x99) {
+                adjust += 0x60;
+                carry = 1;
+            }
+            *a = adder(cpu, *a, adjust, 0);
+            set_flag(cpu, REF_CY, carry);
+            break;
+        }
+        case 5: *a = ~*a; break;
+        case 6: cpu->flags |= REF_CY; break;
+        case 7: cpu->flags ^= REF_CY; break;
+    }
+}
+
+#pragma endregion
+
+#pragma region Decoding
+
+/**
+ * @brief Opcodes 00xxxxxx: immediates, increments, 16-bit loads and stores, rotates.
+ */
+static int step_block0(Reference8080* cpu, uint8_t opcode) {
+    int y = (opcode >> 3) & 7;
+    int rp = y >> 1;
+    uint16_t address;
+    uint8_t value;
+
+    switch (opcode & 7) {
+        case 0:
+            return 4;                                       // NOP and its undocumented copies
+        case 1:
+            if (y & 1) {                                    // DAD
+                uint32_t sum = hl(cpu) + get_rp(cpu, rp);
+                set_flag(cpu, REF_CY, sum > 0xffff);
+                set_pair(cpu, REF_H, sum);
+                return 10;
+            }
+            set_rp(cpu, rp, fetch16(cpu));                  // LXI
+            return 10;
+        case 2:
+            switch (y) {
+                case 0: store(cpu, get_pair(cpu, REF_B), cpu->registers[REF_A]); return 7;
+                case 1: cpu->registers[REF_A] = cpu->memory[get_pair(cpu, REF_B)]; return 7;
+                case 2: store(cpu, get_pair(cpu, REF_D), cpu->registers[REF_A]); return 7;
+                case 3: cpu->registers[REF_A] = cpu->memory[get_pair(cpu, REF_D)]; return 7;
+                case 4:                                     // SHLD
+                    address = fetch16(cpu);
+                    store(cpu, address, cpu->registers[REF_L]);
+                    store(cpu, address + 1, cpu->registers[REF_H]);
+                    return 16;
+                case 5:                                     // LHLD
+                    address = fetch16(cpu);
+                    cpu->registers[REF_L] = cpu->memory[address];
+                    cpu->registers[REF_H] = cpu->memory[(uint16_t)(address + 1)];
+                    return 16;
+                case 6: store(cpu, fetch16(cpu), cpu->registers[REF_A]); return 13;
+                default: cpu->registers[REF_A] = cpu->memory[fetch16(cpu)]; return 13;
+            }
+        case 3:                                             // INX, DCX
+            set_rp(cpu, rp, get_rp(cpu, rp) + ((y & 1) ? -1 : 1));
+            return 5;
+        case 4:
+        case 5: {                                           // INR, DCR leave CY alone
+            int increment = (opcode & 7) == 4;
+            value = get_r(cpu, y) + (increment ? 1 : -1);
+            set_flag(cpu, REF_AC, increment ? (value & 0x0f) == 0 : (value & 0x0f) != 0x0f);
+            set_szp(cpu, value);
+            set_r(cpu, y, value);
+            return y == REF_M ? 10 : 5;
+        }
+        case 6:                                             // MVI
+            set_r(cpu, y, fetch(cpu));
+            return y == REF_M ? 10 : 7;
+        default:
+            accumulator_op(cpu, y);
+            return 4;
+    }
+}
+
+/**
+ * @brief Opcodes 11xxxxxx: branches, stack, I/O and immediate ALU operations.
+ */
+static int step_block3(Reference8080* cpu, uint8_t opcode) {
+    int y = (opcode >> 3) & 7;
+    uint16_t target, value;
+
+    switch (opcode & 7) {
+        case 0:                                             // Rcc
+            if (condition(cpu, y)) {
+                cpu->pc = pop16(cpu);
+                return 11;
+            }
+            return 5;
+        case 1:
+            if (!(y & 1)) {                                 // POP
+                value = pop16(cpu);
+                if (y == 6) {
+                    cpu->registers[REF_A] = value >> 8;
+                    cpu->flags = (value & 0xd5) | 0x02;
+                }
+                else {
+                    set_pair(cpu, y, value);
+                }
+                return 10;
+            }
+            switch (y) {
+                case 1: case 3: cpu->pc = pop16(cpu); return 10;       // RET
+                case 5: cpu->pc = hl(cpu); return 5;                    // PCHL
+                default: cpu->sp = hl(cpu); return 5;                   // SPHL
+            }
+        case 2:                                             // Jcc
+            target = fetch16(cpu);
+            if (condition(cpu, y)) {
+                cpu->pc = target;
+            }
+            return 10;
+        case 3:
+            switch (y) {
+                case 0: case 1: cpu->pc = fetch16(cpu); return 10;      // JMP
+                case 2: {                                               // OUT
+                    uint8_t port = fetch(cpu);
+                    if (cpu->port_out) {
+                        cpu->port_out(cpu->io_context, port, cpu->registers[REF_A]);
+                    }
+                    return 10;
+                }
+                case 3: {                                               // IN
+                    uint8_t port = fetch(cpu);
+                    cpu->registers[REF_A] = cpu->port_in ? cpu->port_in(cpu->io_context, port) : 0;
+                    return 10;
+                }
+                case 4:                                                 // XTHL
+                    value = cpu->memory[cpu->sp] | (cpu->memory[(uint16_t)(cpu->sp + 1)] << 8);
+                    store(cpu, cpu->sp, cpu->registers[REF_L]);
+                    store(cpu, cpu->sp + 1, cpu->registers[REF_H]);
+                    set_pair(cpu, REF_H, value);
+                    return 18;
+                case 5:                                                 // XCHG
+                    value = hl(cpu);
+                    set_pair(cpu, REF_H, get_pair(cpu, REF_D));
+                    set_pair(cpu, REF_D, value);
+                    return 5;
+                case 6: cpu->int_enable = 0; return 4;                  // DI
+                default: cpu->int_enable = 1; return 4;                 // EI
+            }
+        case 4:                                             // Ccc
+            target = fetch16(cpu);
+            if (condition(cpu, y)) {
+                push16(cpu, cpu->pc);
+                cpu->pc = target;
+                return 17;
+            }
+            return 11;
+        case 5:
+            if (!(y & 1)) {                                 // PUSH
+                if (y == 6) {
+                    push16(cpu, (cpu->registers[REF_A] << 8) | cpu->flags);
+                }
+                else {
+                    push16(cpu, get_pair(cpu, y));
+                }
+                return 11;
+            }
+            target = fetch16(cpu);                          // CALL and its undocumented copies
+            push16(cpu, cpu->pc);
+            cpu->pc = target;
+            return 17;
+        case 6:
+            alu(cpu, y, fetch(cpu));
+            return 7;
+        default:                                            // RST
+            push16(cpu, cpu->pc);
+            cpu->pc = y * 8;
+            return 11;
+    }
+}
+
+#pragma endregion
+
+#pragma region Public
+
+Reference8080* reference_create(uint8_t* memory) {
+    Reference8080* cpu = calloc(1, sizeof(Reference8080));
+    cpu->memory = memory;
+    cpu->flags = 0x02;
+    return cpu;
+}
+
+void reference_free(Reference8080* cpu) {
+    free(cpu);
+}
+
+/**
+ * @brief Runs one instruction.
+ * 
+ * @param cpu 
+ * @return int Cycles taken
+ */
+int reference_step(Reference8080* cpu) {
+    cpu->write_count = 0;
+    if (cpu->halted) {
+        cpu->cycles += 4;
+        return 4;
+    }
+
+    uint8_t opcode = fetch(cpu);
+    int cycles;
+    switch (opcode >> 6) {
+        case 0:
+            cycles = step_block0(cpu, opcode);
+            break;
+        case 1:
+            if (opcode == 0x76) {                           // HLT sits where MOV M,M would
+                cpu->halted = 1;
+                cycles = 7;
+            }
+            else {
+                set_r(cpu, (opcode >> 3) & 7, get_r(cpu, opcode & 7));
+                cycles = ((opcode & 7) == REF_M || ((opcode >> 3) & 7) == REF_M) ? 7 : 5;
+            }
+            break;
+        case 2:
+            alu(cpu, (opcode >> 3) & 7, get_r(cpu, opcode & 7));
+            cycles = (opcode & 7) == REF_M ? 7 : 4;
+            break;
+        default:
+            cycles = step_block3(cpu, opcode);
+            break;
+    }
+
+    cpu->cycles += cycles;
+    return cycles;
+}
+
+/**
+ * @brief Delivers RST n if interrupts are enabled.
+ * 
+ * @param cpu 
+ * @param interrupt_num 
+ * @return int Whether it was delivered
+ */
+int reference_interrupt(Reference8080* cpu, int interrupt_num) {
+    cpu->write_count = 0;
+    if (!cpu->int_enable) {
+        return 0;
+    }
+    push16(cpu, cpu->pc);
+    cpu->pc = interrupt_num * 8;
+    cpu->int_enable = 0;
+    cpu->halted = 0;
+    cpu->cycles += 11;
+    return 1;
+}
+
+#pragma endregion
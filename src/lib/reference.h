@@ -0,0 +1,45 @@
+#ifndef REFERENCE_H
+#define REFERENCE_H
+
+#include <stdint.h>
+
+// Register indexes in the order the opcodes encode them. 6 is (HL) in memory, not a register.
+enum { REF_B, REF_C, REF_D, REF_E, REF_H, REF_L, REF_M, REF_A };
+
+// Flag bits, laid out like the flags byte pushed by PUSH PSW
+#define REF_CY 0x01
+#define REF_P  0x04
+#define REF_AC 0x10
+#define REF_Z  0x40
+#define REF_S  0x80
+
+/**
+ * @brief A second, independently written 8080 core, used as the reference the main core is
+ *  checked against. It's written for being obviously right rather than fast: opcodes are decoded
+ *  from their bit fields and the flags are kept packed the way PUSH PSW stores them.
+ */
+typedef struct Reference8080 {
+    uint8_t registers[8];
+    uint8_t flags;
+    uint16_t sp;
+    uint16_t pc;
+    uint8_t* memory;
+    uint8_t int_enable;
+    uint8_t halted;
+    uint64_t cycles;
+
+    // Addresses written by the last step, so a checker knows which bytes to compare.
+    uint16_t writes[2];
+    int write_count;
+
+    uint8_t (*port_in)(void* context, uint8_t port);
+    void (*port_out)(void* context, uint8_t port, uint8_t value);
+    void* io_context;
+} Reference8080;
+
+Reference8080* reference_create(uint8_t* memory);
+void reference_free(Reference8080* cpu);
+int reference_step(Reference8080* cpu);
+int reference_interrupt(Reference8080* cpu, int interrupt_num);
+
+#endif
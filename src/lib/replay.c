@@ -0,0 +1,243 @@
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include "replay.h"
+
+static const char* KIND_NAMES[] = { "IN", "RST", "register hash", "memory hash" };
+
+#pragma region Checking
+
+/**
+ * @brief Stops the replay, remembering where and why for the report.
+ */
+static void diverge(Replay* replay, const char* what, ReplayRecord* expected, uint64_t got) {
+    replay->diverged = 1;
+    if (expected == NULL) {
+        snprintf(replay->message, sizeof(replay->message),
+            "Replay diverged at frame %llu, pc 0x%04x: the log ended before %s",
+            (unsigned long long)replay->frame, replay->state->pc, what);
+        return;
+    }
+
+    char expected_what[64];
+    char detail[32] = "";
+    if (expected->kind == REPLAY_INPUT) {
+        snprintf(expected_what, sizeof(expected_what), "IN port %d", expected->port);
+    }
+    else {
+        snprintf(expected_what, sizeof(expected_what), "%s 0x%llx", KIND_NAMES[expected->kind],
+            (unsigned long long)expected->value);
+        snprintf(detail, sizeof(detail), " 0x%llx", (unsigned long long)got);
+    }
+    snprintf(replay->message, sizeof(replay->message),
+        "Replay diverged at frame %llu, pc 0x%04x (cycle %llu): expected %s at pc 0x%04x "
+        "(cycle %llu), got %s%s", (unsigned long long)replay->frame, replay->state->pc,
+        (unsigned long long)replay->state->cycles, expected_what, expected->pc,
+        (unsigned long long)expected->cycles, what, detail);
+}
+
+/**
+ * @brief Takes the next record off the log being replayed, if it's the one expected.
+ * 
+ * @return ReplayRecord* The record, or NULL if the replay diverged
+ */
+static ReplayRecord* expect(Replay* replay, uint8_t kind, uint8_t port, uint64_t value,
+                            const char* what) {
+    if (replay->position == replay->count) {
+        diverge(replay, what, NULL, 0);
+        return NULL;
+    }
+
+    ReplayRecord* record = &replay->records[replay->position];
+    if (record->kind != kind || record->cycles != replay->state->cycles ||
+        (kind == REPLAY_INPUT && record->port != port) ||
+        (kind != REPLAY_INPUT && record->value != value)) {
+        diverge(replay, what, record, value);
+        return NULL;
+    }
+    replay->position++;
+    return record;
+}
+
+static void write_record(Replay* replay, uint8_t kind, uint8_t port, uint64_t value) {
+    ReplayRecord record = { replay->state->cycles, value, replay->frame, replay->state->pc,
+        kind, port };
+    fwrite(&record, sizeof(record), 1, replay->file);
+}
+
+#pragma endregion
+
+#pragma region I/O Ports
+
+static uint8_t replay_in(void* context, uint8_t port) {
+    Replay* replay = context;
+    uint8_t value = replay->port_in ? replay->port_in(replay->io_context, port) : 0;
+
+    if (replay->recording) {
+        write_record(replay, REPLAY_INPUT, port, value);
+    }
+    else if (!replay->diverged) {
+        char what[32];
+        snprintf(what, sizeof(what), "IN port %d", port);
+        ReplayRecord* record = expect(replay, REPLAY_INPUT, port, 0, what);
+        if (record != NULL) {
+            value = record->value;
+        }
+    }
+    return value;
+}
+
+static void replay_out(void* context, uint8_t port, uint8_t value) {
+    Replay* replay = context;
+    if (replay->port_out) {
+        replay->port_out(replay->io_context, port, value);
+    }
+}
+
+#pragma endregion
+
+#pragma region Replay
+
+static Replay* create(State8080* state) {
+    Replay* replay = calloc(1, sizeof(Replay));
+    replay->state = state;
+    replay->port_in = state->port_in;
+    replay->port_out = state->port_out;
+    replay->io_context = state->io_context;
+    state->port_in = replay_in;
+    state->port_out = replay_out;
+    state->io_context = replay;
+    hasher_init(&replay->hasher, state);
+    return replay;
+}
+
+/**
+ * @brief Starts recording. Call once the machine is set up, right before it starts running.
+ * 
+ * @param state The 8080 state, with the machine's I/O callbacks already installed
+ * @param filename Where to write the log
+ * @return Replay* The recorder, or NULL if the file couldn't be opened
+ */
+Replay* replay_record(State8080* state, const char* filename) {
+    FILE* file = fopen(filename, "wb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    Replay* replay = create(state);
+    replay->recording = 1;
+    replay->file = file;
+
+    ReplayHeader header = { REPLAY_MAGIC, REPLAY_VERSION, sizeof(ReplayRecord),
+        hash_registers(state), replay->hasher.memory_hash };
+    fwrite(&header, sizeof(header), 1, file);
+    return replay;
+}
+
+/**
+ * @brief Starts replaying a log. Inputs come from the log from here on, and interrupts and
+ *  frame hashes are checked against it. A different starting state counts as diverging at
+ *  frame 0.
+ * 
+ * @param state The 8080 state, with the machine's I/O callbacks already installed
+ * @param filename The log to replay
+ * @return Replay* The replay, or NULL if the file couldn't be read or isn't a replay log
+ */
+Replay* replay_play(State8080* state, const char* filename) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        return NULL;
+    }
+
+    ReplayHeader header;
+    if (fread(&header, sizeof(header), 1, file) != 1 ||
+        memcmp(header.magic, REPLAY_MAGIC, sizeof(header.magic)) != 0 ||
+        header.version != REPLAY_VERSION || header.record_size != sizeof(ReplayRecord)) {
+        fclose(file);
+        return NULL;
+    }
+
+    Replay* replay = create(state);
+    long start = ftell(file);
+    fseek(file, 0, SEEK_END);
+    replay->count = (ftell(file) - start) / sizeof(ReplayRecord);
+    fseek(file, start, SEEK_SET);
+    replay->records = malloc(replay->count * sizeof(ReplayRecord) + 1);
+    replay->count = fread(replay->records, sizeof(ReplayRecord), replay->count, file);
+    fclose(file);
+
+    if (header.registers_hash != hash_registers(state) ||
+        header.memory_hash != replay->hasher.memory_hash) {
+        replay->diverged = 1;
+        snprintf(replay->message, sizeof(replay->message),
+            "Replay diverged at frame 0, pc 0x%04x: the starting %s is different",
+            state->pc, header.memory_hash != replay->hasher.memory_hash ? "memory" : "state");
+    }
+    return replay;
+}
+
+/**
+ * @brief Call right after the machine delivers an interrupt.
+ * 
+ * @param replay 
+ * @param interrupt_num The RST number
+ */
+void replay_interrupt(Replay* replay, int interrupt_num) {
+    if (replay->recording) {
+        write_record(replay, REPLAY_INTERRUPT, 0, interrupt_num);
+    }
+    else if (!replay->diverged) {
+        expect(replay, REPLAY_INTERRUPT, 0, interrupt_num, "RST");
+    }
+}
+
+/**
+ * @brief Call at the end of every frame. Hashes the registers and memory (only the pages that
+ *  were written this frame are hashed again) and records or checks them.
+ * 
+ * @param replay 
+ */
+void replay_frame(Replay* replay) {
+    uint64_t registers = hash_registers(replay->state);
+    uint64_t memory = hasher_update(&replay->hasher, replay->state);
+
+    if (replay->recording) {
+        write_record(replay, REPLAY_REGISTERS, 0, registers);
+        write_record(replay, REPLAY_MEMORY, 0, memory);
+    }
+    else if (!replay->diverged) {
+        if (expect(replay, REPLAY_REGISTERS, 0, registers, "register hash") != NULL &&
+            expect(replay, REPLAY_MEMORY, 0, memory, "memory hash") != NULL &&
+            replay->position == replay->count) {
+            replay->finished = 1;
+        }
+    }
+    replay->frame++;
+}
+
+/**
+ * @brief Whether a replay is over, because it diverged or got to the end of the log.
+ */
+int replay_stopped(Replay* replay) {
+    return replay->diverged || replay->finished;
+}
+
+/**
+ * @brief Finishes the log if recording, and gives the machine its I/O callbacks back.
+ */
+void replay_free(Replay* replay) {
+    State8080* state = replay->state;
+    state->port_in = replay->port_in;
+    state->port_out = replay->port_out;
+    state->io_context = replay->io_context;
+
+    if (replay->file != NULL) {
+        fclose(replay->file);
+    }
+    free(replay->records);
+    free(replay);
+}
+
+#pragma endregion
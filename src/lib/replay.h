@@ -0,0 +1,76 @@
+#ifndef REPLAY_H
+#define REPLAY_H
+
+#include <stdint.h>
+#include <stdio.h>
+
+#include "cpu8080.h"
+#include "hash.h"
+
+#define REPLAY_MAGIC "8080RPLY"
+#define REPLAY_VERSION 1
+
+enum ReplayKind {
+    REPLAY_INPUT,           // An IN, value is what it read
+    REPLAY_INTERRUPT,       // value is the RST number
+    REPLAY_REGISTERS,       // End of a frame, value is the hash of the registers
+    REPLAY_MEMORY,          // End of a frame, value is the hash of memory
+};
+
+/**
+ * @brief One entry in a replay log, stamped with the cycle counter and pc when it happened.
+ */
+typedef struct ReplayRecord {
+    uint64_t cycles;
+    uint64_t value;
+    uint32_t frame;
+    uint16_t pc;
+    uint8_t kind;
+    uint8_t port;
+} ReplayRecord;
+
+/**
+ * @brief Start of a replay log: hashes of the state the recording started from.
+ */
+typedef struct ReplayHeader {
+    char magic[8];
+    uint32_t version;
+    uint32_t record_size;
+    uint64_t registers_hash;
+    uint64_t memory_hash;
+} ReplayHeader;
+
+/**
+ * @brief Records every input and interrupt with its cycle timestamp, plus state hashes at every
+ *  frame boundary, or plays them back and checks that the run comes out the same. It sits
+ *  between the CPU and the machine's I/O callbacks.
+ */
+typedef struct Replay {
+    State8080* state;
+    int recording;
+
+    FILE* file;                     // Log being recorded
+    ReplayRecord* records;          // Log being replayed
+    uint64_t count;
+    uint64_t position;
+
+    StateHasher hasher;
+    uint64_t frame;
+    int diverged;
+    int finished;                   // Got to the end of the log being replayed
+    char message[256];
+
+    // The machine's own I/O callbacks
+    uint8_t (*port_in)(void* context, uint8_t port);
+    void (*port_out)(void* context, uint8_t port, uint8_t value);
+    void* io_context;
+} Replay;
+
+Replay* replay_record(State8080* state, const char* filename);
+Replay* replay_play(State8080* state, const char* filename);
+void replay_interrupt(Replay* replay, int interrupt_num);
+void replay_frame(Replay* replay);
+int replay_stopped(Replay* replay);
+void replay_free(Replay* replay);
+
+#endif
@@ -0,0 +1,116 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "ring.h"
+
+/**
+ * @brief Creates an empty ring.
+ * 
+ * @param capacity Number of elements, rounded up to a power of two
+ * @param element_size Size of each element in bytes
+ * @return Ring* 
+ */
+Ring* ring_create(size_t capacity, size_t element_size) {
+    size_t size = 1;
+    while (size < capacity) {
+        size <<= 1;
+    }
+
+    Ring* ring = aligned_alloc(64, sizeof(Ring));
+    atomic_init(&ring->head, 0);
+    atomic_init(&ring->tail, 0);
+    ring->mask = size - 1;
+    ring->element_size = element_size;
+    ring->data = malloc(size * element_size);
+    return ring;
+}
+
+void ring_free(Ring* ring) {
+    free(ring->data);
+    free(ring);
+}
+
+/**
+ * @brief Copies an element onto the ring. Only call from the producer thread.
+ * 
+ * @param ring 
+ * @param element 
+ * @return int 1 if it was pushed, 0 if the ring is full
+ */
+int ring_push(Ring* ring, const void* element) {
+    void* slot = ring_reserve(ring);
+    if (slot == NULL) {
+        return 0;
+    }
+
+    memcpy(slot, element, ring->element_size);
+    ring_commit(ring);
+    return 1;
+}
+
+/**
+ * @brief Copies the oldest element off the ring. Only call from the consumer thread.
+ * 
+ * @param ring 
+ * @param element Where the element is copied to
+ * @return int 1 if an element was popped, 0 if the ring is empty
+ */
+int ring_pop(Ring* ring, void* element) {
+    const void* slot = ring_peek(ring);
+    if (slot == NULL) {
+        return 0;
+    }
+
+    memcpy(element, slot, ring->element_size);
+    ring_release(ring);
+    return 1;
+}
+
+/**
+ * @brief The slot the next element goes in, for filling in place instead of copying a whole
+ *  element in with ring_push. Nothing sees it until ring_commit. Only call from the producer
+ *  thread.
+ * 
+ * @param ring 
+ * @return void* The slot, or NULL if the ring is full
+ */
+void* ring_reserve(Ring* ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    size_t head = atomic_load_explicit(&ring->head, memory_order_acquire);
+    if (tail - head > ring->mask) {
+        return NULL;
+    }
+    return &ring->data[(tail & ring->mask) * ring->element_size];
+}
+
+/**
+ * @brief Hands the slot from ring_reserve to the consumer.
+ */
+void ring_commit(Ring* ring) {
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_relaxed);
+    atomic_store_explicit(&ring->tail, tail + 1, memory_order_release);
+}
+
+/**
+ * @brief The oldest element, left in place on the ring until ring_release. Only call from the
+ *  consumer thread.
+ * 
+ * @param ring 
+ * @return const void* The element, or NULL if the ring is empty
+ */
+const void* ring_peek(Ring* ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    size_t tail = atomic_load_explicit(&ring->tail, memory_order_acquire);
+    if (head == tail) {
+        return NULL;
+    }
+    return &ring->data[(head & ring->mask) * ring->element_size];
+}
+
+/**
+ * @brief Gives the slot of the element from ring_peek back to the producer.
+ */
+void ring_release(Ring* ring) {
+    size_t head = atomic_load_explicit(&ring->head, memory_order_relaxed);
+    atomic_store_explicit(&ring->head, head + 1, memory_order_release);
+}
@@ -0,0 +1,29 @@
+#ifndef RING_H
+#define RING_H
+
+#include <stdatomic.h>
+#include <stddef.h>
+
+/**
+ * @brief Lock-free ring buffer for exactly one producer thread and one consumer thread. Neither
+ *  side ever blocks: a push onto a full ring or a pop from an empty one just fails. The head and
+ *  tail live on separate cache lines so the two threads don't fight over one.
+ */
+typedef struct Ring {
+    _Alignas(64) atomic_size_t head;        // Next slot to pop, only written by the consumer
+    _Alignas(64) atomic_size_t tail;        // Next slot to push, only written by the producer
+    _Alignas(64) size_t mask;               // Capacity - 1, the capacity is a power of two
+    size_t element_size;
+    unsigned char* data;
+} Ring;
+
+Ring* ring_create(size_t capacity, size_t element_size);
+void ring_free(Ring* ring);
+int ring_push(Ring* ring, const void* element);
+int ring_pop(Ring* ring, void* element);
+void* ring_reserve(Ring* ring);
+void ring_commit(Ring* ring);
+const void* ring_peek(Ring* ring);
+void ring_release(Ring* ring);
+
+#endif
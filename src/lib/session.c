@@ -0,0 +1,141 @@
+#define _GNU_SOURCE
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <unistd.h>
+
+#include "session.h"
+
+/**
+ * @brief Loads a ROM file. Unlike read_file_into_memory this reports a bad file instead of
+ *  exiting, since one client's mistake mustn't take the server down.
+ */
+static long load_rom(State8080* state, const char* filename, uint32_t offset, char* error,
+    size_t error_size) {
+    FILE* file = fopen(filename, "rb");
+    if (file == NULL) {
+        snprintf(error, error_size, "could not open %s", filename);
+        return -1;
+    }
+    size_t size = fread(&state->memory[offset], 1, 0x10000 - offset, file);
+    int more = fgetc(file) != EOF;
+    fclose(file);
+    if (size == 0 || more) {
+        snprintf(error, error_size, "%s is empty or doesn't fit in memory", filename);
+        return -1;
+    }
+
+    mark_written(state, offset, size);
+    return size;
+}
+
+static void free_state(State8080* state) {
+    munmap(state->memory, 0x10000);
+    state->memory = NULL;
+    free_8080(state);
+}
+
+/**
+ * @brief Creates a Space Invaders session, with its ROM files loaded back to back from 0x0000.
+ *
+ * @param id Session number
+ * @param roms Paths of the ROM files, in load order
+ * @param rom_count Number of ROM files
+ * @param error Filled in with the reason if the session can't be created
+ * @param error_size Size of error
+ * @return Session* The session, or NULL
+ */
+Session* session_create(uint32_t id, char** roms, int rom_count, char* error,
+    size_t error_size) {
+    if (rom_count == 0) {
+        snprintf(error, error_size, "no ROM files");
+        return NULL;
+    }
+
+    int memory_fd = memfd_create("8080-memory", MFD_CLOEXEC);
+    if (memory_fd < 0 || ftruncate(memory_fd, 0x10000) < 0) {
+        snprintf(error, error_size, "could not create shared memory");
+        if (memory_fd >= 0) {
+            close(memory_fd);
+        }
+        return NULL;
+    }
+
+    uint8_t* memory = mmap(NULL, 0x10000, PROT_READ | PROT_WRITE, MAP_SHARED, memory_fd, 0);
+    if (memory == MAP_FAILED) {
+        close(memory_fd);
+        snprintf(error, error_size, "could not map shared memory");
+        return NULL;
+    }
+    State8080* state = init_8080_without_memory();
+    state->memory = memory;
+
+    uint32_t offset = 0;
+    int i;
+    for (i = 0; i < rom_count; i++) {
+        long size = load_rom(state, roms[i], offset, error, error_size);
+        if (size < 0) {
+            free_state(state);
+            close(memory_fd);
+            return NULL;
+        }
+        offset += size;
+    }
+
+    Session* session = calloc(1, sizeof(Session));
+    session->id = id;
+    session->state = state;
+    session->memory_fd = memory_fd;
+    session->invaders = invaders_create(state);
+    hasher_init(&session->hasher, state);
+    return session;
+}
+
+void session_free(Session* session) {
+    invaders_free(session->invaders);
+    free_state(session->state);
+    close(session->memory_fd);
+    free(session);
+}
+
+/**
+ * @brief Applies an input script action (e.g. "+coin") from the next frame on.
+ *
+ * @return int 0 on success, -1 if the action is unknown
+ */
+int session_input(Session* session, const char* action) {
+    return invaders_input(session->invaders, action);
+}
+
+/**
+ * @brief Runs whole frames. This is the batch the server's workers schedule, so only one thread
+ *  may be in it for a session at a time.
+ */
+void session_run(Session* session, uint64_t frames) {
+    uint64_t i;
+    for (i = 0; i < frames; i++) {
+        invaders_run_frame(session->invaders);
+    }
+}
+
+/**
+ * @brief Hashes the state the same way replay logs do: the registers, and memory a page at a
+ *  time so only the pages written since the last call are hashed again.
+ */
+void session_hash(Session* session, uint64_t* registers, uint64_t* memory) {
+    *registers = hash_registers(session->state);
+    *memory = hasher_update(&session->hasher, session->state);
+}
+
+/**
+ * @brief Video RAM, in place in the shared memory.
+ *
+ * @param session
+ * @param length Set to the size of video RAM
+ * @return const uint8_t* Start of video RAM
+ */
+const uint8_t* session_framebuffer(Session* session, size_t* length) {
+    *length = INVADERS_VRAM_SIZE;
+    return &session->state->memory[INVADERS_VRAM];
+}
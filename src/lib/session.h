@@ -0,0 +1,31 @@
+#ifndef SESSION_H
+#define SESSION_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#include "cpu8080.h"
+#include "hash.h"
+#include "invaders.h"
+
+/**
+ * @brief One Space Invaders machine hosted by the server. Its 64KB of memory is a shared memory
+ *  file (memfd) mapped into the server, so the framebuffer can be sent straight out of it or
+ *  the file handed to a local client to map for itself.
+ */
+typedef struct Session {
+    uint32_t id;
+    State8080* state;
+    Invaders* invaders;
+    int memory_fd;              // The memfd backing state->memory
+    StateHasher hasher;
+} Session;
+
+Session* session_create(uint32_t id, char** roms, int rom_count, char* error, size_t error_size);
+void session_free(Session* session);
+int session_input(Session* session, const char* action);
+void session_run(Session* session, uint64_t frames);
+void session_hash(Session* session, uint64_t* registers, uint64_t* memory);
+const uint8_t* session_framebuffer(Session* session, size_t* length);
+
+#endif
@@ -0,0 +1,82 @@
+#include <stdlib.h>
+#include <string.h>
+
+#include "snapshot.h"
+
+/**
+ * @brief Freezes a machine. The machine itself can keep running afterwards.
+ * 
+ * @param invaders The machine
+ * @return Snapshot* The snapshot, or NULL if the memory image couldn't be created
+ */
+Snapshot* snapshot_take(Invaders* invaders) {
+    MemoryImage* image = create_memory_image(invaders->state);
+    if (image == NULL) {
+        return NULL;
+    }
+
+    Snapshot* snapshot = malloc(sizeof(Snapshot));
+    snapshot->state = *invaders->state;
+    snapshot->board = *invaders;
+    snapshot->image = image;
+    return snapshot;
+}
+
+/**
+ * @brief Starts a new machine from the snapshot. It has no script, sound, replay or metrics of
+ *  its own until they're set, and starts with a fresh idle skipper, since rejected loops are
+ *  forgotten at every interrupt anyway.
+ * 
+ * @param snapshot 
+ * @return Invaders* The child, or NULL if the image couldn't be mapped
+ */
+Invaders* snapshot_fork(Snapshot* snapshot) {
+    State8080* state = init_8080_shared(snapshot->image);
+    if (state == NULL) {
+        return NULL;
+    }
+    Invaders* child = invaders_create(state);
+
+    State8080* from = &snapshot->state;
+    state->cycles = from->cycles;
+    state->instructions = from->instructions;
+    state->fused_instructions = from->fused_instructions;
+    state->pc = from->pc;
+    state->sp = from->sp;
+    state->a = from->a;
+    state->codes = from->codes;
+    state->bc = from->bc;
+    state->de = from->de;
+    state->hl = from->hl;
+    state->int_enable = from->int_enable;
+    state->halted = from->halted;
+    state->interrupts = from->interrupts;
+
+    Invaders* board = &snapshot->board;
+    child->port1 = board->port1;
+    child->port2 = board->port2;
+    child->shift = board->shift;
+    child->shift_offset = board->shift_offset;
+    child->port3 = board->port3;
+    child->port5 = board->port5;
+    child->superinstructions = board->superinstructions;
+    child->idle_skipping = board->idle_skipping;
+    child->frame = board->frame;
+    child->half = board->half;
+    child->start_cycles = board->start_cycles;
+    return child;
+}
+
+void snapshot_free_fork(Invaders* child) {
+    State8080* state = child->state;
+    invaders_free(child);
+    free_8080(state);
+}
+
+/**
+ * @brief Frees the snapshot. Children forked from it can outlive it.
+ */
+void snapshot_free(Snapshot* snapshot) {
+    release_memory_image(snapshot->image);
+    free(snapshot);
+}
@@ -0,0 +1,24 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "cpu8080.h"
+#include "invaders.h"
+
+/**
+ * @brief A Space Invaders machine frozen at some point, which any number of children can be
+ *  forked from. The memory is kept as a shared image that every child maps copy-on-write, so a
+ *  fork costs a mapping and a few small structures, and a child only pays for the pages it
+ *  goes on to write.
+ */
+typedef struct Snapshot {
+    State8080 state;            // Registers at the snapshot, the memory pointer isn't used
+    Invaders board;             // Ports, shift register and frame at the snapshot
+    MemoryImage* image;
+} Snapshot;
+
+Snapshot* snapshot_take(Invaders* invaders);
+Invaders* snapshot_fork(Snapshot* snapshot);
+void snapshot_free_fork(Invaders* child);
+void snapshot_free(Snapshot* snapshot);
+
+#endif
@@ -0,0 +1,725 @@
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdarg.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include "lib/net.h"
+#include "lib/session.h"
+
+#define SERVER_MAX_SESSIONS 1024
+#define SERVER_MAX_EVENTS 64
+#define SERVER_MAX_LINE 4096
+#define SERVER_MAX_ARGS 64
+
+/**
+ * @brief A client connection. Commands are handled one at a time in the order they were sent:
+ *  the next line isn't looked at until the last reply is out and any run it started is done.
+ */
+typedef struct Connection {
+    int fd;
+    char input[SERVER_MAX_LINE];
+    int input_length;
+    int eof;                    // The client won't send anything else
+    int closed;                 // Gone, freed once its run finishes and the event batch is over
+    int waiting;                // A run for it is in progress
+    uint32_t events;            // What it's registered with epoll for
+
+    char* output;               // Reply text not sent yet
+    size_t output_length;
+    size_t output_sent;
+    size_t output_capacity;
+    const uint8_t* payload;     // Sent after the text, straight out of a session's memory
+    size_t payload_length;
+    int pass_fd;                // Handed over with the reply over a Unix socket, or -1
+    int pinned;                 // Session kept busy until the reply is out, or -1
+
+    struct Connection* next;
+} Connection;
+
+/**
+ * @brief Frames still to run for a session, and who to tell when they're done.
+ */
+typedef struct Job {
+    Session* session;
+    Connection* connection;
+    uint64_t frames;
+    struct Job* next;
+} Job;
+
+typedef struct Server {
+    int listen_fd;
+    int epoll_fd;
+    int done_fd;                // eventfd the workers bump when a job finishes
+    uint64_t slice;             // Frames a worker runs before moving on to the next session
+    int quit;                   // A client asked the server to shut down
+
+    Session* sessions[SERVER_MAX_SESSIONS];     // Indexed by id - 1
+    int busy[SERVER_MAX_SESSIONS];              // Running, or its memory is being sent
+    Connection* connections;
+
+    // Shared with the workers, under the lock
+    pthread_mutex_t lock;
+    pthread_cond_t ready;
+    int stopping;
+    Job* queue_head;
+    Job* queue_tail;
+    Job* done;
+    pthread_t* workers;
+    int worker_count;
+    uint64_t frames;
+} Server;
+
+#pragma region Workers
+
+static void enqueue(Server* server, Job* job) {
+    job->next = NULL;
+    if (server->queue_tail == NULL) {
+        server->queue_head = job;
+    }
+    else {
+        server->queue_tail->next = job;
+    }
+    server->queue_tail = job;
+}
+
+/**
+ * @brief Takes sessions off the queue and runs each for one slice of frames. A session with
+ *  frames left goes to the back of the queue, so long runs share the workers with short ones.
+ */
+static void* worker_thread(void* arg) {
+    Server* server = arg;
+    pthread_mutex_lock(&server->lock);
+    while (1) {
+        while (server->queue_head == NULL && !server->stopping) {
+            pthread_cond_wait(&server->ready, &server->lock);
+        }
+        if (server->stopping) {
+            break;
+        }
+        Job* job = server->queue_head;
+        server->queue_head = job->next;
+        if (server->queue_head == NULL) {
+            server->queue_tail = NULL;
+        }
+        pthread_mutex_unlock(&server->lock);
+
+        uint64_t frames = job->frames < server->slice ? job->frames : server->slice;
+        session_run(job->session, frames);
+        job->frames -= frames;
+
+        pthread_mutex_lock(&server->lock);
+        server->frames += frames;
+        if (job->frames > 0) {
+            enqueue(server, job);
+        }
+        else {
+            job->next = server->done;
+            server->done = job;
+            uint64_t one = 1;
+            if (write(server->done_fd, &one, sizeof(one)) < 0) {
+                perror("eventfd");
+            }
+        }
+    }
+    pthread_mutex_unlock(&server->lock);
+    return NULL;
+}
+
+#pragma endregion
+
+#pragma region Connections
+
+static void reply(Connection* connection, const char* format, ...) {
+    va_list args;
+    va_start(args, format);
+    int length = vsnprintf(NULL, 0, format, args);
+    va_end(args);
+
+    size_t needed = connection->output_length + length + 2;
+    if (needed > connection->output_capacity) {
+        connection->output_capacity = needed * 2;
+        connection->output = realloc(connection->output, connection->output_capacity);
+    }
+    va_start(args, format);
+    vsnprintf(&connection->output[connection->output_length], length + 1, format, args);
+    va_end(args);
+    connection->output_length += length;
+    connection->output[connection->output_length++] = '\n';
+}
+
+static int pending(Connection* connection) {
+    return connection->output_sent < connection->output_length + connection->payload_length;
+}
+
+/**
+ * @brief Sends as much of the reply as the socket takes without blocking. The payload goes out
+ *  of the session's memory as the second iovec, so the framebuffer is never copied in between.
+ *
+ * @return int 0, or -1 if the connection is broken
+ */
+static int flush(Server* server, Connection* connection) {
+    while (pending(connection)) {
+        struct iovec iov[2];
+        int count = 0;
+        size_t sent = connection->output_sent;
+        if (sent < connection->output_length) {
+            iov[count].iov_base = &connection->output[sent];
+            iov[count++].iov_len = connection->output_length - sent;
+            sent = 0;
+        }
+        else {
+            sent -= connection->output_length;
+        }
+        if (connection->payload_length > sent) {
+            iov[count].iov_base = (void*)&connection->payload[sent];
+            iov[count++].iov_len = connection->payload_length - sent;
+        }
+
+        struct msghdr message = { 0 };
+        message.msg_iov = iov;
+        message.msg_iovlen = count;
+        char control[CMSG_SPACE(sizeof(int))];
+        if (connection->pass_fd >= 0) {
+            memset(control, 0, sizeof(control));
+            message.msg_control = control;
+            message.msg_controllen = sizeof(control);
+            struct cmsghdr* header = CMSG_FIRSTHDR(&message);
+            header->cmsg_level = SOL_SOCKET;
+            header->cmsg_type = SCM_RIGHTS;
+            header->cmsg_len = CMSG_LEN(sizeof(int));
+            memcpy(CMSG_DATA(header), &connection->pass_fd, sizeof(int));
+        }
+
+        ssize_t written = sendmsg(connection->fd, &message, MSG_NOSIGNAL | MSG_DONTWAIT);
+        if (written < 0) {
+            return errno == EAGAIN || errno == EWOULDBLOCK ? 0 : -1;
+        }
+        connection->output_sent += written;
+        connection->pass_fd = -1;
+    }
+
+    connection->output_length = connection->output_sent = 0;
+    connection->payload = NULL;
+    connection->payload_length = 0;
+    if (connection->pinned >= 0) {
+        server->busy[connection->pinned] = 0;
+        connection->pinned = -1;
+    }
+    return 0;
+}
+
+static void watch(Server* server, Connection* connection) {
+    uint32_t events = 0;
+    if (pending(connection)) {
+        events |= EPOLLOUT;
+    }
+    else if (!connection->waiting && !connection->eof &&
+             connection->input_length < SERVER_MAX_LINE) {
+        events |= EPOLLIN;
+    }
+    if (events != connection->events) {
+        struct epoll_event event = { events, { .ptr = connection } };
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_MOD, connection->fd, &event);
+        connection->events = events;
+    }
+}
+
+static void free_connection(Server* server, Connection* connection) {
+    Connection** link = &server->connections;
+    while (*link != connection) {
+        link = &(*link)->next;
+    }
+    *link = connection->next;
+    free(connection->output);
+    free(connection);
+}
+
+/**
+ * @brief Closes the socket. The connection itself is left for reap_connections, since a worker
+ *  may still hand it back and later events in the same epoll batch may still point at it.
+ */
+static void close_connection(Server* server, Connection* connection) {
+    if (connection->pinned >= 0) {
+        server->busy[connection->pinned] = 0;
+        connection->pinned = -1;
+    }
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_DEL, connection->fd, NULL);
+    close(connection->fd);
+    connection->closed = 1;
+}
+
+/**
+ * @brief Frees the closed connections no run is waiting on. Only called between epoll batches,
+ *  when no event can refer to them any more.
+ */
+static void reap_connections(Server* server) {
+    Connection** link = &server->connections;
+    while (*link != NULL) {
+        Connection* connection = *link;
+        if (connection->closed && !connection->waiting) {
+            *link = connection->next;
+            free(connection->output);
+            free(connection);
+        }
+        else {
+            link = &connection->next;
+        }
+    }
+}
+
+#pragma endregion
+
+#pragma region Commands
+
+/**
+ * @brief Looks up the session named by an argument that has to be idle.
+ *
+ * @return int Index of the session, or -1 after replying with the error
+ */
+static int find_session(Server* server, Connection* connection, const char* arg) {
+    char* end;
+    unsigned long id = arg != NULL ? strtoul(arg, &end, 10) : 0;
+    if (arg == NULL || *end != '\0' || id == 0 || id > SERVER_MAX_SESSIONS ||
+        server->sessions[id - 1] == NULL) {
+        reply(connection, "error no session %s", arg != NULL ? arg : "given");
+        return -1;
+    }
+    if (server->busy[id - 1]) {
+        reply(connection, "error session %lu is busy", id);
+        return -1;
+    }
+    return id - 1;
+}
+
+static void command_new(Server* server, Connection* connection, char** args, int count) {
+    int index;
+    for (index = 0; index < SERVER_MAX_SESSIONS && server->sessions[index] != NULL; index++);
+    if (index == SERVER_MAX_SESSIONS) {
+        reply(connection, "error too many sessions");
+        return;
+    }
+
+    char error[256];
+    Session* session = session_create(index + 1, &args[1], count - 1, error, sizeof(error));
+    if (session == NULL) {
+        reply(connection, "error %s", error);
+        return;
+    }
+    server->sessions[index] = session;
+    reply(connection, "ok %u", session->id);
+}
+
+static void command_run(Server* server, Connection* connection, char** args, int count) {
+    int index = find_session(server, connection, args[1]);
+    if (index < 0) {
+        return;
+    }
+    char* end;
+    uint64_t frames = count == 3 ? strtoull(args[2], &end, 10) : 0;
+    if (count != 3 || *end != '\0') {
+        reply(connection, "error usage: run <session> <frames>");
+        return;
+    }
+    if (frames == 0) {
+        reply(connection, "ok %llu", (unsigned long long)server->sessions[index]->invaders->frame);
+        return;
+    }
+
+    Job* job = malloc(sizeof(Job));
+    job->session = server->sessions[index];
+    job->connection = connection;
+    job->frames = frames;
+    server->busy[index] = 1;
+    connection->waiting = 1;
+
+    pthread_mutex_lock(&server->lock);
+    enqueue(server, job);
+    pthread_cond_signal(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+}
+
+static void command_input(Server* server, Connection* connection, char** args, int count) {
+    int index = find_session(server, connection, args[1]);
+    if (index < 0) {
+        return;
+    }
+    int i;
+    for (i = 2; i < count; i++) {
+        if (session_input(server->sessions[index], args[i]) < 0) {
+            reply(connection, "error unknown action %s", args[i]);
+            return;
+        }
+    }
+    reply(connection, "ok");
+}
+
+static void command_hash(Server* server, Connection* connection, char** args) {
+    int index = find_session(server, connection, args[1]);
+    if (index < 0) {
+        return;
+    }
+    Session* session = server->sessions[index];
+    uint64_t registers, memory;
+    session_hash(session, &registers, &memory);
+    reply(connection, "ok %llu %016llx %016llx", (unsigned long long)session->invaders->frame,
+        (unsigned long long)registers, (unsigned long long)memory);
+}
+
+/**
+ * @brief "screen" sends the framebuffer after the reply line. "map" hands the session's memory
+ *  file to the client instead (Unix sockets only), which can then map it and read the
+ *  framebuffer for itself at the given offset whenever the session isn't running.
+ */
+static void command_screen(Server* server, Connection* connection, char** args, int map) {
+    struct sockaddr address;
+    socklen_t address_length = sizeof(address);
+    if (map && (getsockname(connection->fd, &address, &address_length) < 0 ||
+                address.sa_family != AF_UNIX)) {
+        reply(connection, "error map needs a Unix socket");
+        return;
+    }
+    int index = find_session(server, connection, args[1]);
+    if (index < 0) {
+        return;
+    }
+    Session* session = server->sessions[index];
+    size_t length;
+    const uint8_t* framebuffer = session_framebuffer(session, &length);
+    if (map) {
+        connection->pass_fd = session->memory_fd;
+        reply(connection, "ok %zu %zu", (size_t)(framebuffer - session->state->memory), length);
+    }
+    else {
+        reply(connection, "ok %zu", length);
+        connection->payload = framebuffer;
+        connection->payload_length = length;
+    }
+    server->busy[index] = 1;
+    connection->pinned = index;
+}
+
+static void command_free(Server* server, Connection* connection, char** args) {
+    int index = find_session(server, connection, args[1]);
+    if (index < 0) {
+        return;
+    }
+    session_free(server->sessions[index]);
+    server->sessions[index] = NULL;
+    reply(connection, "ok");
+}
+
+static void command_stats(Server* server, Connection* connection) {
+    int sessions = 0;
+    int i;
+    for (i = 0; i < SERVER_MAX_SESSIONS; i++) {
+        sessions += server->sessions[i] != NULL;
+    }
+    pthread_mutex_lock(&server->lock);
+    uint64_t frames = server->frames;
+    pthread_mutex_unlock(&server->lock);
+    reply(connection, "ok sessions %d workers %d frames %llu", sessions, server->worker_count,
+        (unsigned long long)frames);
+}
+
+/**
+ * @brief Handles one command line. Replies start with "ok" or "error".
+ */
+static void handle_command(Server* server, Connection* connection, char* line) {
+    char* args[SERVER_MAX_ARGS + 1];
+    int count = 0;
+    char* token = strtok(line, " \t\r");
+    while (token != NULL && count < SERVER_MAX_ARGS) {
+        args[count++] = token;
+        token = strtok(NULL, " \t\r");
+    }
+    if (count == 0) {
+        return;
+    }
+    args[count] = NULL;
+
+    if (strcmp(args[0], "new") == 0) {
+        command_new(server, connection, args, count);
+    }
+    else if (strcmp(args[0], "run") == 0) {
+        command_run(server, connection, args, count);
+    }
+    else if (strcmp(args[0], "input") == 0) {
+        command_input(server, connection, args, count);
+    }
+    else if (strcmp(args[0], "hash") == 0) {
+        command_hash(server, connection, args);
+    }
+    else if (strcmp(args[0], "screen") == 0 || strcmp(args[0], "map") == 0) {
+        command_screen(server, connection, args, args[0][0] == 'm');
+    }
+    else if (strcmp(args[0], "free") == 0) {
+        command_free(server, connection, args);
+    }
+    else if (strcmp(args[0], "stats") == 0) {
+        command_stats(server, connection);
+    }
+    else if (strcmp(args[0], "shutdown") == 0) {
+        server->quit = 1;
+        reply(connection, "ok");
+    }
+    else {
+        reply(connection, "error unknown command %s", args[0]);
+    }
+}
+
+/**
+ * @brief Handles whatever the connection can do right now: sends what's pending, then runs
+ *  buffered commands until one has to wait for a reply to go out or a run to finish, or the
+ *  server is shutting down.
+ */
+static void service(Server* server, Connection* connection) {
+    while (1) {
+        if (flush(server, connection) < 0) {
+            close_connection(server, connection);
+            return;
+        }
+        if (pending(connection) || connection->waiting || server->quit) {
+            break;                  // Nothing else runs once a client asked to shut down
+        }
+
+        char* newline = memchr(connection->input, '\n', connection->input_length);
+        if (newline == NULL) {
+            if (connection->input_length == SERVER_MAX_LINE || connection->eof) {
+                close_connection(server, connection);       // Too long, or all done
+                return;
+            }
+            break;
+        }
+        *newline = '\0';
+        handle_command(server, connection, connection->input);
+
+        int used = newline + 1 - connection->input;
+        connection->input_length -= used;
+        memmove(connection->input, newline + 1, connection->input_length);
+    }
+    watch(server, connection);
+}
+
+static void receive(Server* server, Connection* connection) {
+    ssize_t received = recv(connection->fd, &connection->input[connection->input_length],
+        SERVER_MAX_LINE - connection->input_length, MSG_DONTWAIT);
+    if (received == 0) {
+        connection->eof = 1;
+    }
+    else if (received < 0) {
+        if (errno != EAGAIN && errno != EWOULDBLOCK) {
+            close_connection(server, connection);
+        }
+        return;
+    }
+    connection->input_length += received > 0 ? received : 0;
+    service(server, connection);
+}
+
+static void accept_connections(Server* server) {
+    int fd;
+    while ((fd = accept(server->listen_fd, NULL, NULL)) >= 0) {
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL) | O_NONBLOCK);
+        Connection* connection = calloc(1, sizeof(Connection));
+        connection->fd = fd;
+        connection->pass_fd = -1;
+        connection->pinned = -1;
+        connection->events = EPOLLIN;
+        connection->next = server->connections;
+        server->connections = connection;
+
+        struct epoll_event event = { EPOLLIN, { .ptr = connection } };
+        epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, fd, &event);
+    }
+}
+
+/**
+ * @brief Replies to the connections whose runs the workers finished.
+ */
+static void finish_jobs(Server* server) {
+    uint64_t count;
+    if (read(server->done_fd, &count, sizeof(count)) < 0) {
+        return;
+    }
+    pthread_mutex_lock(&server->lock);
+    Job* job = server->done;
+    server->done = NULL;
+    pthread_mutex_unlock(&server->lock);
+
+    while (job != NULL) {
+        Job* next = job->next;
+        Connection* connection = job->connection;
+        server->busy[job->session->id - 1] = 0;
+        connection->waiting = 0;
+        if (!connection->closed) {
+            reply(connection, "ok %llu", (unsigned long long)job->session->invaders->frame);
+            service(server, connection);
+        }
+        free(job);
+        job = next;
+    }
+}
+
+#pragma endregion
+
+/**
+ * @brief The event loop. Only this thread touches connections and the session table; the
+ *  workers only ever see the sessions they were handed.
+ */
+static void serve(Server* server) {
+    struct epoll_event events[SERVER_MAX_EVENTS];
+    while (!server->quit) {
+        int count = epoll_wait(server->epoll_fd, events, SERVER_MAX_EVENTS, -1);
+        if (count < 0 && errno != EINTR) {
+            perror("epoll_wait");
+            return;
+        }
+
+        int i;
+        for (i = 0; i < count; i++) {
+            void* source = events[i].data.ptr;
+            if (source == &server->listen_fd) {
+                accept_connections(server);
+            }
+            else if (source == &server->done_fd) {
+                finish_jobs(server);
+            }
+            else {
+                Connection* connection = source;
+                if (connection->closed) {
+                    continue;               // Closed by an earlier event in this batch
+                }
+                if (events[i].events & EPOLLIN) {
+                    receive(server, connection);
+                }
+                else if (events[i].events & (EPOLLHUP | EPOLLERR)) {
+                    close_connection(server, connection);
+                }
+                else {
+                    service(server, connection);
+                }
+            }
+        }
+        reap_connections(server);
+    }
+}
+
+void print_usage() {
+    printf("Usage: server [-j workers] [-s frames] <address>\n");
+    printf("  -j workers Worker threads running the sessions (default 4)\n");
+    printf("  -s frames  Frames a worker runs a session for before moving on to the next one\n");
+    printf("             (default 60)\n");
+    printf("Listens on a localhost TCP port or a Unix socket path. Commands, one per line:\n");
+    printf("  new <rom>...            Create a Space Invaders session from ROM files\n");
+    printf("  input <id> <action>...  Apply input script actions, e.g. +coin -start1\n");
+    printf("  run <id> <frames>       Run frames, replying once they're done\n");
+    printf("  hash <id>               Frame number, register hash and memory hash\n");
+    printf("  screen <id>             Video RAM, sent after the reply line\n");
+    printf("  map <id>                Pass the session's memory file (Unix sockets only)\n");
+    printf("  free <id>               Delete the session\n");
+    printf("  stats                   Sessions, workers and frames run\n");
+    printf("  shutdown                Stop the server\n");
+}
+
+/**
+ * @brief Main method where program starts.
+ *
+ * @param argc Number of arguments
+ * @param argv Arguments
+ * @return int Return code
+ */
+int main(int argc, char** argv) {
+    int workers = 4;
+    uint64_t slice = 60;
+
+    int opt;
+    while ((opt = getopt(argc, argv, "j:s:h")) != -1) {
+        switch (opt) {
+            case 'j': workers = atoi(optarg); break;
+            case 's': slice = strtoull(optarg, NULL, 10); break;
+            default: print_usage(); exit(1);
+        }
+    }
+    if (optind >= argc || workers < 1 || slice < 1) {
+        print_usage();
+        exit(1);
+    }
+
+    Server* server = calloc(1, sizeof(Server));
+    server->slice = slice;
+    server->worker_count = workers;
+    pthread_mutex_init(&server->lock, NULL);
+    pthread_cond_init(&server->ready, NULL);
+
+    server->listen_fd = net_listen(argv[optind], 64);
+    if (server->listen_fd < 0) {
+        printf("Error: Could not listen on %s\n", argv[optind]);
+        exit(1);
+    }
+    fcntl(server->listen_fd, F_SETFL, fcntl(server->listen_fd, F_GETFL) | O_NONBLOCK);
+    server->done_fd = eventfd(0, EFD_NONBLOCK);
+    server->epoll_fd = epoll_create1(0);
+    struct epoll_event event = { EPOLLIN, { .ptr = &server->listen_fd } };
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->listen_fd, &event);
+    event.data.ptr = &server->done_fd;
+    epoll_ctl(server->epoll_fd, EPOLL_CTL_ADD, server->done_fd, &event);
+
+    server->workers = malloc(workers * sizeof(pthread_t));
+    int i;
+    for (i = 0; i < workers; i++) {
+        pthread_create(&server->workers[i], NULL, worker_thread, server);
+    }
+    printf("Serving on %s with %d workers\n", argv[optind], workers);
+    fflush(stdout);
+
+    serve(server);
+
+    // Let the workers finish the slice they're on, then throw away whatever is left.
+    pthread_mutex_lock(&server->lock);
+    server->stopping = 1;
+    pthread_cond_broadcast(&server->ready);
+    pthread_mutex_unlock(&server->lock);
+    for (i = 0; i < workers; i++) {
+        pthread_join(server->workers[i], NULL);
+    }
+    while (server->queue_head != NULL) {
+        Job* next = server->queue_head->next;
+        free(server->queue_head);
+        server->queue_head = next;
+    }
+    while (server->done != NULL) {
+        Job* next = server->done->next;
+        free(server->done);
+        server->done = next;
+    }
+    while (server->connections != NULL) {
+        Connection* connection = server->connections;
+        if (!connection->closed) {
+            flush(server, connection);
+            close(connection->fd);
+        }
+        free_connection(server, connection);
+    }
+    for (i = 0; i < SERVER_MAX_SESSIONS; i++) {
+        if (server->sessions[i] != NULL) {
+            session_free(server->sessions[i]);
+        }
+    }
+    printf("Ran %llu frames\n", (unsigned long long)server->frames);
+
+    close(server->epoll_fd);
+    close(server->done_fd);
+    close(server->listen_fd);
+    free(server->workers);
+    free(server);
+    return 0;
+}